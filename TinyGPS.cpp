@@ -56,26 +56,41 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 TinyGPS::TinyGPS()
   :  _time(GPS_INVALID_TIME)
+  ,  _new_time(GPS_INVALID_TIME)
   ,  _date(GPS_INVALID_DATE)
+  ,  _new_date(GPS_INVALID_DATE)
 #ifndef _GPS_TIME_ONLY
   ,  _latitude(GPS_INVALID_ANGLE)
+  ,  _new_latitude(GPS_INVALID_ANGLE)
   ,  _longitude(GPS_INVALID_ANGLE)
+  ,  _new_longitude(GPS_INVALID_ANGLE)
   ,  _speed(GPS_INVALID_SPEED)
+  ,  _new_speed(GPS_INVALID_SPEED)
   ,  _course(GPS_INVALID_ANGLE)
+  ,  _new_course(GPS_INVALID_ANGLE)
   ,  _hdop(GPS_INVALID_HDOP)
+  ,  _new_hdop(0)
 #endif /* _GPS_TIME_ONLY */
   ,  _altitude(GPS_INVALID_ALTITUDE)
+  ,  _new_altitude(0)
   ,  _pdop(GPS_INVALID_PDOP)
+  ,  _new_pdop(0)
   ,  _satsinview(GPS_INVALID_SATELLITES)
+  ,  _new_satsinview(0)
   ,  _satsused(GPS_INVALID_SATELLITES)
+  ,  _new_satsused(0)
   ,  _fixtype(GPS_INVALID_FIXTYPE)
+  ,  _new_fixtype(0)
   ,  _last_time_fix(GPS_INVALID_FIX_TIME)
+  ,  _new_time_fix(GPS_INVALID_FIX_TIME)
   ,  _last_position_fix(GPS_INVALID_FIX_TIME)
+  ,  _new_position_fix(GPS_INVALID_FIX_TIME)
   ,  _parity(0)
   ,  _is_checksum_term(false)
   ,  _sentence_type(_GPS_SENTENCE_OTHER)
   ,  _term_number(0)
   ,  _term_offset(0)
+  ,  _gps_data_good(false)
 #ifndef _GPS_NO_STATS
   ,  _encoded_characters(0)
   ,  _good_sentences(0)
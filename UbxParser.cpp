@@ -52,14 +52,14 @@ bool UbxParser::encode(uint8_t c) {
             }
             break;
         case UBX_PAYLOAD:
-            if (this->_offset > sizeof(this->_buffer)){
+            if (this->_offset >= sizeof(this->_buffer)){
                 this->_state = UBX_IDLE;
                 return false;
             }
             this->_buffer[this->_offset++] = c;
             if (this->_offset == 4) {
                 this->_len = this->_buffer[2] | this->_buffer[3] << 8;
-                if (this->_len > 100) {
+                if (this->_len > sizeof(this->_buffer) - 6) {
                     this->_state = UBX_IDLE;
                     return false;
                 }
@@ -52,8 +52,8 @@ private:
     ubx_state_t _state;
     uint16_t _len;
     uint16_t _offset;
-    uint8_t _buffer[60];
-    int _ck[2];
+    uint8_t _buffer[110]; // AID-EPH: header, 104 byte payload, checksum
+    uint8_t _ck[2];
     volatile bool _got_response;
 
 };
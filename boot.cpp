@@ -0,0 +1,66 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "boot.h"
+
+BootTimeline::BootTimeline(void) :
+    _count(0)
+{
+
+}
+
+void BootTimeline::start(void)
+{
+    this->_count = 0;
+    this->_timer.reset();
+    this->_timer.start();
+}
+
+void BootTimeline::mark(const char *stage)
+{
+    if (this->_count >= BOOT_STAGES_MAX)
+        return;
+
+    this->_marks[this->_count].stage = stage;
+    this->_marks[this->_count].us = this->_timer.read_us();
+    this->_count++;
+}
+
+void BootTimeline::print(Stream &out)
+{
+    uint32_t prev = 0;
+
+    for (int i = 0; i < this->_count; i++) {
+        out.printf("boot %8lu us (+%7lu): %s\r\n",
+            (unsigned long)this->_marks[i].us,
+            (unsigned long)(this->_marks[i].us - prev),
+            this->_marks[i].stage);
+        prev = this->_marks[i].us;
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Boot timeline
+ *
+ * Records when each boot stage finished, in microseconds since start().
+ * Marks are only stored; print() writes them out in one go so the
+ * serial console doesn't skew the timings being measured.
+ */
+
+#include <mbed.h>
+
+#define BOOT_STAGES_MAX 12
+
+class BootTimeline
+{
+public:
+    BootTimeline(void);
+
+    void start(void);
+    void mark(const char *stage);
+    void print(Stream &out);
+
+private:
+    struct mark_t {
+        const char *stage;
+        uint32_t us;
+    };
+
+    Timer _timer;
+    mark_t _marks[BOOT_STAGES_MAX];
+    int _count;
+};
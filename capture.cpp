@@ -0,0 +1,150 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <string.h>
+
+#include "capture.h"
+
+Capture::Capture(void) :
+    _head(0),
+    _tail(0),
+    _mark_head(0),
+    _mark_tail(0),
+    _dropped(0),
+    _last_us(0),
+    _lost(0),
+    _filling(0),
+    _writing(false)
+{
+    this->_start();
+}
+
+void Capture::put(uint8_t c)
+{
+    uint32_t now = us_ticker_read();
+    uint32_t head = this->_head;
+    uint8_t next;
+
+    if (head - this->_tail >= CAPTURE_RING) {
+        this->_dropped++;
+        return;
+    }
+
+    // Without room for a marker the timing of this burst is lost, the
+    // bytes themselves aren't
+    if (now - this->_last_us > CAPTURE_GAP_US) {
+        next = (this->_mark_head + 1) & (CAPTURE_RING_MARKS - 1);
+        if (next != this->_mark_tail) {
+            this->_marks[this->_mark_head].index = head;
+            this->_marks[this->_mark_head].us = now;
+            this->_mark_head = next;
+        }
+    }
+    this->_last_us = now;
+
+    this->_ring[head & (CAPTURE_RING - 1)] = c;
+    this->_head = head + 1;
+}
+
+const uint8_t *Capture::poll(bool flush)
+{
+    uint8_t *chunk = this->_chunks[this->_filling];
+    uint8_t *mark;
+    uint32_t tail = this->_tail;
+    uint32_t dropped;
+    bool full = this->_len >= CAPTURE_DATA_MAX;
+    const mark_t *m;
+
+    while (tail != this->_head && !full) {
+        if (this->_mark_tail != this->_mark_head) {
+            m = &this->_marks[this->_mark_tail];
+            if (m->index == tail) {
+                if (this->_mark_count >= CAPTURE_MARKS_MAX) {
+                    full = true;
+                    break;
+                }
+                mark = &chunk[12 + this->_mark_count * CAPTURE_MARK_SIZE];
+                mark[0] = this->_len;
+                mark[1] = this->_len >> 8;
+                mark[2] = m->us;
+                mark[3] = m->us >> 8;
+                mark[4] = m->us >> 16;
+                mark[5] = m->us >> 24;
+                this->_mark_count++;
+                this->_mark_tail = (this->_mark_tail + 1) & (CAPTURE_RING_MARKS - 1);
+            }
+        }
+
+        chunk[CAPTURE_HEADER_LEN + this->_len++] = this->_ring[tail & (CAPTURE_RING - 1)];
+        tail++;
+        full = this->_len >= CAPTURE_DATA_MAX;
+    }
+    this->_tail = tail;
+
+    // Full, out of markers, or asked to
+    if (!full && !flush)
+        return nullptr;
+    if (this->_len == 0 || this->_writing)
+        return nullptr;
+
+    dropped = this->dropped();
+    chunk[0] = CAPTURE_MAGIC;
+    chunk[1] = CAPTURE_VERSION;
+    chunk[2] = this->_len;
+    chunk[3] = this->_len >> 8;
+    chunk[4] = dropped;
+    chunk[5] = dropped >> 8;
+    chunk[6] = dropped >> 16;
+    chunk[7] = dropped >> 24;
+    chunk[8] = this->_mark_count;
+
+    this->_writing = true;
+    this->_filling ^= 1;
+    this->_start();
+
+    return chunk;
+}
+
+void Capture::written(bool ok)
+{
+    const uint8_t *chunk = this->_chunks[this->_filling ^ 1];
+
+    // Counted with the next chunk
+    if (!ok)
+        this->_lost += chunk[2] | chunk[3] << 8;
+
+    this->_writing = false;
+}
+
+void Capture::_start(void)
+{
+    memset(this->_chunks[this->_filling], 0, CAPTURE_CHUNK_SIZE);
+    this->_len = 0;
+    this->_mark_count = 0;
+}
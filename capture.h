@@ -0,0 +1,105 @@
+#pragma once
+
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Raw receiver capture
+ *
+ * Every byte from the receiver is teed here from the RX interrupt, into
+ * a ring that never blocks: when it's full the byte is counted as
+ * dropped instead. poll() packs the ring into sector sized chunks for
+ * Storage::append_block(), one filling while the other is written.
+ *
+ * The first byte after a quiet spell gets a marker with its local time.
+ * Receiver output comes in bursts at the wire rate, so a marker per
+ * burst is enough to recover the timing of every byte on replay.
+ *
+ * Chunk layout, little endian:
+ *   0   'R', version, data length (2)
+ *   4   bytes dropped so far (4)
+ *   8   marker count, 3 reserved
+ *   12  markers: data offset (2), us_ticker time (4)
+ *   60  data
+ */
+
+#include <mbed.h>
+
+#define CAPTURE_CHUNK_SIZE  512
+#define CAPTURE_MAGIC       'R'
+#define CAPTURE_VERSION     1
+#define CAPTURE_MARKS_MAX   8
+#define CAPTURE_MARK_SIZE   6
+#define CAPTURE_HEADER_LEN  (12 + CAPTURE_MARKS_MAX * CAPTURE_MARK_SIZE)
+#define CAPTURE_DATA_MAX    (CAPTURE_CHUNK_SIZE - CAPTURE_HEADER_LEN)
+
+#define CAPTURE_RING        1024 // Power of two
+#define CAPTURE_RING_MARKS  16   // Power of two
+#define CAPTURE_GAP_US      2000
+
+class Capture
+{
+public:
+    Capture(void);
+
+    // From the RX interrupt
+    void put(uint8_t c);
+
+    // A sealed chunk to write out, if one is ready. flush seals a part
+    // filled one. Hand it back with written() once done with.
+    const uint8_t *poll(bool flush = false);
+    void written(bool ok);
+
+    uint32_t dropped(void) const { return this->_dropped + this->_lost; }
+
+private:
+    struct mark_t {
+        uint32_t index; // Of the byte, counting from the start
+        uint32_t us;
+    };
+
+    void _start(void);
+
+    // Filled by put(), drained by poll()
+    uint8_t _ring[CAPTURE_RING];
+    mark_t _marks[CAPTURE_RING_MARKS];
+    volatile uint32_t _head;       // Bytes put
+    volatile uint32_t _tail;       // Bytes taken
+    volatile uint8_t _mark_head;
+    volatile uint8_t _mark_tail;
+    volatile uint32_t _dropped;
+    uint32_t _last_us;
+    uint32_t _lost;                // Chunks that didn't make it
+
+    uint8_t _chunks[2][CAPTURE_CHUNK_SIZE];
+    int _filling;
+    bool _writing;
+    uint16_t _len;
+    uint8_t _mark_count;
+};
@@ -22,20 +22,93 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <string.h>
 #include "fs.h"
 
+// Logs are grown in chunks of this size, and the directory entry is
+// brought up to date every time this much has been appended. Free space
+// ahead of the data is zeroed up to LOG_ZERO_AHEAD by log_idle().
+static const uint32_t LOG_PREALLOC_SIZE = 64 * 1024;
+static const uint32_t LOG_CHECKPOINT_SIZE = 4 * 1024;
+static const uint32_t LOG_ZERO_AHEAD = 4 * 1024;
+
+// Retention keeps this much free by default, counting this many bytes of
+// FAT per idle call.
+static const offset_t RETAIN_MIN_FREE = 32UL * 1024 * 1024;
+static const uint32_t RETAIN_COUNT_STEP = 512;
+
+static const uint8_t zero_block[512] = {0};
+
 FS::FS() :
     _partition(nullptr),
     _fs(nullptr),
-    _dd(nullptr)
+    _dd(nullptr),
+    _mount(MOUNT_NONE),
+    _sub_dd(nullptr),
+    _op(OP_IDLE),
+    _op_write(false),
+    _op_part(0),
+    _op_dd(nullptr),
+    _op_fd(nullptr),
+    _op_pos(0),
+    _op_pad(0),
+    _op_done(0),
+    _op_at(0),
+    _op_cluster(0),
+    _end_next(0),
+    _retain(RETAIN_NONE),
+    _retain_min(RETAIN_MIN_FREE),
+    _retain_free(0),
+    _retain_pos(0),
+    _log_name(nullptr),
+    _log_at(0),
+    _log_cluster(0),
+    _log_size(0),
+    _log_synced(0),
+    _log_offset(0),
+    _log_avail(0),
+    _log_clean(0),
+    _log_reserved(false)
 {
-
+    this->_sub_path[0] = '\0';
+    this->end_forget();
 }
 
 int FS::init(void)
 {
-    struct fat_dir_entry_struct dir_ent;
+    int result;
 
-    if (!sd_raw_init())
-        goto err;
+    while ((result = this->mount()) == MOUNT_BUSY);
+
+    return result == MOUNT_DONE;
+}
+
+int FS::mount(void)
+{
+    switch (this->_mount) {
+        case MOUNT_NONE:
+            // Resetting the card is quick, waiting for it to get ready isn't
+            this->_mount = sd_raw_init_start() ? MOUNT_BUSY : MOUNT_FAILED;
+            break;
+        case MOUNT_BUSY:
+            switch (sd_raw_init_poll()) {
+                case SD_RAW_INIT_BUSY:
+                    break;
+                case SD_RAW_INIT_DONE:
+                    this->_mount = this->open_volume() ? MOUNT_DONE : MOUNT_FAILED;
+                    break;
+                default:
+                    this->_mount = MOUNT_FAILED;
+                    break;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return this->_mount;
+}
+
+int FS::open_volume(void)
+{
+    struct fat_dir_entry_struct dir_ent;
 
     this->_partition = partition_open(
         sd_raw_read,
@@ -67,6 +140,8 @@ int FS::init(void)
     if (!this->_dd)
         goto err_fat;
 
+    this->retain_check();
+
     return 1;
 
 err_fat:
@@ -83,44 +158,51 @@ err:
 
 int FS::write_file(const char *fn, const void *data, size_t size)
 {
-    struct fat_dir_entry_struct file_entry;
+    int result;
 
-    if (find_file_in_dir(this->_fs, this->_dd, fn, &file_entry))
-        if (!fat_delete_file(this->_fs, &file_entry))
-            return 0;
+    if (this->_op != OP_IDLE)
+        return 0;
+
+    while ((result = this->write_step(fn, data, size)) == STEP_MORE);
+
+    return result == STEP_DONE;
+}
+
+int FS::append_file(const char *fn, const void *data, size_t size, size_t align, uint32_t *at)
+{
+    int result;
 
-    if (!fat_create_file(this->_dd, fn, &file_entry))
+    if (this->_op != OP_IDLE)
         return 0;
 
-    return this->append_file(fn, (uint8_t*)data, size);
+    while ((result = this->append_step(fn, data, size, align, at)) == STEP_MORE);
+
+    return result == STEP_DONE;
 }
 
-int FS::append_file(const char *fn, const void *data, size_t size)
+int FS::read_file(const char *fn, void *data, size_t size, uint32_t offset)
 {
-    struct fat_dir_entry_struct file_entry;
     struct fat_file_struct *fd;
+    struct fat_dir_struct *dd;
+    const char *name;
     intptr_t count;
-    int32_t offset;
+    int32_t seek = offset;
 
-    fd = open_file_in_dir(this->_fs, this->_dd, fn);
-    if (!fd) {
-        if (!fat_create_file(this->_dd, fn, &file_entry))
-            goto err;
+    if (this->_op != OP_IDLE)
+        goto err;
 
-        fd = open_file_in_dir(this->_fs, this->_dd, fn);
-        if (!fd)
-            goto err;
-    }
+    dd = this->dir_for(fn, &name, false);
+    if (!dd)
+        goto err;
 
-    offset = 0;
-    if (!fat_seek_file(fd, &offset, FAT_SEEK_END))
-        goto err_file;
+    fd = open_file_in_dir(this->_fs, dd, name);
+    if (!fd)
+        goto err;
 
-    count = fat_write_file(fd, (uint8_t*)data, size);
-    // Failure to write is bad
-    if (count < 0)
+    if (seek && !fat_seek_file(fd, &seek, FAT_SEEK_SET))
         goto err_file;
-    // Failure to write is bad
+
+    count = fat_read_file(fd, (uint8_t*)data, size);
     if ((size_t)count != size)
         goto err_file;
 
@@ -135,44 +217,669 @@ err:
     return 0;
 }
 
-int FS::read_file(const char *fn, void *data, size_t size)
+/*
+ * Replaces a file, creating it and its directories if needed. A file
+ * of the same size is rewritten in place, leaving FAT and directory
+ * alone.
+ */
+int FS::write_step(const char *fn, const void *data, size_t size)
+{
+    return this->file_step(fn, data, size, 0, nullptr, true, 0);
+}
+
+/*
+ * Appends to a file, creating it and its directories if needed. With
+ * align, the data starts on a multiple of it, zero padded after anything
+ * left short. With max, a file already that big is left as it is and
+ * STEP_FULL returned instead.
+ */
+int FS::append_step(const char *fn, const void *data, size_t size, size_t align, uint32_t *at, uint32_t max)
+{
+    return this->file_step(fn, data, size, align, at, false, max);
+}
+
+/*
+ * Opens a log file for fast appends.
+ *
+ * The log is kept preallocated LOG_PREALLOC_SIZE ahead of its data, so
+ * log_append() can write the data sectors directly without touching the
+ * FAT. The byte following the data is always kept zero. Only
+ * log_checkpoint() updates the size in the directory entry; after a
+ * power loss, the data written since the last checkpoint is recovered
+ * by scanning forward for the end of the text. Log records must
+ * therefore be newline-terminated text.
+ */
+int FS::open_log(const char *fn)
 {
     struct fat_file_struct *fd;
-    intptr_t count;
+    int result;
 
-    fd = open_file_in_dir(this->_fs, this->_dd, fn);
-    if (!fd)
-        goto err;
+    if (this->_op != OP_IDLE)
+        return 0;
 
-    count = fat_read_file(fd, (uint8_t*)data, size);
-    if ((size_t)count != size)
-        goto err_file;
+    this->_log_name = nullptr;
+    this->_log_cluster = 0;
+
+    // The entry is kept, so log steps needn't look for it again
+    if (!find_file_in_dir(this->_fs, this->_dd, fn, &this->_log_entry) &&
+        !fat_create_file(this->_dd, fn, &this->_log_entry))
+        return 0;
 
+    fd = fat_open_file(this->_fs, &this->_log_entry);
+    if (!fd)
+        return 0;
+    result = this->log_recover(fd);
     fat_close_file(fd);
+    if (!result)
+        return 0;
+    this->_log_entry.file_size = this->_log_synced;
+
+    // Space past the data is reserved by the first log_step() needing it
+    this->_log_name = fn;
 
     return 1;
+}
+
+int FS::log_append(const void *data, size_t size)
+{
+    int result;
+
+    if (this->_op != OP_IDLE)
+        return 0;
+
+    while ((result = this->log_step(data, size)) == STEP_MORE);
+
+    return result == STEP_DONE;
+}
+
+/*
+ * One step of log_append(): growing the log, zeroing a sector ahead of
+ * the data or writing it up to the end of a sector, and last a
+ * checkpoint if one is due.
+ */
+int FS::log_step(const void *data, size_t size)
+{
+    uint32_t len, need;
+
+    if (!this->_log_name)
+        return STEP_FAILED;
+
+    switch (this->_op) {
+        case OP_IDLE:
+            this->_op = OP_LOG;
+            this->_op_done = 0;
+            break;
+        case OP_LOG:
+        case OP_LOG_GROW:
+            break;
+        default:
+            return STEP_FAILED;
+    }
+
+    if (this->_op_done < size) {
+        if (this->_log_avail == 0 || this->_op == OP_LOG_GROW)
+            return this->log_grow() ? STEP_MORE : this->op_end(STEP_FAILED);
+
+        len = sizeof(zero_block) - (this->_log_offset & (sizeof(zero_block) - 1));
+        if (len > size - this->_op_done)
+            len = size - this->_op_done;
+        if (len > this->_log_avail)
+            len = this->_log_avail;
+
+        // The byte after the data must be zero before the data goes down
+        need = len < this->_log_avail ? len + 1 : len;
+        if (this->_log_clean < need)
+            return this->log_clear(this->_log_clean + 1) ? STEP_MORE : this->op_end(STEP_FAILED);
+
+        if (!this->_partition->device_write(this->_log_offset, (const uint8_t *)data + this->_op_done, len))
+            return this->op_end(STEP_FAILED);
+
+        this->_op_done += len;
+        this->_log_size += len;
+        this->_log_offset += len;
+        this->_log_avail -= len;
+        this->_log_clean -= len;
+
+        if (this->_op_done < size || this->_log_size - this->_log_synced >= LOG_CHECKPOINT_SIZE)
+            return STEP_MORE;
+
+        return this->op_end(STEP_DONE);
+    }
+
+    if (this->_log_size - this->_log_synced >= LOG_CHECKPOINT_SIZE && !this->log_checkpoint())
+        return this->op_end(STEP_FAILED);
+
+    return this->op_end(STEP_DONE);
+}
+
+int FS::log_checkpoint(void)
+{
+    struct fat_file_struct *fd;
+    int result;
+
+    if (!this->_log_name)
+        return 0;
+
+    if (this->_log_size == this->_log_synced)
+        return 1;
+
+    fd = fat_open_file(this->_fs, &this->_log_entry);
+    if (!fd)
+        return 0;
+
+    result = fat_set_file_size(fd, this->_log_size);
+    if (result) {
+        this->_log_synced = this->_log_size;
+        this->_log_entry.file_size = this->_log_size;
+    }
 
-err_file:
     fat_close_file(fd);
 
+    return result;
+}
+
+/*
+ * Zeroes one more sector ahead of the log data, so most appends don't
+ * have to do it themselves. Returns 1 if there was anything to do.
+ */
+int FS::log_idle(void)
+{
+    if (!this->_log_name || this->_op != OP_IDLE)
+        return 0;
+
+    if (this->_log_clean >= this->_log_avail || this->_log_clean >= LOG_ZERO_AHEAD)
+        return 0;
+
+    return this->log_clear(this->_log_clean + 1);
+}
+
+/*
+ * Sets the free space retention keeps, and counts it again.
+ */
+void FS::retain_free(offset_t bytes)
+{
+    this->_retain_min = bytes;
+    this->_retain = RETAIN_NONE;
+    if (this->mounted())
+        this->retain_check();
+}
+
+/*
+ * One step of retention: counts a slice of the FAT, or deletes one of
+ * the oldest files. Returns 1 if there was anything to do.
+ */
+int FS::retain_idle(void)
+{
+    if (this->_op != OP_IDLE)
+        return 0;
+
+    switch (this->_retain) {
+        case RETAIN_COUNT:
+            switch (fat_get_fs_free_step(this->_fs, &this->_retain_pos, &this->_retain_free, RETAIN_COUNT_STEP)) {
+                case 1:
+                    break;
+                case 2:
+                    this->_retain = this->_retain_free < this->_retain_min ? RETAIN_PRUNE : RETAIN_NONE;
+                    break;
+                default:
+                    this->_retain = RETAIN_NONE;
+                    break;
+            }
+            return 1;
+        case RETAIN_PRUNE:
+            // Deleted files are credited by size, so this stops a little late
+            if (this->_retain_free >= 2 * this->_retain_min || !this->retain_prune())
+                this->_retain = RETAIN_NONE;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+int FS::ready(void)
+{
+    return sd_raw_ready();
+}
+
+/*
+ * One step of write_step() or append_step(). The directories and the
+ * file are looked up a few entries at a time, then padding and data go
+ * out up to the next sector boundary per step, and last the new size
+ * goes in the directory entry. Creating a directory or a file, deleting
+ * the old copy of one being replaced and adding a cluster are single
+ * steps that can take a few sectors more.
+ */
+int FS::file_step(const char *fn, const void *data, size_t size, size_t align, uint32_t *at, bool write, uint32_t max)
+{
+    const char *name;
+    intptr_t count;
+    int32_t offset;
+    uint32_t len;
+    end_t *end;
+    int result;
+
+    name = strrchr(fn, '/');
+    name = name ? name + 1 : fn;
+
+    switch (this->_op) {
+        case OP_IDLE:
+            this->_op_write = write;
+            this->_op_dd = nullptr;
+            this->_op = OP_DIR;
+            /* fall through */
+        case OP_DIR:
+            result = this->dir_step(fn, true);
+            if (result != STEP_DONE)
+                break;
+            this->_op = OP_FIND;
+            return STEP_MORE;
+        case OP_FIND:
+            result = this->find_step(this->_op_dd, name, &this->_op_entry);
+            if (result == STEP_MORE)
+                return STEP_MORE;
+            if (result == STEP_FAILED)
+                this->_op = OP_CREATE;
+            else if (this->_op_write && this->_op_entry.file_size != size)
+                this->_op = OP_DELETE;
+            else if (max && this->_op_entry.file_size >= max)
+                return this->op_end(STEP_FULL);
+            else
+                this->_op = OP_OPEN;
+            return STEP_MORE;
+        case OP_DELETE:
+            if (!fat_delete_file(this->_fs, &this->_op_entry))
+                return this->op_end(STEP_FAILED);
+            this->end_forget();
+            this->_op = OP_CREATE;
+            return STEP_MORE;
+        case OP_CREATE:
+            if (!fat_create_file(this->_op_dd, name, &this->_op_entry))
+                return this->op_end(STEP_FAILED);
+            // Something new on the card, see if room needs making
+            this->retain_check();
+            this->_op = OP_OPEN;
+            return STEP_MORE;
+        case OP_OPEN:
+            // Opening and seeking don't touch the card, go on to the data
+            this->_op_fd = fat_open_file(this->_fs, &this->_op_entry);
+            if (!this->_op_fd)
+                return this->op_end(STEP_FAILED);
+
+            this->_op_pos = this->_op_write ? 0 : this->_op_entry.file_size;
+            offset = this->_op_pos;
+            if (!fat_seek_file(this->_op_fd, &offset, FAT_SEEK_SET))
+                return this->op_end(STEP_FAILED);
+
+            this->_op_pad = align && this->_op_pos % align ? align - this->_op_pos % align : 0;
+            if (at)
+                *at = this->_op_pos + this->_op_pad;
+            this->_op_done = 0;
+
+            end = this->end_for(this->_op_entry.entry_offset);
+            this->_op_at = end ? end->at : 0;
+            this->_op_cluster = end ? end->cluster : 0;
+            this->_op = OP_DATA;
+            /* fall through */
+        case OP_DATA:
+            if (this->_op_pad || this->_op_done < size) {
+                switch (fat_seek_file_step(this->_op_fd, &this->_op_at, &this->_op_cluster, FS_FAT_STEP)) {
+                    case 1:
+                        return STEP_MORE;
+                    case 2:
+                        break;
+                    default:
+                        return this->op_end(STEP_FAILED);
+                }
+
+                len = sizeof(zero_block) - this->_op_pos % sizeof(zero_block);
+                if (this->_op_pad) {
+                    if (len > this->_op_pad)
+                        len = this->_op_pad;
+                    count = fat_write_file_deferred(this->_op_fd, zero_block, len);
+                    this->_op_pad -= len;
+                } else {
+                    if (len > size - this->_op_done)
+                        len = size - this->_op_done;
+                    count = fat_write_file_deferred(this->_op_fd, (const uint8_t *)data + this->_op_done, len);
+                    this->_op_done += len;
+                }
+                // Failure to write is bad
+                if (count < 0 || (uint32_t)count != len)
+                    return this->op_end(STEP_FAILED);
+                this->_op_pos += len;
+
+                if (this->_op_pad || this->_op_done < size)
+                    return STEP_MORE;
+            }
+
+            // Rewritten in place, the directory entry is still right
+            if (this->_op_pos <= this->_op_entry.file_size)
+                return this->op_end(STEP_DONE);
+            this->_op = OP_SYNC;
+            return STEP_MORE;
+        case OP_SYNC:
+            if (!fat_set_file_size(this->_op_fd, this->_op_pos))
+                return this->op_end(STEP_FAILED);
+
+            // The next append to it carries on from here
+            fat_seek_file_step(this->_op_fd, &this->_op_at, &this->_op_cluster, 0);
+            end = this->end_for(this->_op_entry.entry_offset);
+            if (!end) {
+                end = &this->_end[this->_end_next];
+                this->_end_next = (this->_end_next + 1) % FS_END_COUNT;
+            }
+            end->entry = this->_op_entry.entry_offset;
+            end->at = this->_op_at;
+            end->cluster = this->_op_cluster;
+            return this->op_end(STEP_DONE);
+        default:
+            return STEP_FAILED;
+    }
+
+    if (result == STEP_MORE)
+        return STEP_MORE;
+
+    return this->op_end(STEP_FAILED);
+}
+
+/*
+ * One step towards the directory a file name is in, leaving it in
+ * _op_dd. Names are relative to the root: "2024/05/17-00.trk" opens
+ * 2024/05/, making it first with create. The last one stays open for
+ * the next file in it. Start with _op_dd cleared.
+ */
+int FS::dir_step(const char *fn, bool create)
+{
+    struct fat_dir_entry_struct entry;
+    char part[sizeof(entry.long_name)];
+    const char *slash, *p, *end;
+    size_t len;
+
+    slash = strrchr(fn, '/');
+    if (!slash) {
+        this->_op_dd = this->_dd;
+        return STEP_DONE;
+    }
+
+    len = slash - fn;
+    if (len >= sizeof(this->_sub_path))
+        return STEP_FAILED;
+
+    if (!this->_op_dd) {
+        if (this->_sub_dd && strncmp(this->_sub_path, fn, len) == 0 && this->_sub_path[len] == '\0') {
+            this->_op_dd = this->_sub_dd;
+            return STEP_DONE;
+        }
+
+        // Only one directory handle besides the root: close each parent
+        // before opening the next one down
+        this->close_sub_dir();
+        this->_op_dd = this->_dd;
+        this->_op_part = 0;
+    }
+
+    p = fn + this->_op_part;
+    end = strchr(p, '/');
+    if (end == p || (size_t)(end - p) >= sizeof(part))
+        goto err;
+    memcpy(part, p, end - p);
+    part[end - p] = '\0';
+
+    switch (this->find_step(this->_op_dd, part, &entry)) {
+        case STEP_MORE:
+            return STEP_MORE;
+        case STEP_DONE:
+            if (!(entry.attributes & FAT_ATTRIB_DIR))
+                goto err;
+            break;
+        default:
+            if (!create || !fat_create_dir(this->_op_dd, part, &entry))
+                goto err;
+            break;
+    }
+
+    if (this->_op_dd != this->_dd)
+        fat_close_dir(this->_op_dd);
+    this->_op_dd = fat_open_dir(this->_fs, &entry);
+    if (!this->_op_dd)
+        return STEP_FAILED;
+
+    this->_op_part = end + 1 - fn;
+    if (end < slash)
+        return STEP_MORE;
+
+    memcpy(this->_sub_path, fn, len);
+    this->_sub_path[len] = '\0';
+    this->_sub_dd = this->_op_dd;
+
+    return STEP_DONE;
+
 err:
-    return 0;
+    if (this->_op_dd != this->_dd)
+        fat_close_dir(this->_op_dd);
+    this->_op_dd = nullptr;
+    return STEP_FAILED;
 }
 
-int FS::find_file_in_dir(struct fat_fs_struct* fs, struct fat_dir_struct* dd, const char* name, struct fat_dir_entry_struct* dir_entry)
+// Looks through a few more entries of a directory for a name
+int FS::find_step(struct fat_dir_struct *dd, const char *name, struct fat_dir_entry_struct *dir_entry)
 {
-    while(fat_read_dir(dd, dir_entry))
-    {
-        if(strcmp(dir_entry->long_name, name) == 0)
-        {
+    for (int i = 0; i < FS_FIND_STEP; i++) {
+        // Reading past the last entry starts the directory over
+        if (!fat_read_dir(dd, dir_entry))
+            return STEP_FAILED;
+
+        if (strcmp(dir_entry->long_name, name) == 0) {
             fat_reset_dir(dd);
-            return 1;
+            return STEP_DONE;
+        }
+    }
+
+    return STEP_MORE;
+}
+
+// Ends the step in progress, closing its file
+int FS::op_end(int result)
+{
+    if (this->_op_fd) {
+        fat_close_file(this->_op_fd);
+        this->_op_fd = nullptr;
+    }
+    this->_op = OP_IDLE;
+
+    return result;
+}
+
+// Where the last append to a file ended, if it's remembered
+FS::end_t *FS::end_for(offset_t entry)
+{
+    for (int i = 0; i < FS_END_COUNT; i++) {
+        if (this->_end[i].entry == entry)
+            return &this->_end[i];
+    }
+
+    return nullptr;
+}
+
+void FS::end_forget(void)
+{
+    for (int i = 0; i < FS_END_COUNT; i++)
+        this->_end[i].entry = 0;
+}
+
+/*
+ * The directory a file name is in, with name set past it, see
+ * dir_step().
+ */
+struct fat_dir_struct *FS::dir_for(const char *fn, const char **name, bool create)
+{
+    const char *slash;
+    int result;
+
+    slash = strrchr(fn, '/');
+    *name = slash ? slash + 1 : fn;
+
+    this->_op_dd = nullptr;
+    while ((result = this->dir_step(fn, create)) == STEP_MORE);
+
+    return result == STEP_DONE ? this->_op_dd : nullptr;
+}
+
+void FS::close_sub_dir(void)
+{
+    if (this->_sub_dd) {
+        fat_close_dir(this->_sub_dd);
+        this->_sub_dd = nullptr;
+    }
+    this->_sub_path[0] = '\0';
+}
+
+// Starts counting free space, unless already at it
+void FS::retain_check(void)
+{
+    if (this->_retain != RETAIN_NONE || !this->_retain_min)
+        return;
+
+    this->_retain = RETAIN_COUNT;
+    this->_retain_pos = 0;
+    this->_retain_free = 0;
+}
+
+/*
+ * Deletes the oldest file under /YYYY/MM/, or the oldest month or year
+ * once it is empty. The newest month is left alone, it's being written.
+ * A month or year holding anything else, put there by hand, isn't ours
+ * to delete and is passed over. Returns 0 once there's nothing left to
+ * delete.
+ */
+int FS::retain_prune(void)
+{
+    struct fat_dir_entry_struct year, last_year, month, last_month;
+    struct fat_dir_struct *dd;
+    char year_after[sizeof(year.long_name)], month_after[sizeof(month.long_name)];
+    int found, others, result;
+
+    // The walk needs the second directory handle
+    this->close_sub_dir();
+
+    year_after[0] = '\0';
+    while (this->dir_range(this->_dd, 4, year_after, &year, &last_year)) {
+        strcpy(year_after, year.long_name);
+        month_after[0] = '\0';
+
+        for (;;) {
+            dd = fat_open_dir(this->_fs, &year);
+            if (!dd)
+                return 0;
+            found = this->dir_range(dd, 2, month_after, &month, &last_month, &others);
+            fat_close_dir(dd);
+            if (!found)
+                break;
+
+            if (strcmp(year.long_name, last_year.long_name) == 0 &&
+                strcmp(month.long_name, last_month.long_name) == 0)
+                return 0;
+
+            result = this->retain_month(&month);
+            if (result >= 0)
+                return result;
+            strcpy(month_after, month.long_name);
+        }
+
+        if (!month_after[0] && !others) {
+            this->end_forget();
+            return fat_delete_dir(this->_fs, &year);
         }
     }
 
     return 0;
 }
 
+/*
+ * Deletes the oldest file in a month, or the month once it is empty.
+ * Returns -1 if there are only directories in it.
+ */
+int FS::retain_month(struct fat_dir_entry_struct *month)
+{
+    struct fat_dir_entry_struct file, last_file;
+    struct fat_dir_struct *dd;
+    int found, others;
+
+    dd = fat_open_dir(this->_fs, month);
+    if (!dd)
+        return 0;
+    found = this->dir_range(dd, 0, "", &file, &last_file, &others);
+    fat_close_dir(dd);
+    if (!found && others)
+        return -1;
+
+    this->end_forget();
+    if (!found)
+        return fat_delete_dir(this->_fs, month);
+
+    if (!fat_delete_file(this->_fs, &file))
+        return 0;
+    this->_retain_free += file.file_size;
+
+    return 1;
+}
+
+/*
+ * The lowest named entry after the given name, and the highest, of a
+ * directory: subdirectories named with just so many digits, or with no
+ * digits given, files. Returns the number after the name; others, if
+ * given, gets the number of everything else but "." and "..".
+ */
+int FS::dir_range(struct fat_dir_struct *dd, int digits, const char *after, struct fat_dir_entry_struct *oldest, struct fat_dir_entry_struct *newest, int *others)
+{
+    struct fat_dir_entry_struct entry;
+    bool any = false;
+    int count = 0;
+    int i;
+
+    if (others)
+        *others = 0;
+
+    while (fat_read_dir(dd, &entry)) {
+        if (strcmp(entry.long_name, ".") == 0 || strcmp(entry.long_name, "..") == 0)
+            continue;
+
+        if (digits) {
+            for (i = 0; i < digits && entry.long_name[i] >= '0' && entry.long_name[i] <= '9'; i++);
+            if (!(entry.attributes & FAT_ATTRIB_DIR) || i < digits || entry.long_name[i] != '\0')
+                goto other;
+        } else if (entry.attributes & (FAT_ATTRIB_DIR | FAT_ATTRIB_VOLUME)) {
+            goto other;
+        }
+
+        if (!any || strcmp(entry.long_name, newest->long_name) > 0)
+            *newest = entry;
+        any = true;
+
+        if (strcmp(entry.long_name, after) <= 0)
+            continue;
+        if (!count || strcmp(entry.long_name, oldest->long_name) < 0)
+            *oldest = entry;
+        count++;
+        continue;
+
+other:
+        if (others && !(entry.attributes & FAT_ATTRIB_VOLUME))
+            (*others)++;
+    }
+
+    return count;
+}
+
+int FS::find_file_in_dir(struct fat_fs_struct* fs, struct fat_dir_struct* dd, const char* name, struct fat_dir_entry_struct* dir_entry)
+{
+    int result;
+
+    while((result = this->find_step(dd, name, dir_entry)) == STEP_MORE);
+
+    return result == STEP_DONE;
+}
+
 struct fat_file_struct* FS::open_file_in_dir(struct fat_fs_struct* fs, struct fat_dir_struct* dd, const char* name)
 {
     struct fat_dir_entry_struct file_entry;
@@ -181,3 +888,149 @@ struct fat_file_struct* FS::open_file_in_dir(struct fat_fs_struct* fs, struct fa
 
     return fat_open_file(fs, &file_entry);
 }
+
+int FS::log_recover(struct fat_file_struct *fd)
+{
+    uint8_t buf[32];
+    uint32_t scanned, end, len, i;
+    int32_t offset;
+
+    // Directory entry size is the last checkpoint
+    offset = 0;
+    if (!fat_seek_file(fd, &offset, FAT_SEEK_END))
+        return 0;
+    this->_log_size = this->_log_synced = offset;
+
+    if (!this->log_extent(fd))
+        return 1; // Nothing allocated past the checkpoint
+
+    // Data appended since then is text up to the first zero byte. Only
+    // whole lines are kept.
+    end = 0;
+    for (scanned = 0; scanned < this->_log_avail; scanned += len) {
+        len = this->_log_avail - scanned;
+        if (len > sizeof(buf))
+            len = sizeof(buf);
+
+        if (!this->_partition->device_read(this->_log_offset + scanned, buf, len))
+            return 0;
+
+        for (i = 0; i < len; i++) {
+            if (buf[i] == '\n')
+                end = scanned + i + 1;
+            else if (buf[i] < ' ' && buf[i] != '\r' && buf[i] != '\t')
+                break;
+        }
+        if (i < len) {
+            scanned += i;
+            break;
+        }
+    }
+
+    // Clear any torn record so it can't be picked up again
+    if (scanned > end && !this->zero_fill(this->_log_offset + end, scanned - end))
+        return 0;
+
+    if (end == 0)
+        return 1;
+
+    this->_log_size += end;
+    if (!fat_set_file_size(fd, this->_log_size))
+        return 0;
+    this->_log_synced = this->_log_size;
+
+    return this->log_extent(fd);
+}
+
+/*
+ * One step of growing the log once its run is used up: the size goes
+ * in the directory entry first, as recovery only scans the current run,
+ * then a cluster at a time is reserved up to LOG_PREALLOC_SIZE ahead,
+ * and in a step of its own the new run is looked up. The new space only
+ * becomes part of the file through checkpoints.
+ */
+int FS::log_grow(void)
+{
+    struct fat_file_struct *fd;
+    int result;
+
+    if (this->_log_size != this->_log_synced)
+        return this->log_checkpoint();
+
+    if (this->_op != OP_LOG_GROW) {
+        this->_op = OP_LOG_GROW;
+        this->_op_at = this->_log_at;
+        this->_op_cluster = this->_log_cluster;
+        this->_log_reserved = false;
+    }
+
+    fd = fat_open_file(this->_fs, &this->_log_entry);
+    if (!fd)
+        return 0;
+
+    if (this->_log_reserved) {
+        result = this->log_extent(fd);
+        this->_op = OP_LOG;
+    } else {
+        result = fat_reserve_file_step(fd, &this->_op_at, &this->_op_cluster, this->_log_size + LOG_PREALLOC_SIZE, FS_FAT_STEP);
+        // A log that was empty starts with the cluster just reserved
+        if (result && !this->_log_entry.cluster)
+            this->_log_entry.cluster = this->_op_cluster;
+        this->_log_reserved = result == 2;
+    }
+
+    fat_close_file(fd);
+
+    return result != 0;
+}
+
+int FS::log_extent(struct fat_file_struct *fd)
+{
+    this->_log_clean = 0;
+
+    if (!fat_get_file_extent(fd, this->_log_size, &this->_log_at, &this->_log_cluster, &this->_log_offset, &this->_log_avail)) {
+        this->_log_avail = 0;
+        return 0;
+    }
+
+    return 1;
+}
+
+// Make sure the next len bytes of free log space are zero, clearing up
+// to the end of the sector the last one falls in.
+int FS::log_clear(uint32_t len)
+{
+    offset_t end;
+
+    if (len <= this->_log_clean)
+        return 1;
+
+    end = (this->_log_offset + len + sizeof(zero_block) - 1) & ~(offset_t)(sizeof(zero_block) - 1);
+    if (end > this->_log_offset + this->_log_avail)
+        end = this->_log_offset + this->_log_avail;
+
+    if (!this->zero_fill(this->_log_offset + this->_log_clean, end - this->_log_offset - this->_log_clean))
+        return 0;
+
+    this->_log_clean = end - this->_log_offset;
+
+    return 1;
+}
+
+int FS::zero_fill(offset_t offset, uint32_t len)
+{
+    uint32_t chunk;
+
+    // Sector aligned, so whole sectors are written without a read first
+    while (len > 0) {
+        chunk = sizeof(zero_block) - (offset & (sizeof(zero_block) - 1));
+        if (chunk > len)
+            chunk = len;
+        if (!this->_partition->device_write(offset, zero_block, chunk))
+            return 0;
+        offset += chunk;
+        len -= chunk;
+    }
+
+    return 1;
+}
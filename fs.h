@@ -25,22 +25,157 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <sd-reader/fat.h>
 #include <sd-reader/sd_raw.h>
 
+// Longest directory part of a file name, as in "2024/05"
+#define FS_PATH_MAX 16
+
+// The most directory entries looked at, and FAT sectors read, by one
+// step: about a sector of either
+#define FS_FIND_STEP 16
+#define FS_FAT_STEP  1
+
+// Files whose last append is remembered: a track, its index and capture
+#define FS_END_COUNT 4
+
 class FS
 {
 public:
+	enum mount_t {
+		MOUNT_NONE,
+		MOUNT_BUSY,
+		MOUNT_DONE,
+		MOUNT_FAILED,
+	};
+
+	enum retain_t {
+		RETAIN_NONE,
+		RETAIN_COUNT,
+		RETAIN_PRUNE,
+	};
+
+	enum step_t {
+		STEP_FAILED,
+		STEP_DONE,
+		STEP_MORE,
+		STEP_FULL,  // append_step() with max: already that big, left alone
+	};
+
 	FS(void);
 
 	int init(void);
+	int mount(void);
+	bool mounted(void) const { return this->_mount == MOUNT_DONE; }
 
 	int write_file(const char *fn, const void *data, size_t size);
-	int append_file(const char *fn, const void *data, size_t size);
-	int read_file(const char *fn, void *data, size_t size);
+	int append_file(const char *fn, const void *data, size_t size, size_t align = 0, uint32_t *at = nullptr);
+	int read_file(const char *fn, void *data, size_t size, uint32_t offset = 0);
+
+	// The same a step at a time, each about one sector read or written.
+	// Call again with the same arguments while they return STEP_MORE;
+	// only one runs at a time, and the calls above fail meanwhile.
+	int write_step(const char *fn, const void *data, size_t size);
+	int append_step(const char *fn, const void *data, size_t size, size_t align = 0, uint32_t *at = nullptr, uint32_t max = 0);
+	int log_step(const void *data, size_t size);
+	bool stepping(void) const { return this->_op != OP_IDLE; }
+
+	int open_log(const char *fn);
+	int log_append(const void *data, size_t size);
+	int log_checkpoint(void);
+	int log_idle(void);
+
+	void retain_free(offset_t bytes);
+	int retain_idle(void);
+	bool retaining(void) const { return this->_retain != RETAIN_NONE; }
+
+	int ready(void);
 
 private:
+	enum op_t {
+		OP_IDLE,
+		OP_DIR,
+		OP_FIND,
+		OP_DELETE,
+		OP_CREATE,
+		OP_OPEN,
+		OP_DATA,
+		OP_SYNC,
+		OP_LOG,
+		OP_LOG_GROW,
+	};
+
+	// Where an append ended: a cluster of the file and its offset
+	struct end_t {
+		offset_t entry;    // entry_offset of the file's directory entry
+		uint32_t at;
+		cluster_t cluster;
+	};
+
+	int open_volume(void);
+	int file_step(const char *fn, const void *data, size_t size, size_t align, uint32_t *at, bool write, uint32_t max);
+	int dir_step(const char *fn, bool create);
+	int find_step(struct fat_dir_struct *dd, const char *name, struct fat_dir_entry_struct *dir_entry);
+	int op_end(int result);
+	end_t *end_for(offset_t entry);
+	void end_forget(void);
+	struct fat_dir_struct *dir_for(const char *fn, const char **name, bool create);
+	void close_sub_dir(void);
+	void retain_check(void);
+	int retain_prune(void);
+	int retain_month(struct fat_dir_entry_struct *month);
+	int dir_range(struct fat_dir_struct *dd, int digits, const char *after, struct fat_dir_entry_struct *oldest, struct fat_dir_entry_struct *newest, int *others = nullptr);
 	int find_file_in_dir(struct fat_fs_struct* fs, struct fat_dir_struct* dd, const char* name, struct fat_dir_entry_struct* dir_entry);
 	struct fat_file_struct* open_file_in_dir(struct fat_fs_struct* fs, struct fat_dir_struct* dd, const char* name);
+	int log_recover(struct fat_file_struct *fd);
+	int log_grow(void);
+	int log_extent(struct fat_file_struct *fd);
+	int log_clear(uint32_t len);
+	int zero_fill(offset_t offset, uint32_t len);
 
 	struct partition_struct *_partition;
 	struct fat_fs_struct *_fs;
 	struct fat_dir_struct *_dd;
+	mount_t _mount;
+
+	// Last subdirectory a file was found in, kept open for the next
+	struct fat_dir_struct *_sub_dd;
+	char _sub_path[FS_PATH_MAX];
+
+	// The step in progress. The file stays open between steps, and its
+	// cluster at _op_at is kept to pick up the chain from.
+	op_t _op;
+	bool _op_write;        // write_step(): replace rather than append
+	uint8_t _op_part;      // start of the next directory in the name
+	struct fat_dir_struct *_op_dd;
+	struct fat_dir_entry_struct _op_entry;
+	struct fat_file_struct *_op_fd;
+	uint32_t _op_pos;      // file position
+	uint32_t _op_pad;      // zero padding still to write
+	uint32_t _op_done;     // data written
+	uint32_t _op_at;
+	cluster_t _op_cluster;
+
+	// Where the last few appends ended, so the next one to the same
+	// file doesn't walk its whole chain again. Any delete forgets them.
+	end_t _end[FS_END_COUNT];
+	uint8_t _end_next;
+
+	// Free space is counted a slice at a time while idle; below
+	// _retain_min, the oldest files under /YYYY/MM/ are deleted until
+	// there is twice that.
+	retain_t _retain;
+	offset_t _retain_min;
+	offset_t _retain_free;
+	uint32_t _retain_pos;
+
+	// Preallocated log: appended by writing the device directly, the
+	// directory entry only catches up at checkpoints.
+	const char *_log_name;
+	struct fat_dir_entry_struct _log_entry;
+	uint32_t _log_at;      // a cluster of the log at or before _log_size
+	cluster_t _log_cluster;
+	uint32_t _log_size;    // true end of the log data
+	uint32_t _log_synced;  // size last recorded in the directory entry
+	offset_t _log_offset;  // device offset of byte _log_size
+	uint32_t _log_avail;   // contiguous preallocated bytes at _log_offset
+	uint32_t _log_clean;   // bytes at _log_offset known to be zero
+	bool _log_reserved;    // log_grow(): reserved, the run is looked up next
 };
\ No newline at end of file
@@ -0,0 +1,246 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <mbed.h>
+#include <rtc_api.h>
+
+#include "gpsclock.h"
+
+#define RTC_HZ          32768
+#define RTC_SUBSEC_MASK 0x7FFF // TSR ticks each time TPR bit 14 falls
+#define CIR_MAX         256    // s
+#define TCR_MAX         127    // cycles per interval
+
+// Until the drift is known, assume a so-so crystal
+#define ACC_UNKNOWN_PPM 50
+#define ACC_KNOWN_PPM   5
+
+GpsClock::GpsClock(void) :
+    _drift_ppm(0.0f),
+    _drift_known(false),
+    _anchor(0),
+    _disciplined(0)
+{
+    int8_t tcr;
+    unsigned interval;
+
+    // The RTC runs on through a reset, compensation and all
+    if (!rtc_isenabled()) {
+        rtc_init();
+        return;
+    }
+
+    tcr = (RTC->TCR & RTC_TCR_TCR_MASK) >> RTC_TCR_TCR_SHIFT;
+    interval = ((RTC->TCR & RTC_TCR_CIR_MASK) >> RTC_TCR_CIR_SHIFT) + 1;
+    this->_drift_ppm = -tcr * 1e6f / ((float)RTC_HZ * interval);
+}
+
+/*
+ * Compares the RTC against GPS time. Within GPSCLOCK_STEP_MS it is left
+ * alone until GPSCLOCK_SPAN_S have passed since the last step; then, or
+ * sooner if it's drifted further than that, the offset built up since is
+ * put down to drift. Either way, it's stepped.
+ */
+void GpsClock::discipline(uint32_t utc, uint16_t ms)
+{
+    uint32_t rtc, span, limit;
+    uint16_t rtc_ms;
+    int32_t offset_s, offset_ms;
+    float residual_ppm;
+
+    if (utc < GPSCLOCK_EPOCH)
+        return;
+
+    this->_disciplined = utc;
+
+    if (!this->_anchor || !this->valid() || utc < this->_anchor) {
+        this->_set(utc, ms);
+        return;
+    }
+
+    now(&rtc, &rtc_ms);
+    span = utc - this->_anchor;
+
+    // Further off than drift explains: stopped, or set by something else
+    offset_s = (int32_t)(rtc - utc);
+    limit = span / (1000000 / GPSCLOCK_DRIFT_MAX_PPM) + 1;
+    if (offset_s > (int32_t)limit || -offset_s > (int32_t)limit) {
+        this->_set(utc, ms);
+        return;
+    }
+
+    offset_ms = offset_s * 1000 + rtc_ms - ms;
+
+    // A crystal more than GPSCLOCK_STEP_MS / GPSCLOCK_SPAN_S off never
+    // lasts the span, the step has to do. Short of GPSCLOCK_STEP_MS /
+    // GPSCLOCK_DRIFT_MAX_PPM it's a bad fix rather than drift.
+    if (span < GPSCLOCK_SPAN_S && offset_ms <= GPSCLOCK_STEP_MS && offset_ms >= -GPSCLOCK_STEP_MS)
+        return;
+
+    residual_ppm = offset_ms * 1000.0f / span;
+    if (residual_ppm < GPSCLOCK_DRIFT_MAX_PPM && residual_ppm > -GPSCLOCK_DRIFT_MAX_PPM) {
+        // Later estimates only nudge it, NMEA latency jitters
+        this->_drift_ppm += this->_drift_known ? residual_ppm / 2 : residual_ppm;
+        this->_drift_known = true;
+        this->_compensate();
+    }
+
+    this->_set(utc, ms);
+}
+
+bool GpsClock::valid(void)
+{
+    return RTC->TSR >= GPSCLOCK_EPOCH;
+}
+
+uint32_t GpsClock::age(void)
+{
+    uint32_t utc;
+    uint16_t ms;
+
+    if (!this->_disciplined)
+        return UINT32_MAX;
+
+    now(&utc, &ms);
+    return utc - this->_disciplined;
+}
+
+uint32_t GpsClock::accuracy_ms(void)
+{
+    uint32_t age = this->age();
+    uint32_t ppm = this->_drift_known ? ACC_KNOWN_PPM : ACC_UNKNOWN_PPM;
+
+    if (age == UINT32_MAX)
+        return UINT32_MAX;
+
+    return GPSCLOCK_LATENCY_MS + age * ppm / 1000;
+}
+
+void GpsClock::now(uint32_t *utc, uint16_t *ms)
+{
+    uint32_t tsr, tpr;
+
+    // Read again if the seconds ticked in between
+    do {
+        tsr = RTC->TSR;
+        tpr = RTC->TPR;
+    } while (tsr != RTC->TSR);
+
+    *utc = tsr;
+    *ms = ((tpr & RTC_SUBSEC_MASK) * 1000) / RTC_HZ;
+}
+
+// Days from civil, proleptic Gregorian
+uint32_t GpsClock::to_utc(int year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second)
+{
+    int y = year - (month <= 2);
+    int era = y / 400;
+    unsigned yoe = y - era * 400;
+    unsigned doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int32_t days = era * 146097 + (int32_t)doe - 719468;
+
+    return (uint32_t)days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+void GpsClock::to_civil(uint32_t utc, int *year, uint8_t *month, uint8_t *day, uint8_t *hour, uint8_t *minute, uint8_t *second)
+{
+    uint32_t days = utc / 86400;
+    uint32_t secs = utc % 86400;
+    uint32_t z = days + 719468;
+    uint32_t era = z / 146097;
+    uint32_t doe = z - era * 146097;
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+
+    *day = doy - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = yoe + era * 400 + (*month <= 2);
+    *hour = secs / 3600;
+    *minute = secs / 60 % 60;
+    *second = secs % 60;
+}
+
+void GpsClock::_set(uint32_t utc, uint16_t ms)
+{
+    // The prescaler only takes writes with the counter stopped
+    RTC->SR &= ~RTC_SR_TCE_MASK;
+    RTC->TPR = (uint32_t)ms * RTC_HZ / 1000;
+    RTC->TSR = utc;
+    RTC->SR |= RTC_SR_TCE_MASK;
+
+    this->_anchor = utc;
+}
+
+/*
+ * One second in every interval is lengthened or shortened by TCR
+ * cycles. The longest interval that keeps TCR in range gives the finest
+ * trim: 0.12ppm at 256s.
+ */
+void GpsClock::_compensate(void)
+{
+    float cycles = 0.0f;
+    unsigned interval;
+    int tcr;
+
+    for (interval = CIR_MAX; ; interval /= 2) {
+        cycles = this->_drift_ppm * RTC_HZ * interval / 1e6f;
+        if ((cycles <= TCR_MAX && cycles >= -TCR_MAX) || interval == 1)
+            break;
+    }
+
+    tcr = -(int)(cycles + (cycles < 0 ? -0.5f : 0.5f));
+    if (tcr > TCR_MAX)
+        tcr = TCR_MAX;
+    if (tcr < -TCR_MAX)
+        tcr = -TCR_MAX;
+
+    RTC->TCR = RTC_TCR_CIR(interval - 1) | RTC_TCR_TCR((uint8_t)tcr);
+}
+
+// FAT timestamps, see fat_config.h
+extern "C" void get_datetime(uint16_t *year, uint8_t *month, uint8_t *day, uint8_t *hour, uint8_t *min, uint8_t *sec)
+{
+    uint32_t utc;
+    uint16_t ms;
+    int y;
+
+    GpsClock::now(&utc, &ms);
+    if (utc < GPSCLOCK_EPOCH) {
+        // FAT can't go before 1980
+        *year = 1980;
+        *month = *day = 1;
+        *hour = *min = *sec = 0;
+        return;
+    }
+
+    GpsClock::to_civil(utc, &y, month, day, hour, min, sec);
+    *year = y;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * GPS disciplined RTC
+ *
+ * The KL25Z RTC keeps UTC across sleep and is stepped to GPS time
+ * whenever a good fix says it is off. Once the two have been compared
+ * over long enough, the drift is estimated and trimmed out with the
+ * RTC's own compensation registers, so the time is still close when
+ * the next fix is a long way off.
+ */
+
+#include <stdint.h>
+
+#define GPSCLOCK_EPOCH         1577836800 // 2020-01-01, anything before is unset
+#define GPSCLOCK_SPAN_S        1800       // Shortest comparison to estimate drift from
+#define GPSCLOCK_STEP_MS       250        // Stepped before this far off
+#define GPSCLOCK_DRIFT_MAX_PPM 500        // More is a clock that stopped or was set
+#define GPSCLOCK_LATENCY_MS    200        // NMEA time trails the fix it came from
+
+class GpsClock
+{
+public:
+    GpsClock(void);
+
+    // GPS UTC as of now, from a good fix
+    void discipline(uint32_t utc, uint16_t ms);
+
+    bool valid(void);
+    uint32_t age(void);          // s since last disciplined
+    uint32_t accuracy_ms(void);
+    float drift_ppm(void) { return this->_drift_ppm; }
+
+    static void now(uint32_t *utc, uint16_t *ms);
+    static uint32_t to_utc(int year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second);
+    static void to_civil(uint32_t utc, int *year, uint8_t *month, uint8_t *day, uint8_t *hour, uint8_t *minute, uint8_t *second);
+
+private:
+    void _set(uint32_t utc, uint16_t ms);
+    void _compensate(void);
+
+    float _drift_ppm;      // Trimmed out by the compensation registers
+    bool _drift_known;
+    uint32_t _anchor;      // UTC of the last step
+    uint32_t _disciplined; // UTC of the last fix compared against
+};
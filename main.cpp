@@ -29,17 +29,26 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <mbed.h>
 #include <TinyGPS.h>
-#include <millis.h>
 
+#include "boot.h"
+#include "capture.h"
 #include "common.h"
 #include "leds.h"
 #include "odom.h"
 #include "fs.h"
+#include "gpsclock.h"
+#include "storage.h"
 #include "tm1650.h"
 #include "pins.h"
+#include "scheduler.h"
+#include "segfmt.h"
+#include "track.h"
 #include "ublox.h"
 
 #define PRETTY_LOG
+#define BOOT_TRACE
+#define TASK_STATS
+// #define RAW_CAPTURE // Receiver stream to raw.bin for replay, 2k of RAM
 
 #include "main.h"
 
@@ -48,21 +57,44 @@ const int IDLE_SLEEP_MAX_TIME_MS = 5 * 60 * 1000;
 const int MIN_HDOP_THRESHOLD = 500;
 const char *ODOM_BIN = "odom.bin";
 const char *ODOM_LOG = "odom.log";
-const double ODOM_MOVING_LOWER_BOUND_MPH = 1.0;
-const double ODOM_MOVING_UPPER_BOUND_MPH = 6.0;
+const char *AID_BIN = "aid.bin";
+const char *CAPTURE_BIN = "raw.bin";
 const double ODOM_SAVE_DISTANCE_THRESHOLD_M = 50 * METERS_PER_MILE;
 const float MIN_TIME_BETWEEN_SAVE_S = 10;
 const float MAX_TIME_BETWEEN_SAVE_S = 10 * 60; // 10 minutes
+const float GPS_BOOT_TIME_S = 1.0;
+const uint32_t STORAGE_BUSY_POLL_US = 1000;
+const uint32_t STORAGE_IDLE_POLL_US = 1000 * 1000;
+const uint32_t SAVE_RETRY_US = 100 * 1000;
+const uint32_t GPS_CFG_SPACING_US = 20 * 1000;
+const uint32_t CAPTURE_POLL_US = 20 * 1000; // Well inside the ring at 115200
+const uint32_t SLEEP_MESSAGE_US = 750 * 1000;
+const uint32_t SLEEP_SETTLE_US = 1000 * 1000;
+const uint32_t AID_POLL_US = 5 * 1000; // For the answer to each AID poll
+// Tracks go to /YYYY/MM/DD-NN.trk by GPS date, each with a .idx beside
+// it; NN moves on once a file gets this big.
+const uint32_t TRACK_FILE_MAX = 4 * 1024 * 1024;
+
+#define TRACK_FN_LEN        20  // "2024/05/17-00.trk"
+#define TRACK_PART_MAX      99  // NN, the last one grows past TRACK_FILE_MAX
+#define OVERLAY_QUEUE_LEN   4
+#define OVERLAY_TEXT_MAX    (2 * TM1650_COLUMNS + 1) // Every digit with a dot
 
 Serial pc(USBTX, USBRX);
-Ublox gps(GPS_TX, GPS_RX, GPS_EN, NC);
+Ublox gps(GPS_TX, GPS_RX, GPS_EN, GPS_PPS);
 Odom odom;
 FS fs;
+Storage storage(fs);
 TM1650 tm1650(TM1650_DIO, TM1650_CLK, TM1650_AIN);
-Timer display_timer;
-Timeout overlay_timer;
+Scheduler sched;
 Timer save_timer;
 Timer idle_timer;
+Timer gps_timer;
+BootTimeline boot;
+GpsClock gpsclock;
+#ifdef RAW_CAPTURE
+Capture capture;
+#endif
 
 struct {
     mode_func_t func;
@@ -81,16 +113,62 @@ struct {
 
 int display_mode = MODE_SHOW_SATS;
 bool sleeping = false;
-bool wakeup = false;
+bool entering_sleep = false;
+bool booting = true;
+int self_test_step;
 bool waiting_for_gps_ready = true;
-bool have_position = false;
-double prev_lat, prev_lon;
 double last_save_odom = 0.0;
-bool moving = false;
+bool save_deferred = false;
+// Nothing is saved until odom.bin is merged, see load_odom(); trips reset
+// before then aren't added back to what's on the card
+bool odom_merged = false;
+unsigned odom_reset;
 int sats_used, sats_inview;
 int hdop = TinyGPS::GPS_INVALID_HDOP;
 int pdop = TinyGPS::GPS_INVALID_PDOP;
 bool overlay_visible = false;
+uint32_t shown_epoch_us;
+uint32_t display_latency_us, display_latency_max_us;
+// One block fills while the other is written out
+TrackBlock track[2];
+TrackFilter track_filter;
+int track_filling;
+bool track_writing;
+// Names of the file each block goes to, kept until its index is written
+char track_fn[2][TRACK_FN_LEN];
+char track_idx_fn[2][TRACK_FN_LEN];
+uint32_t track_day;
+int track_part;
+unsigned long track_time = TinyGPS::GPS_INVALID_TIME;
+// Records are collected into a block for Storage, none split across two
+uint8_t aid_chunk[STORAGE_BLOCK_SIZE];
+size_t aid_chunk_len;
+bool aid_saving;
+uint32_t aid_offset;
+int aid_loaded;
+
+// Where run_gps_init() is
+enum gps_init_t {
+    GPS_INIT_START,
+    GPS_INIT_WAKE,
+    GPS_INIT_BOOT,
+    GPS_INIT_CONFIG,
+    GPS_INIT_AID,
+};
+gps_init_t gps_init_state = GPS_INIT_START;
+int gps_init_step;
+
+// Overlays waiting for the one on display to time out
+struct {
+    char text[OVERLAY_TEXT_MAX];
+    float delay;
+} overlays[OVERLAY_QUEUE_LEN];
+int overlay_head = 0;
+int overlay_count = 0;
+
+int task_gps, task_keys, task_display, task_save, task_idle, task_storage;
+int task_overlay, task_sleep, task_gps_rate, task_capture;
+int task_self_test, task_gps_init;
 
 char main_buf[72];
 
@@ -100,126 +178,420 @@ int main()
 
     set_color(COLOR_RED);
 
-    startMillis();
+    boot.start();
 
-    tm1650.init();
-    tm1650.setDisplay(true);
-    display_test();
-    tm1650.setBrightness(1);
+    // The receiver boots while the self-test runs and the card mounts
+    gps.set_enabled(true);
+    gps_timer.start();
+    boot.mark("gps power");
 
-    display_timer.start();
     save_timer.start();
     idle_timer.start();
 
-    if (!fs.init())
-        show_error(ERR_DISK);
+    tm1650.init();
+    tm1650.setDisplay(true);
 
-    load_odom();
+    add_tasks();
 
-    /* TODO:
-    * - Implement GPS PPS (Shoot.. this needs to be moved to PORT A.. (or D? B?))
-    * - Detect GPS ready rather than waiting
-    */
+    // Mounted by run_storage(), see odom_mounted()
+    storage.mount(odom_mounted);
 
-init_gps:
-    // Let GPS start warming up as soon as possible
-    gps.set_enabled(true);
-    waiting_for_gps_ready = true;
-    tm1650.puts("INIT");
-    wait(1.0);
-    gps.set_baud(115200);
-    gps.disable_feature("GLL"); // Not used by TinyGPS
-    gps.disable_feature("ZDA"); // Not used by TinyGPS
-    gps.disable_feature("VTG"); // Not used by TinyGPS (speed: This could be higher performance way to get speed?)
-    gps.set_feature_rate("RMC", 1); // Speed, time, etc
-    gps.set_feature_rate("GGA", 5);
-    gps.set_feature_rate("GSA", 10);
-    gps.set_feature_rate("GSV", 20);
-    gps.set_fix_rate(Ublox::RATE_10Hz);
-    gps.set_dyn_model(Ublox::DYN_AUTOMOTIVE);
-    tm1650.clear();
+    // The self-test, then run_gps_init() once the receiver is up
+    sched.run_in(task_self_test, 0);
+    sched.run_in(task_storage, 0);
 
-    // Clear any key events
-    tm1650.getEvent();
+    while (true) {
+        sched.run();
 
-    set_color(COLOR_OFF);
+        // Deep sleep only once keys may wake us again
+        sched.sleep(sleeping && !entering_sleep);
+    }
+}
 
-    while (true) {
-        if (!sleeping) {
-            if (!waiting_for_gps_ready) {
-                if (save_timer.read() > MAX_TIME_BETWEEN_SAVE_S)
-                    save_odom();
+void add_tasks(void)
+{
+    task_gps = sched.add(run_gps, "gps");
+    task_keys = sched.add(run_keys, "keys");
+    task_display = sched.add(run_display, "display");
+    task_save = sched.add(run_save, "save");
+    task_idle = sched.add(run_idle, "idle");
+    task_storage = sched.add(run_storage, "storage");
+    task_overlay = sched.add(run_overlay, "overlay");
+    task_sleep = sched.add(run_sleep, "sleep");
+    task_gps_rate = sched.add(run_gps_rate, "gps rate");
+    task_self_test = sched.add(run_self_test, "self-test");
+    task_gps_init = sched.add(run_gps_init, "gps init");
+#ifdef RAW_CAPTURE
+    task_capture = sched.add(run_capture, "capture");
+    gps.attach_tee(capture_byte);
+#endif
 
-                if (gps.changed())
-                    update_position();
-            }
+    gps.attach(gps_changed);
+    gps.attach_time(clock_time);
+    tm1650.attach(keys_changed);
+}
 
-            update_dop();
+void start_tasks(void)
+{
+    sched.run_in(task_display, 0);
+    sched.run_in(task_save, 0);
+    sched.run_in(task_idle, 0);
+    sched.run_in(task_storage, 0);
+#ifdef RAW_CAPTURE
+    sched.run_in(task_capture, 0);
+#endif
 
-            if (display_timer.read_ms() >= DISPLAY_MAX_TIME_MS) {
-                if (waiting_for_gps_ready)
-                    check_for_gps_ready();
+    update_gps_rates();
+}
 
-                if (!overlay_visible) {
-                    modes[display_mode].func();
-                    display_timer.reset();
-                }
-            }
+void stop_tasks(void)
+{
+    // Storage is left to drain, see run_sleep()
+    sched.cancel(task_gps);
+    sched.cancel(task_gps_rate);
+#ifdef RAW_CAPTURE
+    sched.cancel(task_capture);
+#endif
+    sched.cancel(task_display);
+    sched.cancel(task_save);
+    sched.cancel(task_idle);
+    sched.cancel(task_overlay);
+}
 
-            if (idle_timer.read_ms() >= IDLE_SLEEP_MAX_TIME_MS)
-                enter_sleep();
-        }
+void gps_changed(void)
+{
+    sched.signal(task_gps);
+}
+
+void keys_changed(void)
+{
+    sched.signal(task_keys);
+}
+
+void run_gps(void)
+{
+    if (sleeping || booting || !gps.changed())
+        return;
+
+    update_dop();
+
+    // Checked per sentence so speed shows up with the first good fix
+    if (waiting_for_gps_ready)
+        check_for_gps_ready();
+    if (!waiting_for_gps_ready) {
+        update_position();
+        update_clock();
+        record_track();
+    }
+}
+
+void run_gps_rate(void)
+{
+    // One CFG message at a time, leaving room for GPS output in between
+    if (gps.govern())
+        sched.run_in(task_gps_rate, GPS_CFG_SPACING_US);
+}
 
-        key_event_t event = tm1650.getEvent();
-        if (event != NO_EVENT)
+// Fast fixes only while moving; GSV and GSA only for the screens showing them
+void update_gps_rates(void)
+{
+    unsigned sentences = 0;
+
+    if (display_mode == MODE_SHOW_SATS)
+        sentences |= Ublox::SENTENCE_GSV;
+    if (display_mode == MODE_SHOW_HDOP || display_mode == MODE_SHOW_PDOP)
+        sentences |= Ublox::SENTENCE_GSA;
+
+    gps.set_moving(odom.moving());
+    gps.set_sentences(sentences);
+    sched.signal(task_gps_rate);
+}
+
+void run_keys(void)
+{
+    key_event_t event;
+
+    // Dropped while the self-test or INIT is showing
+    while ((event = tm1650.getEvent()) != NO_EVENT) {
+        if (!booting)
             handle_key_event(event);
+    }
+}
+
+void run_display(void)
+{
+    if (!overlay_visible)
+        modes[display_mode].func();
+
+    sched.run_in(task_display, DISPLAY_MAX_TIME_MS * 1000);
+}
+
+void run_save(void)
+{
+    float left;
+
+    if (!waiting_for_gps_ready && (save_deferred || save_timer.read() > MAX_TIME_BETWEEN_SAVE_S))
+        save_odom();
+
+    // Still waiting for room in the storage queue
+    if (save_deferred) {
+        sched.run_in(task_save, SAVE_RETRY_US);
+        return;
+    }
+
+    left = MAX_TIME_BETWEEN_SAVE_S - save_timer.read();
+    if (left <= 0.0)
+        left = MAX_TIME_BETWEEN_SAVE_S;
+    sched.run_in(task_save, left * 1000000);
+}
+
+void run_idle(void)
+{
+    int elapsed = idle_timer.read_ms();
+
+    if (elapsed >= IDLE_SLEEP_MAX_TIME_MS) {
+        enter_sleep();
+        return;
+    }
+
+    // Keys and movement push this out, so just look again when it's up
+    sched.run_in(task_idle, (IDLE_SLEEP_MAX_TIME_MS - elapsed) * 1000);
+}
+
+// The overlay on display has timed out
+void run_overlay(void)
+{
+    if (overlay_count > 0) {
+        tm1650.puts(overlays[overlay_head].text);
+        sched.run_in(task_overlay, overlays[overlay_head].delay * 1000000);
+        overlay_head = (overlay_head + 1) % OVERLAY_QUEUE_LEN;
+        overlay_count--;
+        return;
+    }
+
+    overlay_visible = false;
+    if (booting)
+        return;
+    modes[display_mode].func();
+    sched.run_in(task_display, DISPLAY_MAX_TIME_MS * 1000);
+}
+
+// Steps through going to sleep once "SLP " has been shown
+void run_sleep(void)
+{
+    // Don't power down in the middle of a write
+    if (!storage.idle()) {
+        sched.run_in(task_sleep, STORAGE_BUSY_POLL_US);
+        return;
+    }
 
-        if (wakeup) {
-            wakeup = false;
-            goto init_gps;
+    // One poll of the receiver at a time, the block goes out once full
+    if (aid_saving) {
+        if (aid_chunk_len + UBLOX_AID_MAX > sizeof(aid_chunk)) {
+            aid_flush();
+            sched.run_in(task_sleep, STORAGE_BUSY_POLL_US);
+            return;
         }
+        if (gps.save_aid_step()) {
+            sched.run_in(task_sleep, AID_POLL_US);
+            return;
+        }
+        aid_saving = false;
+        if (aid_flush()) {
+            sched.run_in(task_sleep, STORAGE_BUSY_POLL_US);
+            return;
+        }
+    }
 
-        if (sleeping)
-            deepsleep();
-        else
-            sleep();
+    if (!sleeping) {
+        storage.flush();
+        gps.sleep();
+        sched.cancel(task_storage);
+#ifdef TASK_STATS
+        sched.print(pc);
+        pc.printf("fix latency %lu us, to display %lu us (max %lu us)\r\n",
+            (unsigned long)gps.latency_us(),
+            (unsigned long)display_latency_us,
+            (unsigned long)display_latency_max_us);
+#endif
+        set_color(COLOR_OFF);
+        tm1650.clear();
+        sleeping = true;
+        sched.run_in(task_sleep, SLEEP_SETTLE_US);
+        return;
     }
+
+    entering_sleep = false;
 }
 
-void display_test(void)
+// One step of the display self-test; the card mounts in between
+void run_self_test(void)
 {
-    const float delay = 0.1;
-    const float delay_b = 0.05;
+    float delay = display_test(self_test_step++);
 
+    if (delay >= 0.0) {
+        sched.run_in(task_self_test, delay * 1000000);
+        return;
+    }
+
+    tm1650.setBrightness(1);
+    boot.mark("display");
+    sched.run_in(task_gps_init, 0);
+}
+
+// Brings the receiver up from power on or backup a step at a time, then
+// starts the rest
+void run_gps_init(void)
+{
+    float left;
+
+    switch (gps_init_state) {
+        case GPS_INIT_START:
+            waiting_for_gps_ready = true;
+            tm1650.puts("INIT");
+            if (gps.asleep()) {
+                // Config was saved before going to backup, see enter_sleep()
+                gps_init_state = GPS_INIT_WAKE;
+                sched.run_in(task_gps_init, gps.wake() * 1000);
+                return;
+            }
+            // Let GPS start warming up as soon as possible
+            if (!gps.enabled()) {
+                gps.set_enabled(true);
+                gps_timer.reset();
+                gps_timer.start();
+            }
+            gps_init_state = GPS_INIT_BOOT;
+            // fall through
+        case GPS_INIT_BOOT:
+            // TODO: Detect GPS ready rather than waiting
+            left = GPS_BOOT_TIME_S - gps_timer.read();
+            if (left > 0.0) {
+                sched.run_in(task_gps_init, left * 1000000);
+                return;
+            }
+            boot.mark("gps boot");
+            gps_init_step = 0;
+            gps_init_state = GPS_INIT_CONFIG;
+            // fall through
+        case GPS_INIT_CONFIG:
+            if (gps_config(gps_init_step++)) {
+                sched.run_in(task_gps_init, GPS_CFG_SPACING_US);
+                return;
+            }
+            boot.mark("gps config");
+            aid_offset = 0;
+            aid_loaded = 0;
+            gps_init_state = GPS_INIT_AID;
+            // fall through
+        case GPS_INIT_AID:
+            if (storage.mounted() && load_aid()) {
+                sched.run_in(task_gps_init, STORAGE_BUSY_POLL_US);
+                return;
+            }
+            if (aid_loaded)
+                boot.mark("gps aid");
+            gps.send_time_hint();
+            break;
+        case GPS_INIT_WAKE:
+            gps.hot_start();
+            gps.send_time_hint();
+            boot.mark("gps wake");
+            break;
+    }
+    gps_init_state = GPS_INIT_START;
     tm1650.clear();
 
-    tm1650.setBrightness(8);
+    // Clear any key events
+    while (tm1650.getEvent() != NO_EVENT);
+
+    set_color(storage.ram_only() ? COLOR_ORANGE : COLOR_OFF);
+
+    booting = false;
+    start_tasks();
+}
+
+// One CFG message of the receiver's boot config, false once all are sent
+bool gps_config(int step)
+{
+    switch (step) {
+        case 0:
+            gps.set_baud(115200);
+            return true;
+        case 1:
+            gps.disable_feature("GLL"); // Not used by TinyGPS
+            return true;
+        case 2:
+            gps.disable_feature("ZDA"); // Not used by TinyGPS
+            return true;
+        case 3:
+            gps.disable_feature("VTG"); // Not used by TinyGPS (speed: This could be higher performance way to get speed?)
+            return true;
+        case 4:
+            gps.set_dyn_model(Ublox::DYN_AUTOMOTIVE);
+            return true;
+        default:
+            // RMC, GGA, GSA, GSV and the fix rate are left to the governor, see update_gps_rates()
+            return false;
+    }
+}
+
+void run_storage(void)
+{
+    storage.poll();
 
-    tm1650.locate(0);
-    for (int i = 0; i < tm1650.columns(); i++) {
+    if (!storage.idle() || storage.retaining() || (!storage.mounted() && !storage.ram_only()))
+        sched.run_in(task_storage, STORAGE_BUSY_POLL_US);
+    else
+        sched.run_in(task_storage, STORAGE_IDLE_POLL_US);
+}
+
+float display_test(int step)
+{
+    const float delay = 0.1;
+    const float delay_b = 0.05;
+    const int columns = tm1650.columns();
+
+    // Light every segment
+    if (step == 0) {
+        tm1650.clear();
+        tm1650.setBrightness(8);
+        tm1650.locate(0);
+        return 0.0;
+    }
+    step -= 1;
+    if (step < columns) {
         tm1650.putc('8');
         tm1650.putc('.');
-        wait(delay);
+        return delay;
     }
 
-    for (int i = 8; i >= 0; i--) {
-        tm1650.setBrightness(i);
-        wait(delay_b);
+    // Fade out and back in
+    step -= columns;
+    if (step <= 8) {
+        tm1650.setBrightness(8 - step);
+        return step == 8 ? delay_b + delay : delay_b;
     }
-    wait(delay);
-
-    for (int i = 0; i <= 8; i++) {
-        tm1650.setBrightness(i);
-        wait(delay_b);
+    step -= 9;
+    if (step <= 8) {
+        tm1650.setBrightness(step);
+        return delay_b;
     }
 
-    tm1650.locate(0);
-    for (int i = 0; i < tm1650.columns(); i++) {
+    // Blank one digit at a time
+    step -= 9;
+    if (step == 0) {
+        tm1650.locate(0);
+        return 0.0;
+    }
+    step -= 1;
+    if (step < columns) {
         tm1650.putc(' ');
-        wait(delay);
+        return delay;
     }
 
     tm1650.clear();
+    return -1.0;
 }
 
 void show_error(int error)
@@ -233,11 +605,20 @@ void show_error(int error)
 void show_speed(void)
 {
     if (gps.gps_good_data()) {
+        uint8_t glyphs[TM1650_COLUMNS];
         double speed = gps.d_speed_mph();
         if (speed > 999.9)
             speed = 999.9; // Let's... hope not.
-        snprintf(main_buf, sizeof(main_buf), "%4d", (int)floor(speed));
-        tm1650.puts(main_buf);
+        segfmt(glyphs, TM1650_COLUMNS, (int32_t)speed);
+        tm1650.putGlyphs(glyphs, TM1650_COLUMNS);
+
+        // Fix to display, once per epoch
+        if (gps.pps_locked() && gps.epoch_us() != shown_epoch_us) {
+            shown_epoch_us = gps.epoch_us();
+            display_latency_us = us_ticker_read() - shown_epoch_us;
+            if (display_latency_us > display_latency_max_us)
+                display_latency_max_us = display_latency_us;
+        }
     } else {
         tm1650.puts("----");
     }
@@ -245,80 +626,42 @@ void show_speed(void)
 
 void show_odom(void)
 {
-    odom_t o;
+    uint8_t glyphs[TM1650_COLUMNS];
     double dist;
-    double whole, fract;
-    int whole_w, fract_w;
-    int whole_mod, fract_mod;
+    int32_t value;
 
     switch (display_mode) {
         case MODE_SHOW_ODOM_HI:
             // Given 123456.78, show 12
-            o = ODOM_ENGINE;
-            break;
-        case MODE_SHOW_ODOM_LO:
-            // Given 123456.78, show 3456
-            o = ODOM_ENGINE;
-            break;
-        case MODE_SHOW_TRIP_A:
-            // Given 123456.78, show 456.7
-            o = ODOM_TRIP_A;
-            break;
-        case MODE_SHOW_TRIP_B:
-            // Given 123456.78, show 456.7
-            o = ODOM_TRIP_B;
-            break;
-        default:
-            return;
-    }
-
-    dist = odom.get_odom(o);
-    fract = modf(dist, &whole);
-
-    switch (display_mode) {
-        case MODE_SHOW_ODOM_HI:
-            // Given 123456.78, show 12
-            whole *= 0.0001;
-            if (whole < 1.0) {
+            value = (int32_t)(odom.get_odom(ODOM_ENGINE) * 0.0001);
+            if (value < 1) {
                 tm1650.clear();
                 return;
             }
-            whole_w = 4;
-            fract_w = 0;
+            segfmt(glyphs, TM1650_COLUMNS, value, 0, SEGFMT_WRAP);
             break;
         case MODE_SHOW_ODOM_LO:
             // Given 123456.78, show 3456
-            whole_w = 4;
-            fract_w = 0;
+            value = (int32_t)odom.get_odom(ODOM_ENGINE);
+            segfmt(glyphs, TM1650_COLUMNS, value, 0, SEGFMT_WRAP);
             break;
         case MODE_SHOW_TRIP_A:
-            // Given 123456.78, show 456.7
-            whole_w = 3;
-            fract_w = 1;
-            break;
         case MODE_SHOW_TRIP_B:
             // Given 123456.78, show 456.7
-            whole_w = 3;
-            fract_w = 1;
+            dist = odom.get_odom(display_mode == MODE_SHOW_TRIP_A ? ODOM_TRIP_A : ODOM_TRIP_B);
+            value = (int32_t)(dist * 10);
+            segfmt(glyphs, TM1650_COLUMNS, value, 1, SEGFMT_WRAP);
             break;
         default:
             return;
     }
 
-    whole_mod = (int)pow(10, whole_w);
-    fract_mod = (int)pow(10, fract_w);
-
-    if (whole_w > 0 && fract_w > 0)
-        snprintf(main_buf, sizeof(main_buf), "%*d.%*d", whole_w, (int)(whole) % whole_mod, fract_w, (int)(fract * fract_mod) % fract_mod);
-    else if (whole_w == 0)
-        snprintf(main_buf, sizeof(main_buf), "%*d", fract_w, (int)(fract * fract_mod) % fract_mod);
-    else
-        snprintf(main_buf, sizeof(main_buf), "%*d", whole_w, (int)(whole) % whole_mod);
-    tm1650.puts(main_buf);
+    tm1650.putGlyphs(glyphs, TM1650_COLUMNS);
 }
 
 void show_sats(void)
 {
+    uint8_t glyphs[TM1650_COLUMNS];
     int new_sats_used, new_sats_inview;
     new_sats_used = gps.satsused();
     new_sats_inview = gps.satsinview();
@@ -328,12 +671,15 @@ void show_sats(void)
     if (new_sats_inview)
         sats_inview = new_sats_inview;
 
-    snprintf(main_buf, sizeof(main_buf), "%02d.%02d", sats_used, sats_inview);
-    tm1650.puts(main_buf);
+    segfmt(&glyphs[0], 2, sats_used, 0, SEGFMT_ZERO_PAD);
+    glyphs[1] |= SEG_DOT;
+    segfmt(&glyphs[2], 2, sats_inview, 0, SEGFMT_ZERO_PAD);
+    tm1650.putGlyphs(glyphs, TM1650_COLUMNS);
 }
 
 void show_dop(void)
 {
+    uint8_t glyphs[TM1650_COLUMNS];
     int dop;
     char label;
     if (display_mode == MODE_SHOW_HDOP) {
@@ -344,8 +690,9 @@ void show_dop(void)
         dop = pdop;
     }
 
-    snprintf(main_buf, sizeof(main_buf), "%c%03d", label, dop % 10000);
-    tm1650.puts(main_buf);
+    glyphs[0] = tm1650.glyph(label);
+    segfmt(&glyphs[1], 3, dop, 0, SEGFMT_ZERO_PAD);
+    tm1650.putGlyphs(glyphs, TM1650_COLUMNS);
 }
 
 void show_noop(void)
@@ -353,48 +700,155 @@ void show_noop(void)
     return;
 }
 
-void show_overlay(const char *msg, float delay)
+void show_overlay(const char *msg, float delay, bool replace)
 {
+    int tail;
+
+    if (replace)
+        overlay_count = 0;
+
+    if (overlay_visible && !replace) {
+        if (overlay_count >= OVERLAY_QUEUE_LEN)
+            return;
+        tail = (overlay_head + overlay_count) % OVERLAY_QUEUE_LEN;
+        strncpy(overlays[tail].text, msg, OVERLAY_TEXT_MAX - 1);
+        overlays[tail].text[OVERLAY_TEXT_MAX - 1] = '\0';
+        overlays[tail].delay = delay;
+        overlay_count++;
+        return;
+    }
+
     tm1650.puts(msg);
     overlay_visible = true;
-    overlay_timer.attach(hide_overlay, delay);
+    sched.run_in(task_overlay, delay * 1000000);
 }
 
-void hide_overlay(void)
+void show_debug(int num, float delay)
 {
-    overlay_visible = false;
+    uint8_t glyphs[TM1650_COLUMNS];
+    char text[OVERLAY_TEXT_MAX];
+
+    if (delay > 0.0) {
+        snprintf(text, sizeof(text), "%4d", num);
+        show_overlay(text, delay);
+    } else {
+        segfmt(glyphs, TM1650_COLUMNS, num);
+        tm1650.putGlyphs(glyphs, TM1650_COLUMNS);
+    }
+    display_mode = MODE_SHOW_DEBUG;
 }
 
-void show_debug(int num, float delay)
+void odom_mounted(int result)
 {
-    snprintf(main_buf, sizeof(main_buf), "%4d", num);
-    tm1650.puts(main_buf);
-    if (delay > 0.0)
-        wait(delay);
-    display_mode = MODE_SHOW_DEBUG;
+    boot.mark(result ? "mounted" : "no disk");
+    odom_merged = true;
+
+    if (!result) {
+        // Keep going from RAM, the LED shows nothing is being saved
+        show_overlay("NOSD", 1.0);
+        if (!sleeping)
+            set_color(COLOR_ORANGE);
+        return;
+    }
+
+    load_odom();
+#ifdef PRETTY_LOG
+    fs.open_log(ODOM_LOG);
+#endif
+    boot.mark("odom");
 }
 
 int load_odom(void)
 {
     double o[ODOM_COUNT];
+    bool moved;
 
     if (!fs.read_file(ODOM_BIN, &o, sizeof(o))) {
         show_overlay("DISK", 1.0);
-        wait(1.0);
         show_overlay("FAIL", 1.0);
-
-        for (int i = 0; i < ODOM_COUNT; i++)
-            odom.set_odom((odom_t)i, 0.0);
-
         return 0;
     }
 
+    // Distance covered before the card was mounted goes on top
+    moved = odom.get_odom(ODOM_ENGINE) > 0.0;
+    for (int i = 0; i < ODOM_COUNT; i++) {
+        if (odom_reset & (1u << i))
+            o[i] = 0.0;
+        o[i] += odom.get_odom((odom_t)i);
+        odom.set_odom((odom_t)i, o[i]);
+    }
+
     last_save_odom = o[ODOM_ENGINE];
 
-    for (int i = 0; i < ODOM_COUNT; i++)
-        odom.set_odom((odom_t)i, o[i]);
+    // Saves were refused until now, these are the first
+    if (moved || odom_reset)
+        storage.write_file(ODOM_BIN, &o, sizeof(o), odom_saved);
+    odom_reset = 0;
+
+    return 1;
+}
+
+// Streams the saved assistance data to a cold receiver, a block per
+// call until it returns false
+bool load_aid(void)
+{
+    uint16_t size;
+
+    // FS can't read while a queued write is part way through
+    if (!storage.idle())
+        return true;
+
+    // Zeros after the last record in each block
+    if (!fs.read_file(AID_BIN, aid_chunk, sizeof(aid_chunk), aid_offset))
+        return false;
+    for (size_t i = 0; i + 4 <= sizeof(aid_chunk) && aid_chunk[i] == 0x0B; i += size) {
+        size = 4 + (aid_chunk[i + 2] | aid_chunk[i + 3] << 8);
+        if (size > UBLOX_AID_MAX || i + size > sizeof(aid_chunk))
+            break;
+        if (gps.load_aid(&aid_chunk[i], size))
+            aid_loaded++;
+    }
+    aid_offset += sizeof(aid_chunk);
+    return true;
+}
+
+// Starts replacing aid.bin, run_sleep() steps it through from here
+int save_aid(void)
+{
+    aid_chunk_len = 0;
+    if (!storage.write_file(AID_BIN, nullptr, 0))
+        return 0;
+
+    gps.save_aid(aid_record);
+    aid_saving = true;
+    return 1;
+}
+
+bool aid_record(const uint8_t *record, uint16_t size)
+{
+    // run_sleep() flushes before a record could overflow
+    if (aid_chunk_len + size > sizeof(aid_chunk))
+        return false;
 
-    return 0;
+    memcpy(&aid_chunk[aid_chunk_len], record, size);
+    aid_chunk_len += size;
+    return true;
+}
+
+bool aid_flush(void)
+{
+    if (!aid_chunk_len)
+        return false;
+
+    memset(&aid_chunk[aid_chunk_len], 0, sizeof(aid_chunk) - aid_chunk_len);
+    aid_chunk_len = 0;
+    if (!storage.append_block(AID_BIN, aid_chunk)) {
+        aid_saving = false;
+        return false;
+    }
+
+    sched.signal(task_storage);
+    return true;
 }
 
 int save_odom(void)
@@ -402,8 +856,20 @@ int save_odom(void)
     double o[ODOM_COUNT];
     int result;
 
+    // Would replace odom.bin with what's only been counted since boot
+    if (!odom_merged)
+        return 1;
+
     if (save_timer.read() < MIN_TIME_BETWEEN_SAVE_S)
         return 1;
+
+    // The card is only behind, not failing: run_save() tries again
+    // once there's room for the log line and odom.bin
+    save_deferred = !storage.ram_only() && storage.room() < 2;
+    if (save_deferred) {
+        sched.run_in(task_save, SAVE_RETRY_US);
+        return 1;
+    }
     save_timer.reset();
 
     for (int i = 0; i < ODOM_COUNT; i++)
@@ -411,6 +877,9 @@ int save_odom(void)
 
     last_save_odom = o[ODOM_ENGINE];
 
+    if (storage.ram_only())
+        return 1;
+
     if (!overlay_visible)
         show_overlay("SAVE", 0.5);
 
@@ -419,77 +888,293 @@ int save_odom(void)
         int buf_len;
         unsigned long age;
         int year;
-        uint8_t month, day, hour, minute, second, hundredths;
-        gps.crack_datetime(&year, &month, &day, &hour, &minute, &second, &hundredths, &age);
-        if (year < 2020)
-            year += 20; // Roll-over for if this firmware is still in use 20 years from now. *snicker*
-        buf_len = snprintf(main_buf, sizeof(main_buf),
-            "%04d-%02d-%02d %02d:%02d:%02d.%03d+%03lu, %f, %f, %f\n",
-            year, month, day,
-            hour, minute, second, hundredths, age,
-            o[ODOM_ENGINE],
-            o[ODOM_TRIP_A],
-            o[ODOM_TRIP_B]
+        uint8_t month, day, hour, minute, second;
+        uint32_t utc;
+        uint16_t ms;
+        unsigned long whole[ODOM_COUNT], fract[ODOM_COUNT];
+        for (int i = 0; i < ODOM_COUNT; i++)
+            split_fixed(o[i], &whole[i], &fract[i]);
+        if (gpsclock.valid()) {
+            // RTC time, good from wake on; age is seconds since GPS last set it
+            GpsClock::now(&utc, &ms);
+            GpsClock::to_civil(utc, &year, &month, &day, &hour, &minute, &second);
+            age = gpsclock.age();
+            buf_len = snprintf(main_buf, sizeof(main_buf), "%04d-%02d-%02d %02d:%02d:%02d.%03d+%03lu",
+                year, month, day,
+                hour, minute, second, ms, age);
+        } else {
+            // The RTC hasn't had GPS time since it lost power
+            buf_len = snprintf(main_buf, sizeof(main_buf), "unsynced");
+        }
+        buf_len += snprintf(main_buf + buf_len, sizeof(main_buf) - buf_len,
+            ", %lu.%06lu, %lu.%06lu, %lu.%06lu\n",
+            whole[ODOM_ENGINE], fract[ODOM_ENGINE],
+            whole[ODOM_TRIP_A], fract[ODOM_TRIP_A],
+            whole[ODOM_TRIP_B], fract[ODOM_TRIP_B]
         );
-        fs.append_file(ODOM_LOG, main_buf, buf_len);
+        if (!storage.append_log(main_buf, buf_len, odom_saved))
+            odom_saved(0);
     }
 #endif
 
-    result = fs.write_file(ODOM_BIN, &o, sizeof(o));
+    result = storage.write_file(ODOM_BIN, &o, sizeof(o), odom_saved);
+    if (!result)
+        odom_saved(result);
+    sched.signal(task_storage);
+    return result;
+}
+
+void reset_trip(odom_t trip)
+{
+    odom.reset_odom(trip);
+    if (!odom_merged)
+        odom_reset |= 1u << trip;
+}
+
+// What "%f" would print, without pulling in newlib's float printf
+void split_fixed(double value, unsigned long *whole, unsigned long *fract)
+{
+    uint64_t micro = (uint64_t)(value * 1000000.0 + 0.5);
+
+    *whole = (unsigned long)(micro / 1000000);
+    *fract = (unsigned long)(micro % 1000000);
+}
+
+void odom_saved(int result)
+{
     if (!result) {
         show_overlay("DISK", 1.0);
-        wait(1.0);
         show_overlay("FAIL", 1.0);
     }
-    return result;
 }
 
-void update_position(void)
+/*
+ * The fix's time as UTC, whole seconds. TinyGPS reads the two digit year
+ * as 1981-2080; one before 2020, older than this firmware, is a receiver
+ * that has lost count of GPS week rollovers (1024 weeks, close enough to
+ * 20 years), so it's moved on by 20.
+ */
+uint32_t fix_utc(uint8_t *hundredths, unsigned long *age)
 {
-    double lat, lon;
+    int year;
+    uint8_t month, day, hour, minute, second;
+
+    gps.crack_datetime(&year, &month, &day, &hour, &minute, &second, hundredths, age);
+    if (year < 2020)
+        year += 20;
+    return GpsClock::to_utc(year, month, day, hour, minute, second);
+}
+
+// Keeps the RTC on GPS time while the fix is good
+void update_clock(void)
+{
+    uint8_t hundredths;
     unsigned long age;
-    double dist_m;
-    double speed_mph;
+    uint32_t utc, ms;
 
-    if (!gps.gps_good_data()) {
-        have_position = false;
+    utc = fix_utc(&hundredths, &age);
+    if (age == TinyGPS::GPS_INVALID_AGE || age > 1000)
         return;
-    }
 
-    gps.d_get_position(&lat, &lon, &age);
-    if (!have_position) {
-        prev_lat = lat;
-        prev_lon = lon;
-        have_position = true;
+    // The time is that of the fix, age brings it up to now. With 1PPS
+    // it's measured from the epoch rather than the sentence.
+    if (gps.pps_locked())
+        ms = hundredths * 10 + (us_ticker_read() - gps.epoch_us()) / 1000;
+    else
+        ms = hundredths * 10 + age;
+    gpsclock.discipline(utc + ms / 1000, ms % 1000);
+}
+
+// Once per fix: RMC and GGA both carry its time
+void record_track(void)
+{
+    uint8_t hundredths;
+    unsigned long date, time, age;
+    track_fix_t fix, kept[2];
+    long lat, lon;
+    int count;
+
+    if (storage.ram_only() || !gps.gps_good_data())
+        return;
+
+    gps.get_datetime(&date, &time, &age);
+    if (time == track_time)
         return;
+    track_time = time;
+
+    fix.utc = fix_utc(&hundredths, &age);
+    gps.get_position(&lat, &lon, &age);
+
+    fix.cs = hundredths;
+    fix.lat = lat;
+    fix.lon = lon;
+    fix.speed = gps.speed();
+    fix.course = gps.course();
+    fix.hdop = hdop;
+
+    count = track_filter.add(fix, kept);
+    for (int i = 0; i < count; i++)
+        track_add(kept[i]);
+}
+
+void track_add(const track_fix_t &fix)
+{
+    if (track[track_filling].add(fix))
+        return;
+
+    // Full; with the other still being written this fix is dropped
+    if (!track_flush())
+        return;
+    track[track_filling].add(fix);
+}
+
+// Queues the filling block and switches to the other
+bool track_flush(void)
+{
+    TrackBlock *block = &track[track_filling];
+
+    if (block->empty())
+        return true;
+    if (track_writing)
+        return false;
+
+    track_name(block->first_utc(), track_fn[track_filling], track_idx_fn[track_filling]);
+    if (!storage.append_block(track_fn[track_filling], block->seal(), track_written, track_max()))
+        return false;
+
+    track_writing = true;
+    track_filling ^= 1;
+    track[track_filling].reset();
+    sched.signal(task_storage);
+    return true;
+}
+
+void track_written(int result)
+{
+    uint32_t at = storage.appended_at();
+    int written = track_filling ^ 1;
+    track_index_t entry;
+    uint8_t packed[TRACK_INDEX_LEN];
+
+    // Left full before a restart: the same block to the next part
+    if (result == STORAGE_FULL) {
+        track_part++;
+        track_name(track[written].first_utc(), track_fn[written], track_idx_fn[written]);
+        if (storage.append_block(track_fn[written], track[written].seal(), track_written, track_max()))
+            return;
+    }
+
+    track_writing = false;
+
+    // Every so many blocks in, note where it is; losing one only slows seeks
+    if (result == STORAGE_DONE && at % (TRACK_BLOCK_SIZE * TRACK_INDEX_EVERY) == 0) {
+        entry.utc = track[written].first_utc();
+        entry.block = at / TRACK_BLOCK_SIZE;
+        track_index_pack(entry, packed);
+        storage.append_file(track_idx_fn[written], packed, sizeof(packed));
+    }
+
+    // Full; after a restart this is only found out by the next append
+    if (result == STORAGE_DONE && at + TRACK_BLOCK_SIZE >= TRACK_FILE_MAX && track_part < TRACK_PART_MAX)
+        track_part++;
+}
+
+// The size a part is full at, none for the last one
+uint32_t track_max(void)
+{
+    return track_part < TRACK_PART_MAX ? TRACK_FILE_MAX : 0;
+}
+
+// The files a block starting at utc goes to
+void track_name(uint32_t utc, char *fn, char *idx_fn)
+{
+    int year;
+    uint8_t month, day, hour, minute, second;
+
+    if (utc / 86400 != track_day) {
+        track_day = utc / 86400;
+        track_part = 0;
     }
 
-    if (prev_lat == lat && prev_lon == lon)
+    GpsClock::to_civil(utc, &year, &month, &day, &hour, &minute, &second);
+    snprintf(fn, TRACK_FN_LEN, "%04d/%02u/%02u-%02d.trk", year, month, day, track_part);
+    snprintf(idx_fn, TRACK_FN_LEN, "%04d/%02u/%02u-%02d.idx", year, month, day, track_part);
+}
+
+#ifdef RAW_CAPTURE
+void capture_byte(uint8_t c)
+{
+    capture.put(c);
+}
+
+void run_capture(void)
+{
+    capture_flush(false);
+    sched.run_in(task_capture, CAPTURE_POLL_US);
+}
+
+void capture_flush(bool flush)
+{
+    const uint8_t *chunk;
+
+    if (storage.ram_only())
         return;
 
-    dist_m = TinyGPS::distance_between(prev_lat, prev_lon, lat, lon);
-    speed_mph = gps.d_speed_mph();
+    chunk = capture.poll(flush);
+    if (!chunk)
+        return;
 
-    prev_lat = lat;
-    prev_lon = lon;
+    if (storage.append_block(CAPTURE_BIN, chunk, capture_written))
+        sched.signal(task_storage);
+    else
+        capture.written(false);
+}
 
-    if (moving) {
-        idle_timer.reset();
-        if (speed_mph < ODOM_MOVING_LOWER_BOUND_MPH) {
-            save_odom();
-            moving = false;
-        }
-    } else {
-        if (speed_mph > ODOM_MOVING_UPPER_BOUND_MPH) {
-            moving = true;
-        }
+void capture_written(int result)
+{
+    capture.written(result);
+}
+#endif
+
+bool clock_time(uint32_t *utc, uint16_t *ms, uint32_t *acc_ms)
+{
+    if (!gpsclock.valid())
+        return false;
+
+    GpsClock::now(utc, ms);
+    *acc_ms = gpsclock.accuracy_ms();
+    return true;
+}
+
+void update_position(void)
+{
+    double lat, lon;
+    unsigned long age;
+
+    if (!gps.gps_good_data()) {
+        odom.lost_fix();
+        return;
     }
 
-    if (moving) {
-        odom.increment(dist_m);
-        if (odom.get_odom(ODOM_ENGINE) - last_save_odom > ODOM_SAVE_DISTANCE_THRESHOLD_M)
+    gps.d_get_position(&lat, &lon, &age);
+    switch (odom.update(lat, lon, gps.d_speed_mph())) {
+        case ODOM_STOPPED:
+            idle_timer.reset();
             save_odom();
+            update_gps_rates();
+            return;
+        case ODOM_STARTED:
+            update_gps_rates();
+            break;
+        case ODOM_MOVED:
+            idle_timer.reset();
+            break;
+        default:
+            return;
     }
+
+    if (odom.get_odom(ODOM_ENGINE) - last_save_odom > ODOM_SAVE_DISTANCE_THRESHOLD_M)
+        save_odom();
 }
 
 void update_dop(void)
@@ -509,8 +1194,8 @@ void handle_key_event(key_event_t event)
 {
     idle_timer.reset();
 
-    if (sleeping) {
-        if (event.key == KEY_RIGHT && event.action == ACTION_PRESS)
+    if (sleeping || entering_sleep) {
+        if (!entering_sleep && event.key == KEY_RIGHT && event.action == ACTION_PRESS)
             exit_sleep();
         return;
     }
@@ -520,22 +1205,24 @@ void handle_key_event(key_event_t event)
         if (event.action == ACTION_PRESS) {
             if (display_mode < MODE_SHOW_LAST)
                 display_mode++;
-            show_overlay(modes[display_mode].label, 1.0);
+            show_overlay(modes[display_mode].label, 1.0, true);
+            update_gps_rates();
         }
         break;
     case KEY_UP:
         if (event.action == ACTION_PRESS) {
             if (display_mode > MODE_SHOW_FIRST)
                 display_mode--;
-            show_overlay(modes[display_mode].label, 1.0);
+            show_overlay(modes[display_mode].label, 1.0, true);
+            update_gps_rates();
         }
         break;
     case KEY_LEFT:
         if (event.action == ACTION_LONG_PRESS) {
             if (display_mode == MODE_SHOW_TRIP_A)
-                odom.reset_odom(ODOM_TRIP_A);
+                reset_trip(ODOM_TRIP_A);
             else if (display_mode == MODE_SHOW_TRIP_B)
-                odom.reset_odom(ODOM_TRIP_B);
+                reset_trip(ODOM_TRIP_B);
             show_overlay("RST ");
             save_odom();
         }
@@ -557,33 +1244,59 @@ void check_for_gps_ready(void)
 
     gps.get_position(&lat, &lon, &age_ms);
     if (age_ms != TinyGPS::GPS_INVALID_AGE && age_ms > 10*1000) {
-        show_overlay("EFIX");
+        show_overlay("EFIX", 0.5, true);
         return;
     }
 
     if (hdop <= MIN_HDOP_THRESHOLD && gps.gps_good_data()) {
         waiting_for_gps_ready = false;
         display_mode = MODE_SHOW_SPEED;
+        update_gps_rates();
+        if (!overlay_visible) {
+            modes[display_mode].func();
+            sched.run_in(task_display, DISPLAY_MAX_TIME_MS * 1000);
+        }
+        boot.mark("fix");
+#ifdef BOOT_TRACE
+        boot.print(pc);
+#endif
     }
 }
 
 void enter_sleep(void)
 {
+    track_fix_t fix;
+
     idle_timer.reset();
-    gps.set_enabled(false);
+    stop_tasks();
+    if (track_filter.flush(&fix))
+        track_add(fix);
+    track_flush();
+#ifdef RAW_CAPTURE
+    capture_flush(true);
+#endif
+    storage.checkpoint();
+    // Only a receiver that got a fix has anything worth keeping
+    if (storage.mounted() && !waiting_for_gps_ready)
+        save_aid();
+    sched.signal(task_storage);
+
+    overlay_count = 0;
+    overlay_visible = false;
     tm1650.puts("SLP ");
-    wait(0.75);
-    set_color(COLOR_OFF);
-    tm1650.clear();
-    sleeping = true;
-    wait(1.0);
+
+    // Keys are ignored until run_sleep() is done
+    entering_sleep = true;
+    sched.run_in(task_sleep, SLEEP_MESSAGE_US);
 }
 
 void exit_sleep(void)
 {
-    wakeup = true;
+    boot.start();
+    booting = true;
+    sched.run_in(task_gps_init, 0);
     sleeping = false;
+    overlay_visible = false;
     idle_timer.reset();
-    display_timer.reset();
     save_timer.reset();
 }
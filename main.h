@@ -1,20 +1,59 @@
 #pragma once
 
 #include "common.h"
+#include "track.h"
 
 typedef void (*mode_func_t)(void);
 
-void display_test(void);
+void add_tasks(void);
+void start_tasks(void);
+void stop_tasks(void);
+void gps_changed(void);
+void keys_changed(void);
+void run_gps(void);
+void run_gps_rate(void);
+void update_gps_rates(void);
+void run_keys(void);
+void run_display(void);
+void run_save(void);
+void run_idle(void);
+void run_overlay(void);
+void run_sleep(void);
+void run_self_test(void);
+void run_gps_init(void);
+bool gps_config(int step);
+void run_storage(void);
+float display_test(int step);
 void show_error(int err);
 void show_speed(void);
 void show_odom(void);
 void show_sats(void);
 void show_dop(void);
 void show_noop(void);
-void show_overlay(const char *msg, float delay = 0.5);
-void hide_overlay(void);
+void show_overlay(const char *msg, float delay = 0.5, bool replace = false);
+void odom_mounted(int result);
 int load_odom(void);
 int save_odom(void);
+void reset_trip(odom_t trip);
+void split_fixed(double value, unsigned long *whole, unsigned long *fract);
+void odom_saved(int result);
+bool load_aid(void);
+int save_aid(void);
+bool aid_record(const uint8_t *record, uint16_t size);
+bool aid_flush(void);
+uint32_t fix_utc(uint8_t *hundredths, unsigned long *age);
+void update_clock(void);
+void record_track(void);
+void track_add(const track_fix_t &fix);
+bool track_flush(void);
+void track_written(int result);
+uint32_t track_max(void);
+void track_name(uint32_t utc, char *fn, char *idx_fn);
+void capture_byte(uint8_t c);
+void run_capture(void);
+void capture_flush(bool flush);
+void capture_written(int result);
+bool clock_time(uint32_t *utc, uint16_t *ms, uint32_t *acc_ms);
 void update_position(void);
 void update_dop(void);
 void handle_key_event(key_event_t event);
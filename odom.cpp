@@ -36,12 +36,60 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "odom.h"
 
+static const double ODOM_MOVING_LOWER_BOUND_MPH = 1.0;
+static const double ODOM_MOVING_UPPER_BOUND_MPH = 6.0;
+
 Odom::Odom(void)
 {
     this->_odom[ODOM_ENGINE] = 0.0;
     this->_odom[ODOM_TRIP_A] = 0.0;
     this->_odom[ODOM_TRIP_B] = 0.0;
     this->_dist_unit = DIST_MILES;
+    this->_have_position = false;
+    this->_moving = false;
+}
+
+odom_event_t Odom::update(double lat, double lon, double speed_mph)
+{
+    odom_event_t event = ODOM_NO_CHANGE;
+    double dist_m;
+
+    if (!this->_have_position) {
+        this->_prev_lat = lat;
+        this->_prev_lon = lon;
+        this->_have_position = true;
+        return ODOM_NO_CHANGE;
+    }
+
+    if (this->_prev_lat == lat && this->_prev_lon == lon) {
+        // Static hold pins the position once stopped, only the speed shows it
+        if (this->_moving && speed_mph < ODOM_MOVING_LOWER_BOUND_MPH) {
+            this->_moving = false;
+            return ODOM_STOPPED;
+        }
+        return ODOM_NO_CHANGE;
+    }
+
+    dist_m = TinyGPS::distance_between(this->_prev_lat, this->_prev_lon, lat, lon);
+
+    this->_prev_lat = lat;
+    this->_prev_lon = lon;
+
+    if (this->_moving) {
+        event = ODOM_MOVED;
+        if (speed_mph < ODOM_MOVING_LOWER_BOUND_MPH) {
+            this->_moving = false;
+            return ODOM_STOPPED;
+        }
+    } else if (speed_mph > ODOM_MOVING_UPPER_BOUND_MPH) {
+        this->_moving = true;
+        event = ODOM_STARTED;
+    }
+
+    if (this->_moving)
+        this->increment(dist_m);
+
+    return event;
 }
 
 void Odom::increment(double dist_m)
@@ -31,11 +31,23 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "common.h"
 
+enum odom_event_t {
+    ODOM_NO_CHANGE,
+    ODOM_MOVED,    // Distance counted
+    ODOM_STARTED,  // Now moving, distance counted
+    ODOM_STOPPED,  // No longer moving
+};
+
 class Odom
 {
 public:
     Odom(void);
 
+    // Feeds a good fix, counting the distance from the last one while moving
+    odom_event_t update(double lat, double lon, double speed_mph);
+    void lost_fix(void) { this->_have_position = false; }
+    bool moving(void) const { return this->_moving; }
+
     void increment(double dist);
     void reset_odom(odom_t o);
     void set_odom(odom_t o, double dist);
@@ -44,4 +56,8 @@ public:
 private:
     double _odom[ODOM_COUNT];
     dist_unit_t _dist_unit;
+
+    bool _have_position;
+    bool _moving;
+    double _prev_lat, _prev_lon;
 };
\ No newline at end of file
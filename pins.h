@@ -32,7 +32,7 @@
 
 #define GPS_TX  PTE22 // -- (Rx  green)  J10.5
 #define GPS_RX  PTE23 // -- (Tx  blue)   J10.7
-#define GPS_PPS PTE21 // -- (Pps white)  J10.3
+#define GPS_PPS PTD4  // D2 (Pps white), PORTA/PORTD only for InterruptIn
 #define GPS_EN  PTE20 // -- (En  yellow) J10.1  1
 
 #define TM1650_DIO PTE0 // D14 (I2C_SDA)
@@ -0,0 +1,202 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <us_ticker_api.h>
+
+#include "scheduler.h"
+
+// Wrap-safe "a is at or before b" on the 32-bit microsecond clock
+static inline bool reached(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) <= 0;
+}
+
+Scheduler::Scheduler(void) :
+    _count(0)
+{
+
+}
+
+int Scheduler::add(task_func_t func, const char *name)
+{
+    task_t *task;
+
+    if (this->_count >= SCHED_TASKS_MAX)
+        return -1;
+
+    task = &this->_tasks[this->_count];
+    task->func = func;
+    task->name = name;
+    task->deadline = 0;
+    task->timed = false;
+    task->signaled = false;
+    task->runs = 0;
+    task->max_us = 0;
+    task->total_us = 0;
+
+    return this->_count++;
+}
+
+void Scheduler::run_at(int task, uint32_t us)
+{
+    if (task < 0 || task >= this->_count)
+        return;
+
+    this->_tasks[task].deadline = us;
+    this->_tasks[task].timed = true;
+}
+
+void Scheduler::run_in(int task, uint32_t us)
+{
+    this->run_at(task, Scheduler::now() + us);
+}
+
+void Scheduler::cancel(int task)
+{
+    if (task < 0 || task >= this->_count)
+        return;
+
+    this->_tasks[task].timed = false;
+    this->_tasks[task].signaled = false;
+}
+
+void Scheduler::signal(int task)
+{
+    if (task < 0 || task >= this->_count)
+        return;
+
+    this->_tasks[task].signaled = true;
+}
+
+void Scheduler::run(void)
+{
+    uint32_t now = Scheduler::now();
+    uint32_t start, elapsed;
+    task_t *task;
+
+    for (int i = 0; i < this->_count; i++) {
+        task = &this->_tasks[i];
+
+        if (task->signaled) {
+            task->signaled = false;
+        } else if (task->timed && reached(task->deadline, now)) {
+            task->timed = false;
+        } else {
+            continue;
+        }
+
+        start = Scheduler::now();
+        task->func();
+        now = Scheduler::now();
+
+        elapsed = now - start;
+        task->runs++;
+        task->total_us += elapsed;
+        if (elapsed > task->max_us)
+            task->max_us = elapsed;
+    }
+
+    this->_arm(now);
+}
+
+void Scheduler::sleep(bool deep)
+{
+    // With interrupts masked a signal can't slip in between the check
+    // and the WFI, and a pending one still wakes the core.
+    __disable_irq();
+    if (!this->_due(Scheduler::now())) {
+        if (deep)
+            deepsleep();
+        else
+            ::sleep();
+    }
+    __enable_irq();
+}
+
+void Scheduler::print(Stream &out)
+{
+    task_t *task;
+
+    for (int i = 0; i < this->_count; i++) {
+        task = &this->_tasks[i];
+        out.printf("task %-8s runs %8lu total %10lu us max %7lu us\r\n",
+            task->name,
+            (unsigned long)task->runs,
+            (unsigned long)task->total_us,
+            (unsigned long)task->max_us);
+    }
+}
+
+uint32_t Scheduler::now(void)
+{
+    return us_ticker_read();
+}
+
+bool Scheduler::_due(uint32_t now)
+{
+    for (int i = 0; i < this->_count; i++) {
+        if (this->_tasks[i].signaled)
+            return true;
+        if (this->_tasks[i].timed && reached(this->_tasks[i].deadline, now))
+            return true;
+    }
+
+    return false;
+}
+
+void Scheduler::_arm(uint32_t now)
+{
+    bool found = false;
+    uint32_t earliest = 0;
+
+    for (int i = 0; i < this->_count; i++) {
+        if (!this->_tasks[i].timed)
+            continue;
+        if (!found || reached(this->_tasks[i].deadline, earliest)) {
+            earliest = this->_tasks[i].deadline;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        this->_timeout.detach();
+        return;
+    }
+
+    // Already overdue: sleep() won't sleep, so no need for a wake up
+    if (reached(earliest, now))
+        return;
+
+    this->_timeout.attach_us(this, &Scheduler::_wake, earliest - now);
+}
+
+void Scheduler::_wake(void)
+{
+    // Nothing to do, the interrupt itself ends sleep()
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Run-to-completion task scheduler
+ *
+ * Each task is a plain function that runs until it returns. A task runs
+ * when its deadline (run_in()/run_at()) passes or when it is signal()ed,
+ * which is safe from interrupt context. Deadlines are one-shot: a task
+ * that wants to run again re-arms itself.
+ *
+ * Between passes, sleep() puts the core to sleep with a single Timeout
+ * programmed for the earliest deadline, so only that and real events
+ * (UART, keypad) wake it up.
+ */
+
+#include <stdint.h>
+#include <mbed.h>
+
+#define SCHED_TASKS_MAX 12
+
+typedef void (*task_func_t)(void);
+
+class Scheduler
+{
+public:
+    Scheduler(void);
+
+    int add(task_func_t func, const char *name);
+
+    void run_at(int task, uint32_t us);
+    void run_in(int task, uint32_t us);
+    void cancel(int task);
+    void signal(int task);
+
+    void run(void);
+    void sleep(bool deep = false);
+
+    void print(Stream &out);
+
+    static uint32_t now(void);
+
+private:
+    struct task_t {
+        task_func_t func;
+        const char *name;
+        uint32_t deadline;
+        bool timed;
+        volatile bool signaled;
+
+        // Run-time accounting
+        uint32_t runs;
+        uint32_t max_us;
+        uint64_t total_us;
+    };
+
+    bool _due(uint32_t now);
+    void _arm(uint32_t now);
+    void _wake(void);
+
+    task_t _tasks[SCHED_TASKS_MAX];
+    int _count;
+    Timeout _timeout;
+};
@@ -197,9 +197,15 @@ static struct fat_file_struct fat_file_handles[FAT_FILE_COUNT];
 static struct fat_dir_struct fat_dir_handles[FAT_DIR_COUNT];
 #endif
 
+#if FAT_WRITE_SUPPORT
+/* for clearing clusters a sector at a time */
+static const uint8_t fat_zero_sector[512] = { 0 };
+#endif
+
 static uint8_t fat_read_header(struct fat_fs_struct* fs);
 static cluster_t fat_get_next_cluster(const struct fat_fs_struct* fs, cluster_t cluster_num);
 static offset_t fat_cluster_offset(const struct fat_fs_struct* fs, cluster_t cluster_num);
+static uint8_t fat_walk_budget(const struct fat_fs_struct* fs, cluster_t cluster_num, offset_t* sector, uint16_t* sectors);
 static uint8_t fat_dir_entry_read_callback(uint8_t* buffer, offset_t offset, void* p);
 #if FAT_LFN_SUPPORT
 static uint8_t fat_calc_83_checksum(const uint8_t* file_name_83);
@@ -215,7 +221,7 @@ static cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster
 static uint8_t fat_free_clusters(struct fat_fs_struct* fs, cluster_t cluster_num);
 static uint8_t fat_terminate_clusters(struct fat_fs_struct* fs, cluster_t cluster_num);
 static uint8_t fat_clear_cluster(const struct fat_fs_struct* fs, cluster_t cluster_num);
-static uintptr_t fat_clear_cluster_callback(uint8_t* buffer, offset_t offset, void* p);
+static uint8_t fat_link_cluster(const struct fat_fs_struct* fs, cluster_t cluster_num, cluster_t cluster_next);
 static offset_t fat_find_offset_for_dir_entry(struct fat_fs_struct* fs, const struct fat_dir_struct* parent, const struct fat_dir_entry_struct* dir_entry);
 static uint8_t fat_write_dir_entry(const struct fat_fs_struct* fs, struct fat_dir_entry_struct* dir_entry);
 #if FAT_DATETIME_SUPPORT
@@ -485,6 +491,12 @@ cluster_t fat_get_next_cluster(const struct fat_fs_struct* fs, cluster_t cluster
  *
  * Set cluster_num to zero to create a completely new one.
  *
+ * The new chain is linked in ascending cluster order, so a run of
+ * free clusters ends up physically contiguous in file order. Each
+ * cluster is marked as the end of the chain before its predecessor
+ * is pointed at it, so the chain on the card is terminated at every
+ * step and a claimed cluster never reads as free.
+ *
  * \param[in] fs The file system on which to operate.
  * \param[in] cluster_num The cluster to which to append the new chain.
  * \param[in] count The number of clusters to allocate.
@@ -500,7 +512,8 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
     offset_t fat_offset = fs->header.fat_offset;
     cluster_t count_left = count;
     cluster_t cluster_current = fs->cluster_free;
-    cluster_t cluster_next = 0;
+    cluster_t cluster_first = 0;
+    cluster_t cluster_prev = 0;
     cluster_t cluster_count;
     uint16_t fat_entry16;
 #if FAT_FAT32_SUPPORT
@@ -524,36 +537,37 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
         {
             if(!device_read(fat_offset + (offset_t) cluster_current * sizeof(fat_entry32), (uint8_t*) &fat_entry32, sizeof(fat_entry32)))
                 return 0;
+
+            /* check if this is a free cluster */
+            if(fat_entry32 != HTOL32(FAT32_CLUSTER_FREE))
+                continue;
         }
         else
 #endif
         {
             if(!device_read(fat_offset + (offset_t) cluster_current * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16)))
                 return 0;
-        }
 
-#if FAT_FAT32_SUPPORT
-        if(is_fat32)
-        {
             /* check if this is a free cluster */
-            if(fat_entry32 != HTOL32(FAT32_CLUSTER_FREE))
+            if(fat_entry16 != HTOL16(FAT16_CLUSTER_FREE))
                 continue;
+        }
 
-            /* If we don't need this free cluster for the
-             * current allocation, we keep it in mind for
-             * the next time.
-             */
-            if(count_left == 0)
-            {
-                fs->cluster_free = cluster_current;
-                break;
-            }
+        /* If we don't need this free cluster for the
+         * current allocation, we keep it in mind for
+         * the next time.
+         */
+        if(count_left == 0)
+        {
+            fs->cluster_free = cluster_current;
+            break;
+        }
 
-            /* allocate cluster */
-            if(cluster_next == 0)
-                fat_entry32 = HTOL32(FAT32_CLUSTER_LAST_MAX);
-            else
-                fat_entry32 = htol32(cluster_next);
+        /* claim the cluster as the new end of the chain */
+#if FAT_FAT32_SUPPORT
+        if(is_fat32)
+        {
+            fat_entry32 = HTOL32(FAT32_CLUSTER_LAST_MAX);
 
             if(!device_write(fat_offset + (offset_t) cluster_current * sizeof(fat_entry32), (uint8_t*) &fat_entry32, sizeof(fat_entry32)))
                 break;
@@ -561,37 +575,50 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
         else
 #endif
         {
-            /* check if this is a free cluster */
-            if(fat_entry16 != HTOL16(FAT16_CLUSTER_FREE))
-                continue;
+            fat_entry16 = HTOL16(FAT16_CLUSTER_LAST_MAX);
 
-            /* If we don't need this free cluster for the
-             * current allocation, we keep it in mind for
-             * the next time.
-             */
-            if(count_left == 0)
-            {
-                fs->cluster_free = cluster_current;
+            if(!device_write(fat_offset + (offset_t) cluster_current * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16)))
                 break;
-            }
+        }
+
+        /* then link its predecessor to it */
+        if(cluster_prev)
+        {
+#if FAT_FAT32_SUPPORT
+            if(is_fat32)
+            {
+                fat_entry32 = htol32(cluster_current);
 
-            /* allocate cluster */
-            if(cluster_next == 0)
-                fat_entry16 = HTOL16(FAT16_CLUSTER_LAST_MAX);
+                if(!device_write(fat_offset + (offset_t) cluster_prev * sizeof(fat_entry32), (uint8_t*) &fat_entry32, sizeof(fat_entry32)))
+                {
+                    fat_free_clusters(fs, cluster_current);
+                    break;
+                }
+            }
             else
-                fat_entry16 = htol16((uint16_t) cluster_next);
+#endif
+            {
+                fat_entry16 = htol16((uint16_t) cluster_current);
 
-            if(!device_write(fat_offset + (offset_t) cluster_current * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16)))
-                break;
+                if(!device_write(fat_offset + (offset_t) cluster_prev * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16)))
+                {
+                    fat_free_clusters(fs, cluster_current);
+                    break;
+                }
+            }
+        }
+        else
+        {
+            cluster_first = cluster_current;
         }
 
-        cluster_next = cluster_current;
+        cluster_prev = cluster_current;
         --count_left;
     }
 
     do
     {
-        if(count_left > 0)
+        if(count_left > 0 || !cluster_first)
             break;
 
         /* We allocated a new cluster chain. Now join
@@ -602,7 +629,7 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
 #if FAT_FAT32_SUPPORT
             if(is_fat32)
             {
-                fat_entry32 = htol32(cluster_next);
+                fat_entry32 = htol32(cluster_first);
 
                 if(!device_write(fat_offset + (offset_t) cluster_num * sizeof(fat_entry32), (uint8_t*) &fat_entry32, sizeof(fat_entry32)))
                     break;
@@ -610,21 +637,21 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
             else
 #endif
             {
-                fat_entry16 = htol16((uint16_t) cluster_next);
+                fat_entry16 = htol16((uint16_t) cluster_first);
 
                 if(!device_write(fat_offset + (offset_t) cluster_num * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16)))
                     break;
             }
         }
 
-        return cluster_next;
+        return cluster_first;
 
     } while(0);
 
     /* No space left on device or writing error.
      * Free up all clusters already allocated.
      */
-    fat_free_clusters(fs, cluster_next);
+    fat_free_clusters(fs, cluster_first);
 
     return 0;
 }
@@ -796,25 +823,43 @@ uint8_t fat_clear_cluster(const struct fat_fs_struct* fs, cluster_t cluster_num)
 
     offset_t cluster_offset = fat_cluster_offset(fs, cluster_num);
 
-    uint8_t zero[16];
-    memset(zero, 0, sizeof(zero));
-    return fs->partition->device_write_interval(cluster_offset,
-                                                zero,
-                                                fs->header.cluster_size,
-                                                fat_clear_cluster_callback,
-                                                0
-                                               );
+    /* whole sectors, each goes to the card in one write */
+    for(uint16_t cleared = 0; cleared < fs->header.cluster_size; cleared += sizeof(fat_zero_sector))
+    {
+        if(!fs->partition->device_write(cluster_offset + cleared, fat_zero_sector, sizeof(fat_zero_sector)))
+            return 0;
+    }
+
+    return 1;
 }
 #endif
 
 #if DOXYGEN || FAT_WRITE_SUPPORT
 /**
  * \ingroup fat_fs
- * Callback function for clearing a cluster.
+ * Points a cluster's FAT entry at the next one in its chain.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] cluster_num The cluster to link.
+ * \param[in] cluster_next The cluster to link it to.
+ * \returns 0 on failure, 1 on success.
  */
-uintptr_t fat_clear_cluster_callback(uint8_t* buffer, offset_t offset, void* p)
+uint8_t fat_link_cluster(const struct fat_fs_struct* fs, cluster_t cluster_num, cluster_t cluster_next)
 {
-    return 16;
+    offset_t fat_offset = fs->header.fat_offset;
+    device_write_t device_write = fs->partition->device_write;
+
+#if FAT_FAT32_SUPPORT
+    if(fs->partition->type == PARTITION_TYPE_FAT32)
+    {
+        uint32_t fat_entry32 = htol32(cluster_next);
+
+        return device_write(fat_offset + (offset_t) cluster_num * sizeof(fat_entry32), (uint8_t*) &fat_entry32, sizeof(fat_entry32));
+    }
+#endif
+    uint16_t fat_entry16 = htol16((uint16_t) cluster_next);
+
+    return device_write(fat_offset + (offset_t) cluster_num * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16));
 }
 #endif
 
@@ -834,6 +879,41 @@ offset_t fat_cluster_offset(const struct fat_fs_struct* fs, cluster_t cluster_nu
     return fs->header.cluster_zero_offset + (offset_t) (cluster_num - 2) * fs->header.cluster_size;
 }
 
+/**
+ * \ingroup fat_fs
+ * Counts a FAT read against the budget of a chain walk.
+ *
+ * Walks along a cluster chain a few FAT sectors at a time call this
+ * before reading the entry of each cluster. Entries in the sector read
+ * last come for free.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] cluster_num The cluster whose FAT entry is read next.
+ * \param[in,out] sector The FAT sector read last, 0 for none yet.
+ * \param[in,out] sectors The number of sectors the walk may still read.
+ * \returns 0 once the budget is used up, 1 to read on.
+ */
+uint8_t fat_walk_budget(const struct fat_fs_struct* fs, cluster_t cluster_num, offset_t* sector, uint16_t* sectors)
+{
+    offset_t entry_offset;
+#if FAT_FAT32_SUPPORT
+    if(fs->partition->type == PARTITION_TYPE_FAT32)
+        entry_offset = fs->header.fat_offset + (offset_t) cluster_num * sizeof(uint32_t);
+    else
+#endif
+        entry_offset = fs->header.fat_offset + (offset_t) cluster_num * sizeof(uint16_t);
+
+    if(entry_offset / 512 == *sector)
+        return 1;
+    if(!*sectors)
+        return 0;
+
+    --*sectors;
+    *sector = entry_offset / 512;
+
+    return 1;
+}
+
 /**
  * \ingroup fat_file
  * Retrieves the directory entry of a path.
@@ -1074,17 +1154,20 @@ intptr_t fat_read_file(struct fat_file_struct* fd, uint8_t* buffer, uintptr_t bu
 #if DOXYGEN || FAT_WRITE_SUPPORT
 /**
  * \ingroup fat_file
- * Writes data to a file.
- * 
- * The data is written to the current file location.
+ * Writes data to a file, leaving its directory entry alone.
+ *
+ * As fat_write_file(), except that a file growing only grows in memory:
+ * the size on the card is brought up to date by a later
+ * fat_set_file_size() with the file's new size. A write and its
+ * directory entry update can then go to the card separately.
  *
  * \param[in] fd The file handle of the file to which to write.
  * \param[in] buffer The buffer from which to read the data to be written.
  * \param[in] buffer_len The amount of data to write.
  * \returns The number of bytes written (0 or something less than \c buffer_len on disk full) or -1 on failure.
- * \see fat_read_file
+ * \see fat_write_file, fat_set_file_size
  */
-intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintptr_t buffer_len)
+intptr_t fat_write_file_deferred(struct fat_file_struct* fd, const uint8_t* buffer, uintptr_t buffer_len)
 {
     /* check arguments */
     if(!fd || !buffer || buffer_len < 1)
@@ -1180,31 +1263,54 @@ intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintp
 
     } while(buffer_left > 0); /* check if we are done */
 
-    /* update directory entry */
+    /* update file size, the directory entry is left to the caller */
     if(fd->pos > fd->dir_entry.file_size)
-    {
-#if !FAT_DELAY_DIRENTRY_UPDATE
-        uint32_t size_old = fd->dir_entry.file_size;
+        fd->dir_entry.file_size = fd->pos;
+
+    return buffer_len - buffer_left;
+}
 #endif
 
-        /* update file size */
-        fd->dir_entry.file_size = fd->pos;
+#if DOXYGEN || FAT_WRITE_SUPPORT
+/**
+ * \ingroup fat_file
+ * Writes data to a file.
+ * 
+ * The data is written to the current file location.
+ *
+ * \param[in] fd The file handle of the file to which to write.
+ * \param[in] buffer The buffer from which to read the data to be written.
+ * \param[in] buffer_len The amount of data to write.
+ * \returns The number of bytes written (0 or something less than \c buffer_len on disk full) or -1 on failure.
+ * \see fat_read_file
+ */
+intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintptr_t buffer_len)
+{
+    if(!fd)
+        return -1;
 
 #if !FAT_DELAY_DIRENTRY_UPDATE
-        /* write directory entry */
+    uint32_t size_old = fd->dir_entry.file_size;
+#endif
+    intptr_t count = fat_write_file_deferred(fd, buffer, buffer_len);
+
+#if !FAT_DELAY_DIRENTRY_UPDATE
+    /* write directory entry */
+    if(count > 0 && fd->dir_entry.file_size != size_old)
+    {
         if(!fat_write_dir_entry(fd->fs, &fd->dir_entry))
         {
             /* We do not return an error here since we actually wrote
              * some data to disk. So we calculate the amount of data
              * we wrote to disk and which lies within the old file size.
              */
-            buffer_left = fd->pos - size_old;
+            count = buffer_len - (fd->pos - size_old);
             fd->pos = size_old;
         }
-#endif
     }
+#endif
 
-    return buffer_len - buffer_left;
+    return count;
 }
 #endif
 
@@ -1279,6 +1385,78 @@ uint8_t fat_seek_file(struct fat_file_struct* fd, int32_t* offset, uint8_t whenc
     return 1;
 }
 
+#if DOXYGEN || FAT_WRITE_SUPPORT
+/**
+ * \ingroup fat_file
+ * Finds the cluster holding the file position, a few links at a time.
+ *
+ * After fat_seek_file(), or a write ending on a cluster boundary, the
+ * next write walks the file's cluster chain from its start in one go.
+ * This does that walk beforehand, reading at most \c sectors sectors of
+ * the FAT per call. It starts from \c *cluster, a cluster of the file at file
+ * offset \c *at, at or before the position (0 for both to start at the
+ * beginning), and advances them as it goes, so they can be kept to pick
+ * up from for the next position further on. Where the chain ends right
+ * at the position, a cluster is appended for the next write to go into;
+ * that takes a call of its own.
+ *
+ * \param[in] fd The file decriptor of the file.
+ * \param[in,out] at The file offset of \c *cluster.
+ * \param[in,out] cluster A cluster of the file at or before its position.
+ * \param[in] sectors The most FAT sectors to read in this call.
+ * \returns 0 on failure, 1 if there is more to do, 2 once done.
+ * \see fat_seek_file
+ */
+uint8_t fat_seek_file_step(struct fat_file_struct* fd, uint32_t* at, cluster_t* cluster, uint16_t sectors)
+{
+    if(!fd || !at || !cluster)
+        return 0;
+
+    uint16_t cluster_size = fd->fs->header.cluster_size;
+
+    if(fd->pos_cluster)
+    {
+        *cluster = fd->pos_cluster;
+        *at = fd->pos & ~(uint32_t) (cluster_size - 1);
+        return 2;
+    }
+
+    if(!*cluster || *at > fd->pos)
+    {
+        *cluster = fd->dir_entry.cluster;
+        *at = 0;
+    }
+
+    /* nothing allocated yet, the first write starts the chain */
+    if(!*cluster)
+        return fd->pos ? 0 : 2;
+
+    offset_t sector = 0;
+    while(fd->pos - *at >= cluster_size)
+    {
+        if(!fat_walk_budget(fd->fs, *cluster, &sector, &sectors))
+            return 1;
+
+        cluster_t cluster_next = fat_get_next_cluster(fd->fs, *cluster);
+        if(!cluster_next)
+        {
+            /* the file exactly ends on a cluster boundary, and we append to it */
+            if(fd->pos - *at != cluster_size)
+                return 0;
+
+            return fat_append_clusters(fd->fs, *cluster, 1) ? 1 : 0;
+        }
+
+        *cluster = cluster_next;
+        *at += cluster_size;
+    }
+
+    fd->pos_cluster = *cluster;
+
+    return 2;
+}
+#endif
+
 #if DOXYGEN || FAT_WRITE_SUPPORT
 /**
  * \ingroup fat_file
@@ -1378,6 +1556,242 @@ uint8_t fat_resize_file(struct fat_file_struct* fd, uint32_t size)
 }
 #endif
 
+#if DOXYGEN || FAT_WRITE_SUPPORT
+/**
+ * \ingroup fat_file
+ * Allocates clusters for a file to grow into, leaving its size alone.
+ *
+ * Growing a file with fat_resize_file() and setting its size back with
+ * fat_set_file_size() leaves it claiming the new, unwritten space if
+ * power is lost in between. This only allocates. The first sector of
+ * each new cluster is zeroed before the file is linked to it, so a scan
+ * for data written past the recorded size stops there, whatever the
+ * cluster held before.
+ *
+ * \param[in] fd The file decriptor of the file to grow.
+ * \param[in] size The number of bytes the cluster chain has to cover.
+ * \returns 0 on failure, 1 on success.
+ * \see fat_reserve_file_step, fat_set_file_size, fat_get_file_extent
+ */
+uint8_t fat_reserve_file(struct fat_file_struct* fd, uint32_t size)
+{
+    uint32_t at = 0;
+    cluster_t cluster = 0;
+    uint8_t result;
+
+    while((result = fat_reserve_file_step(fd, &at, &cluster, size, 0xffff)) == 1);
+
+    return result == 2;
+}
+#endif
+
+#if DOXYGEN || FAT_WRITE_SUPPORT
+/**
+ * \ingroup fat_file
+ * Allocates clusters for a file to grow into, a cluster at a time.
+ *
+ * As fat_reserve_file(), but each call either reads at most \c sectors
+ * sectors of the FAT on the way to the end of the chain, or adds one
+ * cluster to it.
+ * The walk starts from \c *cluster, a cluster of the file at file offset
+ * \c *at (0 for both to start at the beginning), and both are advanced
+ * as it goes, as for fat_seek_file_step().
+ *
+ * \param[in] fd The file decriptor of the file to grow.
+ * \param[in,out] at The file offset of \c *cluster.
+ * \param[in,out] cluster A cluster of the file.
+ * \param[in] size The number of bytes the cluster chain has to cover.
+ * \param[in] sectors The most FAT sectors to read in this call.
+ * \returns 0 on failure, 1 if there is more to do, 2 once done.
+ * \see fat_reserve_file
+ */
+uint8_t fat_reserve_file_step(struct fat_file_struct* fd, uint32_t* at, cluster_t* cluster, uint32_t size, uint16_t sectors)
+{
+    if(!fd || !at || !cluster)
+        return 0;
+
+    struct fat_fs_struct* fs = fd->fs;
+    uint16_t cluster_size = fs->header.cluster_size;
+
+    if(!*cluster)
+    {
+        *cluster = fd->dir_entry.cluster;
+        *at = 0;
+    }
+
+    if(!*cluster)
+    {
+        if(size == 0)
+            return 2;
+    }
+    else
+    {
+        /* find the end of the chain, unless it already covers size */
+        offset_t sector = 0;
+        for(;;)
+        {
+            if(size <= *at + cluster_size)
+                return 2;
+            if(!fat_walk_budget(fs, *cluster, &sector, &sectors))
+                return 1;
+
+            cluster_t cluster_num_next = fat_get_next_cluster(fs, *cluster);
+            if(!cluster_num_next)
+                break;
+
+            *cluster = cluster_num_next;
+            *at += cluster_size;
+        }
+    }
+
+    /* a cluster of its own first, linked to the file once cleared */
+    cluster_t cluster_new = fat_append_clusters(fs, 0, 1);
+    if(!cluster_new)
+        return 0;
+
+    do
+    {
+        /* one whole sector, so it goes to the card in one write */
+        if(!fs->partition->device_write(fat_cluster_offset(fs, cluster_new), fat_zero_sector, sizeof(fat_zero_sector)))
+            break;
+
+        if(*cluster)
+        {
+            if(!fat_link_cluster(fs, *cluster, cluster_new))
+                break;
+            *at += cluster_size;
+        }
+        else
+        {
+            fd->dir_entry.cluster = cluster_new;
+            if(!fat_write_dir_entry(fs, &fd->dir_entry))
+            {
+                fd->dir_entry.cluster = 0;
+                break;
+            }
+        }
+
+        *cluster = cluster_new;
+
+        return size <= *at + cluster_size ? 2 : 1;
+
+    } while(0);
+
+    fat_free_clusters(fs, cluster_new);
+
+    return 0;
+}
+#endif
+
+#if DOXYGEN || FAT_WRITE_SUPPORT
+/**
+ * \ingroup fat_file
+ * Sets the size recorded in a file's directory entry.
+ *
+ * Unlike fat_resize_file(), this function neither allocates nor frees
+ * clusters. It is meant for files which were preallocated with
+ * fat_reserve_file() and are then filled by writing to the device
+ * directly, where only the logical end of the data has to be recorded.
+ *
+ * \note The caller must make sure the file's cluster chain covers
+ *       at least \c size bytes.
+ *
+ * \param[in] fd The file decriptor of the file to update.
+ * \param[in] size The new logical size of the file.
+ * \returns 0 on failure, 1 on success.
+ * \see fat_reserve_file, fat_get_file_extent
+ */
+uint8_t fat_set_file_size(struct fat_file_struct* fd, uint32_t size)
+{
+    if(!fd)
+        return 0;
+
+    fd->dir_entry.file_size = size;
+    if(!fat_write_dir_entry(fd->fs, &fd->dir_entry))
+        return 0;
+
+    if(size < fd->pos)
+    {
+        fd->pos = size;
+        fd->pos_cluster = 0;
+    }
+
+    return 1;
+}
+#endif
+
+/**
+ * \ingroup fat_file
+ * Determines where a file position lies on the device.
+ *
+ * Follows the file's cluster chain up to \c pos and reports the device
+ * offset of that byte, together with the number of bytes from there on
+ * which are stored physically contiguous on the device. The allocated
+ * chain is followed regardless of the file size recorded in the
+ * directory entry, so clusters preallocated beyond the end of the file
+ * are included. With \c at and \c cluster, the walk starts from there as
+ * for fat_seek_file_step() and they are left at the cluster holding
+ * \c pos.
+ *
+ * \param[in] fd The file decriptor of the file to examine.
+ * \param[in] pos The file position to look up.
+ * \param[in,out] at The file offset of \c *cluster, or NULL.
+ * \param[in,out] cluster A cluster of the file at or before \c pos, or NULL.
+ * \param[out] offset The device offset of the byte at \c pos.
+ * \param[out] length The number of contiguous bytes allocated from \c pos on.
+ * \returns 0 on failure or if \c pos lies beyond the cluster chain, 1 on success.
+ * \see fat_set_file_size
+ */
+uint8_t fat_get_file_extent(const struct fat_file_struct* fd, uint32_t pos, uint32_t* at, cluster_t* cluster, offset_t* offset, uint32_t* length)
+{
+    if(!fd || !offset || !length)
+        return 0;
+
+    uint16_t cluster_size = fd->fs->header.cluster_size;
+    cluster_t cluster_num = fd->dir_entry.cluster;
+    uint32_t cluster_pos = 0;
+
+    /* carry on from the cluster given, if it isn't past pos */
+    if(at && cluster && *cluster && *at <= pos)
+    {
+        cluster_num = *cluster;
+        cluster_pos = *at;
+    }
+    if(!cluster_num)
+        return 0;
+
+    /* find cluster containing the requested position */
+    while(pos - cluster_pos >= cluster_size)
+    {
+        cluster_num = fat_get_next_cluster(fd->fs, cluster_num);
+        if(!cluster_num)
+            return 0;
+        cluster_pos += cluster_size;
+    }
+
+    if(at && cluster)
+    {
+        *cluster = cluster_num;
+        *at = cluster_pos;
+    }
+
+    *offset = fat_cluster_offset(fd->fs, cluster_num) + (pos - cluster_pos);
+    *length = cluster_size - (pos - cluster_pos);
+
+    /* count the clusters directly following it */
+    for(;;)
+    {
+        cluster_t cluster_num_next = fat_get_next_cluster(fd->fs, cluster_num);
+        if(cluster_num_next != cluster_num + 1)
+            break;
+
+        cluster_num = cluster_num_next;
+        *length += cluster_size;
+    }
+
+    return 1;
+}
+
 /**
  * \ingroup fat_dir
  * Opens a directory.
@@ -2509,6 +2923,94 @@ offset_t fat_get_fs_free(const struct fat_fs_struct* fs)
     return (offset_t) count_arg.cluster_count * fs->header.cluster_size;
 }
 
+/**
+ * \ingroup fat_fs
+ * Describes the on-disk layout of the filesystem.
+ *
+ * Meant for tools which check the FAT and directories directly rather
+ * than through the file functions.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[out] layout The layout of the filesystem.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t fat_get_fs_layout(const struct fat_fs_struct* fs, struct fat_fs_layout_struct* layout)
+{
+    if(!fs || !layout)
+        return 0;
+
+    memset(layout, 0, sizeof(*layout));
+    layout->fat_offset = fs->header.fat_offset;
+    layout->fat_size = fs->header.fat_size;
+    layout->fat_entry_size = 2;
+    layout->cluster_size = fs->header.cluster_size;
+    layout->cluster_zero_offset = fs->header.cluster_zero_offset;
+    layout->root_dir_offset = fs->header.root_dir_offset;
+#if FAT_FAT32_SUPPORT
+    if(fs->partition->type == PARTITION_TYPE_FAT32)
+    {
+        layout->fat_entry_size = 4;
+        layout->root_dir_cluster = fs->header.root_dir_cluster;
+    }
+#endif
+
+    return 1;
+}
+
+/**
+ * \ingroup fat_fs
+ * Counts free storage capacity a slice of the FAT at a time.
+ *
+ * Scans up to \c length bytes of the FAT starting at byte \c *pos, adds
+ * the free space found there to \c *free and advances \c *pos past it.
+ * Start with both at zero and call again until the whole table has been
+ * scanned, to spread the work of fat_get_fs_free() over time.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in,out] pos The FAT byte offset to continue at.
+ * \param[in,out] free The free space counted so far, in bytes.
+ * \param[in] length The number of FAT bytes to scan, a multiple of 32.
+ * \returns 0 on failure, 1 if there is more to scan, 2 once done.
+ */
+uint8_t fat_get_fs_free_step(const struct fat_fs_struct* fs, uint32_t* pos, offset_t* free, uint32_t length)
+{
+    if(!fs || !pos || !free || length < 32)
+        return 0;
+
+    /* a tail shorter than one read is left out, as fat_get_fs_free() does */
+    if(*pos + 32 > fs->header.fat_size)
+        return 2;
+    if(length > fs->header.fat_size - *pos)
+        length = fs->header.fat_size - *pos;
+
+    uint8_t fat[32];
+    struct fat_usage_count_callback_arg count_arg;
+    count_arg.cluster_count = 0;
+    count_arg.buffer_size = sizeof(fat);
+
+    length &= ~(uint32_t) (sizeof(fat) - 1);
+    if(!fs->partition->device_read_interval(fs->header.fat_offset + *pos,
+                                            fat,
+                                            sizeof(fat),
+                                            length,
+#if FAT_FAT32_SUPPORT
+                                            (fs->partition->type == PARTITION_TYPE_FAT16) ?
+                                                fat_get_fs_free_16_callback :
+                                                fat_get_fs_free_32_callback,
+#else
+                                            fat_get_fs_free_16_callback,
+#endif
+                                            &count_arg
+                                           )
+      )
+        return 0;
+
+    *pos += length;
+    *free += (offset_t) count_arg.cluster_count * fs->header.cluster_size;
+
+    return *pos + sizeof(fat) <= fs->header.fat_size ? 1 : 2;
+}
+
 /**
  * \ingroup fat_fs
  * Callback function used for counting free clusters in a FAT.
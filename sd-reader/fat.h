@@ -89,6 +89,28 @@ struct fat_dir_entry_struct
     offset_t entry_offset;
 };
 
+/**
+ * \ingroup fat_fs
+ * Describes where a filesystem keeps its structures on disk.
+ */
+struct fat_fs_layout_struct
+{
+    /** The total disk offset of the first FAT. */
+    offset_t fat_offset;
+    /** The size of one FAT in bytes. */
+    uint32_t fat_size;
+    /** The size of a FAT entry in bytes, 2 or 4. */
+    uint8_t fat_entry_size;
+    /** The size of a cluster in bytes. */
+    uint16_t cluster_size;
+    /** The total disk offset of the first data cluster, cluster 2. */
+    offset_t cluster_zero_offset;
+    /** The total disk offset of the FAT16 root directory. */
+    offset_t root_dir_offset;
+    /** The first cluster of the FAT32 root directory, 0 for FAT16. */
+    cluster_t root_dir_cluster;
+};
+
 struct fat_fs_struct* fat_open(struct partition_struct* partition);
 void fat_close(struct fat_fs_struct* fs);
 
@@ -96,8 +118,14 @@ struct fat_file_struct* fat_open_file(struct fat_fs_struct* fs, const struct fat
 void fat_close_file(struct fat_file_struct* fd);
 intptr_t fat_read_file(struct fat_file_struct* fd, uint8_t* buffer, uintptr_t buffer_len);
 intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintptr_t buffer_len);
+intptr_t fat_write_file_deferred(struct fat_file_struct* fd, const uint8_t* buffer, uintptr_t buffer_len);
 uint8_t fat_seek_file(struct fat_file_struct* fd, int32_t* offset, uint8_t whence);
+uint8_t fat_seek_file_step(struct fat_file_struct* fd, uint32_t* at, cluster_t* cluster, uint16_t links);
 uint8_t fat_resize_file(struct fat_file_struct* fd, uint32_t size);
+uint8_t fat_reserve_file(struct fat_file_struct* fd, uint32_t size);
+uint8_t fat_reserve_file_step(struct fat_file_struct* fd, uint32_t* at, cluster_t* cluster, uint32_t size, uint16_t links);
+uint8_t fat_set_file_size(struct fat_file_struct* fd, uint32_t size);
+uint8_t fat_get_file_extent(const struct fat_file_struct* fd, uint32_t pos, uint32_t* at, cluster_t* cluster, offset_t* offset, uint32_t* length);
 
 struct fat_dir_struct* fat_open_dir(struct fat_fs_struct* fs, const struct fat_dir_entry_struct* dir_entry);
 void fat_close_dir(struct fat_dir_struct* dd);
@@ -118,6 +146,8 @@ uint8_t fat_get_dir_entry_of_path(struct fat_fs_struct* fs, const char* path, st
 
 offset_t fat_get_fs_size(const struct fat_fs_struct* fs);
 offset_t fat_get_fs_free(const struct fat_fs_struct* fs);
+uint8_t fat_get_fs_layout(const struct fat_fs_struct* fs, struct fat_fs_layout_struct* layout);
+uint8_t fat_get_fs_free_step(const struct fat_fs_struct* fs, uint32_t* pos, offset_t* free, uint32_t length);
 
 /**
  * @}
@@ -156,6 +156,13 @@ static uint8_t raw_block_written;
 
 /* card type state */
 static uint8_t sd_raw_card_type;
+/* number of times the card was found still idle during initialization */
+static uint16_t sd_raw_init_tries;
+
+#if SD_RAW_DEFER_BUSY
+/* flag to remember if the card may still be programming a block */
+static uint8_t sd_raw_busy;
+#endif
 
 /* private helper functions */
 static void sd_raw_send_byte(uint8_t b);
@@ -166,24 +173,49 @@ static uint8_t sd_raw_send_command(uint8_t command, uint32_t arg);
  * \ingroup sd_raw
  * Initializes memory card communication.
  *
+ * This blocks until the card has left its idle state. See
+ * sd_raw_init_start() and sd_raw_init_poll() for a stepwise variant.
+ *
  * \returns 0 on failure, 1 on success.
  */
 uint8_t sd_raw_init()
+{
+    uint8_t result;
+
+    if(!sd_raw_init_start())
+        return 0;
+
+    while((result = sd_raw_init_poll()) == SD_RAW_INIT_BUSY);
+
+    return result == SD_RAW_INIT_DONE;
+}
+
+/**
+ * \ingroup sd_raw
+ * Starts initializing memory card communication.
+ *
+ * Resets the card and determines its type. The card then needs to be
+ * polled with sd_raw_init_poll() until it reports being ready, which
+ * may take up to a second.
+ *
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_raw_init_start()
 {
     SPI_Init();
 
     /* initialization procedure */
     sd_raw_card_type = 0;
+    sd_raw_init_tries = 0;
+#if SD_RAW_DEFER_BUSY
+    sd_raw_busy = 0;
+#endif
 
     if(!sd_raw_available())
         return 0;
 
     /* card needs 74 cycles minimum to start up */
-    for(uint8_t i = 0; i < 10; ++i)
-    {
-        /* wait 8 clock cycles */
-        sd_raw_rec_byte();
-    }
+    SPI_Fill(0xff, 10);
 
     SPI_Freq_Low();
 
@@ -213,9 +245,15 @@ uint8_t sd_raw_init()
         sd_raw_rec_byte();
         sd_raw_rec_byte();
         if((sd_raw_rec_byte() & 0x01) == 0)
+        {
+            SPI_CS_High();
             return 0; /* card operation voltage range doesn't match */
+        }
         if(sd_raw_rec_byte() != 0xaa)
+        {
+            SPI_CS_High();
             return 0; /* wrong test pattern */
+        }
 
         /* card conforms to SD 2 card specification */
         sd_raw_card_type |= (1 << SD_RAW_SPEC_2);
@@ -237,32 +275,54 @@ uint8_t sd_raw_init()
         }
     }
 
-    /* wait for card to get ready */
-    for(uint16_t i = 0; ; ++i)
+    /* deaddress card until it is polled */
+    SPI_CS_High();
+
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Continues initializing memory card communication.
+ *
+ * Asks the card once wether it has left its idle state, and finishes
+ * the initialization when it has.
+ *
+ * \returns SD_RAW_INIT_BUSY while the card is still initializing,
+ *          SD_RAW_INIT_DONE when it is ready to be used, or
+ *          SD_RAW_INIT_FAILED on failure.
+ */
+uint8_t sd_raw_init_poll()
+{
+    uint8_t response;
+
+    /* address card */
+    SPI_CS_Low();
+
+    /* check wether card is ready */
+    if(sd_raw_card_type & ((1 << SD_RAW_SPEC_1) | (1 << SD_RAW_SPEC_2)))
     {
-        if(sd_raw_card_type & ((1 << SD_RAW_SPEC_1) | (1 << SD_RAW_SPEC_2)))
-        {
-            uint32_t arg = 0;
+        uint32_t arg = 0;
 #if SD_RAW_SDHC
-            if(sd_raw_card_type & (1 << SD_RAW_SPEC_2))
-                arg = 0x40000000;
+        if(sd_raw_card_type & (1 << SD_RAW_SPEC_2))
+            arg = 0x40000000;
 #endif
-            sd_raw_send_command(CMD_APP, 0);
-            response = sd_raw_send_command(CMD_SD_SEND_OP_COND, arg);
-        }
-        else
-        {
-            response = sd_raw_send_command(CMD_SEND_OP_COND, 0);
-        }
+        sd_raw_send_command(CMD_APP, 0);
+        response = sd_raw_send_command(CMD_SD_SEND_OP_COND, arg);
+    }
+    else
+    {
+        response = sd_raw_send_command(CMD_SEND_OP_COND, 0);
+    }
 
-        if((response & (1 << R1_IDLE_STATE)) == 0)
-            break;
+    if(response & (1 << R1_IDLE_STATE))
+    {
+        SPI_CS_High();
 
-        if(i == 0x7fff)
-        {
-            SPI_CS_High();
-            return 0;
-        }
+        if(sd_raw_init_tries++ == 0x7fff)
+            return SD_RAW_INIT_FAILED;
+
+        return SD_RAW_INIT_BUSY;
     }
 
 #if SD_RAW_SDHC
@@ -271,7 +331,7 @@ uint8_t sd_raw_init()
         if(sd_raw_send_command(CMD_READ_OCR, 0))
         {
             SPI_CS_High();
-            return 0;
+            return SD_RAW_INIT_FAILED;
         }
 
         if(sd_raw_rec_byte() & 0x40)
@@ -287,7 +347,7 @@ uint8_t sd_raw_init()
     if(sd_raw_send_command(CMD_SET_BLOCKLEN, 512))
     {
         SPI_CS_High();
-        return 0;
+        return SD_RAW_INIT_FAILED;
     }
 
     /* deaddress card */
@@ -303,10 +363,10 @@ uint8_t sd_raw_init()
     raw_block_written = 1;
 #endif
     if(!sd_raw_read(0, raw_block, sizeof(raw_block)))
-        return 0;
+        return SD_RAW_INIT_FAILED;
 #endif
 
-    return 1;
+    return SD_RAW_INIT_DONE;
 }
 
 /**
@@ -368,6 +428,15 @@ uint8_t sd_raw_send_command(uint8_t command, uint32_t arg)
 {
     uint8_t response;
 
+#if SD_RAW_DEFER_BUSY
+    /* wait for the card to finish a previous write */
+    if(sd_raw_busy)
+    {
+        while(sd_raw_rec_byte() != 0xff);
+        sd_raw_busy = 0;
+    }
+#endif
+
     /* wait some clock cycles */
     sd_raw_rec_byte();
 
@@ -463,9 +532,7 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
             }
 #else
             /* read byte block */
-            uint8_t* cache = raw_block;
-            for(uint16_t i = 0; i < 512; ++i)
-                *cache++ = sd_raw_rec_byte();
+            SPI_Transfer(0, raw_block, 512);
             raw_block_address = block_address;
 
             memcpy(buffer, raw_block + block_offset, read_length);
@@ -473,8 +540,7 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
 #endif
             
             /* read crc16 */
-            sd_raw_rec_byte();
-            sd_raw_rec_byte();
+            SPI_Fill(0xff, 2);
             
             /* deaddress card */
             SPI_CS_High();
@@ -700,17 +766,20 @@ uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
         sd_raw_send_byte(0xfe);
 
         /* write byte block */
-        uint8_t* cache = raw_block;
-        for(uint16_t i = 0; i < 512; ++i)
-            sd_raw_send_byte(*cache++);
+        SPI_Transfer(raw_block, 0, 512);
 
         /* write dummy crc16 */
-        sd_raw_send_byte(0xff);
-        sd_raw_send_byte(0xff);
+        SPI_Fill(0xff, 2);
 
+#if SD_RAW_DEFER_BUSY
+        /* read data response, the card is busy from here on */
+        sd_raw_rec_byte();
+        sd_raw_busy = 1;
+#else
         /* wait while card is busy */
         while(sd_raw_rec_byte() != 0xff);
         sd_raw_rec_byte();
+#endif
 
         /* deaddress card */
         SPI_CS_High();
@@ -805,6 +874,33 @@ uint8_t sd_raw_sync()
 }
 #endif
 
+/**
+ * \ingroup sd_raw
+ * Checks wether the card is ready for the next command.
+ *
+ * With SD_RAW_DEFER_BUSY, a write returns while the card is still
+ * programming the block. This function polls the card's busy state
+ * once, without blocking, so callers can do other work meanwhile.
+ *
+ * \returns 1 if the card is ready, 0 if it is still busy.
+ */
+uint8_t sd_raw_ready()
+{
+#if SD_RAW_DEFER_BUSY
+    if(sd_raw_busy)
+    {
+        SPI_CS_Low();
+        if(sd_raw_rec_byte() == 0xff)
+            sd_raw_busy = 0;
+        SPI_CS_High();
+    }
+
+    return !sd_raw_busy;
+#else
+    return 1;
+#endif
+}
+
 /**
  * \ingroup sd_raw
  * Reads informational data from the card.
@@ -121,10 +121,25 @@ struct sd_raw_info
     uint8_t format;
 };
 
+/**
+ * sd_raw_init_poll() result: the card is still initializing.
+ */
+#define SD_RAW_INIT_BUSY 2
+/**
+ * sd_raw_init_poll() result: the card is ready to be used.
+ */
+#define SD_RAW_INIT_DONE 1
+/**
+ * sd_raw_init_poll() result: the card failed to initialize.
+ */
+#define SD_RAW_INIT_FAILED 0
+
 typedef uint8_t (*sd_raw_read_interval_handler_t)(uint8_t* buffer, offset_t offset, void* p);
 typedef uintptr_t (*sd_raw_write_interval_handler_t)(uint8_t* buffer, offset_t offset, void* p);
 
 uint8_t sd_raw_init();
+uint8_t sd_raw_init_start();
+uint8_t sd_raw_init_poll();
 uint8_t sd_raw_available();
 uint8_t sd_raw_locked();
 
@@ -133,6 +148,7 @@ uint8_t sd_raw_read_interval(offset_t offset, uint8_t* buffer, uintptr_t interva
 uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length);
 uint8_t sd_raw_write_interval(offset_t offset, uint8_t* buffer, uintptr_t length, sd_raw_write_interval_handler_t callback, void* p);
 uint8_t sd_raw_sync();
+uint8_t sd_raw_ready();
 
 uint8_t sd_raw_get_info(struct sd_raw_info* info);
 
@@ -46,6 +46,17 @@ extern "C"
  */
 #define SD_RAW_WRITE_BUFFERING 0
 
+/**
+ * \ingroup sd_raw_config
+ * Controls waiting for the card to finish programming a written block.
+ *
+ * Set to 1 to return from a write as soon as the block has been
+ * transferred. The card's busy state is then waited for right before
+ * the next command, or polled without blocking by sd_raw_ready().
+ * Set to 0 to wait within every write.
+ */
+#define SD_RAW_DEFER_BUSY 1
+
 /**
  * \ingroup sd_raw_config
  * Controls MMC/SD access buffering.
@@ -0,0 +1,95 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "segfmt.h"
+
+void segfmt(uint8_t *glyphs, int width, int32_t value, int decimals, unsigned flags)
+{
+    bool negative = value < 0;
+    uint32_t v = negative ? -(uint32_t)value : (uint32_t)value;
+    uint8_t pad = (flags & SEGFMT_ZERO_PAD) ? SEG_DIGITS[0] : SEG_BLANK;
+    int digits, start, first;
+    bool lead;
+
+    if (width <= 0)
+        return;
+    if (width > SEGFMT_MAX_WIDTH)
+        width = SEGFMT_MAX_WIDTH;
+    if (decimals < 0)
+        decimals = 0;
+
+    // The sign takes a column
+    digits = negative ? width - 1 : width;
+    if (digits < 1) {
+        glyphs[0] = SEG_MINUS;
+        return;
+    }
+
+    if (v >= SEG_POW10[digits])
+        v = (flags & SEGFMT_WRAP) ? v % SEG_POW10[digits] : SEG_POW10[digits] - 1;
+
+    // Digits never go in the sign column, so first - 1 stays in the buffer
+    start = width - digits;
+    if (start > 0)
+        glyphs[0] = pad;
+
+    first = width;
+    lead = true;
+    for (int i = start; i < width; i++) {
+        int k = width - 1 - i;
+        uint8_t d = 0;
+
+        while (v >= SEG_POW10[k]) {
+            v -= SEG_POW10[k];
+            d++;
+        }
+
+        if (lead && d == 0 && k > decimals) {
+            glyphs[i] = pad;
+            continue;
+        }
+
+        if (lead) {
+            first = i;
+            lead = false;
+        }
+        glyphs[i] = SEG_DIGITS[d];
+    }
+
+    if (negative) {
+        // Right in front of the number, or at the far left when zero padded
+        if (flags & SEGFMT_ZERO_PAD)
+            glyphs[0] = SEG_MINUS;
+        else
+            glyphs[first - 1] = SEG_MINUS;
+    }
+
+    if (decimals > 0 && decimals < width)
+        glyphs[width - 1 - decimals] |= SEG_DOT;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Fixed-width number formatting for 7-segment displays
+ *
+ * Renders integers and fixed-point values straight into segment
+ * patterns (bit 0 = segment A ... bit 6 = G, bit 7 = DP), without going
+ * through printf. Digits are peeled off most significant first by
+ * repeated subtraction of powers of ten from a table, which avoids the
+ * software division the Cortex-M0+ would otherwise need per digit.
+ */
+
+#include <stdint.h>
+
+#define SEGFMT_MAX_WIDTH    9
+
+#define SEG_BLANK           0x00
+#define SEG_MINUS           0x40
+#define SEG_DOT             0x80
+
+enum segfmt_flags_t {
+    SEGFMT_ZERO_PAD = 1u<<0, // Pad with zeros rather than blanks
+    SEGFMT_WRAP     = 1u<<1, // Too wide: keep the low digits rather than clamp
+};
+
+static constexpr uint8_t SEG_DIGITS[10] = {
+    0b00111111, /* 0 */
+    0b00000110, /* 1 */
+    0b01011011, /* 2 */
+    0b01001111, /* 3 */
+    0b01100110, /* 4 */
+    0b01101101, /* 5 */
+    0b01111101, /* 6 */
+    0b00000111, /* 7 */
+    0b01111111, /* 8 */
+    0b01101111, /* 9 */
+};
+
+static constexpr uint32_t SEG_POW10[SEGFMT_MAX_WIDTH + 1] = {
+    1,
+    10,
+    100,
+    1000,
+    10000,
+    100000,
+    1000000,
+    10000000,
+    100000000,
+    1000000000,
+};
+
+/*
+ * Render value into glyphs[0..width-1], right aligned.
+ *
+ * The value is taken to have `decimals` digits after the point, so
+ * segfmt(g, 4, 1234, 1) shows "123.4". At least one digit is always
+ * shown before the point. Values that don't fit are clamped to the
+ * largest (or smallest) one that does, or wrapped with SEGFMT_WRAP.
+ */
+void segfmt(uint8_t *glyphs, int width, int32_t value, int decimals = 0, unsigned flags = 0);
@@ -5,7 +5,72 @@
 #include "common.h"
 #include "pins.h"
 
-SPI spi(SDIO_MOSI, SDIO_MISO, SDIO_SCLK);
+/*
+ * mbed's SPI::write() costs a virtual call, an ownership check and two
+ * status polls per byte. For the card's data phases the data register
+ * is fed directly instead, queueing the next byte while the previous
+ * one is still shifting out.
+ *
+ * With two bytes in flight, the first has to be read before the second
+ * also arrives: there's no receive FIFO, a byte arriving while SPRF is
+ * still set is lost, and the wait for the last byte would never end.
+ * Interrupts are masked from queueing a byte until the previous one is
+ * read, at most a byte time, so one can't run long enough to cause it.
+ */
+class BulkSPI : public SPI
+{
+public:
+    BulkSPI(PinName mosi, PinName miso, PinName sclk) :
+        SPI(mosi, miso, sclk)
+    {
+
+    }
+
+    unsigned int rw(unsigned int d)
+    {
+        SPI_Type *regs = this->_spi.spi;
+
+        this->aquire();
+
+        while (!(regs->S & SPI_S_SPTEF_MASK));
+        regs->D = d;
+        while (!(regs->S & SPI_S_SPRF_MASK));
+        return regs->D;
+    }
+
+    void transfer(const unsigned char *tx, unsigned char *rx, unsigned int len, unsigned char fill)
+    {
+        SPI_Type *regs = this->_spi.spi;
+        unsigned char c;
+
+        if (len == 0)
+            return;
+
+        this->aquire();
+
+        while (!(regs->S & SPI_S_SPTEF_MASK));
+        regs->D = tx ? *tx++ : fill;
+
+        while (--len) {
+            __disable_irq();
+            while (!(regs->S & SPI_S_SPTEF_MASK));
+            regs->D = tx ? *tx++ : fill;
+
+            while (!(regs->S & SPI_S_SPRF_MASK));
+            c = regs->D;
+            __enable_irq();
+            if (rx)
+                *rx++ = c;
+        }
+
+        while (!(regs->S & SPI_S_SPRF_MASK));
+        c = regs->D;
+        if (rx)
+            *rx = c;
+    }
+};
+
+BulkSPI spi(SDIO_MOSI, SDIO_MISO, SDIO_SCLK);
 DigitalOut cs(SDIO_CS);
 Timer timer;
 int timeout_ms;
@@ -20,13 +85,23 @@ void SPI_Init (void)
 
 unsigned int SPI_RW (unsigned int d)
 {
-    return spi.write(d);
+    return spi.rw(d);
+}
+
+void SPI_Transfer(const unsigned char *tx, unsigned char *rx, unsigned int len)
+{
+    spi.transfer(tx, rx, len, 0xFF);
+}
+
+void SPI_Fill(unsigned char d, unsigned int len)
+{
+    spi.transfer(NULL, NULL, len, d);
 }
 
 void SPI_Release(void)
 {
     int idx;
-    for (idx=512; idx && (SPI_RW(0xFF)!=0xFF); idx--);
+    for (idx=512; idx && (spi.rw(0xFF)!=0xFF); idx--);
 }
 
 void SPI_CS_Low(void)
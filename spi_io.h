@@ -30,6 +30,21 @@ void SPI_Init (void);
  */
 unsigned int SPI_RW(unsigned int d);
 
+/**
+    \brief Read/Write a block of bytes back to back.
+    \param tx Bytes to send, or NULL to send 0xFF for every byte.
+    \param rx Buffer for the bytes that arrived, or NULL to discard them.
+    \param len Number of bytes.
+ */
+void SPI_Transfer(const unsigned char *tx, unsigned char *rx, unsigned int len);
+
+/**
+    \brief Send the same byte repeatedly, discarding what arrives.
+    \param d Byte to send.
+    \param len Number of bytes.
+ */
+void SPI_Fill(unsigned char d, unsigned int len);
+
 /**
     \brief Flush of SPI buffer.
  */
@@ -0,0 +1,225 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <string.h>
+
+#include "storage.h"
+
+Storage::Storage(FS &fs) :
+    _fs(fs),
+    _mount_done(nullptr),
+    _mounting(false),
+    _failed(false),
+    _started(false),
+    _appended_at(0),
+    _head(0),
+    _count(0)
+{
+
+}
+
+void Storage::mount(storage_done_t done)
+{
+    this->_mount_done = done;
+    this->_mounting = true;
+}
+
+bool Storage::write_file(const char *fn, const void *data, size_t size, storage_done_t done)
+{
+    job_t *job;
+
+    // A newer copy of the same file replaces one still waiting
+    for (int i = this->_started ? 1 : 0; i < this->_count; i++) {
+        job = &this->_jobs[(this->_head + i) % STORAGE_QUEUE_LEN];
+        if (job->op == OP_WRITE_FILE && job->fn == fn && job->done == done && size <= STORAGE_DATA_MAX) {
+            memcpy(job->data, data, size);
+            job->size = size;
+            return true;
+        }
+    }
+
+    job = this->_push(OP_WRITE_FILE, data, size, done);
+    if (!job)
+        return false;
+
+    job->fn = fn;
+    return true;
+}
+
+bool Storage::append_log(const void *data, size_t size, storage_done_t done)
+{
+    return this->_push(OP_APPEND_LOG, data, size, done) != nullptr;
+}
+
+bool Storage::append_file(const char *fn, const void *data, size_t size, storage_done_t done)
+{
+    job_t *job;
+
+    job = this->_push(OP_APPEND_FILE, data, size, done);
+    if (!job)
+        return false;
+
+    job->fn = fn;
+    return true;
+}
+
+bool Storage::append_block(const char *fn, const void *block, storage_done_t done, uint32_t max)
+{
+    job_t *job;
+
+    job = this->_push(OP_APPEND_BLOCK, nullptr, 0, done);
+    if (!job)
+        return false;
+
+    job->fn = fn;
+    job->block = block;
+    job->max = max;
+    return true;
+}
+
+bool Storage::checkpoint(storage_done_t done)
+{
+    return this->_push(OP_CHECKPOINT, nullptr, 0, done) != nullptr;
+}
+
+void Storage::poll(void)
+{
+    job_t *job;
+    int result;
+
+    if (!this->_fs.mounted()) {
+        this->_poll_mount();
+        return;
+    }
+
+    // One busy poll while the card is still programming
+    if (!this->_fs.ready())
+        return;
+
+    if (this->idle()) {
+        if (!this->_fs.log_idle())
+            this->_fs.retain_idle();
+        return;
+    }
+
+    job = &this->_jobs[this->_head];
+    switch (job->op) {
+        case OP_WRITE_FILE:
+            result = this->_fs.write_step(job->fn, job->data, job->size);
+            break;
+        case OP_APPEND_LOG:
+            result = this->_fs.log_step(job->data, job->size);
+            break;
+        case OP_CHECKPOINT:
+            result = this->_fs.log_checkpoint() ? FS::STEP_DONE : FS::STEP_FAILED;
+            break;
+        case OP_APPEND_BLOCK:
+            result = this->_fs.append_step(job->fn, job->block, STORAGE_BLOCK_SIZE, STORAGE_BLOCK_SIZE, &this->_appended_at, job->max);
+            break;
+        case OP_APPEND_FILE:
+            result = this->_fs.append_step(job->fn, job->data, job->size, 0, &this->_appended_at);
+            break;
+        default:
+            result = FS::STEP_FAILED;
+            break;
+    }
+
+    // Picked up again on the next poll
+    this->_started = result == FS::STEP_MORE;
+    if (this->_started)
+        return;
+
+    this->_pop(result == FS::STEP_DONE ? STORAGE_DONE : result == FS::STEP_FULL ? STORAGE_FULL : STORAGE_FAILED);
+}
+
+void Storage::flush(void)
+{
+    // Nothing will drain the queue if the card was never mounted
+    while (!this->idle() && (this->_mounting || this->_fs.mounted()))
+        this->poll();
+
+    while (!this->_fs.ready());
+}
+
+void Storage::_poll_mount(void)
+{
+    int result;
+
+    if (!this->_mounting)
+        return;
+
+    result = this->_fs.mount();
+    if (result == FS::MOUNT_BUSY)
+        return;
+
+    this->_mounting = false;
+    if (result != FS::MOUNT_DONE) {
+        this->_failed = true;
+        // Nothing queued will be written, let each job know
+        while (!this->idle())
+            this->_pop(STORAGE_FAILED);
+    }
+
+    if (this->_mount_done)
+        this->_mount_done(result == FS::MOUNT_DONE);
+}
+
+Storage::job_t *Storage::_push(op_t op, const void *data, size_t size, storage_done_t done)
+{
+    job_t *job;
+
+    if (this->_failed || this->_count >= STORAGE_QUEUE_LEN || size > STORAGE_DATA_MAX)
+        return nullptr;
+
+    job = &this->_jobs[(this->_head + this->_count) % STORAGE_QUEUE_LEN];
+    job->op = op;
+    job->fn = nullptr;
+    job->block = nullptr;
+    job->done = done;
+    job->max = 0;
+    job->size = size;
+    if (size > 0)
+        memcpy(job->data, data, size);
+
+    this->_count++;
+
+    return job;
+}
+
+void Storage::_pop(int result)
+{
+    storage_done_t done;
+
+    done = this->_jobs[this->_head].done;
+    this->_head = (this->_head + 1) % STORAGE_QUEUE_LEN;
+    this->_count--;
+
+    if (done)
+        done(result);
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Queued storage operations
+ *
+ * SD card writes are queued and carried out one at a time from poll(),
+ * one FS step per call: about a sector read or written, see
+ * FS::write_step(). While the card is still programming a previous
+ * block, poll() only checks its busy state and returns.
+ *
+ * The card is mounted the same way, one step per poll(). Jobs queue up
+ * until it is mounted; if mounting fails they are completed as failed
+ * and further requests are refused, leaving the caller to carry on from
+ * RAM. A full queue only means the card is behind: callers check room()
+ * first rather than take a refusal for a failed card.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fs.h"
+
+// Room for every producer at once: a track block and its index entry, a
+// capture chunk, an odom.log line and odom.bin (twice when one is being
+// written), and the sleep checkpoint
+#define STORAGE_QUEUE_LEN   8
+#define STORAGE_DATA_MAX    80
+#define STORAGE_BLOCK_SIZE  512
+
+// What done is told; STORAGE_FULL only by append_block() given a max
+enum storage_result_t {
+    STORAGE_FAILED,
+    STORAGE_DONE,
+    STORAGE_FULL,
+};
+
+typedef void (*storage_done_t)(int result);
+
+class Storage
+{
+public:
+    Storage(FS &fs);
+
+    void mount(storage_done_t done = nullptr);
+
+    bool write_file(const char *fn, const void *data, size_t size, storage_done_t done = nullptr);
+    bool append_log(const void *data, size_t size, storage_done_t done = nullptr);
+    bool append_file(const char *fn, const void *data, size_t size, storage_done_t done = nullptr);
+    // Not copied: the block must stay put until done is called. A file
+    // already max long is left alone, done gets STORAGE_FULL.
+    bool append_block(const char *fn, const void *block, storage_done_t done = nullptr, uint32_t max = 0);
+    // Where the last append landed in its file, for its done callback
+    uint32_t appended_at(void) const { return this->_appended_at; }
+    bool checkpoint(storage_done_t done = nullptr);
+
+    void poll(void);
+    void flush(void);
+
+    bool idle(void) const { return this->_count == 0; }
+    int room(void) const { return STORAGE_QUEUE_LEN - this->_count; }
+    // Retention is working through the card, poll at the busy rate
+    bool retaining(void) const { return this->_fs.retaining(); }
+    bool mounted(void) const { return this->_fs.mounted(); }
+    bool ram_only(void) const { return this->_failed; }
+
+private:
+    enum op_t {
+        OP_WRITE_FILE,
+        OP_APPEND_LOG,
+        OP_CHECKPOINT,
+        OP_APPEND_BLOCK,
+        OP_APPEND_FILE,
+    };
+
+    struct job_t {
+        op_t op;
+        const char *fn;
+        const void *block;
+        storage_done_t done;
+        uint32_t max;
+        uint8_t size;
+        uint8_t data[STORAGE_DATA_MAX];
+    };
+
+    job_t *_push(op_t op, const void *data, size_t size, storage_done_t done);
+    void _pop(int result);
+    void _poll_mount(void);
+
+    FS &_fs;
+    storage_done_t _mount_done;
+    bool _mounting;
+    bool _failed;
+    bool _started;  // the job at _head is part way through
+    uint32_t _appended_at;
+    job_t _jobs[STORAGE_QUEUE_LEN];
+    int _head;
+    int _count;
+};
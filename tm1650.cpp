@@ -46,6 +46,9 @@ const int THRESHOLD_DOWN = 0x2666;
 const int KEY_SHORT_PRESS_TIME_MS = 10; // 10ms
 const int KEY_LONG_PRESS_TIME_MS = 1000; // 1s
 const int INTER_KEY_TIME_MS = 25; // 25ms
+const int KEY_SHORT_PRESS_TICKS = KEY_SHORT_PRESS_TIME_MS / TM1650_SAMPLE_MS;
+const int KEY_LONG_PRESS_TICKS = KEY_LONG_PRESS_TIME_MS / TM1650_SAMPLE_MS;
+const int INTER_KEY_TICKS = INTER_KEY_TIME_MS / TM1650_SAMPLE_MS;
 
 #include "ascii_7seg.h"
 #define CHARACTERS SevenSegmentASCII
@@ -53,7 +56,6 @@ static const int NUM_CHARACTERS = sizeof(CHARACTERS) / sizeof(*CHARACTERS);
 
 static const uint8_t DOT = 0x80;
 
-#define TM1650_SETUP_HOLD_US 1
 
 //Data write command
 //Combine with address
@@ -76,21 +78,30 @@ static const uint8_t DOT = 0x80;
 #define TM1650_DSP_ON       (1u<<0)
 #define TM1650_DSP_OFF      (0u<<0)
 
-#define TM1650_DEF_BRT      3
-#define TM1650_COLUMNS      4
+// _stale bit for the display control register
+#define TM1650_STALE_CTRL   (1u<<TM1650_COLUMNS)
 
-TM1650::TM1650(PinName dio, PinName clk, PinName ain) :
-	_dio(dio),
-	_clk(clk),
+template <class Bus>
+TM1650T<Bus>::TM1650T(PinName dio, PinName clk, PinName ain) :
+	_bus(dio, clk),
 	_ain(ain),
-	_column(0)
+	_lastEvent(NO_EVENT),
+	_keyTicks(0),
+	_interKeyTicks(0),
+	_eventHead(0),
+	_eventTail(0),
+	_eventCallback(nullptr),
+	_column(0),
+	_stale(0xFF)
 {
 
 }
 
-void TM1650::init(void)
+template <class Bus>
+void TM1650T<Bus>::init(void)
 {
-	this->_busInit();
+	this->_bus.init();
+	this->_stale = 0xFF;
 
 	this->_brightness = TM1650_DEF_BRT;
 	this->_segment = TM1650_8_SEG;
@@ -99,9 +110,12 @@ void TM1650::init(void)
 	this->_pushCtrl();
 
 	this->clear(); // calls _pushMem()
+
+	this->_sampleTicker.attach_us(this, &TM1650T<Bus>::_sample, TM1650_SAMPLE_MS * 1000);
 }
 
-void TM1650::setBrightness(int brightness)
+template <class Bus>
+void TM1650T<Bus>::setBrightness(int brightness)
 {
 	if (brightness < 1)
 		brightness = 1;
@@ -114,14 +128,16 @@ void TM1650::setBrightness(int brightness)
 	this->_pushCtrl();
 }
 
-void TM1650::setDisplay(bool on)
+template <class Bus>
+void TM1650T<Bus>::setDisplay(bool on)
 {
 	this->_display = on ? TM1650_DSP_ON : TM1650_DSP_OFF;
 
 	this->_pushCtrl();
 }
 
-void TM1650::clear(void)
+template <class Bus>
+void TM1650T<Bus>::clear(void)
 {
 	for (int i = 0; i < TM1650_COLUMNS; i++)
 		this->_buffer[i] = 0;
@@ -130,13 +146,15 @@ void TM1650::clear(void)
 	this->_pushMem();
 }
 
-void TM1650::putc(char c)
+template <class Bus>
+void TM1650T<Bus>::putc(char c)
 {
 	this->_bufferChar(c);
 	this->_pushMem();
 }
 
-void TM1650::puts(const char *s)
+template <class Bus>
+void TM1650T<Bus>::puts(const char *s)
 {
 	this->_column = 0;
 	while (*s != '\0' && this->_column < TM1650_COLUMNS)
@@ -144,7 +162,17 @@ void TM1650::puts(const char *s)
 	this->_pushMem();
 }
 
-void TM1650::locate(int column)
+// Like puts(), with segment patterns instead of characters
+template <class Bus>
+void TM1650T<Bus>::putGlyphs(const uint8_t *glyphs, int count)
+{
+	for (this->_column = 0; this->_column < count && this->_column < TM1650_COLUMNS; this->_column++)
+		this->_buffer[this->_column] = glyphs[this->_column];
+	this->_pushMem();
+}
+
+template <class Bus>
+void TM1650T<Bus>::locate(int column)
 {
 	if (column < 0)
 		column = 0;
@@ -155,10 +183,31 @@ void TM1650::locate(int column)
 	this->_column = column;
 }
 
-key_event_t TM1650::getEvent(void)
+template <class Bus>
+key_event_t TM1650T<Bus>::getEvent(void)
+{
+	key_event_t event;
+	uint8_t tail = this->_eventTail;
+
+	if (tail == this->_eventHead)
+		return NO_EVENT;
+
+	event = this->_events[tail];
+	this->_eventTail = (tail + 1) & (TM1650_EVENT_QUEUE - 1);
+
+	return event;
+}
+
+#ifdef TARGET_KL25Z
+template <class Bus>
+TM1650T<Bus> *TM1650T<Bus>::_waker;
+#endif
+
+// Called from _sampleTicker
+template <class Bus>
+void TM1650T<Bus>::_sample(void)
 {
 	key_event_t event = {KEY_INVALID, ACTION_NONE};
-	int time = this->_keyTimer.read_ms();
 	uint16_t value = this->_ain.read_u16();
 
 	if (value < THRESHOLD_DOWN)
@@ -173,63 +222,105 @@ key_event_t TM1650::getEvent(void)
 		event.key = KEY_SELECT;
 
 	if (this->_lastEvent.action == ACTION_RELEASE) {
-		time = this->_interKeyTimer.read_ms();
-		if (time < INTER_KEY_TIME_MS) {
-			goto no_event;
-		} else {
-			this->_lastEvent = NO_EVENT;
-			this->_interKeyTimer.stop();
-			this->_interKeyTimer.reset();
-		}
+		if (++this->_interKeyTicks < INTER_KEY_TICKS)
+			return;
+		this->_lastEvent = NO_EVENT;
 	}
 
 	if (event.key != this->_lastEvent.key || event.key == KEY_INVALID) {
-		this->_keyTimer.stop();
-		this->_keyTimer.reset();
+		this->_keyTicks = 0;
 
 		if (this->_lastEvent.action != ACTION_NONE) {
-			this->_lastEvent.key;
 			this->_lastEvent.action = ACTION_RELEASE;
-			this->_interKeyTimer.start();
-			return this->_lastEvent;
+			this->_interKeyTicks = 0;
+			this->_pushEvent(this->_lastEvent);
+			return;
 		}
 
-		if (event.key != KEY_INVALID)
-			this->_keyTimer.start();
-
 		this->_lastEvent = event;
-		goto no_event;
+#ifdef TARGET_KL25Z
+		if (event.key == KEY_INVALID)
+			this->_idle();
+#endif
+		return;
 	}
 
-	if (this->_lastEvent.action == ACTION_NONE && time >= KEY_SHORT_PRESS_TIME_MS) {
-		this->_lastEvent.action = ACTION_PRESS;
-		return this->_lastEvent;
-	}
+	if (this->_lastEvent.action == ACTION_LONG_PRESS)
+		return;
+
+	this->_keyTicks++;
 
-	if (this->_lastEvent.action == ACTION_PRESS && time >= KEY_LONG_PRESS_TIME_MS) {
+	if (this->_lastEvent.action == ACTION_NONE && this->_keyTicks >= KEY_SHORT_PRESS_TICKS) {
+		this->_lastEvent.action = ACTION_PRESS;
+		this->_pushEvent(this->_lastEvent);
+	} else if (this->_lastEvent.action == ACTION_PRESS && this->_keyTicks >= KEY_LONG_PRESS_TICKS) {
 		this->_lastEvent.action = ACTION_LONG_PRESS;
-		this->_keyTimer.stop();
-		return this->_lastEvent;
+		this->_pushEvent(this->_lastEvent);
 	}
+}
+
+#ifdef TARGET_KL25Z
+// Nothing down and nothing being timed: stop sampling, and have the ADC
+// convert on its own until the ladder reads below RIGHT's threshold.
+// The channel is the one _sample() just converted.
+template <class Bus>
+void TM1650T<Bus>::_idle(void)
+{
+	uint32_t channel = ADC0->SC1[0] & ADC_SC1_ADCH_MASK;
+
+	this->_sampleTicker.detach();
+
+	_waker = this;
+	NVIC_SetVector(ADC0_IRQn, (uintptr_t)&TM1650T<Bus>::_adcIrq);
+	NVIC_EnableIRQ(ADC0_IRQn);
 
-no_event:
-	return NO_EVENT;
+	// ADACK keeps converting in deep sleep, where the bus clock stops
+	this->_adcCfg1 = ADC0->CFG1;
+	ADC0->CFG1 = (ADC0->CFG1 & ~ADC_CFG1_ADICLK_MASK) | ADC_CFG1_ADICLK(3);
+	ADC0->CV1 = THRESHOLD_RIGHT;
+	ADC0->SC2 = (ADC0->SC2 & ~ADC_SC2_ACFGT_MASK) | ADC_SC2_ACFE_MASK; // Less than CV1
+	ADC0->SC3 |= ADC_SC3_ADCO_MASK;
+	ADC0->SC1[0] = ADC_SC1_AIEN_MASK | ADC_SC1_ADCH(channel);
 }
 
-void TM1650::_bufferChar(char c)
+// A key is going down: put the ADC back for AnalogIn and sample again
+template <class Bus>
+void TM1650T<Bus>::_adcIrq(void)
 {
-	unsigned int i;
+	TM1650T<Bus> *self = _waker;
 
-	if (this->_column >= TM1650_COLUMNS)
-		return;
+	NVIC_DisableIRQ(ADC0_IRQn);
+	ADC0->SC1[0] = ADC_SC1_ADCH(ADC_SC1_ADCH_MASK); // Disabled
+	ADC0->SC3 &= ~ADC_SC3_ADCO_MASK;
+	ADC0->SC2 &= ~ADC_SC2_ACFE_MASK;
+	ADC0->CFG1 = self->_adcCfg1;
 
-	if (c == '.') {
-		if (this->_column <= 0)
-			return;
+	self->_sampleTicker.attach_us(self, &TM1650T<Bus>::_sample, TM1650_SAMPLE_MS * 1000);
+	self->_sample();
+}
+#endif
 
-		this->_buffer[this->_column - 1] |= DOT;
+template <class Bus>
+void TM1650T<Bus>::_pushEvent(key_event_t event)
+{
+	uint8_t head = this->_eventHead;
+	uint8_t next = (head + 1) & (TM1650_EVENT_QUEUE - 1);
+
+	// Full, drop the event rather than overwrite one being read
+	if (next == this->_eventTail)
 		return;
-	}
+
+	this->_events[head] = event;
+	this->_eventHead = next;
+
+	if (this->_eventCallback)
+		this->_eventCallback();
+}
+
+template <class Bus>
+uint8_t TM1650T<Bus>::glyph(char c)
+{
+	unsigned int i;
 
 	if (c >= 0 && c <= 0xF) {
 		i = '0' - ' ' + c;
@@ -242,94 +333,58 @@ void TM1650::_bufferChar(char c)
 	if (i >= NUM_CHARACTERS)
 		i = '-' - ' ';
 
-	this->_buffer[this->_column++] = CHARACTERS[i];
+	return CHARACTERS[i];
 }
 
-void TM1650::_pushMem(void)
+template <class Bus>
+void TM1650T<Bus>::_bufferChar(char c)
 {
-	for (int i = 0; i < TM1650_COLUMNS; i++)
-		this->_pushMem(i);
-}
-
-void TM1650::_pushMem(int column)
-{
-	if (column >= TM1650_COLUMNS)
+	if (this->_column >= TM1650_COLUMNS)
 		return;
 
-	this->_start();
-	this->_write(TM1650_DATA_WR_CMD | ((TM1650_ADDR_MSK & column) << TM1650_ADDR_OFFSET));
-	this->_write(this->_buffer[column]);
-	this->_stop();
-}
-
-void TM1650::_pushCtrl(void)
-{
-	this->_start();
-	this->_write(TM1650_DSP_CTRL_CMD);
-	this->_write(((this->_brightness & TM1650_BRT_MSK) << TM1650_BRT_OFFSET) | this->_segment | this->_display);
-	this->_stop();
-}
+	if (c == '.') {
+		if (this->_column <= 0)
+			return;
 
-void TM1650::_busInit(void)
-{
-	this->_dio.output();
-	wait_us(TM1650_SETUP_HOLD_US);
+		this->_buffer[this->_column - 1] |= DOT;
+		return;
+	}
 
-	this->_dio = 1;
-	this->_clk = 1;
+	this->_buffer[this->_column++] = glyph(c);
 }
 
-void TM1650::_start(void)
+template <class Bus>
+void TM1650T<Bus>::_pushMem(void)
 {
-	this->_dio = 0;
-	wait_us(TM1650_SETUP_HOLD_US);
-
-	this->_clk = 0;
-	wait_us(TM1650_SETUP_HOLD_US);
+	for (int i = 0; i < TM1650_COLUMNS; i++)
+		this->_pushMem(i);
 }
 
-void TM1650::_stop(void)
+template <class Bus>
+void TM1650T<Bus>::_pushMem(int column)
 {
-	this->_dio=0;
-	wait_us(TM1650_SETUP_HOLD_US);
+	if (column >= TM1650_COLUMNS)
+		return;
 
-	this->_clk=1;
-	wait_us(TM1650_SETUP_HOLD_US);
+	if (!(this->_stale & (1u << column)) && this->_shadow[column] == this->_buffer[column])
+		return;
 
-	this->_dio=1;
-	wait_us(TM1650_SETUP_HOLD_US);
+	this->_bus.write(TM1650_DATA_WR_CMD | ((TM1650_ADDR_MSK & column) << TM1650_ADDR_OFFSET), this->_buffer[column]);
+	this->_shadow[column] = this->_buffer[column];
+	this->_stale &= ~(1u << column);
 }
 
-void TM1650::_write(uint8_t data)
+template <class Bus>
+void TM1650T<Bus>::_pushCtrl(void)
 {
-	// Write data out MSB first
-	for (uint8_t bit = 0x80; bit; bit >>= 1) {
-		this->_dio = (data & bit) ? 1 : 0;
-		wait_us(TM1650_SETUP_HOLD_US);
-
-		this->_clk = 1;
-		wait_us(TM1650_SETUP_HOLD_US);
-
-		this->_clk = 0;
-		wait_us(TM1650_SETUP_HOLD_US);
-	}
-
-	// Idle and prepare DIO to read data
-	this->_dio = 1;
-	this->_dio.input();
-	wait_us(TM1650_SETUP_HOLD_US);
+	uint8_t ctrl = ((this->_brightness & TM1650_BRT_MSK) << TM1650_BRT_OFFSET) | this->_segment | this->_display;
 
-	// dummy Ack
-	this->_clk = 1;
-	wait_us(TM1650_SETUP_HOLD_US);
-	// ack = this->_dio;
-
-	this->_clk = 0;
-	wait_us(TM1650_SETUP_HOLD_US);
-
-	// Return DIO to output mode
-	this->_dio.output();
-	wait_us(TM1650_SETUP_HOLD_US);
+	if (!(this->_stale & TM1650_STALE_CTRL) && this->_shadowCtrl == ctrl)
+		return;
 
-	this->_dio = 1; //idle
+	this->_bus.write(TM1650_DSP_CTRL_CMD, ctrl);
+	this->_shadowCtrl = ctrl;
+	this->_stale &= ~TM1650_STALE_CTRL;
 }
+
+template class TM1650T<TM1650_BUS>;
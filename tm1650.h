@@ -35,6 +35,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  * Built from bits of:
  *  - https://os.mbed.com/users/wim/code/TM1650//file/4430a1559b4f/TM1650.cpp (MIT - Wim Huiskamp)
  *  - https://os.mbed.com/users/wim/code/TM1650//file/4430a1559b4f/TM1650.h (MIT - Wim Huiskamp)
+ *
+ * The driver keeps a shadow of what the chip was last sent and only
+ * transmits columns (and display control) that changed. Transactions
+ * go through the Bus policy, see tm1650_bus.h.
+ *
+ * The keypad is sampled from a Ticker every TM1650_SAMPLE_MS while a key
+ * is down or the inter-key gap is running. Debouncing and long presses
+ * are worked out there, and the resulting events wait in a small queue
+ * until getEvent() picks them up. On the KL25Z the Ticker stops once the
+ * keys are idle, and the ADC's hardware compare watches the ladder in
+ * its place (running from its own clock, so through deep sleep too).
  */
 
 
@@ -43,14 +54,23 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <mbed.h>
 
 #include "common.h"
+#include "tm1650_bus.h"
 
 #define TM1650_DEF_BRT      3
 #define TM1650_COLUMNS      4
+#define TM1650_SAMPLE_MS    5
+#define TM1650_EVENT_QUEUE  8 // Power of two
+
+// Bus back-end, TM1650BitBang or TM1650I2C
+#ifndef TM1650_BUS
+#define TM1650_BUS          TM1650BitBang
+#endif
 
-class TM1650
+template <class Bus>
+class TM1650T
 {
 public:
-	TM1650(PinName dio, PinName clk, PinName ain);
+	TM1650T(PinName dio, PinName clk, PinName ain);
 
 	void init(void);
 
@@ -61,35 +81,61 @@ public:
 
 	void putc(char c);
 	void puts(const char *s);
+	void putGlyphs(const uint8_t *glyphs, int count);
 	void locate(int column);
 
 	int column(void) const { return this->_column; }
 	int columns(void) const { return TM1650_COLUMNS; }
 
+	static uint8_t glyph(char c);
+
 	key_event_t getEvent(void);
+	void attach(void (*fn)(void)) { this->_eventCallback = fn; }
 
 private:
 	void _bufferChar(char c);
 
+	void _sample(void);
+	void _pushEvent(key_event_t event);
+#ifdef TARGET_KL25Z
+	void _idle(void);
+	static void _adcIrq(void);
+#endif
+
 	void _pushMem(void);
 	void _pushMem(int column);
 	void _pushCtrl(void);
 
-	void _busInit(void);
-	void _start(void);
-	void _stop(void);
-	void _write(uint8_t data);
-
-	Timer _keyTimer;
-	Timer _interKeyTimer;
-	DigitalInOut _dio;
-	DigitalOut _clk;
+	Bus _bus;
+	Ticker _sampleTicker;
 	AnalogIn _ain;
 
+	// Owned by _sample()
 	key_event_t _lastEvent;
+	uint16_t _keyTicks;
+	uint16_t _interKeyTicks;
+#ifdef TARGET_KL25Z
+	// Waiting on the compare, and the ADC clock it had before
+	static TM1650T *_waker;
+	uint32_t _adcCfg1;
+#endif
+
+	// Filled by _sample(), drained by getEvent()
+	key_event_t _events[TM1650_EVENT_QUEUE];
+	volatile uint8_t _eventHead;
+	volatile uint8_t _eventTail;
+	void (*_eventCallback)(void);
+
 	int _column;
 	uint8_t _brightness;
 	uint8_t _segment;
 	uint8_t _display;
 	uint8_t _buffer[TM1650_COLUMNS];
+
+	// Last values sent to the chip, and which of them can't be trusted
+	uint8_t _shadow[TM1650_COLUMNS];
+	uint8_t _shadowCtrl;
+	uint8_t _stale;
 };
+
+typedef TM1650T<TM1650_BUS> TM1650;
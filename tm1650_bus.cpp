@@ -0,0 +1,132 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "tm1650_bus.h"
+
+#define TM1650_SETUP_HOLD_US 1
+
+// The TM1650 is good for up to 100kHz
+#define TM1650_I2C_FREQ     100000
+
+TM1650BitBang::TM1650BitBang(PinName dio, PinName clk) :
+	_dio(dio),
+	_clk(clk)
+{
+
+}
+
+void TM1650BitBang::init(void)
+{
+	this->_dio.output();
+	wait_us(TM1650_SETUP_HOLD_US);
+
+	this->_dio = 1;
+	this->_clk = 1;
+}
+
+void TM1650BitBang::write(uint8_t cmd, uint8_t data)
+{
+	this->_start();
+	this->_write(cmd);
+	this->_write(data);
+	this->_stop();
+}
+
+void TM1650BitBang::_start(void)
+{
+	this->_dio = 0;
+	wait_us(TM1650_SETUP_HOLD_US);
+
+	this->_clk = 0;
+	wait_us(TM1650_SETUP_HOLD_US);
+}
+
+void TM1650BitBang::_stop(void)
+{
+	this->_dio=0;
+	wait_us(TM1650_SETUP_HOLD_US);
+
+	this->_clk=1;
+	wait_us(TM1650_SETUP_HOLD_US);
+
+	this->_dio=1;
+	wait_us(TM1650_SETUP_HOLD_US);
+}
+
+void TM1650BitBang::_write(uint8_t data)
+{
+	// Write data out MSB first
+	for (uint8_t bit = 0x80; bit; bit >>= 1) {
+		this->_dio = (data & bit) ? 1 : 0;
+		wait_us(TM1650_SETUP_HOLD_US);
+
+		this->_clk = 1;
+		wait_us(TM1650_SETUP_HOLD_US);
+
+		this->_clk = 0;
+		wait_us(TM1650_SETUP_HOLD_US);
+	}
+
+	// Idle and prepare DIO to read data
+	this->_dio = 1;
+	this->_dio.input();
+	wait_us(TM1650_SETUP_HOLD_US);
+
+	// dummy Ack
+	this->_clk = 1;
+	wait_us(TM1650_SETUP_HOLD_US);
+	// ack = this->_dio;
+
+	this->_clk = 0;
+	wait_us(TM1650_SETUP_HOLD_US);
+
+	// Return DIO to output mode
+	this->_dio.output();
+	wait_us(TM1650_SETUP_HOLD_US);
+
+	this->_dio = 1; //idle
+}
+
+TM1650I2C::TM1650I2C(PinName dio, PinName clk) :
+	_i2c(dio, clk)
+{
+
+}
+
+void TM1650I2C::init(void)
+{
+	this->_i2c.frequency(TM1650_I2C_FREQ);
+}
+
+void TM1650I2C::write(uint8_t cmd, uint8_t data)
+{
+	// The command byte goes out in the address slot
+	this->_i2c.write(cmd, (const char *)&data, 1);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Bus back-ends for the TM1650
+ *
+ * The TM1650 speaks a two-wire protocol close enough to I2C: each
+ * transaction is a start, a command byte, one data byte and a stop.
+ * Any class with this interface can be used as the Bus policy of
+ * TM1650T:
+ *
+ *	Bus(PinName dio, PinName clk);
+ *	void init(void);
+ *	void write(uint8_t cmd, uint8_t data);
+ */
+
+#include <stdint.h>
+#include <mbed.h>
+
+// Bit-banged on any two GPIOs
+class TM1650BitBang
+{
+public:
+	TM1650BitBang(PinName dio, PinName clk);
+
+	void init(void);
+	void write(uint8_t cmd, uint8_t data);
+
+private:
+	void _start(void);
+	void _stop(void);
+	void _write(uint8_t data);
+
+	DigitalInOut _dio;
+	DigitalOut _clk;
+};
+
+// KL25Z hardware I2C, needs DIO/CLK on SDA/SCL capable pins
+class TM1650I2C
+{
+public:
+	TM1650I2C(PinName dio, PinName clk);
+
+	void init(void);
+	void write(uint8_t cmd, uint8_t data);
+
+private:
+	I2C _i2c;
+};
@@ -0,0 +1,753 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Card image consistency check and repair
+ *
+ *   cardfsck [-j threads] [-r] [-v] IMAGE
+ *
+ * Cards come back from the car with power loss damage. The directories
+ * are read through the firmware's own sd-reader code. Every cluster
+ * chain is then followed straight out of the mmap()ed FAT, one file per
+ * worker thread. The tool reports:
+ *
+ *   - chains that loop or run into free or bad clusters
+ *   - sizes the chain can't hold
+ *   - clusters shared between files (cross-linked)
+ *   - clusters in use by no file (lost)
+ *
+ * Track logs (.trk, track.bin) are checked block by block. Text logs
+ * (.log) are checked for a torn last line. With -v, chains the log
+ * preallocated past its size are listed too.
+ *
+ * With -r the image is repaired in place:
+ *
+ *   - chains are cut where they go wrong
+ *   - the second file onto a cross-linked cluster loses it and all
+ *     after it
+ *   - sizes are trimmed to what the chain and a log's content hold
+ *   - lost clusters are freed
+ *
+ * Only the first FAT is written, as sd-reader does. Exits 0 if the image
+ * is clean, after repair if asked.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "image.h"
+#include "track.h"
+
+enum chain_t {
+    CHAIN_OK,
+    CHAIN_FREE,   // Runs into a free cluster
+    CHAIN_RANGE,  // Points past the FAT
+    CHAIN_BAD,    // Runs into a cluster marked bad
+    CHAIN_LOOP,
+};
+
+enum kind_t {
+    KIND_OTHER,
+    KIND_DIR,
+    KIND_TRACK,
+    KIND_TEXT_LOG,
+};
+
+struct file_t {
+    std::string path;
+    struct fat_dir_entry_struct entry;
+    kind_t kind;
+
+    // Filled in by check_file()
+    chain_t chain;
+    uint32_t clusters;   // Sound ones, from the first
+    uint32_t keep;       // Bytes of content worth keeping
+    int32_t cross_at;    // First shared cluster's place in the chain, or -1
+};
+
+struct totals_t {
+    uint64_t used;
+    uint64_t lost;
+    uint64_t lost_links; // Lost clusters leading to another lost one
+    uint64_t crossed;
+    uint64_t bad;
+};
+
+static struct fat_fs_layout_struct layout;
+static uint8_t *fat;
+static uint32_t fat_entries;
+static std::atomic<uint16_t> *refs;
+static int nthreads;
+
+/*
+ * The FAT, straight from the image
+ */
+
+static uint32_t fat_get(uint32_t cluster)
+{
+    const uint8_t *p = fat + (size_t)cluster * layout.fat_entry_size;
+
+    if (layout.fat_entry_size == 4)
+        return (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24) & 0x0fffffff;
+    return p[0] | p[1] << 8;
+}
+
+static void fat_set(uint32_t cluster, uint32_t value)
+{
+    uint8_t *p = fat + (size_t)cluster * layout.fat_entry_size;
+
+    if (layout.fat_entry_size == 4) {
+        // The top four bits are reserved, leave them be
+        value = (value & 0x0fffffff) | ((uint32_t)p[3] & 0xf0) << 24;
+        p[2] = value >> 16;
+        p[3] = value >> 24;
+    }
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static bool fat_eoc(uint32_t value)
+{
+    return value >= (layout.fat_entry_size == 4 ? 0x0ffffff8u : 0xfff8u);
+}
+
+static bool fat_bad(uint32_t value)
+{
+    return value == (layout.fat_entry_size == 4 ? 0x0ffffff7u : 0xfff7u);
+}
+
+static uint8_t *cluster_data(uint32_t cluster)
+{
+    offset_t offset = layout.cluster_zero_offset + (offset_t)(cluster - 2) * layout.cluster_size;
+
+    if (offset + layout.cluster_size > image_size)
+        return NULL;
+    return image + offset;
+}
+
+// Clusters in a looping chain before it comes round again, by Brent's
+// method: the length of the loop, then where it starts
+static uint32_t loop_count(uint32_t first)
+{
+    uint32_t power = 1, lambda = 1, mu = 0;
+    uint32_t tortoise = first, hare = fat_get(first);
+
+    while (tortoise != hare) {
+        if (power == lambda) {
+            tortoise = hare;
+            power *= 2;
+            lambda = 0;
+        }
+        hare = fat_get(hare);
+        lambda++;
+    }
+
+    tortoise = hare = first;
+    for (uint32_t i = 0; i < lambda; i++)
+        hare = fat_get(hare);
+    while (tortoise != hare) {
+        tortoise = fat_get(tortoise);
+        hare = fat_get(hare);
+        mu++;
+    }
+
+    return mu + lambda;
+}
+
+/*
+ * Follows a chain as far as it is sound, setting count to the clusters
+ * up to there.
+ */
+static chain_t walk(uint32_t first, uint32_t *count)
+{
+    uint32_t cluster = first, next, n = 0;
+
+    *count = 0;
+    if (first == 0)
+        return CHAIN_OK;
+
+    for (;;) {
+        if (cluster < 2 || cluster >= fat_entries)
+            return CHAIN_RANGE;
+        next = fat_get(cluster);
+        if (next == 0)
+            return CHAIN_FREE;
+        if (++n > fat_entries) {
+            *count = loop_count(first);
+            return CHAIN_LOOP;
+        }
+        *count = n;
+        if (fat_eoc(next))
+            return CHAIN_OK;
+        if (fat_bad(next))
+            return CHAIN_BAD;
+        cluster = next;
+    }
+}
+
+// Cluster n of a chain, counting from 0, within its sound part
+static uint32_t chain_at(uint32_t cluster, uint32_t n)
+{
+    while (n--)
+        cluster = fat_get(cluster);
+    return cluster;
+}
+
+/*
+ * The directories, through sd-reader
+ */
+
+static kind_t kind_of(const struct fat_dir_entry_struct &entry)
+{
+    const char *dot = strrchr(entry.long_name, '.');
+
+    if (entry.attributes & FAT_ATTRIB_DIR)
+        return KIND_DIR;
+    if (!strcasecmp(entry.long_name, "track.bin") || (dot && !strcasecmp(dot, ".trk")))
+        return KIND_TRACK;
+    if (dot && !strcasecmp(dot, ".log"))
+        return KIND_TEXT_LOG;
+    return KIND_OTHER;
+}
+
+/*
+ * Every file and directory, each directory's before what's below it.
+ * sd-reader only has two directory handles, so directories are read one
+ * at a time. One whose chain is broken or that was already read (a
+ * cross-link) isn't gone into.
+ */
+static int scan_dirs(std::vector<file_t> *files)
+{
+    std::set<uint32_t> seen;
+    struct fat_dir_entry_struct entry;
+    struct fat_dir_struct *dd;
+    std::string path;
+    uint32_t count;
+    file_t file;
+
+    memset(&file.entry, 0, sizeof(file.entry));
+    if (!fat_get_dir_entry_of_path(fs, "/", &file.entry))
+        return 0;
+    file.path = "/";
+    file.kind = KIND_DIR;
+    files->push_back(file);
+    if (layout.root_dir_cluster)
+        seen.insert(layout.root_dir_cluster);
+
+    for (size_t i = 0; i < files->size(); i++) {
+        if ((*files)[i].kind != KIND_DIR)
+            continue;
+        entry = (*files)[i].entry;
+        path = i ? (*files)[i].path + "/" : "/";
+
+        // Cluster 0 is the root to sd-reader
+        if (i && !entry.cluster)
+            continue;
+        if (walk(entry.cluster, &count) != CHAIN_OK)
+            continue;
+        if (entry.cluster && !seen.insert(entry.cluster).second)
+            continue;
+
+        dd = fat_open_dir(fs, &entry);
+        if (!dd)
+            continue;
+        while (fat_read_dir(dd, &file.entry)) {
+            if (!strcmp(file.entry.long_name, ".") || !strcmp(file.entry.long_name, ".."))
+                continue;
+            if (file.entry.attributes & FAT_ATTRIB_VOLUME)
+                continue;
+            file.path = path + file.entry.long_name;
+            file.kind = kind_of(file.entry);
+            files->push_back(file);
+        }
+        fat_close_dir(dd);
+    }
+
+    // sd-reader calls the root cluster 0, its chain is checked like any
+    (*files)[0].entry.cluster = layout.root_dir_cluster;
+
+    return 1;
+}
+
+/*
+ * The checks
+ */
+
+// Runs job(0) to job(jobs - 1) across the threads, each taking the next
+template <typename F>
+static void parallel(size_t jobs, F job)
+{
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next++) < jobs)
+            job(i);
+    };
+    for (int i = 0; i < nthreads; i++)
+        threads.push_back(std::thread(worker));
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+}
+
+// Up to the end of the last whole block that checks out
+static uint32_t track_keep(const file_t *file, uint32_t avail)
+{
+    uint32_t cluster = file->entry.cluster, pos = 0, keep = 0, utc;
+    const uint8_t *data;
+
+    while (pos + TRACK_BLOCK_SIZE <= avail) {
+        data = cluster_data(cluster);
+        if (!data)
+            break;
+        for (uint32_t i = 0; i < layout.cluster_size && pos + TRACK_BLOCK_SIZE <= avail; i += TRACK_BLOCK_SIZE) {
+            if (TrackBlock::first_utc(data + i, &utc))
+                keep = pos + TRACK_BLOCK_SIZE;
+            pos += TRACK_BLOCK_SIZE;
+        }
+        cluster = fat_get(cluster);
+    }
+
+    return keep;
+}
+
+// Whole lines, if power loss left zeros or noise in the last cluster
+static uint32_t text_keep(const file_t *file, uint32_t avail)
+{
+    const uint8_t *data;
+    uint32_t start, i;
+
+    if (!avail)
+        return 0;
+
+    start = (avail - 1) / layout.cluster_size * layout.cluster_size;
+    data = cluster_data(chain_at(file->entry.cluster, start / layout.cluster_size));
+    if (!data)
+        return start;
+
+    for (i = 0; i < avail - start; i++) {
+        if (data[i] < ' ' && data[i] != '\n' && data[i] != '\r' && data[i] != '\t')
+            break;
+    }
+    if (i == avail - start)
+        return avail;
+
+    while (i > 0 && data[i - 1] != '\n')
+        i--;
+    return start + i;
+}
+
+static void check_file(file_t *file)
+{
+    uint32_t cluster = file->entry.cluster, avail;
+    uint64_t held;
+
+    file->chain = walk(cluster, &file->clusters);
+    file->cross_at = -1;
+
+    for (uint32_t n = 0; n < file->clusters; n++) {
+        refs[cluster].fetch_add(1, std::memory_order_relaxed);
+        cluster = fat_get(cluster);
+    }
+
+    held = (uint64_t)file->clusters * layout.cluster_size;
+    avail = file->entry.file_size < held ? file->entry.file_size : held;
+    if (file->kind == KIND_TRACK)
+        file->keep = track_keep(file, avail);
+    else if (file->kind == KIND_TEXT_LOG)
+        file->keep = text_keep(file, avail);
+    else
+        file->keep = avail;
+}
+
+static void find_cross(file_t *file)
+{
+    uint32_t cluster = file->entry.cluster;
+
+    for (uint32_t n = 0; n < file->clusters; n++) {
+        if (refs[cluster].load(std::memory_order_relaxed) > 1) {
+            file->cross_at = n;
+            return;
+        }
+        cluster = fat_get(cluster);
+    }
+}
+
+static void count_clusters(uint32_t from, uint32_t to, totals_t *totals)
+{
+    uint32_t value;
+    uint16_t count;
+
+    for (uint32_t cluster = from; cluster < to; cluster++) {
+        value = fat_get(cluster);
+        if (!value)
+            continue;
+        if (fat_bad(value)) {
+            totals->bad++;
+            continue;
+        }
+
+        totals->used++;
+        count = refs[cluster].load(std::memory_order_relaxed);
+        if (count > 1)
+            totals->crossed++;
+        if (count == 0) {
+            totals->lost++;
+            if (value >= 2 && value < fat_entries && !fat_eoc(value) &&
+                fat_get(value) && !refs[value].load(std::memory_order_relaxed))
+                totals->lost_links++;
+        }
+    }
+}
+
+// FAT slices for the threads to share out
+static uint32_t slice_size(void)
+{
+    uint32_t size = fat_entries / (nthreads * 8) + 1;
+    return size < 65536 ? 65536 : size;
+}
+
+static void check(std::vector<file_t> &files, const std::vector<size_t> &order, totals_t *totals)
+{
+    uint32_t slice = slice_size();
+    size_t slices = (fat_entries + slice - 1) / slice;
+    std::vector<totals_t> parts(slices);
+
+    for (uint32_t i = 0; i < fat_entries; i++)
+        refs[i].store(0, std::memory_order_relaxed);
+
+    parallel(order.size(), [&](size_t i) {
+        check_file(&files[order[i]]);
+    });
+
+    memset(&parts[0], 0, slices * sizeof(parts[0]));
+    parallel(slices, [&](size_t i) {
+        uint32_t from = i * slice, to = from + slice;
+        count_clusters(from < 2 ? 2 : from, to > fat_entries ? fat_entries : to, &parts[i]);
+    });
+    memset(totals, 0, sizeof(*totals));
+    for (size_t i = 0; i < slices; i++) {
+        totals->used += parts[i].used;
+        totals->lost += parts[i].lost;
+        totals->lost_links += parts[i].lost_links;
+        totals->crossed += parts[i].crossed;
+        totals->bad += parts[i].bad;
+    }
+
+    if (totals->crossed)
+        parallel(files.size(), [&](size_t i) {
+            find_cross(&files[i]);
+        });
+}
+
+static int report(const std::vector<file_t> &files, const totals_t &totals, bool verbose)
+{
+    static const char *chain_errors[] = {
+        NULL,
+        "runs into a free cluster",
+        "points past the FAT",
+        "runs into a bad cluster",
+        "loops",
+    };
+    uint32_t size, need, dirs = 0;
+    uint64_t held;
+    int errors = 0;
+
+    for (size_t i = 0; i < files.size(); i++) {
+        const file_t &file = files[i];
+
+        if (file.kind == KIND_DIR)
+            dirs++;
+        if (file.chain != CHAIN_OK) {
+            printf("%s: chain %s after %u clusters\n", file.path.c_str(), chain_errors[file.chain], file.clusters);
+            errors++;
+        }
+        if (file.cross_at >= 0) {
+            printf("%s: cross-linked from cluster %d of its chain\n", file.path.c_str(), file.cross_at);
+            errors++;
+        }
+        if (file.kind == KIND_DIR)
+            continue;
+
+        size = file.entry.file_size;
+        held = (uint64_t)file.clusters * layout.cluster_size;
+        need = (size + layout.cluster_size - 1) / layout.cluster_size;
+        if (size > held) {
+            printf("%s: size %u, the chain only holds %llu bytes\n", file.path.c_str(), size, (unsigned long long)held);
+            errors++;
+        } else if (file.chain == CHAIN_OK && file.clusters > need) {
+            // Logs are kept allocated ahead of their data
+            if (file.kind != KIND_TEXT_LOG) {
+                printf("%s: %u clusters past its size\n", file.path.c_str(), file.clusters - need);
+                errors++;
+            } else if (verbose) {
+                printf("%s: %u clusters preallocated\n", file.path.c_str(), file.clusters - need);
+            }
+        }
+        if (file.keep < (size < held ? size : held)) {
+            printf("%s: torn %s after byte %u\n", file.path.c_str(),
+                file.kind == KIND_TRACK ? "blocks" : "line", file.keep);
+            errors++;
+        }
+    }
+
+    if (totals.lost) {
+        printf("%llu lost clusters in %llu chains\n",
+            (unsigned long long)totals.lost, (unsigned long long)(totals.lost - totals.lost_links));
+        errors++;
+    }
+
+    printf("%u files, %u directories, %llu of %u clusters in use, %llu lost, %llu cross-linked, %llu bad\n",
+        (unsigned)(files.size() - dirs), dirs - 1,
+        (unsigned long long)totals.used, fat_entries - 2,
+        (unsigned long long)totals.lost, (unsigned long long)totals.crossed,
+        (unsigned long long)totals.bad);
+
+    return errors;
+}
+
+/*
+ * Repair
+ */
+
+static void put_entry(const file_t &file, uint32_t cluster, uint32_t size)
+{
+    uint8_t *p = image + file.entry.entry_offset;
+
+    p[20] = cluster >> 16;
+    p[21] = cluster >> 24;
+    p[26] = cluster;
+    p[27] = cluster >> 8;
+    p[28] = size;
+    p[29] = size >> 8;
+    p[30] = size >> 16;
+    p[31] = size >> 24;
+}
+
+/*
+ * Cuts chains back to what's sound and trims sizes to what the chain and
+ * content hold. A cross-linked cluster goes to the first file that needs
+ * it for its size, a chain run on past its size lets go. Clusters let
+ * go of are left lost for free_lost(). Returns the number of files
+ * changed.
+ */
+static int repair(std::vector<file_t> &files)
+{
+    std::unordered_set<uint32_t> claimed;
+    uint32_t cs = layout.cluster_size, cluster, keep, size, need, n;
+    int fixed = 0;
+    bool cut;
+
+    for (size_t i = 0; i < files.size(); i++) {
+        file_t &file = files[i];
+
+        size = file.entry.file_size;
+        keep = file.clusters;
+        if (file.cross_at >= 0) {
+            need = file.kind == KIND_DIR ? file.clusters : (size + cs - 1) / cs;
+            cluster = file.entry.cluster;
+            for (n = 0; n < file.clusters; n++, cluster = fat_get(cluster)) {
+                if (refs[cluster].load(std::memory_order_relaxed) > 1 &&
+                    (n >= need || !claimed.insert(cluster).second))
+                    break;
+            }
+            keep = n;
+        }
+
+        if (file.kind != KIND_DIR) {
+            if (size > (uint64_t)keep * cs)
+                size = keep * cs;
+            if (size > file.keep)
+                size = file.keep;
+            // A log's preallocation stays, as FS would have it
+            if (file.kind != KIND_TEXT_LOG && keep > (size + cs - 1) / cs)
+                keep = (size + cs - 1) / cs;
+        }
+
+        cut = keep < file.clusters || file.chain != CHAIN_OK;
+        if (cut && keep)
+            fat_set(chain_at(file.entry.cluster, keep - 1), 0x0fffffff);
+
+        if (i == 0)
+            ; // The root has no entry of its own
+        else if (cut && !keep && file.kind == KIND_DIR)
+            image[file.entry.entry_offset] = 0xe5; // Nothing left to list
+        else if ((cut && !keep) || size != file.entry.file_size)
+            put_entry(file, keep ? file.entry.cluster : 0, size);
+
+        if (cut || size != file.entry.file_size) {
+            printf("%s: %s\n", file.path.c_str(), cut ? "chain cut" : "size trimmed");
+            fixed++;
+        }
+    }
+
+    return fixed;
+}
+
+static uint64_t free_lost(void)
+{
+    uint32_t slice = slice_size();
+    size_t slices = (fat_entries + slice - 1) / slice;
+    std::atomic<uint64_t> freed(0);
+
+    parallel(slices, [&](size_t i) {
+        uint32_t from = i * slice < 2 ? 2 : i * slice, to = i * slice + slice, value;
+        uint64_t count = 0;
+
+        if (to > fat_entries)
+            to = fat_entries;
+        for (uint32_t cluster = from; cluster < to; cluster++) {
+            value = fat_get(cluster);
+            if (value && !fat_bad(value) && !refs[cluster].load(std::memory_order_relaxed)) {
+                fat_set(cluster, 0);
+                count++;
+            }
+        }
+        freed += count;
+    });
+
+    return freed;
+}
+
+// Every file, and the order to check them in: biggest first, to keep the
+// tail short
+static int scan(std::vector<file_t> *files, std::vector<size_t> *order)
+{
+    files->clear();
+    order->clear();
+    if (!scan_dirs(files))
+        return 0;
+
+    for (size_t i = 0; i < files->size(); i++)
+        order->push_back(i);
+    std::sort(order->begin(), order->end(), [&](size_t a, size_t b) {
+        return (*files)[a].entry.file_size > (*files)[b].entry.file_size;
+    });
+
+    return 1;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-j threads] [-r] [-v] IMAGE\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<file_t> files;
+    std::vector<size_t> order;
+    bool fix = false, verbose = false;
+    totals_t totals;
+    double start;
+    int opt, errors, fixed;
+    uint64_t freed;
+
+    nthreads = std::thread::hardware_concurrency();
+    while ((opt = getopt(argc, argv, "j:rv")) != -1) {
+        switch (opt) {
+            case 'j':
+                nthreads = atoi(optarg);
+                break;
+            case 'r':
+                fix = true;
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (nthreads < 1)
+        nthreads = 1;
+
+    if (!open_image(argv[optind], fix))
+        return 1;
+    if (!fat_get_fs_layout(fs, &layout) || layout.fat_offset + layout.fat_size > image_size) {
+        fprintf(stderr, "%s: FAT runs off the image\n", argv[optind]);
+        close_image(false);
+        return 1;
+    }
+    fat = image + layout.fat_offset;
+    fat_entries = layout.fat_size / layout.fat_entry_size;
+    refs = new std::atomic<uint16_t>[fat_entries];
+
+    start = now_s();
+    if (!scan(&files, &order)) {
+        fprintf(stderr, "%s: no root directory\n", argv[optind]);
+        close_image(false);
+        return 1;
+    }
+
+    check(files, order, &totals);
+    errors = report(files, totals, verbose);
+    fprintf(stderr, "checked in %.2f s on %d threads\n", now_s() - start, nthreads);
+
+    if (fix && errors) {
+        fixed = repair(files);
+
+        // What's still referenced now, so the rest can go
+        scan(&files, &order);
+        check(files, order, &totals);
+        freed = free_lost();
+        printf("%d files repaired, %llu lost clusters freed\n", fixed, (unsigned long long)freed);
+
+        check(files, order, &totals);
+        errors = report(files, totals, verbose);
+    }
+
+    close_image(fix);
+    delete[] refs;
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,169 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <mbed.h>
+#include <string.h>
+
+#include "capture.h"
+#include "drive.h"
+
+#define MIN_HDOP_THRESHOLD 500 // As main.cpp
+
+static const char *events[] = {"", "moved", "started", "stopped"};
+
+static uint16_t get16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+Drive::Drive(int baud, FILE *trace) :
+    _gps(NC, NC),
+    _trace(trace),
+    _t(0),
+    _first(0),
+    _fix_t(0),
+    _ready(false),
+    _hdop(TinyGPS::GPS_INVALID_HDOP)
+{
+    // Start, data and stop bits
+    this->_byte_us = 10 * 1000000 / baud;
+    memset(&this->_stats, 0, sizeof(this->_stats));
+    this->_gps.set_enabled(true);
+}
+
+int Drive::replay(const char *fn)
+{
+    uint8_t chunk[CAPTURE_CHUNK_SIZE];
+    FILE *f;
+
+    f = fopen(fn, "rb");
+    if (!f)
+        return 0;
+
+    while (fread(chunk, sizeof(chunk), 1, f) == 1)
+        this->_chunk(chunk);
+    fclose(f);
+
+    this->_stats.capture_s = (uint32_t)(this->_t - this->_first) / 1e6;
+    return 1;
+}
+
+void Drive::_chunk(const uint8_t *chunk)
+{
+    const uint8_t *mark;
+    int i, m, marks, len;
+
+    len = get16(&chunk[2]);
+    marks = chunk[8];
+    if (chunk[0] != CAPTURE_MAGIC || chunk[1] != CAPTURE_VERSION
+        || len > CAPTURE_DATA_MAX || marks > CAPTURE_MARKS_MAX) {
+        this->_stats.bad++;
+        return;
+    }
+    this->_stats.chunks++;
+
+    if (get32(&chunk[4]) != this->_stats.dropped) {
+        if (this->_trace)
+            fprintf(this->_trace, "%10.3f dropped %lu bytes\n", this->_t / 1e6,
+                (unsigned long)(get32(&chunk[4]) - this->_stats.dropped));
+        this->_stats.dropped = get32(&chunk[4]);
+    }
+
+    for (i = 0, m = 0; i < len; i++) {
+        mark = &chunk[12 + m * CAPTURE_MARK_SIZE];
+        if (m < marks && get16(mark) == i) {
+            this->_t = get32(&mark[2]);
+            m++;
+        } else {
+            this->_t += this->_byte_us;
+        }
+        if (!this->_stats.bytes)
+            this->_first = this->_t;
+
+        shim_now_us = this->_t;
+        shim_rx(chunk[CAPTURE_HEADER_LEN + i]);
+        this->_run_gps();
+        this->_stats.bytes++;
+    }
+}
+
+// run_gps(), without the display and storage
+void Drive::_run_gps(void)
+{
+    double lat, lon, mph;
+    unsigned long age;
+    odom_event_t event;
+    int new_hdop;
+
+    if (!this->_gps.changed())
+        return;
+    this->_stats.sentences++;
+
+    new_hdop = this->_gps.hdop();
+    if (new_hdop)
+        this->_hdop = new_hdop;
+
+    if (!this->_ready && this->_hdop <= MIN_HDOP_THRESHOLD && this->_gps.gps_good_data()) {
+        this->_ready = true;
+        if (this->_trace)
+            fprintf(this->_trace, "%10.3f ready\n", this->_t / 1e6);
+    }
+    if (!this->_ready)
+        return;
+
+    if (!this->_gps.gps_good_data()) {
+        this->_odom.lost_fix();
+        return;
+    }
+
+    this->_gps.d_get_position(&lat, &lon, &age);
+    mph = this->_gps.d_speed_mph();
+    event = this->_odom.update(lat, lon, mph);
+    this->_stats.fixes++;
+
+    if (mph > this->_stats.max_mph)
+        this->_stats.max_mph = mph;
+    if (this->_odom.moving()) {
+        if (event != ODOM_STARTED)
+            this->_stats.moving_s += (uint32_t)(this->_t - this->_fix_t) / 1e6;
+        this->_stats.moving_mph_sum += mph;
+        this->_stats.moving_fixes++;
+    }
+    this->_fix_t = this->_t;
+
+    if (this->_trace && event != ODOM_NO_CHANGE && event != ODOM_MOVED)
+        fprintf(this->_trace, "%10.3f %s at %.6f,%.6f %.1f mph, odom %.3f mi\n",
+            this->_t / 1e6, events[event], lat, lon,
+            mph, this->_odom.get_odom(ODOM_ENGINE));
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+
+#include "odom.h"
+#include "ublox.h"
+
+struct drive_stats_t {
+    unsigned long chunks;
+    unsigned long bad;       // Chunks that didn't check out
+    unsigned long bytes;
+    unsigned long dropped;   // Lost on the device, capture ring full
+    unsigned long sentences; // RMC/GGA
+    unsigned long fixes;     // Fed to Odom
+    double capture_s;
+    double moving_s;
+    double max_mph;
+    double moving_mph_sum;   // Over moving fixes, for the mean
+    unsigned long moving_fixes;
+};
+
+/*
+ * One raw.bin capture through the firmware's receiver code and Odom,
+ * with run_gps()'s gating. Each byte is delivered at the time it came
+ * in: bursts start at their marker and run on at the wire rate.
+ *
+ * The shim clock and serial are per thread, so drives can run side by
+ * side as long as each stays on the thread that made it.
+ */
+class Drive
+{
+public:
+    Drive(int baud = 115200, FILE *trace = NULL);
+
+    // 0 if the file can't be read
+    int replay(const char *fn);
+
+    const drive_stats_t &stats(void) const { return this->_stats; }
+    double odom_mi(void) { return this->_odom.get_odom(ODOM_ENGINE); }
+
+private:
+    void _chunk(const uint8_t *chunk);
+    void _run_gps(void);
+
+    Ublox _gps;
+    Odom _odom;
+    FILE *_trace;
+    uint32_t _byte_us;
+    uint32_t _t;
+    uint32_t _first;
+    uint32_t _fix_t;
+    bool _ready;
+    int _hdop;
+    drive_stats_t _stats;
+};
@@ -0,0 +1,550 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Card image toolkit
+ *
+ * Opens a raw card image through the firmware's own sd-reader code, with
+ * the image mmap()ed in place of the card, to look at what the speedo
+ * sees without it:
+ *
+ *   fatimg IMAGE ls [DIR]          list a directory
+ *   fatimg IMAGE get FILE [OUT]    extract a file, to stdout without OUT
+ *   fatimg IMAGE put FILE [IN]     append to a file, from stdin without IN
+ *   fatimg IMAGE verify            read every file, check the chains
+ *   fatimg IMAGE decode [-q] FILE  track logs as CSV, raw.bin and odom.bin
+ *                                  summarised, text as is; -q only times
+ *                                  the track decode
+ *   fatimg IMAGE mkfs MB           make a blank FAT32 card image
+ *
+ * Only put opens the image for writing, mkfs replaces it.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include <sd-reader/fat.h>
+#include <sd-reader/partition.h>
+
+#include "capture.h"
+#include "common.h"
+#include "image.h"
+#include "mkfs.h"
+#include "storage.h"
+#include "track.h"
+
+#define COPY_CHUNK (64 * 1024)
+
+static struct fat_file_struct *open_path(const char *path, struct fat_dir_entry_struct *entry)
+{
+    if (!fat_get_dir_entry_of_path(fs, path, entry) || (entry->attributes & FAT_ATTRIB_DIR)) {
+        fprintf(stderr, "%s: no such file\n", path);
+        return NULL;
+    }
+
+    return fat_open_file(fs, entry);
+}
+
+/*
+ * Commands
+ */
+
+static int cmd_ls(const char *path)
+{
+    struct fat_dir_entry_struct entry;
+    struct fat_dir_struct *dd;
+    uint16_t year;
+    uint8_t month, day, hour, min, sec;
+
+    if (!fat_get_dir_entry_of_path(fs, path, &entry) || !(entry.attributes & FAT_ATTRIB_DIR)) {
+        fprintf(stderr, "%s: no such directory\n", path);
+        return 1;
+    }
+
+    dd = fat_open_dir(fs, &entry);
+    if (!dd)
+        return 1;
+
+    while (fat_read_dir(dd, &entry)) {
+        fat_get_file_modification_date(&entry, &year, &month, &day);
+        fat_get_file_modification_time(&entry, &hour, &min, &sec);
+        printf("%04u-%02u-%02u %02u:%02u:%02u %10lu %s%s\n",
+            year, month, day, hour, min, sec,
+            (unsigned long)entry.file_size, entry.long_name,
+            entry.attributes & FAT_ATTRIB_DIR ? "/" : "");
+    }
+
+    fat_close_dir(dd);
+    return 0;
+}
+
+static int cmd_get(const char *path, const char *out_fn)
+{
+    struct fat_dir_entry_struct entry;
+    struct fat_file_struct *fd;
+    static uint8_t buffer[COPY_CHUNK];
+    intptr_t count;
+    uint32_t total = 0;
+    FILE *out = stdout;
+
+    fd = open_path(path, &entry);
+    if (!fd)
+        return 1;
+
+    if (out_fn && !(out = fopen(out_fn, "wb"))) {
+        perror(out_fn);
+        fat_close_file(fd);
+        return 1;
+    }
+
+    while ((count = fat_read_file(fd, buffer, sizeof(buffer))) > 0) {
+        fwrite(buffer, 1, count, out);
+        total += count;
+    }
+
+    fat_close_file(fd);
+    if (out != stdout)
+        fclose(out);
+
+    if (count < 0 || total != entry.file_size) {
+        fprintf(stderr, "%s: read %lu of %lu bytes\n", path, (unsigned long)total, (unsigned long)entry.file_size);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int cmd_put(const char *path, const char *in_fn)
+{
+    struct fat_dir_entry_struct entry;
+    struct fat_dir_struct *dd;
+    struct fat_file_struct *fd;
+    static uint8_t buffer[COPY_CHUNK];
+    char parent[256];
+    const char *name;
+    int32_t offset = 0;
+    size_t count;
+    FILE *in = stdin;
+    int result = 1;
+
+    if (in_fn && !(in = fopen(in_fn, "rb"))) {
+        perror(in_fn);
+        return 1;
+    }
+
+    // Split off the name, the parent must already be there
+    name = strrchr(path, '/');
+    if (name) {
+        snprintf(parent, sizeof(parent), "%.*s", (int)(name - path + 1), path);
+        name++;
+    } else {
+        strcpy(parent, "/");
+        name = path;
+    }
+
+    if (!fat_get_dir_entry_of_path(fs, parent, &entry) || !(entry.attributes & FAT_ATTRIB_DIR)) {
+        fprintf(stderr, "%s: no such directory\n", parent);
+        goto out_in;
+    }
+    dd = fat_open_dir(fs, &entry);
+    if (!dd)
+        goto out_in;
+
+    // Creating finds an existing one too
+    if (!fat_create_file(dd, name, &entry) && !fat_get_dir_entry_of_path(fs, path, &entry)) {
+        fprintf(stderr, "%s: can't create\n", path);
+        goto out_dir;
+    }
+
+    fd = fat_open_file(fs, &entry);
+    if (!fd)
+        goto out_dir;
+    if (!fat_seek_file(fd, &offset, FAT_SEEK_END))
+        goto out_file;
+
+    while ((count = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fat_write_file(fd, buffer, count) != (intptr_t)count) {
+            fprintf(stderr, "%s: write failed, card full?\n", path);
+            goto out_file;
+        }
+    }
+    result = 0;
+
+out_file:
+    fat_close_file(fd);
+out_dir:
+    fat_close_dir(dd);
+out_in:
+    if (in != stdin)
+        fclose(in);
+    return result;
+}
+
+struct extent_t {
+    offset_t offset;
+    uint32_t length;
+    const char *file;
+
+    bool operator<(const extent_t &other) const { return this->offset < other.offset; }
+};
+
+static std::vector<extent_t> extents;
+static std::vector<char *> names;
+
+// Follows one file's chain extent by extent and reads all of it
+static int verify_file(const char *path, const struct fat_dir_entry_struct *entry)
+{
+    struct fat_file_struct *fd;
+    static uint8_t buffer[COPY_CHUNK];
+    extent_t extent;
+    uint32_t pos = 0, length;
+    offset_t offset;
+    intptr_t count;
+    uint32_t total = 0;
+    int errors = 0;
+
+    fd = fat_open_file(fs, entry);
+    if (!fd) {
+        printf("%s: can't open\n", path);
+        return 1;
+    }
+
+    names.push_back(strdup(path));
+    extent.file = names.back();
+
+    while (pos < entry->file_size) {
+        if (!fat_get_file_extent(fd, pos, nullptr, nullptr, &offset, &length) || !length) {
+            printf("%s: chain ends at %lu of %lu bytes\n", path, (unsigned long)pos, (unsigned long)entry->file_size);
+            errors++;
+            break;
+        }
+        if (offset + length > image_size) {
+            printf("%s: runs off the image at %lu\n", path, (unsigned long)pos);
+            errors++;
+            break;
+        }
+        extent.offset = offset;
+        extent.length = length;
+        extents.push_back(extent);
+        pos += length;
+    }
+
+    while ((count = fat_read_file(fd, buffer, sizeof(buffer))) > 0)
+        total += count;
+    if (!errors && total != entry->file_size) {
+        printf("%s: read %lu of %lu bytes\n", path, (unsigned long)total, (unsigned long)entry->file_size);
+        errors++;
+    }
+
+    fat_close_file(fd);
+    return errors;
+}
+
+static int verify_dir(const char *path)
+{
+    struct fat_dir_entry_struct entry;
+    std::vector<struct fat_dir_entry_struct> entries;
+    struct fat_dir_struct *dd;
+    char child[512];
+    int errors = 0;
+
+    if (!fat_get_dir_entry_of_path(fs, path, &entry) || !(dd = fat_open_dir(fs, &entry))) {
+        printf("%s: can't open\n", path);
+        return 1;
+    }
+
+    // Only so many directories open at once, read it all first
+    while (fat_read_dir(dd, &entry)) {
+        if (strcmp(entry.long_name, ".") && strcmp(entry.long_name, ".."))
+            entries.push_back(entry);
+    }
+    fat_close_dir(dd);
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        snprintf(child, sizeof(child), "%s%s%s", path, entries[i].long_name,
+            entries[i].attributes & FAT_ATTRIB_DIR ? "/" : "");
+        if (entries[i].attributes & FAT_ATTRIB_DIR)
+            errors += verify_dir(child);
+        else
+            errors += verify_file(child, &entries[i]);
+    }
+
+    return errors;
+}
+
+static int cmd_verify(void)
+{
+    int errors = verify_dir("/");
+    uint64_t used = 0;
+
+    // Two files claiming the same clusters
+    std::sort(extents.begin(), extents.end());
+    for (size_t i = 0; i < extents.size(); i++) {
+        used += extents[i].length;
+        if (i > 0 && extents[i - 1].offset + extents[i - 1].length > extents[i].offset) {
+            printf("%s and %s are cross-linked\n", extents[i - 1].file, extents[i].file);
+            errors++;
+        }
+    }
+
+    printf("%lu files, %llu bytes allocated, %llu of %llu bytes free, %d errors\n",
+        (unsigned long)names.size(), (unsigned long long)used,
+        (unsigned long long)fat_get_fs_free(fs), (unsigned long long)fat_get_fs_size(fs),
+        errors);
+
+    for (size_t i = 0; i < names.size(); i++)
+        free(names[i]);
+
+    return errors ? 1 : 0;
+}
+
+typedef bool (*block_fn_t)(const uint8_t *block, void *p);
+
+// Hands out the file's whole blocks straight from the mapped image, one
+// contiguous run at a time
+static int for_each_block(struct fat_file_struct *fd, uint32_t size, block_fn_t fn, void *p)
+{
+    uint32_t pos = 0, length;
+    offset_t offset;
+
+    while (pos + STORAGE_BLOCK_SIZE <= size) {
+        if (!fat_get_file_extent(fd, pos, nullptr, nullptr, &offset, &length) || length < STORAGE_BLOCK_SIZE)
+            return 0;
+
+        for (; length >= STORAGE_BLOCK_SIZE && pos + STORAGE_BLOCK_SIZE <= size; length -= STORAGE_BLOCK_SIZE) {
+            if (!fn(image + offset, p))
+                return 0;
+            offset += STORAGE_BLOCK_SIZE;
+            pos += STORAGE_BLOCK_SIZE;
+        }
+    }
+
+    return 1;
+}
+
+struct track_stats_t {
+    unsigned long blocks;
+    unsigned long bad;
+    unsigned long fixes;
+    bool quiet;
+};
+
+static bool decode_track_block(const uint8_t *block, void *p)
+{
+    track_stats_t *stats = (track_stats_t *)p;
+    track_fix_t fixes[TRACK_BLOCK_SIZE];
+    int count;
+
+    stats->blocks++;
+    count = TrackBlock::decode(block, fixes, TRACK_BLOCK_SIZE);
+    if (count < 0) {
+        stats->bad++;
+        return true;
+    }
+    stats->fixes += count;
+
+    if (stats->quiet)
+        return true;
+
+    for (int i = 0; i < count; i++) {
+        printf("%lu,%02u,%.6f,%.6f,%.2f,%.2f,%.2f\n",
+            (unsigned long)fixes[i].utc, fixes[i].cs,
+            fixes[i].lat / 1e6, fixes[i].lon / 1e6,
+            fixes[i].speed / 100.0, fixes[i].course / 100.0, fixes[i].hdop / 100.0);
+    }
+
+    return true;
+}
+
+static int decode_track(struct fat_file_struct *fd, uint32_t size, bool quiet)
+{
+    track_stats_t stats = { 0, 0, 0, quiet };
+    struct timespec start, end;
+    double secs;
+    int result;
+
+    if (!quiet)
+        printf("utc,cs,lat,lon,speed_kn,course,hdop\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    result = for_each_block(fd, size, decode_track_block, &stats);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    fprintf(stderr, "%lu blocks (%lu bad), %lu fixes, %.1f MB/s\n",
+        stats.blocks, stats.bad, stats.fixes,
+        secs > 0 ? stats.blocks * TRACK_BLOCK_SIZE / secs / 1e6 : 0.0);
+
+    return result && !stats.bad ? 0 : 1;
+}
+
+struct capture_stats_t {
+    unsigned long chunks;
+    unsigned long bad;
+    unsigned long bytes;
+    unsigned long marks;
+    uint32_t dropped;
+};
+
+static bool decode_capture_chunk(const uint8_t *chunk, void *p)
+{
+    capture_stats_t *stats = (capture_stats_t *)p;
+
+    if (chunk[0] != CAPTURE_MAGIC || chunk[1] != CAPTURE_VERSION) {
+        stats->bad++;
+        return true;
+    }
+
+    stats->chunks++;
+    stats->bytes += chunk[2] | chunk[3] << 8;
+    stats->marks += chunk[8];
+    // Running total, the last one counts
+    stats->dropped = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (uint32_t)chunk[7] << 24;
+
+    return true;
+}
+
+static int decode_capture(struct fat_file_struct *fd, uint32_t size)
+{
+    capture_stats_t stats = { 0, 0, 0, 0, 0 };
+    int result;
+
+    result = for_each_block(fd, size, decode_capture_chunk, &stats);
+
+    printf("%lu chunks (%lu bad), %lu bytes, %lu markers, %lu dropped\n",
+        stats.chunks, stats.bad, stats.bytes, stats.marks, (unsigned long)stats.dropped);
+
+    return result && !stats.bad ? 0 : 1;
+}
+
+static int cmd_decode(const char *path, bool quiet)
+{
+    struct fat_dir_entry_struct entry;
+    struct fat_file_struct *fd;
+    uint8_t head[2];
+    double odom[ODOM_COUNT];
+    int result = 0;
+
+    fd = open_path(path, &entry);
+    if (!fd)
+        return 1;
+
+    if (fat_read_file(fd, head, sizeof(head)) != sizeof(head)) {
+        head[0] = head[1] = 0;
+    }
+
+    if (head[0] == TRACK_MAGIC && head[1] == TRACK_VERSION) {
+        result = decode_track(fd, entry.file_size, quiet);
+    } else if (head[0] == CAPTURE_MAGIC && head[1] == CAPTURE_VERSION) {
+        result = decode_capture(fd, entry.file_size);
+    } else if (entry.file_size == sizeof(odom)) {
+        // odom.bin, in miles
+        int32_t seek = 0;
+        fat_seek_file(fd, &seek, FAT_SEEK_SET);
+        fat_read_file(fd, (uint8_t *)odom, sizeof(odom));
+        printf("odom %.6f, trip A %.6f, trip B %.6f\n", odom[ODOM_ENGINE], odom[ODOM_TRIP_A], odom[ODOM_TRIP_B]);
+    } else {
+        fat_close_file(fd);
+        return cmd_get(path, NULL);
+    }
+
+    fat_close_file(fd);
+    return result;
+}
+
+// A blank card as formatted on a PC, see mkfs()
+static int cmd_mkfs(const char *fn, uint32_t mb)
+{
+    uint32_t clusters, cluster_size;
+
+    clusters = mkfs(fn, mb, 4096, &cluster_size);
+    if (!clusters)
+        return 1;
+
+    printf("%u clusters of %u bytes\n", clusters, cluster_size);
+    return 0;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+        "usage: %s IMAGE ls [DIR]\n"
+        "       %s IMAGE get FILE [OUT]\n"
+        "       %s IMAGE put FILE [IN]\n"
+        "       %s IMAGE verify\n"
+        "       %s IMAGE decode [-q] FILE\n"
+        "       %s IMAGE mkfs MB\n",
+        argv0, argv0, argv0, argv0, argv0, argv0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *cmd;
+    bool writable;
+    int result;
+
+    if (argc < 3) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    cmd = argv[2];
+    if (!strcmp(cmd, "mkfs") && argc > 3)
+        return cmd_mkfs(argv[1], strtoul(argv[3], NULL, 0));
+
+    writable = !strcmp(cmd, "put");
+    if (!open_image(argv[1], writable))
+        return 1;
+
+    if (!strcmp(cmd, "ls"))
+        result = cmd_ls(argc > 3 ? argv[3] : "/");
+    else if (!strcmp(cmd, "get") && argc > 3)
+        result = cmd_get(argv[3], argc > 4 ? argv[4] : NULL);
+    else if (!strcmp(cmd, "put") && argc > 3)
+        result = cmd_put(argv[3], argc > 4 ? argv[4] : NULL);
+    else if (!strcmp(cmd, "verify"))
+        result = cmd_verify();
+    else if (!strcmp(cmd, "decode") && argc > 4 && !strcmp(argv[3], "-q"))
+        result = cmd_decode(argv[4], true);
+    else if (!strcmp(cmd, "decode") && argc > 3)
+        result = cmd_decode(argv[3], false);
+    else {
+        usage(argv[0]);
+        result = 2;
+    }
+
+    close_image(writable);
+    return result;
+}
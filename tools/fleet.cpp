@@ -0,0 +1,302 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Batch analytics over many recorded drives
+ *
+ * Each DRIVE is a directory holding a raw.bin capture and/or an odom.log,
+ * as copied off a card with fatimg, or one of those files on its own;
+ * with - the drives are read from stdin, one per line. Captures are
+ * replayed through the firmware's receiver code and Odom (see Drive), and
+ * where there is a log too, the replayed distance is held against what
+ * the odometer logged over the same drive.
+ *
+ *   fleet [-j threads] [-b baud] DRIVE... > report.csv
+ *
+ * One CSV row per drive, in the order given. Drives are independent, so
+ * each worker just takes the next one, biggest first to keep the tail
+ * short.
+ */
+
+#include <mbed.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture.h"
+#include "drive.h"
+
+struct log_stats_t {
+    unsigned long lines;
+    unsigned long backsteps; // Engine odometer went down
+    double first_mi;
+    double last_mi;
+};
+
+struct job_t {
+    std::string name;
+    std::string raw;
+    std::string log;
+    off_t size;
+
+    bool ok;
+    drive_stats_t drive;
+    double odom_mi;
+    log_stats_t log_stats;
+};
+
+static std::vector<job_t> jobs;
+static std::vector<size_t> order;
+static std::atomic<size_t> next_job;
+static int baud = 115200;
+
+static off_t file_size(const std::string &fn)
+{
+    struct stat st;
+
+    if (fn.empty() || stat(fn.c_str(), &st) < 0)
+        return 0;
+    return st.st_size;
+}
+
+static bool is_capture(const char *fn)
+{
+    uint8_t head[2] = {0, 0};
+    FILE *f = fopen(fn, "rb");
+
+    if (!f)
+        return false;
+    if (fread(head, sizeof(head), 1, f) != 1)
+        head[0] = 0;
+    fclose(f);
+
+    return head[0] == CAPTURE_MAGIC && head[1] == CAPTURE_VERSION;
+}
+
+static int add_job(const char *path)
+{
+    struct stat st;
+    job_t job;
+
+    if (stat(path, &st) < 0) {
+        perror(path);
+        return 0;
+    }
+
+    job.name = path;
+    if (S_ISDIR(st.st_mode)) {
+        job.raw = job.name + "/raw.bin";
+        job.log = job.name + "/odom.log";
+        if (access(job.raw.c_str(), R_OK) < 0)
+            job.raw.clear();
+        if (access(job.log.c_str(), R_OK) < 0)
+            job.log.clear();
+    } else if (is_capture(path)) {
+        job.raw = path;
+    } else {
+        job.log = path;
+    }
+
+    job.size = file_size(job.raw) + file_size(job.log);
+    job.ok = false;
+    job.odom_mi = 0;
+    memset(&job.drive, 0, sizeof(job.drive));
+    memset(&job.log_stats, 0, sizeof(job.log_stats));
+    jobs.push_back(job);
+
+    return 1;
+}
+
+// Lines as save_odom() writes them, up to the preallocated zeroes
+static int read_log(const char *fn, log_stats_t *stats)
+{
+    char line[160];
+    double engine, trip_a, trip_b;
+    FILE *f;
+
+    f = fopen(fn, "r");
+    if (!f)
+        return 0;
+
+    while (fgets(line, sizeof(line), f) && line[0]) {
+        // Unsynced lines have no stamp, but the distances still count
+        if (sscanf(line, "unsynced, %lf, %lf, %lf", &engine, &trip_a, &trip_b) != 3
+            && sscanf(line, "%*s %*[^,], %lf, %lf, %lf", &engine, &trip_a, &trip_b) != 3)
+            continue;
+        if (!stats->lines)
+            stats->first_mi = engine;
+        else if (engine < stats->last_mi)
+            stats->backsteps++;
+        stats->last_mi = engine;
+        stats->lines++;
+    }
+    fclose(f);
+
+    return 1;
+}
+
+static void run_job(job_t *job)
+{
+    job->ok = true;
+
+    if (!job->raw.empty()) {
+        Drive drive(baud);
+
+        if (drive.replay(job->raw.c_str())) {
+            job->drive = drive.stats();
+            job->odom_mi = drive.odom_mi();
+        } else {
+            job->ok = false;
+        }
+    }
+
+    if (!job->log.empty() && !read_log(job->log.c_str(), &job->log_stats))
+        job->ok = false;
+}
+
+static void worker(void)
+{
+    size_t i;
+
+    while ((i = next_job++) < order.size())
+        run_job(&jobs[order[i]]);
+}
+
+static void print_report(void)
+{
+    printf("drive,ok,bytes,bad_chunks,dropped,sentences,fixes,capture_s,moving_s,"
+        "distance_mi,max_mph,mean_mph,log_lines,log_backsteps,log_mi,drift_mi,drift_pct\n");
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const job_t &job = jobs[i];
+        const drive_stats_t &d = job.drive;
+        const log_stats_t &l = job.log_stats;
+        double log_mi = l.last_mi - l.first_mi;
+
+        printf("%s,%d,", job.name.c_str(), job.ok);
+        if (!job.raw.empty()) {
+            printf("%lu,%lu,%lu,%lu,%lu,%.1f,%.1f,%.6f,%.1f,%.1f,",
+                d.bytes, d.bad, d.dropped, d.sentences, d.fixes,
+                d.capture_s, d.moving_s, job.odom_mi, d.max_mph,
+                d.moving_fixes ? d.moving_mph_sum / d.moving_fixes : 0.0);
+        } else {
+            printf(",,,,,,,,,,");
+        }
+        if (!job.log.empty())
+            printf("%lu,%lu,%.6f,", l.lines, l.backsteps, log_mi);
+        else
+            printf(",,,");
+        if (!job.raw.empty() && l.lines > 1) {
+            printf("%.6f,", job.odom_mi - log_mi);
+            if (log_mi > 0)
+                printf("%.3f", 100 * (job.odom_mi - log_mi) / log_mi);
+        } else {
+            printf(",");
+        }
+        printf("\n");
+    }
+}
+
+static bool bigger(size_t a, size_t b)
+{
+    return jobs[a].size > jobs[b].size;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::thread> threads;
+    int nthreads = std::thread::hardware_concurrency();
+    char line[1024];
+    struct timespec start, end;
+    double secs, bytes = 0;
+    int opt, i, failed = 0;
+
+    while ((opt = getopt(argc, argv, "b:j:")) != -1) {
+        switch (opt) {
+            case 'b':
+                baud = atoi(optarg);
+                break;
+            case 'j':
+                nthreads = atoi(optarg);
+                break;
+            default:
+                goto usage;
+        }
+    }
+    if (optind == argc || baud <= 0)
+        goto usage;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    for (i = optind; i < argc; i++) {
+        if (strcmp(argv[i], "-")) {
+            add_job(argv[i]);
+            continue;
+        }
+        while (fgets(line, sizeof(line), stdin)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0])
+                add_job(line);
+        }
+    }
+
+    for (size_t j = 0; j < jobs.size(); j++) {
+        order.push_back(j);
+        bytes += jobs[j].size;
+    }
+    std::sort(order.begin(), order.end(), bigger);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nthreads; i++)
+        threads.push_back(std::thread(worker));
+    for (i = 0; i < nthreads; i++)
+        threads[i].join();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    print_report();
+
+    for (size_t j = 0; j < jobs.size(); j++)
+        failed += !jobs[j].ok;
+    fprintf(stderr, "%lu drives (%d failed), %.1f MB in %.2f s on %d threads, %.1f MB/s\n",
+        (unsigned long)jobs.size(), failed, bytes / 1e6, secs, nthreads,
+        secs > 0 ? bytes / secs / 1e6 : 0.0);
+
+    return failed ? 1 : 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-j threads] [-b baud] DRIVE...|-\n", argv[0]);
+    return 2;
+}
@@ -0,0 +1,165 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "image.h"
+
+uint8_t *image;
+size_t image_size;
+
+struct partition_struct *partition;
+struct fat_fs_struct *fs;
+
+/*
+ * The card, as sd-reader wants it
+ */
+
+static uint8_t image_read(offset_t offset, uint8_t *buffer, uintptr_t length)
+{
+    if (offset + length > image_size)
+        return 0;
+    memcpy(buffer, image + offset, length);
+    return 1;
+}
+
+static uint8_t image_read_interval(offset_t offset, uint8_t *buffer, uintptr_t interval, uintptr_t length, device_read_callback_t callback, void *p)
+{
+    if (!buffer || interval == 0 || length < interval || !callback)
+        return 0;
+
+    while (length >= interval) {
+        if (!image_read(offset, buffer, interval))
+            return 0;
+        if (!callback(buffer, offset, p))
+            break;
+        offset += interval;
+        length -= interval;
+    }
+
+    return 1;
+}
+
+static uint8_t image_write(offset_t offset, const uint8_t *buffer, uintptr_t length)
+{
+    if (offset + length > image_size)
+        return 0;
+    memcpy(image + offset, buffer, length);
+    return 1;
+}
+
+static uint8_t image_write_interval(offset_t offset, uint8_t *buffer, uintptr_t length, device_write_callback_t callback, void *p)
+{
+    uintptr_t count;
+    bool endless = length == 0;
+
+    if (!buffer || !callback)
+        return 0;
+
+    while (endless || length > 0) {
+        count = callback(buffer, offset, p);
+        if (!count)
+            break;
+        if (!endless && count > length)
+            return 0;
+        if (!image_write(offset, buffer, count))
+            return 0;
+        offset += count;
+        length -= count;
+    }
+
+    return 1;
+}
+
+// Directory entry timestamps, see fat_config.h
+extern "C" void get_datetime(uint16_t *year, uint8_t *month, uint8_t *day, uint8_t *hour, uint8_t *min, uint8_t *sec)
+{
+    time_t now = time(NULL);
+    struct tm *tm = gmtime(&now);
+
+    *year = tm->tm_year + 1900;
+    *month = tm->tm_mon + 1;
+    *day = tm->tm_mday;
+    *hour = tm->tm_hour;
+    *min = tm->tm_min;
+    *sec = tm->tm_sec;
+}
+
+int open_image(const char *fn, bool writable)
+{
+    struct stat st;
+    int fd;
+
+    fd = open(fn, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(fn);
+        return 0;
+    }
+
+    image_size = st.st_size;
+    // Read only, writes stay private; big cards needn't fit in swap for it
+    image = (uint8_t *)mmap(NULL, image_size, PROT_READ | PROT_WRITE, writable ? MAP_SHARED : MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        perror(fn);
+        return 0;
+    }
+
+    // As FS::open_volume(): first partition, or the whole card
+    partition = partition_open(image_read, image_read_interval, image_write, image_write_interval, 0);
+    if (!partition)
+        partition = partition_open(image_read, image_read_interval, image_write, image_write_interval, -1);
+    if (!partition) {
+        fprintf(stderr, "%s: no partition\n", fn);
+        return 0;
+    }
+
+    fs = fat_open(partition);
+    if (!fs) {
+        fprintf(stderr, "%s: no FAT filesystem\n", fn);
+        return 0;
+    }
+
+    return 1;
+}
+
+void close_image(bool writable)
+{
+    fat_close(fs);
+    partition_close(partition);
+    if (writable)
+        msync(image, image_size, MS_SYNC);
+    munmap(image, image_size);
+}
@@ -0,0 +1,631 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Exports the speedo's logs for mapping
+ *
+ *   logexport [-f gpx|csv] [-s FROM] [-e TO] [-g GAP] [-o OUT | -t PREFIX] LOG...
+ *
+ * Each LOG is one of these, taken in the order given:
+ *   - a track log, as DD-NN.trk or an old track.bin: GPX 1.1 or CSV
+ *   - an odom.log: CSV only, it has no positions
+ * The two kinds don't mix in one run.
+ *
+ * FROM and TO limit the time range. Each is seconds since 1970 or
+ * YYYY-MM-DDTHH:MM:SS, UTC. A track log is bisected to FROM and read up
+ * to TO.
+ *
+ * More than GAP seconds between records (900 by default) starts a new
+ * trip. Trips are a <trk> each in GPX and numbered in CSV. With -t each
+ * one goes to its own new PREFIX-YYYYMMDD-HHMMSS.gpx or .csv. Otherwise
+ * everything goes to OUT, or to stdout.
+ *
+ * Logs are streamed through fixed buffers, so memory stays the same
+ * however big they get. Numbers are formatted by hand from the logs'
+ * own fixed point, to keep up with the disk.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "track.h"
+
+#define READ_BLOCKS  2048        // Track blocks read at a time, 1 MB
+#define OUT_BUF      (1 << 20)
+#define OUT_MAX_LINE 256         // Longest record written
+#define DEFAULT_GAP  900
+
+enum format_t {
+    FORMAT_GPX,
+    FORMAT_CSV,
+};
+
+enum input_t {
+    INPUT_NONE,
+    INPUT_TRACK,
+    INPUT_ODOM,
+};
+
+static format_t format = FORMAT_GPX;
+static input_t input = INPUT_NONE;
+static uint32_t from = 0, to = UINT32_MAX, gap = DEFAULT_GAP;
+static const char *prefix;
+
+// Output, buffered by hand
+static FILE *out;
+static char out_buf[OUT_BUF];
+static size_t out_len;
+static bool out_failed;
+
+// The trip being written
+static bool in_trip;
+static uint32_t trip_last;
+static int trips;
+static uint64_t records;
+
+/*
+ * Output
+ */
+
+static void out_flush(void)
+{
+    if (out_len && fwrite(out_buf, 1, out_len, out) != out_len)
+        out_failed = true;
+    out_len = 0;
+}
+
+// Room for one record, at the end of the buffer
+static char *out_reserve(void)
+{
+    if (out_len > OUT_BUF - OUT_MAX_LINE)
+        out_flush();
+    return out_buf + out_len;
+}
+
+static void out_commit(char *end)
+{
+    out_len = end - out_buf;
+}
+
+static void out_str(const char *s)
+{
+    char *p = out_reserve();
+    size_t len = strlen(s);
+
+    memcpy(p, s, len);
+    out_commit(p + len);
+}
+
+static char *put_str(char *p, const char *s)
+{
+    while (*s)
+        *p++ = *s++;
+    return p;
+}
+
+static char *put_uint(char *p, uint32_t value, int width)
+{
+    char digits[10];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (width-- > n)
+        *p++ = '0';
+    while (n)
+        *p++ = digits[--n];
+    return p;
+}
+
+// value / 10^places, with all its places
+static char *put_fixed(char *p, int32_t value, int places)
+{
+    static const uint32_t scale[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+    uint32_t v;
+
+    if (value < 0) {
+        *p++ = '-';
+        v = -(int64_t)value;
+    } else {
+        v = value;
+    }
+    p = put_uint(p, v / scale[places], 1);
+    *p++ = '.';
+    return put_uint(p, v % scale[places], places);
+}
+
+// YYYY-MM-DDTHH:MM:SS.ccZ, the date only worked out once a day
+static char *put_time(char *p, uint32_t utc, int cs)
+{
+    static uint32_t day = UINT32_MAX;
+    static char date[16];
+    uint32_t sod = utc % 86400;
+
+    if (utc / 86400 != day) {
+        time_t t = utc;
+        struct tm tm;
+
+        gmtime_r(&t, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%dT", &tm);
+        day = utc / 86400;
+    }
+
+    p = put_str(p, date);
+    p = put_uint(p, sod / 3600, 2);
+    *p++ = ':';
+    p = put_uint(p, sod / 60 % 60, 2);
+    *p++ = ':';
+    p = put_uint(p, sod % 60, 2);
+    if (cs >= 0) {
+        *p++ = '.';
+        p = put_uint(p, cs, 2);
+    }
+    *p++ = 'Z';
+    return p;
+}
+
+/*
+ * Trips
+ */
+
+static const char *csv_header(void)
+{
+    if (input == INPUT_ODOM)
+        return "trip,time,age_s,engine_mi,trip_a_mi,trip_b_mi\n";
+    return "trip,time,lat,lon,speed_kn,course,hdop\n";
+}
+
+static void gpx_header(void)
+{
+    out_str("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<gpx version=\"1.1\" creator=\"GPS_SPEEDO logexport\" xmlns=\"http://www.topografix.com/GPX/1/1\">\n");
+}
+
+// Starts the output as a whole, or each trip's own file
+static int out_open(uint32_t utc)
+{
+    const char *ext = format == FORMAT_GPX ? "gpx" : "csv";
+    char fn[1024], stamp[16];
+    time_t t = utc;
+    struct tm tm;
+
+    if (prefix) {
+        gmtime_r(&t, &tm);
+        strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+
+        // Trips starting the same second get a -N, nothing is overwritten
+        for (int n = 0; ; n++) {
+            if (n)
+                snprintf(fn, sizeof(fn), "%s-%s-%d.%s", prefix, stamp, n, ext);
+            else
+                snprintf(fn, sizeof(fn), "%s-%s.%s", prefix, stamp, ext);
+            out = fopen(fn, "wx");
+            if (out)
+                break;
+            if (errno != EEXIST) {
+                perror(fn);
+                return 0;
+            }
+        }
+    }
+
+    if (format == FORMAT_GPX)
+        gpx_header();
+    else
+        out_str(csv_header());
+    return 1;
+}
+
+static int out_close(void)
+{
+    int result;
+
+    if (format == FORMAT_GPX)
+        out_str("</gpx>\n");
+    out_flush();
+
+    result = !out_failed && fflush(out) == 0;
+    if (!result)
+        perror(prefix ? prefix : "output");
+    if (prefix)
+        result = fclose(out) == 0 && result;
+    out_failed = false;
+    return result;
+}
+
+static void trip_end(void)
+{
+    if (!in_trip)
+        return;
+    if (format == FORMAT_GPX)
+        out_str("</trkseg></trk>\n");
+    in_trip = false;
+    if (prefix)
+        out_close();
+}
+
+// Sets up for a record at utc; false if output can't be had
+static bool trip_record(uint32_t utc)
+{
+    char *p;
+
+    // Logs given out of order start a trip too
+    if (in_trip && (utc > trip_last + gap || utc < trip_last))
+        trip_end();
+
+    if (!in_trip) {
+        if (prefix && !out_open(utc))
+            return false;
+        trips++;
+        in_trip = true;
+        if (format == FORMAT_GPX) {
+            p = out_reserve();
+            p = put_str(p, "<trk><name>");
+            p = put_time(p, utc, -1);
+            p = put_str(p, "</name><trkseg>\n");
+            out_commit(p);
+        }
+    }
+
+    trip_last = utc;
+    records++;
+    return true;
+}
+
+/*
+ * Track logs
+ */
+
+struct track_log_t {
+    int fd;
+};
+
+static bool read_block(uint32_t block, uint8_t *buf, void *p)
+{
+    track_log_t *log = (track_log_t *)p;
+
+    return pread(log->fd, buf, TRACK_BLOCK_SIZE, (off_t)block * TRACK_BLOCK_SIZE) == TRACK_BLOCK_SIZE;
+}
+
+static void track_fix(const track_fix_t &fix)
+{
+    char *p;
+
+    p = out_reserve();
+    if (format == FORMAT_GPX) {
+        p = put_str(p, "<trkpt lat=\"");
+        p = put_fixed(p, fix.lat, 6);
+        p = put_str(p, "\" lon=\"");
+        p = put_fixed(p, fix.lon, 6);
+        p = put_str(p, "\"><time>");
+        p = put_time(p, fix.utc, fix.cs);
+        p = put_str(p, "</time>");
+        if (fix.hdop) {
+            p = put_str(p, "<hdop>");
+            p = put_fixed(p, fix.hdop, 2);
+            p = put_str(p, "</hdop>");
+        }
+        p = put_str(p, "</trkpt>\n");
+    } else {
+        p = put_uint(p, trips, 1);
+        *p++ = ',';
+        p = put_time(p, fix.utc, fix.cs);
+        *p++ = ',';
+        p = put_fixed(p, fix.lat, 6);
+        *p++ = ',';
+        p = put_fixed(p, fix.lon, 6);
+        *p++ = ',';
+        p = put_fixed(p, fix.speed, 2);
+        *p++ = ',';
+        p = put_fixed(p, fix.course, 2);
+        *p++ = ',';
+        p = put_fixed(p, fix.hdop, 2);
+        *p++ = '\n';
+    }
+    out_commit(p);
+}
+
+static int export_track(const char *fn, int fd)
+{
+    static uint8_t buf[READ_BLOCKS * TRACK_BLOCK_SIZE];
+    track_fix_t fixes[TRACK_BLOCK_SIZE];
+    track_log_t log = { fd };
+    uint32_t blocks, block, bad = 0;
+    struct stat st;
+    ssize_t got;
+    int32_t start;
+    int count;
+
+    if (fstat(fd, &st) < 0) {
+        perror(fn);
+        return 0;
+    }
+    blocks = st.st_size / TRACK_BLOCK_SIZE;
+
+    // Blocks are in time order, the one holding from is found in O(log n)
+    block = 0;
+    if (from) {
+        start = track_seek(read_block, &log, blocks, NULL, 0, from);
+        if (start > 0)
+            block = start;
+    }
+
+    while (block < blocks) {
+        got = pread(fd, buf, sizeof(buf), (off_t)block * TRACK_BLOCK_SIZE);
+        if (got < TRACK_BLOCK_SIZE) {
+            perror(fn);
+            return 0;
+        }
+
+        for (ssize_t at = 0; at + TRACK_BLOCK_SIZE <= got; at += TRACK_BLOCK_SIZE, block++) {
+            count = TrackBlock::decode(buf + at, fixes, TRACK_BLOCK_SIZE);
+            if (count < 0) {
+                bad++;
+                continue;
+            }
+            for (int i = 0; i < count; i++) {
+                if (fixes[i].utc < from)
+                    continue;
+                if (fixes[i].utc > to)
+                    goto done;
+                if (!trip_record(fixes[i].utc))
+                    return 0;
+                track_fix(fixes[i]);
+            }
+        }
+    }
+
+done:
+    if (bad)
+        fprintf(stderr, "%s: %u bad blocks skipped\n", fn, bad);
+    return 1;
+}
+
+/*
+ * odom.log, as save_odom() writes it
+ */
+
+static int export_odom(const char *fn, int fd)
+{
+    int year, month, day, hour, minute, second, ms;
+    unsigned long age;
+    unsigned unsynced = 0;
+    char line[OUT_MAX_LINE], *p;
+    struct tm tm;
+    uint32_t utc;
+    FILE *f;
+
+    f = fdopen(fd, "r");
+    if (!f) {
+        perror(fn);
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        char *fields = NULL;
+
+        // Saved before the RTC had GPS time, there's no telling when
+        if (!strncmp(line, "unsynced,", 9)) {
+            unsynced++;
+            continue;
+        }
+        if (sscanf(line, "%d-%d-%d %d:%d:%d.%d+%lu,", &year, &month, &day, &hour, &minute, &second, &ms, &age) != 8)
+            continue;
+        fields = strchr(line, ',');
+        if (!fields)
+            continue;
+
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year = year - 1900;
+        tm.tm_mon = month - 1;
+        tm.tm_mday = day;
+        tm.tm_hour = hour;
+        tm.tm_min = minute;
+        tm.tm_sec = second;
+        utc = timegm(&tm);
+        if (utc < from)
+            continue;
+        if (utc > to)
+            break;
+
+        if (!trip_record(utc)) {
+            fclose(f);
+            return 0;
+        }
+
+        // The distances go through as written, without the spaces
+        p = out_reserve();
+        p = put_uint(p, trips, 1);
+        *p++ = ',';
+        p = put_time(p, utc, ms / 10);
+        *p++ = ',';
+        p = put_uint(p, age, 1);
+        for (char *q = fields; *q && *q != '\n' && *q != '\r'; q++) {
+            if (*q != ' ')
+                *p++ = *q;
+        }
+        *p++ = '\n';
+        out_commit(p);
+    }
+
+    fclose(f);
+    if (unsynced)
+        fprintf(stderr, "%s: %u unsynced lines skipped\n", fn, unsynced);
+    return 1;
+}
+
+// Track logs are told by their first block, or by name when it's torn
+static input_t input_of(const char *fn, int fd)
+{
+    const char *dot = strrchr(fn, '.');
+    uint8_t head[2];
+
+    if (pread(fd, head, sizeof(head), 0) == sizeof(head) && head[0] == TRACK_MAGIC && head[1] == TRACK_VERSION)
+        return INPUT_TRACK;
+    if (dot && (!strcasecmp(dot, ".trk") || !strcasecmp(dot, ".bin")))
+        return INPUT_TRACK;
+    return INPUT_ODOM;
+}
+
+static int parse_time(const char *s, uint32_t *utc)
+{
+    struct tm tm;
+    char *end;
+
+    *utc = strtoul(s, &end, 10);
+    if (!*end)
+        return 1;
+
+    memset(&tm, 0, sizeof(tm));
+    end = strptime(s, "%Y-%m-%dT%H:%M:%S", &tm);
+    if (!end || *end)
+        return 0;
+    *utc = timegm(&tm);
+    return 1;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-f gpx|csv] [-s FROM] [-e TO] [-g GAP] [-o OUT | -t PREFIX] LOG...\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *out_fn = NULL;
+    input_t kind;
+    int opt, fd, result = 0;
+    double start;
+    struct timespec ts;
+
+    while ((opt = getopt(argc, argv, "f:s:e:g:o:t:")) != -1) {
+        switch (opt) {
+            case 'f':
+                if (!strcmp(optarg, "gpx"))
+                    format = FORMAT_GPX;
+                else if (!strcmp(optarg, "csv"))
+                    format = FORMAT_CSV;
+                else
+                    goto usage;
+                break;
+            case 's':
+                if (!parse_time(optarg, &from))
+                    goto usage;
+                break;
+            case 'e':
+                if (!parse_time(optarg, &to))
+                    goto usage;
+                break;
+            case 'g':
+                gap = strtoul(optarg, NULL, 0);
+                break;
+            case 'o':
+                out_fn = optarg;
+                break;
+            case 't':
+                prefix = optarg;
+                break;
+            default:
+                goto usage;
+        }
+    }
+    if (optind == argc || (out_fn && prefix))
+        goto usage;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    start = ts.tv_sec + ts.tv_nsec / 1e9;
+
+    out = stdout;
+    if (out_fn && !(out = fopen(out_fn, "w"))) {
+        perror(out_fn);
+        return 1;
+    }
+
+    for (int i = optind; i < argc; i++) {
+        fd = open(argv[i], O_RDONLY);
+        if (fd < 0) {
+            perror(argv[i]);
+            result = 1;
+            continue;
+        }
+
+        kind = input_of(argv[i], fd);
+        if (kind == INPUT_ODOM && format == FORMAT_GPX) {
+            fprintf(stderr, "%s: no positions in an odom.log, use -f csv\n", argv[i]);
+            close(fd);
+            result = 1;
+            continue;
+        }
+        if (input != INPUT_NONE && kind != input) {
+            fprintf(stderr, "%s: track logs and odom.log don't mix\n", argv[i]);
+            close(fd);
+            result = 1;
+            continue;
+        }
+
+        // The whole output's header goes ahead of the first record
+        if (input == INPUT_NONE) {
+            input = kind;
+            if (!prefix && !out_open(0))
+                return 1;
+        }
+
+        if (kind == INPUT_TRACK) {
+            if (!export_track(argv[i], fd))
+                result = 1;
+            close(fd);
+        } else if (!export_odom(argv[i], fd)) {
+            result = 1;
+        }
+    }
+
+    trip_end();
+    if (!prefix && input != INPUT_NONE && !out_close())
+        result = 1;
+    if (out_fn)
+        fclose(out);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    fprintf(stderr, "%llu records in %d trips, %.2f s\n",
+        (unsigned long long)records, trips, ts.tv_sec + ts.tv_nsec / 1e9 - start);
+    return result;
+
+usage:
+    usage(argv[0]);
+    return 2;
+}
@@ -0,0 +1,107 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mkfs.h"
+
+static void put_le(uint8_t *p, uint32_t value, int len)
+{
+    for (int i = 0; i < len; i++, value >>= 8)
+        p[i] = value & 0xff;
+}
+
+uint32_t mkfs(const char *fn, uint32_t mb, uint32_t max_cluster, uint32_t *cluster_size)
+{
+    const uint32_t reserved = 32;
+    const uint32_t sectors = mb * 2048;
+    uint32_t fat_sectors = 0, clusters = 0, need;
+    uint8_t boot[512] = { 0 };
+    uint8_t fat[12];
+    uint32_t spc;
+    int fd;
+
+    for (spc = max_cluster / 512; spc; spc /= 2) {
+        fat_sectors = 1;
+        for (;;) {
+            clusters = (sectors - reserved - 2 * fat_sectors) / spc;
+            need = ((clusters + 2) * 4 + 511) / 512;
+            if (need <= fat_sectors)
+                break;
+            fat_sectors = need;
+        }
+        if (clusters >= 65525)
+            break;
+    }
+    if (!spc) {
+        fprintf(stderr, "%s: too small for FAT32, 33 MB at least\n", fn);
+        return 0;
+    }
+
+    boot[0] = 0xeb;
+    boot[1] = 0x58;
+    boot[2] = 0x90;
+    memcpy(&boot[3], "MSWIN4.1", 8);
+    put_le(&boot[11], 512, 2);
+    boot[13] = spc;
+    put_le(&boot[14], reserved, 2);
+    boot[16] = 2;                        // FATs
+    boot[21] = 0xf8;                     // Fixed disk
+    put_le(&boot[24], 32, 2);            // Sectors per track
+    put_le(&boot[26], 64, 2);            // Heads
+    put_le(&boot[32], sectors, 4);
+    put_le(&boot[36], fat_sectors, 4);
+    put_le(&boot[44], 2, 4);             // Root directory cluster
+    boot[510] = 0x55;
+    boot[511] = 0xaa;
+
+    // Media, end of chain, and the root directory's one cluster
+    put_le(&fat[0], 0x0ffffff8, 4);
+    put_le(&fat[4], 0x0fffffff, 4);
+    put_le(&fat[8], 0x0fffffff, 4);
+
+    fd = open(fn, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)sectors * 512) < 0 ||
+        pwrite(fd, boot, sizeof(boot), 0) != sizeof(boot) ||
+        pwrite(fd, fat, sizeof(fat), (off_t)reserved * 512) != sizeof(fat) ||
+        pwrite(fd, fat, sizeof(fat), (off_t)(reserved + fat_sectors) * 512) != sizeof(fat)) {
+        perror(fn);
+        if (fd >= 0)
+            close(fd);
+        return 0;
+    }
+    close(fd);
+
+    if (cluster_size)
+        *cluster_size = spc * 512;
+    return clusters;
+}
@@ -0,0 +1,415 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NMEA_X86
+#endif
+
+#include "nmea.h"
+
+#define NMEA_BATCH 64
+
+struct nmea_ops_t {
+    const char *name;
+    const uint8_t *(*find_dollar)(const uint8_t *p, const uint8_t *end);
+    // Next '$', '*', '\r' or '\n'
+    const uint8_t *(*find_stop)(const uint8_t *p, const uint8_t *end);
+    uint8_t (*xor_bytes)(const uint8_t *p, size_t len);
+};
+
+static bool is_stop(uint8_t c)
+{
+    return c == '$' || c == '*' || c == '\r' || c == '\n';
+}
+
+static int from_hex(uint8_t c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/*
+ * Scalar
+ */
+
+static const uint8_t *scalar_find_dollar(const uint8_t *p, const uint8_t *end)
+{
+    while (p < end && *p != '$')
+        p++;
+    return p;
+}
+
+static const uint8_t *scalar_find_stop(const uint8_t *p, const uint8_t *end)
+{
+    while (p < end && !is_stop(*p))
+        p++;
+    return p;
+}
+
+static uint8_t scalar_xor_bytes(const uint8_t *p, size_t len)
+{
+    uint8_t x = 0;
+
+    while (len--)
+        x ^= *p++;
+    return x;
+}
+
+#ifdef NMEA_X86
+
+/*
+ * SSE2, 16 bytes at a time
+ */
+
+__attribute__((target("sse2")))
+static const uint8_t *sse2_find_dollar(const uint8_t *p, const uint8_t *end)
+{
+    const __m128i dollar = _mm_set1_epi8('$');
+    __m128i v;
+    int mask;
+
+    for (; p + 16 <= end; p += 16) {
+        v = _mm_loadu_si128((const __m128i *)p);
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, dollar));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return scalar_find_dollar(p, end);
+}
+
+__attribute__((target("sse2")))
+static const uint8_t *sse2_find_stop(const uint8_t *p, const uint8_t *end)
+{
+    const __m128i dollar = _mm_set1_epi8('$');
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    __m128i v, hit;
+    int mask;
+
+    for (; p + 16 <= end; p += 16) {
+        v = _mm_loadu_si128((const __m128i *)p);
+        hit = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, dollar), _mm_cmpeq_epi8(v, star)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+        mask = _mm_movemask_epi8(hit);
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return scalar_find_stop(p, end);
+}
+
+__attribute__((target("sse2")))
+static uint8_t sse2_fold(__m128i acc)
+{
+    acc = _mm_xor_si128(acc, _mm_srli_si128(acc, 8));
+    acc = _mm_xor_si128(acc, _mm_srli_si128(acc, 4));
+    acc = _mm_xor_si128(acc, _mm_srli_si128(acc, 2));
+    acc = _mm_xor_si128(acc, _mm_srli_si128(acc, 1));
+    return (uint8_t)_mm_cvtsi128_si32(acc);
+}
+
+__attribute__((target("sse2")))
+static uint8_t sse2_xor_bytes(const uint8_t *p, size_t len)
+{
+    __m128i acc = _mm_setzero_si128();
+    const uint8_t *end = p + len;
+
+    for (; p + 16 <= end; p += 16)
+        acc = _mm_xor_si128(acc, _mm_loadu_si128((const __m128i *)p));
+    return sse2_fold(acc) ^ scalar_xor_bytes(p, end - p);
+}
+
+/*
+ * AVX2, 32 bytes at a time
+ */
+
+__attribute__((target("avx2")))
+static const uint8_t *avx2_find_dollar(const uint8_t *p, const uint8_t *end)
+{
+    const __m256i dollar = _mm256_set1_epi8('$');
+    __m256i v;
+    unsigned mask;
+
+    for (; p + 32 <= end; p += 32) {
+        v = _mm256_loadu_si256((const __m256i *)p);
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, dollar));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return scalar_find_dollar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const uint8_t *avx2_find_stop(const uint8_t *p, const uint8_t *end)
+{
+    const __m256i dollar = _mm256_set1_epi8('$');
+    const __m256i star = _mm256_set1_epi8('*');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    __m256i v, hit;
+    unsigned mask;
+
+    for (; p + 32 <= end; p += 32) {
+        v = _mm256_loadu_si256((const __m256i *)p);
+        hit = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, dollar), _mm256_cmpeq_epi8(v, star)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+        mask = _mm256_movemask_epi8(hit);
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return scalar_find_stop(p, end);
+}
+
+__attribute__((target("avx2")))
+static uint8_t avx2_xor_bytes(const uint8_t *p, size_t len)
+{
+    __m256i acc = _mm256_setzero_si256();
+    __m128i half;
+    const uint8_t *end = p + len;
+
+    for (; p + 32 <= end; p += 32)
+        acc = _mm256_xor_si256(acc, _mm256_loadu_si256((const __m256i *)p));
+
+    // Folded here, not in sse2_fold(), to stay in VEX encoding
+    half = _mm_xor_si128(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    if (p + 16 <= end) {
+        half = _mm_xor_si128(half, _mm_loadu_si128((const __m128i *)p));
+        p += 16;
+    }
+    half = _mm_xor_si128(half, _mm_srli_si128(half, 8));
+    half = _mm_xor_si128(half, _mm_srli_si128(half, 4));
+    half = _mm_xor_si128(half, _mm_srli_si128(half, 2));
+    half = _mm_xor_si128(half, _mm_srli_si128(half, 1));
+    return (uint8_t)_mm_cvtsi128_si32(half) ^ scalar_xor_bytes(p, end - p);
+}
+
+#endif
+
+static const nmea_ops_t ops[NMEA_KERNEL_COUNT] = {
+    {"scalar", scalar_find_dollar, scalar_find_stop, scalar_xor_bytes},
+#ifdef NMEA_X86
+    {"sse2", sse2_find_dollar, sse2_find_stop, sse2_xor_bytes},
+    {"avx2", avx2_find_dollar, avx2_find_stop, avx2_xor_bytes},
+#else
+    {"sse2", NULL, NULL, NULL},
+    {"avx2", NULL, NULL, NULL},
+#endif
+};
+
+bool nmea_kernel_supported(nmea_kernel_t kernel)
+{
+    switch (kernel) {
+        case NMEA_KERNEL_SCALAR:
+            return true;
+#ifdef NMEA_X86
+        case NMEA_KERNEL_SSE2:
+            return __builtin_cpu_supports("sse2");
+        case NMEA_KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+nmea_kernel_t nmea_best_kernel(void)
+{
+    if (nmea_kernel_supported(NMEA_KERNEL_AVX2))
+        return NMEA_KERNEL_AVX2;
+    if (nmea_kernel_supported(NMEA_KERNEL_SSE2))
+        return NMEA_KERNEL_SSE2;
+    return NMEA_KERNEL_SCALAR;
+}
+
+const char *nmea_kernel_name(nmea_kernel_t kernel)
+{
+    return kernel < NMEA_KERNEL_COUNT ? ops[kernel].name : "?";
+}
+
+size_t nmea_frame(nmea_kernel_t kernel, const uint8_t *data, size_t len,
+    nmea_sentence_t *out, size_t max, size_t *used)
+{
+    const nmea_ops_t *k = &ops[kernel];
+    const uint8_t *p = data, *end = data + len;
+    const uint8_t *s, *q;
+    size_t count = 0;
+    int hi, lo;
+
+    while (count < max) {
+        s = k->find_dollar(p, end);
+        if (s == end) {
+            p = end;
+            break;
+        }
+
+        q = k->find_stop(s + 1, end);
+        if (q == end || (*q == '*' && q + 3 > end)) {
+            // Runs off the end, have it again with what follows
+            p = s;
+            break;
+        }
+        if (*q != '*') {
+            // Cut short: start again from another '$', or look for one
+            p = *q == '$' ? q : q + 1;
+            continue;
+        }
+
+        hi = from_hex(q[1]);
+        lo = from_hex(q[2]);
+        if (hi < 0 || lo < 0 || k->xor_bytes(s + 1, q - s - 1) != (hi << 4 | lo)) {
+            p = q + 1;
+            continue;
+        }
+
+        out[count].start = s - data;
+        out[count].len = q + 3 - s;
+        count++;
+        p = q + 3;
+    }
+
+    *used = p - data;
+    return count;
+}
+
+/*
+ * NmeaGPS
+ */
+
+NmeaGPS::NmeaGPS(nmea_kernel_t kernel) :
+    _kernel(nmea_kernel_supported(kernel) ? kernel : NMEA_KERNEL_SCALAR)
+{
+}
+
+unsigned long NmeaGPS::feed(const uint8_t *data, size_t len, valid_fn_t fn, void *p)
+{
+    nmea_sentence_t sentences[NMEA_BATCH];
+    size_t pos = 0, base, start, count, used, i;
+    unsigned long valid = 0;
+
+    do {
+        base = pos;
+        count = nmea_frame(this->_kernel, data + base, len - base, sentences, NMEA_BATCH, &used);
+        for (i = 0; i < count; i++) {
+            start = base + sentences[i].start;
+            valid += this->_encode(data + pos, start - pos, fn, p);
+            this->_sentence((const char *)data + start, sentences[i].len);
+            pos = start + sentences[i].len;
+        }
+    } while (count == NMEA_BATCH);
+
+    // Line ends, bad sentences and a part sentence to carry on from
+    valid += this->_encode(data + pos, len - pos, fn, p);
+
+    return valid;
+}
+
+unsigned long NmeaGPS::_encode(const uint8_t *data, size_t len, valid_fn_t fn, void *p)
+{
+    unsigned long valid = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        if (this->encode(data[i])) {
+            valid++;
+            if (fn)
+                fn(this, p);
+        }
+    }
+
+    return valid;
+}
+
+// What encode() would make of "$...*XX", with the checksum already known good
+void NmeaGPS::_sentence(const char *s, size_t len)
+{
+    // The last term term_complete() does anything with, by sentence type
+    static const uint8_t last_term[] = { 9, 9, 3, 15, 0 }; // GGA, RMC, GSV, GSA, other
+    const char *p = s + 1, *star = s + len - 3, *e, *q;
+    unsigned t;
+    size_t n;
+
+    this->_term_number = this->_term_offset = 0;
+    this->_parity = 0;
+    this->_sentence_type = _GPS_SENTENCE_OTHER;
+    this->_is_checksum_term = false;
+    this->_new_time_fix = this->_gps_time_ref.read_ms();
+
+    for (;;) {
+        e = (const char *)memchr(p, ',', star - p);
+        if (!e)
+            e = star;
+
+        // Past the first, an empty term is nothing to term_complete()
+        n = e - p;
+        if (n || !this->_term_number) {
+            if (n > sizeof(this->_term) - 1)
+                n = sizeof(this->_term) - 1;
+            memcpy(this->_term, p, n);
+            this->_term[n] = '\0';
+            this->term_complete();
+        }
+        ++this->_term_number;
+
+        if (e == star)
+            break;
+        p = e + 1;
+
+        /*
+         * Nothing past the last term it uses is looked at, so long as
+         * there are too few for _term_number to run into another type's
+         * (32 a type) and the rest are only counted.
+         */
+        if (this->_term_number > last_term[this->_sentence_type]) {
+            for (t = this->_term_number, q = p; t < 32; t++, q = e + 1) {
+                e = (const char *)memchr(q, ',', star - q);
+                if (!e)
+                    break;
+            }
+            if (t < 32) {
+                this->_term_number = t + 1;
+                break;
+            }
+        }
+    }
+
+    // Left as the checksum digits would leave it, the line end commits it
+    this->_parity = from_hex(star[1]) << 4 | from_hex(star[2]);
+    this->_is_checksum_term = true;
+    this->_term[0] = star[1];
+    this->_term[1] = star[2];
+    this->_term_offset = 2;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "TinyGPS.h"
+
+enum nmea_kernel_t {
+    NMEA_KERNEL_SCALAR,
+    NMEA_KERNEL_SSE2,
+    NMEA_KERNEL_AVX2,
+    NMEA_KERNEL_COUNT
+};
+
+// A "$...*XX" whose checksum checks out; len covers the '$' to the digits
+struct nmea_sentence_t {
+    size_t start;
+    size_t len;
+};
+
+// Best one this CPU runs
+nmea_kernel_t nmea_best_kernel(void);
+bool nmea_kernel_supported(nmea_kernel_t kernel);
+const char *nmea_kernel_name(nmea_kernel_t kernel);
+
+/*
+ * Finds up to max good sentences in data, 16 or 32 bytes at a time.
+ * Returns how many; *used is where the next call should carry on.
+ */
+size_t nmea_frame(nmea_kernel_t kernel, const uint8_t *data, size_t len,
+    nmea_sentence_t *out, size_t max, size_t *used);
+
+/*
+ * TinyGPS, fed in bulk. Good sentences go straight to the term parser;
+ * everything else, the line ends and anything that failed its checksum
+ * included, still goes through encode(), so what comes out is exactly
+ * what byte by byte would have given.
+ */
+class NmeaGPS : public TinyGPS
+{
+public:
+    typedef void (*valid_fn_t)(NmeaGPS *gps, void *p);
+
+    NmeaGPS(nmea_kernel_t kernel = nmea_best_kernel());
+
+    // Calls fn, if given, wherever encode() would have returned true
+    unsigned long feed(const uint8_t *data, size_t len, valid_fn_t fn = NULL, void *p = NULL);
+
+private:
+    unsigned long _encode(const uint8_t *data, size_t len, valid_fn_t fn, void *p);
+    void _sentence(const char *s, size_t len);
+
+    nmea_kernel_t _kernel;
+};
@@ -0,0 +1,275 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Bulk NMEA parsing, checked against the byte loop and timed
+ *
+ * Runs the stream through TinyGPS::encode() a byte at a time, then
+ * through NmeaGPS with each framing kernel this CPU has. Every field is
+ * compared wherever a sentence is accepted, with the stream fed in odd
+ * sized pieces so sentences straddle them. Then each way is timed over
+ * the whole stream, best of a few runs: the framing on its own, and
+ * everything through to TinyGPS's fields.
+ *
+ *   nmeabench [-m MB] FILE
+ *
+ * FILE is a raw.bin capture or plain NMEA, repeated up to -m MB (64).
+ */
+
+#include <mbed.h>
+#include <getopt.h>
+#include <time.h>
+#include <vector>
+
+#include "capture.h"
+#include "nmea.h"
+
+#define CHECK_PIECE 997
+#define RUNS        3
+
+struct fields_t {
+    long lat, lon;
+    unsigned long date, time, age;
+    unsigned long speed, course, hdop;
+    long altitude;
+    unsigned short pdop;
+    unsigned char satsinview, satsused, fixtype;
+    bool good;
+};
+
+struct check_t {
+    const std::vector<fields_t> *ref;
+    size_t next;
+    unsigned long mismatched;
+};
+
+static void snapshot(TinyGPS *gps, fields_t *f)
+{
+    memset(f, 0, sizeof(*f));
+    gps->get_position(&f->lat, &f->lon, &f->age);
+    gps->get_datetime(&f->date, &f->time);
+    f->speed = gps->speed();
+    f->course = gps->course();
+    f->hdop = gps->hdop();
+    f->altitude = gps->altitude();
+    f->pdop = gps->pdop();
+    f->satsinview = gps->satsinview();
+    f->satsused = gps->satsused();
+    f->fixtype = gps->fixtype();
+    f->good = gps->gps_good_data();
+}
+
+static void check(NmeaGPS *gps, void *p)
+{
+    check_t *c = (check_t *)p;
+    fields_t f;
+
+    snapshot(gps, &f);
+    if (c->next >= c->ref->size() || memcmp(&f, &(*c->ref)[c->next], sizeof(f)))
+        c->mismatched++;
+    c->next++;
+}
+
+static double seconds(const struct timespec &start);
+
+static double time_encode(const std::vector<uint8_t> &data, unsigned long *valid)
+{
+    struct timespec start;
+    double secs, best = 0;
+
+    for (int run = 0; run < RUNS; run++) {
+        TinyGPS gps;
+
+        *valid = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < data.size(); i++)
+            *valid += gps.encode(data[i]);
+        secs = seconds(start);
+        if (!run || secs < best)
+            best = secs;
+    }
+
+    return data.size() / best / 1e9;
+}
+
+static double time_frame(nmea_kernel_t kernel, const std::vector<uint8_t> &data)
+{
+    nmea_sentence_t sentences[64];
+    struct timespec start;
+    size_t pos, count, used;
+    double secs, best = 0;
+
+    for (int run = 0; run < RUNS; run++) {
+        pos = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do {
+            count = nmea_frame(kernel, &data[pos], data.size() - pos, sentences, 64, &used);
+            pos += used;
+        } while (count == 64);
+        secs = seconds(start);
+        if (!run || secs < best)
+            best = secs;
+    }
+
+    return data.size() / best / 1e9;
+}
+
+static double time_feed(nmea_kernel_t kernel, const std::vector<uint8_t> &data, unsigned long *valid)
+{
+    struct timespec start;
+    double secs, best = 0;
+
+    for (int run = 0; run < RUNS; run++) {
+        NmeaGPS gps(kernel);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        *valid = gps.feed(&data[0], data.size());
+        secs = seconds(start);
+        if (!run || secs < best)
+            best = secs;
+    }
+
+    return data.size() / best / 1e9;
+}
+
+static int load(const char *fn, std::vector<uint8_t> *data)
+{
+    uint8_t chunk[CAPTURE_CHUNK_SIZE];
+    size_t len;
+    FILE *f;
+
+    f = fopen(fn, "rb");
+    if (!f)
+        return 0;
+
+    len = fread(chunk, 1, sizeof(chunk), f);
+    if (len == sizeof(chunk) && chunk[0] == CAPTURE_MAGIC && chunk[1] == CAPTURE_VERSION) {
+        // Just what came off the wire
+        do {
+            len = chunk[2] | chunk[3] << 8;
+            if (chunk[0] == CAPTURE_MAGIC && len <= CAPTURE_DATA_MAX)
+                data->insert(data->end(), &chunk[CAPTURE_HEADER_LEN], &chunk[CAPTURE_HEADER_LEN + len]);
+        } while (fread(chunk, sizeof(chunk), 1, f) == 1);
+    } else {
+        do {
+            data->insert(data->end(), chunk, chunk + len);
+        } while ((len = fread(chunk, 1, sizeof(chunk), f)) > 0);
+    }
+    fclose(f);
+
+    return 1;
+}
+
+static double seconds(const struct timespec &start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<uint8_t> data;
+    std::vector<fields_t> ref;
+    unsigned long valid, fast_valid, differ;
+    size_t original, mb = 64, i;
+    double base_gbs, frame_gbs, gbs;
+    int opt, failed = 0;
+
+    while ((opt = getopt(argc, argv, "m:")) != -1) {
+        switch (opt) {
+            case 'm':
+                mb = atoi(optarg);
+                break;
+            default:
+                goto usage;
+        }
+    }
+    if (optind != argc - 1)
+        goto usage;
+
+    if (!load(argv[optind], &data)) {
+        perror(argv[optind]);
+        return 1;
+    }
+    original = data.size();
+    if (!original) {
+        fprintf(stderr, "%s: nothing in it\n", argv[optind]);
+        return 1;
+    }
+    while (data.size() < mb * 1000000)
+        data.insert(data.end(), data.begin(), data.begin() + original);
+
+    // The reference, and the time to beat
+    {
+        TinyGPS gps;
+        fields_t f;
+
+        for (i = 0; i < data.size(); i++) {
+            if (gps.encode(data[i])) {
+                snapshot(&gps, &f);
+                ref.push_back(f);
+            }
+        }
+    }
+    base_gbs = time_encode(data, &valid);
+    printf("%.1f MB, %lu sentences\n", data.size() / 1e6, valid);
+    printf("%-8s %29s %7.3f GB/s\n", "encode", "", base_gbs);
+
+    for (int k = 0; k < NMEA_KERNEL_COUNT; k++) {
+        nmea_kernel_t kernel = (nmea_kernel_t)k;
+        check_t c = { &ref, 0, 0 };
+
+        if (!nmea_kernel_supported(kernel))
+            continue;
+
+        {
+            NmeaGPS gps(kernel);
+
+            for (i = 0; i < data.size(); i += CHECK_PIECE)
+                gps.feed(&data[i], std::min((size_t)CHECK_PIECE, data.size() - i), check, &c);
+        }
+        frame_gbs = time_frame(kernel, data);
+        gbs = time_feed(kernel, data, &fast_valid);
+
+        differ = c.mismatched + (c.next < ref.size() ? ref.size() - c.next : 0);
+        if (differ || c.next != ref.size() || fast_valid != valid)
+            failed++;
+        printf("%-8s framing %7.3f GB/s, parsing %7.3f GB/s %4.1fx, %lu sentences, %lu differ%s\n",
+            nmea_kernel_name(kernel), frame_gbs, gbs, gbs / base_gbs, fast_valid, differ,
+            differ || c.next != ref.size() || fast_valid != valid ? " FAIL" : "");
+    }
+
+    return failed ? 1 : 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-m MB] FILE\n", argv[0]);
+    return 2;
+}
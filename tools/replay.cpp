@@ -0,0 +1,90 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Replays a raw.bin capture through the firmware's receiver code
+ *
+ * Parsed fixes go through the same gating as run_gps() and into Odom,
+ * so a drive's odometer can be reproduced, and stepped through, off the
+ * device. See Drive.
+ *
+ *   replay [-b baud] [-v] raw.bin
+ */
+
+#include <mbed.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "drive.h"
+
+int main(int argc, char **argv)
+{
+    bool verbose = false;
+    int baud = 115200;
+    int opt;
+    clock_t wall;
+
+    while ((opt = getopt(argc, argv, "b:v")) != -1) {
+        switch (opt) {
+            case 'b':
+                baud = atoi(optarg);
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                goto usage;
+        }
+    }
+    if (optind != argc - 1 || baud <= 0)
+        goto usage;
+
+    {
+        Drive drive(baud, verbose ? stdout : NULL);
+        const drive_stats_t &stats = drive.stats();
+
+        wall = clock();
+        if (!drive.replay(argv[optind])) {
+            perror(argv[optind]);
+            return 1;
+        }
+
+        printf("%lu chunks (%lu bad), %lu bytes, %lu dropped\n", stats.chunks, stats.bad, stats.bytes, stats.dropped);
+        printf("%lu RMC/GGA sentences, %lu fixes\n", stats.sentences, stats.fixes);
+        printf("odom %.3f mi, %.1f s of capture in %.3f s\n",
+            drive.odom_mi(), stats.capture_s,
+            (double)(clock() - wall) / CLOCKS_PER_SEC);
+    }
+
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-b baud] [-v] raw.bin\n", argv[0]);
+    return 2;
+}
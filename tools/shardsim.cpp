@@ -0,0 +1,281 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Years of daily track logs on a card image, written and looked up
+ * through the firmware's own FS and sd-reader, to see what lookups cost
+ * as the card fills
+ *
+ *   shardsim [-f] [-y YEARS] [-b BLOCKS] [-r MB] IMAGE
+ *
+ * IMAGE is a blank card image, see fatimg mkfs. Each simulated day adds
+ * BLOCKS track blocks and their index the way the speedo does, sharded
+ * into /YYYY/MM/DD-00.trk, or with -f all in the root as YYMMDD00.TRK
+ * for comparison. Each day then reads back the first block of a random
+ * earlier day. Card blocks read are reported by year; the run fails if
+ * lookups in the last year cost noticeably more than in the first.
+ *
+ * Retention is off unless -r asks it to keep MB free, deleting the
+ * oldest shards while the card is idle after each day. Lookups of days
+ * already deleted are counted as gone, a failed write fails the run.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "fs.h"
+#include "track.h"
+#include "shim/card.h"
+
+#define SIM_START     1577836800 // 2020-01-01
+#define SIM_FIX_S     30         // Between stored fixes
+#define SIM_GROWTH    1.25       // Allowed rise in lookup cost, plus
+#define SIM_SLACK     2          // this many reads
+
+struct year_stats_t {
+    int days;
+    uint64_t create_reads;  // For the day's first append
+    uint64_t lookup_reads;
+    double lookup_us;
+    int lookups;
+    int gone;
+    uint64_t retain_reads;
+};
+
+static uint32_t sim_utc = SIM_START;
+
+// Directory entry timestamps, the simulated day's
+extern "C" void get_datetime(uint16_t *year, uint8_t *month, uint8_t *day, uint8_t *hour, uint8_t *min, uint8_t *sec)
+{
+    time_t t = sim_utc;
+    struct tm *tm = gmtime(&t);
+
+    *year = tm->tm_year + 1900;
+    *month = tm->tm_mon + 1;
+    *day = tm->tm_mday;
+    *hour = tm->tm_hour;
+    *min = tm->tm_min;
+    *sec = tm->tm_sec;
+}
+
+// As track_name() on the speedo, part 0 only
+static void day_name(int day, bool flat, const char *ext, char *fn, size_t size)
+{
+    time_t t = SIM_START + (time_t)day * 86400;
+    struct tm *tm = gmtime(&t);
+
+    if (flat)
+        snprintf(fn, size, "%02d%02d%02d00.%s", tm->tm_year % 100, tm->tm_mon + 1, tm->tm_mday, ext);
+    else
+        snprintf(fn, size, "%04d/%02d/%02d-00.%s", tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, ext);
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// One day's driving, a fix every SIM_FIX_S from 08:00
+static int write_day(FS &fs, int day, int blocks, bool flat, year_stats_t *stats)
+{
+    char fn[32], idx_fn[32];
+    uint8_t packed[TRACK_INDEX_LEN];
+    track_index_t entry;
+    TrackBlock block;
+    track_fix_t fix;
+    uint64_t reads;
+    uint32_t at;
+
+    day_name(day, flat, "trk", fn, sizeof(fn));
+    day_name(day, flat, "idx", idx_fn, sizeof(idx_fn));
+
+    memset(&fix, 0, sizeof(fix));
+    fix.utc = SIM_START + (uint32_t)day * 86400 + 8 * 3600;
+    fix.lat = 45000000;
+    fix.lon = -122000000;
+    sim_utc = fix.utc;
+
+    for (int b = 0; b < blocks; b++) {
+        block.reset();
+        while (block.add(fix)) {
+            fix.utc += SIM_FIX_S;
+            fix.lat += 100;
+        }
+
+        reads = card_stats.blocks_read;
+        if (!fs.append_file(fn, block.seal(), TRACK_BLOCK_SIZE, TRACK_BLOCK_SIZE, &at)) {
+            fprintf(stderr, "%s: append failed\n", fn);
+            return 0;
+        }
+        if (b == 0)
+            stats->create_reads += card_stats.blocks_read - reads;
+
+        if (at % (TRACK_BLOCK_SIZE * TRACK_INDEX_EVERY) == 0) {
+            entry.utc = block.first_utc();
+            entry.block = at / TRACK_BLOCK_SIZE;
+            track_index_pack(entry, packed);
+            if (!fs.append_file(idx_fn, packed, sizeof(packed))) {
+                fprintf(stderr, "%s: append failed\n", idx_fn);
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+static void lookup_day(FS &fs, int day, bool flat, year_stats_t *stats)
+{
+    uint8_t buf[TRACK_BLOCK_SIZE];
+    uint64_t reads;
+    uint32_t utc;
+    char fn[32];
+    double t;
+
+    day_name(day, flat, "trk", fn, sizeof(fn));
+
+    reads = card_stats.blocks_read;
+    t = now_us();
+    if (!fs.read_file(fn, buf, sizeof(buf)) || !TrackBlock::first_utc(buf, &utc)) {
+        stats->gone++;
+        return;
+    }
+    stats->lookup_us += now_us() - t;
+    stats->lookup_reads += card_stats.blocks_read - reads;
+    stats->lookups++;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-f] [-y years] [-b blocks] [-r MB] IMAGE\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<year_stats_t> years;
+    unsigned long retain_mb = 0;
+    int n_years = 5, blocks = 4;
+    bool flat = false;
+    double first, last;
+    year_stats_t *y;
+    uint64_t reads;
+    int opt, day, days, result;
+    FS fs;
+
+    while ((opt = getopt(argc, argv, "fy:b:r:")) != -1) {
+        switch (opt) {
+            case 'f':
+                flat = true;
+                break;
+            case 'y':
+                n_years = atoi(optarg);
+                break;
+            case 'b':
+                blocks = atoi(optarg);
+                break;
+            case 'r':
+                retain_mb = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind != argc - 1 || n_years < 1 || blocks < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (!card_open(argv[optind]))
+        return 1;
+    if (!fs.init()) {
+        fprintf(stderr, "%s: no FAT filesystem\n", argv[optind]);
+        return 1;
+    }
+    fs.retain_free((offset_t)retain_mb * 1024 * 1024);
+
+    srand(1);
+    years.resize(n_years);
+    memset(&years[0], 0, n_years * sizeof(years[0]));
+    days = n_years * 365;
+    result = 0;
+    for (day = 0; day < days; day++) {
+        y = &years[day / 365];
+        y->days++;
+
+        if (!write_day(fs, day, blocks, flat, y)) {
+            result = 1;
+            break;
+        }
+        if (day > 0)
+            lookup_day(fs, rand() % day, flat, y);
+
+        // Parked overnight: what Storage does with an empty queue
+        reads = card_stats.blocks_read;
+        while (fs.retain_idle());
+        y->retain_reads += card_stats.blocks_read - reads;
+    }
+    card_close();
+
+    printf("%s, %d blocks a day\n", flat ? "flat" : "sharded", blocks);
+    printf("year  days  create reads  lookup reads  lookup us  gone  retain reads/day\n");
+    for (int i = 0; i < n_years; i++) {
+        y = &years[i];
+        if (!y->days)
+            break;
+        printf("%4d  %4d  %12.1f  %12.1f  %9.1f  %4d  %16.0f\n",
+            i + 1, y->days,
+            (double)y->create_reads / y->days,
+            y->lookups ? (double)y->lookup_reads / y->lookups : 0.0,
+            y->lookups ? y->lookup_us / y->lookups : 0.0,
+            y->gone,
+            (double)y->retain_reads / y->days);
+    }
+    printf("%llu blocks read, %llu written\n",
+        (unsigned long long)card_stats.blocks_read, (unsigned long long)card_stats.blocks_written);
+
+    if (result || n_years < 2 || !years[0].lookups || !years[n_years - 1].lookups)
+        return result;
+
+    first = (double)years[0].lookup_reads / years[0].lookups;
+    last = (double)years[n_years - 1].lookup_reads / years[n_years - 1].lookups;
+    if (last > first * SIM_GROWTH + SIM_SLACK) {
+        printf("lookups grew from %.1f to %.1f reads\n", first, last);
+        return 1;
+    }
+    printf("lookups steady at %.1f to %.1f reads\n", first, last);
+    return 0;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * The card for host builds of FS: sd_raw over an image file, counting
+ * the blocks that would cross the SPI bus. Like sd_raw, one block is
+ * cached and only a miss goes to the card.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct card_stats_t {
+    uint64_t blocks_read;
+    uint64_t blocks_written;
+    uint64_t init_polls;     // sd_raw_init_poll() calls
+};
+
+extern card_stats_t card_stats;
+
+// Writes the card takes before it loses power, -1 for no limit. Once
+// gone, writes fail and leave the image as it was.
+extern long card_writes_left;
+
+// sd_raw_init_poll() calls the card answers busy to, as a slow card
+// does for up to a second, then whether it gives up instead of getting
+// ready
+extern long card_init_polls;
+extern bool card_init_fails;
+
+// Host clock each block across the bus takes, for callers timing it
+extern uint32_t card_block_us;
+
+int card_open(const char *fn);
+void card_close(void);
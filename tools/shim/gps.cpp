@@ -0,0 +1,631 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <deque>
+#include <string>
+
+#include "gps_sim.h"
+
+#define START_LAT       45.5
+#define START_LON       -122.6
+#define M_PER_DEG       111320.0
+#define M_PER_S_PER_MPH 0.44704
+#define KNOTS_PER_MPH   0.868976
+#define SATS_IN_VIEW    12
+#define SATS_USED       8
+#define UBX_MAX         256
+#define EPH_LEN         104  // AID payloads with data, 8 without
+#define ALM_LEN         40
+#define INI_LEN         48
+#define EPH_AIDED       4    // SVs with ephemeris for an aided start
+
+gps_sim_t gps_sim;
+void (*gps_sim_frame)(uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len);
+
+static const gps_sim_config_t defaults = {
+    9600,
+    1000,
+    {1, 1, 1, 1, 1, 1, 0},
+};
+
+// CFG-MSG ids of the NMEA class, in gps_sim_nmea_t order
+static const uint8_t nmea_ids[GPS_SIM_NMEA_COUNT] = {0x04, 0x05, 0x00, 0x02, 0x03, 0x01, 0x08};
+
+// As in GPGSA
+static const uint8_t svs_used[SATS_USED] = {2, 5, 7, 9, 13, 16, 20, 30};
+
+struct sentence_t {
+    uint64_t end_us; // last byte in
+    std::string text;
+};
+
+static uint64_t clock_us;
+static uint32_t clock_at;
+static uint64_t tx_ns;          // host writes not yet charged
+static uint64_t next_epoch_us;
+static uint64_t next_pps_us;
+static uint64_t wire_free_us;   // the port is sending until then
+static uint64_t start_us;       // of the last start
+static uint64_t moved_us;       // position is up to here
+static double east_m;
+static uint32_t eph_loaded;     // SVs given ephemeris since the last start
+static std::deque<sentence_t> out;
+
+static struct {
+    int state;
+    uint8_t frame[4 + UBX_MAX];
+    uint16_t len;
+    uint16_t offset;
+    uint8_t ck_a, ck_b;
+} ubx;
+
+// The clock up to shim_now_us, with the time spent in each state
+static void advance(void)
+{
+    uint32_t elapsed = shim_now_us - clock_at;
+
+    clock_at = shim_now_us;
+    clock_us += elapsed;
+
+    if (!gps_sim.powered)
+        gps_sim.off_us += elapsed;
+    else if (gps_sim.asleep)
+        gps_sim.backup_us += elapsed;
+    else
+        gps_sim.tracking_us += elapsed;
+
+    if (gps_sim.powered && !gps_sim.asleep && !gps_sim.fixed && clock_us >= gps_sim.fix_us) {
+        gps_sim.fixed = true;
+        gps_sim.first_fix_us = gps_sim.fix_us - start_us;
+    }
+    if (gps_sim.fixed && !gps_sim.asleep) {
+        gps_sim.eph = true;
+        gps_sim.alm = true;
+        gps_sim.eph_us = clock_us;
+    }
+}
+
+static uint64_t wire_us(size_t bytes)
+{
+    // Start, data and stop bits
+    return bytes * 10000000ull / gps_sim.config.baud;
+}
+
+static uint64_t align(uint64_t us)
+{
+    uint64_t period = gps_sim.config.rate_ms * 1000ull;
+
+    return (us + period - 1) / period * period;
+}
+
+// Tracking again, hot if it still has ephemeris it can use
+static void start(bool keep)
+{
+    if (keep && gps_sim.eph && clock_us - gps_sim.eph_us < GPS_SIM_EPH_US) {
+        gps_sim.fix_us = clock_us + GPS_SIM_HOT_US;
+        gps_sim.hot_starts++;
+    } else {
+        gps_sim.eph = false;
+        gps_sim.fix_us = clock_us + GPS_SIM_COLD_US;
+        gps_sim.cold_starts++;
+    }
+
+    gps_sim.fixed = false;
+    eph_loaded = 0;
+    start_us = clock_us;
+    out.clear();
+    wire_free_us = clock_us;
+    next_epoch_us = align(clock_us + GPS_SIM_BOOT_US);
+}
+
+static void send(uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len)
+{
+    uint8_t frame[8 + UBX_MAX];
+    uint8_t ck_a = 0, ck_b = 0;
+    size_t n = 0;
+
+    frame[n++] = 0xB5;
+    frame[n++] = 0x62;
+    frame[n++] = cls;
+    frame[n++] = id;
+    frame[n++] = len;
+    frame[n++] = len >> 8;
+    memcpy(&frame[n], payload, len);
+    n += len;
+    for (size_t i = 2; i < n; i++) {
+        ck_a += frame[i];
+        ck_b += ck_a;
+    }
+    frame[n++] = ck_a;
+    frame[n++] = ck_b;
+
+    // The caller is waiting on it, or at least the line is busy with it
+    gps_sim.bytes_out += n;
+    shim_now_us += wire_us(n);
+    for (size_t i = 0; i < n; i++)
+        shim_rx(frame[i]);
+    advance();
+}
+
+static void ack(uint8_t cls, uint8_t id)
+{
+    uint8_t payload[2] = {cls, id};
+
+    gps_sim.acks++;
+    send(0x05, 0x01, payload, sizeof(payload));
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void cfg(uint8_t id, const uint8_t *payload, uint16_t len)
+{
+    uint32_t clear, save, load;
+
+    switch (id) {
+        case 0x00: // CFG-PRT, UART1
+            if (len >= 20 && payload[0] == 1)
+                gps_sim.config.baud = get32(&payload[8]);
+            break;
+        case 0x01: // CFG-MSG
+            if (len != 3 && len != 8)
+                break;
+            gps_sim.cfg_msg++;
+            for (int i = 0; i < GPS_SIM_NMEA_COUNT; i++) {
+                if (payload[0] == 0xF0 && payload[1] == nmea_ids[i])
+                    gps_sim.config.div[i] = len == 3 ? payload[2] : payload[3];
+            }
+            break;
+        case 0x04: // CFG-RST, not acknowledged
+            if (len != 4)
+                return;
+            if (payload[2] == 0x00 || payload[2] == 0x01 || payload[2] == 0x04)
+                gps_sim.config = gps_sim.has_saved ? gps_sim.saved : defaults;
+            start(get16(payload) != 0xFFFF);
+            return;
+        case 0x08: // CFG-RATE
+            if (len != 6 || get16(payload) == 0)
+                break;
+            gps_sim.cfg_rate++;
+            gps_sim.config.rate_ms = get16(payload);
+            next_epoch_us = align(clock_us);
+            break;
+        case 0x09: // CFG-CFG
+            if (len < 12)
+                break;
+            clear = get32(&payload[0]);
+            save = get32(&payload[4]);
+            load = get32(&payload[8]);
+            if (clear)
+                gps_sim.has_saved = false;
+            if (save) {
+                gps_sim.saved = gps_sim.config;
+                gps_sim.has_saved = true;
+                gps_sim.cfg_saves++;
+            }
+            if (load)
+                gps_sim.config = gps_sim.has_saved ? gps_sim.saved : defaults;
+            break;
+    }
+
+    ack(0x06, id);
+}
+
+static bool sv_used(uint8_t svid)
+{
+    for (int i = 0; i < SATS_USED; i++) {
+        if (svs_used[i] == svid)
+            return true;
+    }
+    return false;
+}
+
+// What AID-EPH (0x31) or AID-ALM (0x30) for svid has, made up but the
+// same each time; 8 bytes when there's nothing
+static uint16_t aid_payload(uint8_t id, uint8_t svid, uint8_t *payload)
+{
+    bool has = id == 0x31 ? gps_sim.eph && sv_used(svid) : gps_sim.alm && svid <= SATS_IN_VIEW;
+    uint16_t len = !has ? 8 : id == 0x31 ? EPH_LEN : ALM_LEN;
+
+    memset(payload, 0, len);
+    payload[0] = svid;
+    for (uint16_t i = 4; has && i < len; i++)
+        payload[i] = svid * 7 + id + i;
+    return len;
+}
+
+static void aid(uint8_t id, const uint8_t *payload, uint16_t len)
+{
+    uint8_t answer[INI_LEN > EPH_LEN ? INI_LEN : EPH_LEN];
+    uint16_t answer_len;
+    int32_t deg;
+
+    if (id == 0x01 && len == 0) {
+        // AID-INI, where it is as latitude and longitude
+        gps_sim.aid_polls++;
+        memset(answer, 0, INI_LEN);
+        if (gps_sim.alm) {
+            deg = START_LAT * 1e7;
+            memcpy(&answer[0], &deg, 4);
+            deg = START_LON * 1e7;
+            memcpy(&answer[4], &deg, 4);
+            answer[44] = 0x01 | 0x20;
+            gps_sim.aid_given++;
+        }
+        send(0x0B, 0x01, answer, INI_LEN);
+    } else if (id == 0x01 && len == INI_LEN) {
+        if (payload[44] & 0x02)
+            gps_sim.ini_time++;
+        // A time hint has no position, a saved one must be where it was
+        if (!(payload[44] & 0x01))
+            return;
+        memcpy(&deg, &payload[0], 4);
+        if (deg == (int32_t)(START_LAT * 1e7))
+            gps_sim.aid_loaded++;
+        else
+            gps_sim.aid_bad++;
+    } else if ((id == 0x30 || id == 0x31) && len == 1) {
+        gps_sim.aid_polls++;
+        answer_len = aid_payload(id, payload[0], answer);
+        if (answer_len > 8)
+            gps_sim.aid_given++;
+        send(0x0B, id, answer, answer_len);
+    } else if ((id == 0x30 || id == 0x31) && len > 8) {
+        // Only good as long as it's what this receiver would give
+        bool had_eph = gps_sim.eph, had_alm = gps_sim.alm;
+
+        gps_sim.eph = gps_sim.alm = true;
+        answer_len = aid_payload(id, payload[0], answer);
+        gps_sim.eph = had_eph;
+        gps_sim.alm = had_alm;
+        if (answer_len != len || memcmp(answer, payload, len) != 0) {
+            gps_sim.aid_bad++;
+            return;
+        }
+        gps_sim.aid_loaded++;
+        if (id == 0x31)
+            eph_loaded |= 1u << (payload[0] - 1);
+        if (__builtin_popcount(eph_loaded) == EPH_AIDED && !gps_sim.fixed && !gps_sim.eph &&
+                clock_us + GPS_SIM_AIDED_US < gps_sim.fix_us) {
+            gps_sim.fix_us = clock_us + GPS_SIM_AIDED_US;
+            gps_sim.aided_starts++;
+        }
+    }
+}
+
+static void frame(uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len)
+{
+    gps_sim.frames++;
+    if (gps_sim_frame)
+        gps_sim_frame(cls, id, payload, len);
+
+    if (cls == 0x06) {
+        cfg(id, payload, len);
+    } else if (cls == 0x0B) {
+        aid(id, payload, len);
+    } else if (cls == 0x02 && id == 0x41 && len >= 8 && (get32(&payload[4]) & (1u<<1))) {
+        // RXM-PMREQ, backup until woken
+        gps_sim.backups++;
+        gps_sim.asleep = true;
+        gps_sim.fixed = false;
+        out.clear();
+    }
+}
+
+static void parse(uint8_t c)
+{
+    switch (ubx.state) {
+        case 0:
+            if (c == 0xB5)
+                ubx.state = 1;
+            return;
+        case 1:
+            ubx.state = c == 0x62 ? 2 : 0;
+            ubx.offset = 0;
+            ubx.ck_a = ubx.ck_b = 0;
+            return;
+        case 2:
+            ubx.frame[ubx.offset++] = c;
+            ubx.ck_a += c;
+            ubx.ck_b += ubx.ck_a;
+            if (ubx.offset < 4)
+                return;
+            ubx.len = get16(&ubx.frame[2]);
+            if (ubx.len > UBX_MAX) {
+                gps_sim.bad_frames++;
+                ubx.state = 0;
+            } else if (ubx.offset == 4 + ubx.len) {
+                ubx.state = 3;
+            }
+            return;
+        case 3:
+            ubx.state = c == ubx.ck_a ? 4 : 0;
+            if (!ubx.state)
+                gps_sim.bad_frames++;
+            return;
+        case 4:
+            ubx.state = 0;
+            if (c != ubx.ck_b) {
+                gps_sim.bad_frames++;
+                return;
+            }
+            frame(ubx.frame[0], ubx.frame[1], &ubx.frame[4], ubx.len);
+            return;
+    }
+}
+
+// A byte from the host, the UART holding it up while it goes out
+static void tx(uint8_t c)
+{
+    advance();
+    gps_sim.bytes_in++;
+    tx_ns += 10000000000ull / gps_sim.config.baud;
+    shim_now_us += tx_ns / 1000;
+    tx_ns %= 1000;
+    advance();
+
+    if (!gps_sim.powered)
+        return;
+
+    // Any activity wakes it, the byte itself is lost
+    if (gps_sim.asleep) {
+        gps_sim.asleep = false;
+        gps_sim.wakes++;
+        gps_sim.lost_bytes++;
+        gps_sim.config = gps_sim.has_saved ? gps_sim.saved : defaults;
+        ubx.state = 0;
+        start(true);
+        return;
+    }
+
+    parse(c);
+}
+
+static void nmea(gps_sim_nmea_t type, uint64_t at_us, const char *body)
+{
+    sentence_t s;
+    uint8_t sum = 0;
+    char tail[8];
+
+    for (const char *p = body; *p; p++)
+        sum ^= *p;
+    snprintf(tail, sizeof(tail), "*%02X\r\n", sum);
+
+    s.text = "$";
+    s.text += body;
+    s.text += tail;
+
+    if (wire_free_us < at_us)
+        wire_free_us = at_us;
+    wire_free_us += wire_us(s.text.size());
+    s.end_us = wire_free_us;
+
+    gps_sim.bytes_out += s.text.size();
+    gps_sim.sentences[type]++;
+    out.push_back(s);
+}
+
+// ddmm.mmmmm and the hemisphere
+static void angle(char *buf, size_t size, double deg, int deg_digits, char pos, char neg)
+{
+    double a = fabs(deg);
+    int d = (int)a;
+
+    snprintf(buf, size, "%0*d%08.5f,%c", deg_digits, d, (a - d) * 60.0, deg < 0 ? neg : pos);
+}
+
+static void epoch(uint64_t at_us)
+{
+    uint64_t utc_ms = GPS_SIM_UTC_START * 1000 + at_us / 1000;
+    uint64_t n = at_us / (gps_sim.config.rate_ms * 1000ull);
+    time_t secs = utc_ms / 1000;
+    struct tm tm;
+    char body[512], hms[48], date[40], lat[40], lon[40];
+    double knots, lon_deg;
+    bool fix = gps_sim.fixed;
+    const uint8_t *div = gps_sim.config.div;
+
+    gps_sim.epochs++;
+
+    east_m += gps_sim.mph * M_PER_S_PER_MPH * (at_us - moved_us) / 1e6;
+    moved_us = at_us;
+
+    gmtime_r(&secs, &tm);
+    snprintf(hms, sizeof(hms), "%02d%02d%02d.%02u", tm.tm_hour, tm.tm_min, tm.tm_sec, (unsigned)(utc_ms % 1000 / 10));
+    snprintf(date, sizeof(date), "%02d%02d%02d", tm.tm_mday, tm.tm_mon + 1, tm.tm_year % 100);
+    lon_deg = START_LON + east_m / (M_PER_DEG * cos(START_LAT * M_PI / 180.0));
+    angle(lat, sizeof(lat), START_LAT, 2, 'N', 'S');
+    angle(lon, sizeof(lon), lon_deg, 3, 'E', 'W');
+    knots = gps_sim.mph * KNOTS_PER_MPH;
+
+    at_us += gps_sim.latency_us;
+
+    if (div[GPS_SIM_RMC] && n % div[GPS_SIM_RMC] == 0) {
+        if (fix)
+            snprintf(body, sizeof(body), "GPRMC,%s,A,%s,%s,%.3f,90.00,%s,,,A", hms, lat, lon, knots, date);
+        else
+            snprintf(body, sizeof(body), "GPRMC,%s,V,,,,,,,%s,,,N", hms, date);
+        nmea(GPS_SIM_RMC, at_us, body);
+    }
+    if (div[GPS_SIM_VTG] && n % div[GPS_SIM_VTG] == 0) {
+        if (fix)
+            snprintf(body, sizeof(body), "GPVTG,90.00,T,,M,%.3f,N,%.3f,K,A", knots, gps_sim.mph * 1.609344);
+        else
+            snprintf(body, sizeof(body), "GPVTG,,,,,,,,,N");
+        nmea(GPS_SIM_VTG, at_us, body);
+    }
+    if (div[GPS_SIM_GGA] && n % div[GPS_SIM_GGA] == 0) {
+        if (fix)
+            snprintf(body, sizeof(body), "GPGGA,%s,%s,%s,1,%02d,1.01,50.0,M,-20.0,M,,", hms, lat, lon, SATS_USED);
+        else
+            snprintf(body, sizeof(body), "GPGGA,%s,,,,,0,00,99.99,,,,,,", hms);
+        nmea(GPS_SIM_GGA, at_us, body);
+    }
+    if (div[GPS_SIM_GSA] && n % div[GPS_SIM_GSA] == 0) {
+        if (fix)
+            snprintf(body, sizeof(body), "GPGSA,A,3,02,05,07,09,13,16,20,30,,,,,1.80,1.01,1.50");
+        else
+            snprintf(body, sizeof(body), "GPGSA,A,1,,,,,,,,,,,,,99.99,99.99,99.99");
+        nmea(GPS_SIM_GSA, at_us, body);
+    }
+    if (div[GPS_SIM_GSV] && n % div[GPS_SIM_GSV] == 0) {
+        for (int m = 0; m < SATS_IN_VIEW / 4; m++) {
+            int len = snprintf(body, sizeof(body), "GPGSV,%d,%d,%02d", SATS_IN_VIEW / 4, m + 1, SATS_IN_VIEW);
+            for (int s = 0; s < 4; s++) {
+                int sv = m * 4 + s + 1;
+                len += snprintf(&body[len], sizeof(body) - len, ",%02d,%02d,%03d,%02d", sv, 10 + sv * 5, sv * 30, fix ? 30 + sv : 20);
+            }
+            nmea(GPS_SIM_GSV, at_us, body);
+        }
+    }
+    if (div[GPS_SIM_GLL] && n % div[GPS_SIM_GLL] == 0) {
+        if (fix)
+            snprintf(body, sizeof(body), "GPGLL,%s,%s,%s,A,A", lat, lon, hms);
+        else
+            snprintf(body, sizeof(body), "GPGLL,,,,,%s,V,N", hms);
+        nmea(GPS_SIM_GLL, at_us, body);
+    }
+    if (div[GPS_SIM_ZDA] && n % div[GPS_SIM_ZDA] == 0) {
+        snprintf(body, sizeof(body), "GPZDA,%s,%02d,%02d,%04d,00,00", hms, tm.tm_mday, tm.tm_mon + 1, tm.tm_year + 1900);
+        nmea(GPS_SIM_ZDA, at_us, body);
+    }
+}
+
+void gps_sim_reset(void)
+{
+    memset(&gps_sim, 0, sizeof(gps_sim));
+    gps_sim.config = defaults;
+    gps_sim.saved = defaults;
+
+    clock_us = 0;
+    clock_at = shim_now_us;
+    tx_ns = 0;
+    east_m = 0.0;
+    moved_us = 0;
+    out.clear();
+    ubx.state = 0;
+    gps_sim.latency_us = GPS_SIM_LATENCY_US;
+    gps_sim.pps_pin = NC;
+
+    shim_tx = tx;
+}
+
+void gps_sim_power(bool on)
+{
+    advance();
+    if (on == gps_sim.powered)
+        return;
+
+    // No backup battery: all it knew goes with the power
+    gps_sim.powered = on;
+    gps_sim.asleep = false;
+    gps_sim.fixed = false;
+    gps_sim.eph = false;
+    gps_sim.alm = false;
+    gps_sim.has_saved = false;
+    gps_sim.config = defaults;
+    out.clear();
+    if (on)
+        start(false);
+}
+
+// The time pulse is on while there's a fix to align it to
+static bool pulsing(void)
+{
+    return gps_sim.pps_pin != NC && !gps_sim.pps_cut && gps_sim.powered && !gps_sim.asleep && gps_sim.fixed;
+}
+
+void gps_sim_poll(void)
+{
+    advance();
+
+    if (gps_sim.powered && !gps_sim.asleep) {
+        while (next_epoch_us <= clock_us) {
+            epoch(next_epoch_us);
+            next_epoch_us += gps_sim.config.rate_ms * 1000ull;
+        }
+    }
+
+    if (!pulsing() || next_pps_us + 1000000 <= clock_us)
+        next_pps_us = (clock_us + 999999) / 1000000 * 1000000;
+
+    // Edges and sentences in the order they happened
+    for (;;) {
+        bool edge = pulsing() && next_pps_us <= clock_us;
+
+        if (edge && (out.empty() || next_pps_us <= out.front().end_us)) {
+            next_pps_us += 1000000;
+            gps_sim.pps_edges++;
+            shim_pin_set(gps_sim.pps_pin, 1);
+            shim_pin_set(gps_sim.pps_pin, 0);
+        } else if (!out.empty() && out.front().end_us <= clock_us) {
+            std::string text = out.front().text;
+
+            out.pop_front();
+            for (size_t i = 0; i < text.size(); i++)
+                shim_rx(text[i]);
+        } else {
+            break;
+        }
+    }
+}
+
+uint32_t gps_sim_next_us(void)
+{
+    uint64_t next;
+
+    advance();
+    if (!out.empty())
+        next = out.front().end_us;
+    else if (gps_sim.powered && !gps_sim.asleep)
+        next = next_epoch_us;
+    else
+        return shim_now_us + 0x40000000;
+    if (pulsing() && next_pps_us < next)
+        next = next_pps_us;
+
+    return next <= clock_us ? shim_now_us : shim_now_us + (uint32_t)(next - clock_us);
+}
+
+uint64_t gps_sim_clock_us(void)
+{
+    advance();
+    return clock_us;
+}
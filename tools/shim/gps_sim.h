@@ -0,0 +1,149 @@
+#pragma once
+
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * The receiver for host builds of the firmware: a u-blox 7 on the other
+ * end of the UART. What's written to it is taken as UBX; CFG messages
+ * are acted on and acknowledged, CFG-RST restarts it and RXM-PMREQ puts
+ * it in backup until the next byte comes in. What comes out is NMEA,
+ * an epoch every CFG-RATE with each sentence at its CFG-MSG divisor,
+ * for a vehicle heading east at gps_sim.mph.
+ *
+ * Bytes take their time on the wire both ways: writing one holds the
+ * caller up as the UART would, answers come straight back on top of
+ * the command, and NMEA is queued to arrive at the port's baud from
+ * just after each epoch. gps_sim_poll() hands over what has arrived.
+ *
+ * Once fixed, 1PPS rises on gps_sim.pps_pin at the top of each UTC
+ * second, epochs at whole seconds falling on the same instant.
+ *
+ * The first fix is hot, aided or cold by what the receiver still knows.
+ * Ephemeris survives backup and a hot CFG-RST, not a power cut. Polls
+ * of AID-INI, AID-EPH and AID-ALM are answered from what it has, and
+ * those records sent back are checked against what it gave: ephemeris
+ * for enough SVs makes the next cold start an aided one.
+ */
+
+#include <stdint.h>
+
+#include "mbed.h"
+
+#define GPS_SIM_COLD_US     29000000  // u-blox 7 time to first fix
+#define GPS_SIM_HOT_US      1000000
+#define GPS_SIM_AIDED_US    5000000
+#define GPS_SIM_BOOT_US     500000    // power or reset to the first epoch
+#define GPS_SIM_LATENCY_US  40000     // epoch to its first byte, by default
+#define GPS_SIM_UTC_START   1715932800ull // 2024-05-17 08:00:00, at gps_sim_reset()
+#define GPS_SIM_EPH_US      (4 * 3600 * 1000000ull) // ephemeris goes stale
+
+enum gps_sim_nmea_t {
+    GPS_SIM_RMC,
+    GPS_SIM_VTG,
+    GPS_SIM_GGA,
+    GPS_SIM_GSA,
+    GPS_SIM_GSV,
+    GPS_SIM_GLL,
+    GPS_SIM_ZDA,
+    GPS_SIM_NMEA_COUNT,
+};
+
+struct gps_sim_config_t {
+    uint32_t baud;
+    uint16_t rate_ms;
+    uint8_t div[GPS_SIM_NMEA_COUNT]; // 0: off
+};
+
+struct gps_sim_t {
+    double mph;
+    uint32_t latency_us;      // epoch to its first byte
+    PinName pps_pin;          // NC: not wired
+    bool pps_cut;             // as a loose wire
+
+    bool powered;
+    bool asleep;
+    bool fixed;
+    bool eph;                 // a hot start gets a fix in GPS_SIM_HOT_US
+    bool alm;                 // kept from any fix until the power goes
+    uint64_t eph_us;          // when it was last good
+    uint64_t fix_us;          // first fix is due
+    gps_sim_config_t config;
+    gps_sim_config_t saved;   // in battery backed RAM, see CFG-CFG
+    bool has_saved;
+
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint32_t epochs;
+    uint32_t sentences[GPS_SIM_NMEA_COUNT];
+    uint32_t frames;          // good UBX frames taken
+    uint32_t bad_frames;
+    uint32_t acks;
+    uint32_t cfg_rate;
+    uint32_t cfg_msg;
+    uint32_t cfg_saves;
+    uint32_t hot_starts;      // CFG-RST that kept ephemeris
+    uint32_t cold_starts;
+    uint32_t backups;         // RXM-PMREQ
+    uint32_t wakes;           // from backup by a byte on RX
+    uint32_t pps_edges;
+    uint32_t lost_bytes;      // written while asleep, only the first wakes it
+    uint32_t aid_polls;
+    uint32_t aid_given;       // answers with data in them
+    uint32_t aid_loaded;      // sent back as they were given
+    uint32_t aid_bad;         // sent back but not as given
+    uint32_t ini_time;        // AID-INI with a time in it
+    uint32_t aided_starts;
+    uint64_t tracking_us;     // powered and awake
+    uint64_t backup_us;
+    uint64_t off_us;
+    uint64_t first_fix_us;    // time to fix of the last start
+};
+
+extern gps_sim_t gps_sim;
+
+// Each good UBX frame taken, before it's acted on
+extern void (*gps_sim_frame)(uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len);
+
+// Powered off with the defaults and everything counted cleared; takes
+// over shim_tx
+void gps_sim_reset(void);
+
+// GPS_EN
+void gps_sim_power(bool on);
+
+// Delivers through shim_rx() whatever has arrived by now
+void gps_sim_poll(void);
+
+// When gps_sim_poll() next has something to hand over
+uint32_t gps_sim_next_us(void);
+
+// The receiver's own clock, microseconds from gps_sim_reset(), good for
+// runs longer than the shim's 32-bit one
+uint64_t gps_sim_clock_us(void);
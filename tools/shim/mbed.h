@@ -0,0 +1,455 @@
+#pragma once
+
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Just enough of mbed for the firmware's receiver code to run on a
+ * host. Time only moves when the caller says so, through shim_now_us,
+ * so a capture replays as fast as it can be read.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+
+typedef enum {
+    NC = -1,
+    PTA1,
+    PTA2,
+    PTB0,
+    PTB18,
+    PTB19,
+    PTD1,
+    PTD2,
+    PTD3,
+    PTD4,
+    PTD5,
+    PTE0,
+    PTE1,
+    PTE20,
+    PTE22,
+    PTE23,
+    SHIM_PIN_COUNT,
+
+    LED_RED = PTB18,
+    LED_GREEN = PTB19,
+    LED_BLUE = PTD1,
+    USBTX = PTA2,
+    USBRX = PTA1,
+} PinName;
+
+// Each thread replays on its own clock
+extern thread_local uint32_t shim_now_us;
+// wait_us() calls, the bit-banged busses' edge waits
+extern thread_local uint32_t shim_waits;
+// What each Timer read costs, so a loop polling one gets somewhere
+extern thread_local uint32_t shim_timer_read_us;
+
+static inline uint32_t us_ticker_read(void) { return shim_now_us; }
+static inline void wait_ms(int ms) { shim_now_us += ms * 1000; }
+static inline void wait_us(int us) { shim_now_us += us; shim_waits++; }
+
+// Pin levels, and who to tell when one changes
+extern thread_local uint8_t shim_pins[SHIM_PIN_COUNT];
+extern thread_local void (*shim_pin_changed)(PinName pin, int value);
+
+// Calls the InterruptIns on the pin that want its rising edge
+void shim_pin_rose(PinName pin);
+
+static inline void shim_pin_set(PinName pin, int value)
+{
+    if (pin == NC || shim_pins[pin] == !!value)
+        return;
+    shim_pins[pin] = !!value;
+    if (shim_pin_changed)
+        shim_pin_changed(pin, !!value);
+    if (value)
+        shim_pin_rose(pin);
+}
+
+class Timer
+{
+public:
+    Timer(void) : _running(false), _start(0), _elapsed(0) {}
+
+    void start(void) { if (!this->_running) { this->_start = shim_now_us; this->_running = true; } }
+    void stop(void) { this->_elapsed = this->read_us(); this->_running = false; }
+    void reset(void) { this->_start = shim_now_us; this->_elapsed = 0; }
+    int read_us(void)
+    {
+        shim_now_us += shim_timer_read_us;
+        return this->_elapsed + (this->_running ? shim_now_us - this->_start : 0);
+    }
+    int read_ms(void) { return this->read_us() / 1000; }
+    float read(void) { return this->read_us() / 1000000.0f; }
+
+private:
+    bool _running;
+    uint32_t _start;
+    uint32_t _elapsed;
+};
+
+class DigitalOut
+{
+public:
+    DigitalOut(PinName pin) : _pin(pin), _value(0) {}
+    DigitalOut &operator=(int value) { this->_value = value; shim_pin_set(this->_pin, value); return *this; }
+    operator int(void) { return this->_value; }
+
+private:
+    PinName _pin;
+    int _value;
+};
+
+// Released as an input, the line is pulled up
+class DigitalInOut
+{
+public:
+    DigitalInOut(PinName pin) : _pin(pin), _value(0), _output(false) {}
+
+    void output(void) { this->_output = true; shim_pin_set(this->_pin, this->_value); }
+    void input(void) { this->_output = false; shim_pin_set(this->_pin, 1); }
+
+    DigitalInOut &operator=(int value)
+    {
+        this->_value = value;
+        if (this->_output)
+            shim_pin_set(this->_pin, value);
+        return *this;
+    }
+    operator int(void) { return this->_pin == NC ? 0 : shim_pins[this->_pin]; }
+
+private:
+    PinName _pin;
+    int _value;
+    bool _output;
+};
+
+// Every write goes to shim_i2c_write and is acknowledged
+extern thread_local void (*shim_i2c_write)(int address, const char *data, int length);
+
+class I2C
+{
+public:
+    I2C(PinName sda, PinName scl) {}
+
+    void frequency(int hz) {}
+    int write(int address, const char *data, int length, bool repeated = false)
+    {
+        if (shim_i2c_write)
+            shim_i2c_write(address, data, length);
+        return 0;
+    }
+};
+
+// Fired by the caller, through Ticker::attached or shim_tickers(),
+// rather than the clock
+class Ticker
+{
+public:
+    Ticker(void);
+    ~Ticker(void);
+
+    template <typename T> void attach_us(T *obj, void (T::*method)(void), uint32_t us)
+    {
+        this->_fn = [obj, method]() { (obj->*method)(); };
+        this->_us = us;
+        this->_next = shim_now_us + us;
+        attached = this;
+    }
+    void attach(void (*fn)(void), float s)
+    {
+        this->_fn = fn;
+        this->_us = s * 1000000;
+        this->_next = shim_now_us + this->_us;
+        attached = this;
+    }
+    void detach(void) { this->_fn = nullptr; }
+
+    // On a copy, the call may detach() it
+    void fire(void) { std::function<void(void)> fn = this->_fn; if (fn) fn(); }
+    uint32_t period_us(void) const { return this->_us; }
+
+    static thread_local Ticker *attached;
+
+private:
+    friend void shim_tickers(void);
+    friend bool shim_ticker_next(uint32_t *at);
+
+    std::function<void(void)> _fn;
+    uint32_t _us;
+    uint32_t _next;
+};
+
+// Fires each attached Ticker as often as it has come due by shim_now_us
+void shim_tickers(void);
+// When the next one is due, false if none is attached
+bool shim_ticker_next(uint32_t *at);
+
+// Reads whatever shim_analog is set to, a waveform being replayed
+extern thread_local uint16_t shim_analog;
+extern thread_local uint32_t shim_analog_reads;
+
+// Starts each conversion through ADC0->SC1[0] as mbed's does
+class AnalogIn
+{
+public:
+    AnalogIn(PinName pin);
+
+    uint16_t read_u16(void);
+    float read(void) { return this->read_u16() / 65535.0f; }
+
+private:
+    uint32_t _channel;
+};
+
+// Run straight from shim_pin_set(), as the ISR would be
+class InterruptIn
+{
+public:
+    InterruptIn(PinName pin);
+    ~InterruptIn(void);
+
+    template <typename T> void rise(T *obj, void (T::*method)(void))
+    {
+        this->_rise = [obj, method]() { (obj->*method)(); };
+    }
+
+private:
+    friend void shim_pin_rose(PinName pin);
+
+    PinName _pin;
+    std::function<void(void)> _rise;
+};
+
+// One-shot, fired by sleep() moving the clock on to it
+class Timeout
+{
+public:
+    Timeout(void);
+    ~Timeout(void);
+
+    template <typename T> void attach_us(T *obj, void (T::*method)(void), uint32_t us)
+    {
+        this->_fn = [obj, method]() { (obj->*method)(); };
+        this->_at = shim_now_us + us;
+        this->_armed = true;
+    }
+    void detach(void) { this->_armed = false; }
+
+private:
+    friend void sleep(void);
+
+    std::function<void(void)> _fn;
+    uint32_t _at;
+    bool _armed;
+};
+
+// Besides a Timeout, sleep() wakes at shim_wake_at to call shim_wake,
+// standing in for an interrupt; that sets the next one
+extern thread_local void (*shim_wake)(void);
+extern thread_local uint32_t shim_wake_at;
+// Time spent asleep, and how often
+extern thread_local uint64_t shim_slept_us;
+extern thread_local uint32_t shim_sleeps;
+// The longest the caller went between sleep()s, from the last clear
+extern thread_local uint32_t shim_awake_max_us;
+
+// Returns at once if there is nothing to wake for
+void sleep(void);
+static inline void deepsleep(void) { sleep(); }
+
+// Console output goes to shim_console, stdout unless set
+extern thread_local FILE *shim_console;
+
+class Stream
+{
+public:
+    int printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        va_list args;
+        int n;
+
+        va_start(args, format);
+        n = vfprintf(shim_console ? shim_console : stdout, format, args);
+        va_end(args);
+        return n;
+    }
+};
+
+// Every byte written to a Serial goes to shim_tx
+extern thread_local void (*shim_tx)(uint8_t c);
+
+// The last one attached to on this thread takes shim_rx()
+class Serial : public Stream
+{
+public:
+    Serial(PinName tx, PinName rx) : _c(0) {}
+
+    void baud(int baud) {}
+    int putc(int c)
+    {
+        if (shim_tx)
+            shim_tx(c);
+        return c;
+    }
+    int getc(void) { return this->_c; }
+
+    template <typename T> void attach(T *obj, void (T::*method)(void))
+    {
+        this->_rx = [obj, method]() { (obj->*method)(); };
+        rx_serial = this;
+    }
+
+    static thread_local Serial *rx_serial;
+
+private:
+    friend void shim_rx(uint8_t c);
+
+    int _c;
+    std::function<void(void)> _rx;
+};
+
+// Delivers a byte as the RX interrupt would
+void shim_rx(uint8_t c);
+
+// The KL25Z's SPI status and data registers, with an SD card on the
+// other end, see shim/spi.cpp. Every access takes bus time, and an
+// interrupt may run first unless they are masked.
+#define SPI_S_SPTEF_MASK 0x20u
+#define SPI_S_SPRF_MASK  0x80u
+
+struct spi_status_reg {
+    operator uint8_t(void) const;
+};
+
+struct spi_data_reg {
+    operator uint8_t(void) const;
+    void operator=(uint8_t d);
+};
+
+struct SPI_Type {
+    spi_status_reg S;
+    spi_data_reg D;
+};
+
+struct spi_s {
+    SPI_Type *spi;
+};
+
+void __disable_irq(void);
+void __enable_irq(void);
+
+class SPI
+{
+public:
+    SPI(PinName mosi, PinName miso, PinName sclk);
+
+    void format(int bits, int mode = 0) {}
+    void frequency(int hz);
+    int write(int value);
+
+protected:
+    void aquire(void) {}
+
+    spi_s _spi;
+};
+
+// The KL25Z's RTC, counting 32.768kHz from the host clock, see
+// shim/rtc.cpp. Seconds and prescaler only take writes while TCE is
+// clear, and only count while it's set.
+#define RTC_SR_TCE_MASK     0x10u
+#define RTC_TCR_TCR_MASK    0xFFu
+#define RTC_TCR_TCR_SHIFT   0
+#define RTC_TCR_CIR_MASK    0xFF00u
+#define RTC_TCR_CIR_SHIFT   8
+#define RTC_TCR_TCR(x)      (((uint32_t)(x) << RTC_TCR_TCR_SHIFT) & RTC_TCR_TCR_MASK)
+#define RTC_TCR_CIR(x)      (((uint32_t)(x) << RTC_TCR_CIR_SHIFT) & RTC_TCR_CIR_MASK)
+
+struct rtc_tsr_reg {
+    operator uint32_t(void) const;
+    void operator=(uint32_t v);
+};
+
+struct rtc_tpr_reg {
+    operator uint32_t(void) const;
+    void operator=(uint32_t v);
+};
+
+struct RTC_Type {
+    rtc_tsr_reg TSR;
+    rtc_tpr_reg TPR;
+    uint32_t TCR;
+    uint32_t SR;
+};
+
+extern RTC_Type shim_rtc;
+extern double shim_rtc_ppm; // How far the crystal is off, fast is positive
+#define RTC (&shim_rtc)
+
+// The KL25Z's ADC0, as much of it as the keypad's wake on compare
+// uses. shim_adc_compare() converts shim_analog the way continuous
+// conversion would, and raises ADC0_IRQn when the compare is true.
+#define ADC_SC1_ADCH_MASK       0x1Fu
+#define ADC_SC1_ADCH(x)         ((uint32_t)(x) & ADC_SC1_ADCH_MASK)
+#define ADC_SC1_AIEN_MASK       0x40u
+#define ADC_SC1_COCO_MASK       0x80u
+#define ADC_CFG1_ADICLK_MASK    0x3u
+#define ADC_CFG1_ADICLK(x)      ((uint32_t)(x) & ADC_CFG1_ADICLK_MASK)
+#define ADC_SC2_ACFGT_MASK      0x10u
+#define ADC_SC2_ACFE_MASK       0x20u
+#define ADC_SC3_ADCO_MASK       0x8u
+
+struct ADC_Type {
+    uint32_t SC1[2];
+    uint32_t CFG1;
+    uint32_t CFG2;
+    uint32_t R[2];
+    uint32_t CV1;
+    uint32_t CV2;
+    uint32_t SC2;
+    uint32_t SC3;
+};
+
+extern thread_local ADC_Type shim_adc;
+#define ADC0 (&shim_adc)
+
+enum IRQn_Type {
+    ADC0_IRQn = 15,
+};
+
+void NVIC_SetVector(IRQn_Type irq, uintptr_t vector);
+void NVIC_EnableIRQ(IRQn_Type irq);
+void NVIC_DisableIRQ(IRQn_Type irq);
+
+void shim_adc_compare(void);
@@ -0,0 +1,132 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rtc_api.h"
+
+#define RTC_HZ 32768
+
+RTC_Type shim_rtc;
+double shim_rtc_ppm;
+
+static bool enabled;
+static uint32_t seconds;
+static uint16_t prescaler;  // TSR ticks as it reaches RTC_HZ
+static unsigned interval;   // Seconds into the compensation interval
+static uint32_t counted_us; // Host clock the count is up to
+static double fraction;     // Of an oscillator cycle
+
+/*
+ * One second in every CIR + 1 starts the prescaler at TCR, two's
+ * complement, so that second is TCR cycles short.
+ */
+static void next_second(void)
+{
+    unsigned cir = (shim_rtc.TCR & RTC_TCR_CIR_MASK) >> RTC_TCR_CIR_SHIFT;
+
+    seconds++;
+    prescaler = 0;
+    if (++interval > cir) {
+        interval = 0;
+        prescaler = (uint16_t)(int8_t)((shim_rtc.TCR & RTC_TCR_TCR_MASK) >> RTC_TCR_TCR_SHIFT);
+    }
+}
+
+// Brings the count up to the host clock, if it's running, with the
+// oscillator shim_rtc_ppm fast
+static void advance(void)
+{
+    uint32_t elapsed = shim_now_us - counted_us;
+    uint64_t cycles;
+    uint16_t left;
+
+    counted_us = shim_now_us;
+    if (!(shim_rtc.SR & RTC_SR_TCE_MASK))
+        return;
+
+    fraction += elapsed * (RTC_HZ / 1e6) * (1.0 + shim_rtc_ppm / 1e6);
+    cycles = (uint64_t)fraction;
+    fraction -= cycles;
+
+    for (;;) {
+        left = RTC_HZ - prescaler;
+        if (cycles < left) {
+            prescaler += cycles;
+            break;
+        }
+        cycles -= left;
+        next_second();
+    }
+}
+
+rtc_tsr_reg::operator uint32_t(void) const
+{
+    advance();
+    return seconds;
+}
+
+void rtc_tsr_reg::operator=(uint32_t v)
+{
+    advance();
+    if (shim_rtc.SR & RTC_SR_TCE_MASK)
+        return;
+    seconds = v;
+}
+
+rtc_tpr_reg::operator uint32_t(void) const
+{
+    advance();
+    return prescaler;
+}
+
+void rtc_tpr_reg::operator=(uint32_t v)
+{
+    advance();
+    if (shim_rtc.SR & RTC_SR_TCE_MASK)
+        return;
+    prescaler = v;
+    fraction = 0;
+}
+
+// As out of reset: TSR at 0 and counting, no compensation
+void rtc_init(void)
+{
+    enabled = true;
+    seconds = 0;
+    prescaler = 0;
+    interval = 0;
+    fraction = 0;
+    counted_us = shim_now_us;
+    shim_rtc.TCR = 0;
+    shim_rtc.SR = RTC_SR_TCE_MASK;
+}
+
+int rtc_isenabled(void)
+{
+    return enabled;
+}
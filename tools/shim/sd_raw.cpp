@@ -0,0 +1,233 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <sd-reader/sd_raw.h>
+
+#include "card.h"
+#include "mbed.h"
+
+#define BLOCK_SIZE 512
+
+card_stats_t card_stats;
+long card_writes_left = -1;
+long card_init_polls;
+bool card_init_fails;
+uint32_t card_block_us;
+
+static uint8_t *card;
+static size_t card_size;
+static offset_t cached = (offset_t)-1;
+
+int card_open(const char *fn)
+{
+    struct stat st;
+    int fd;
+
+    fd = open(fn, O_RDWR);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(fn);
+        return 0;
+    }
+
+    card_size = st.st_size;
+    card = (uint8_t *)mmap(NULL, card_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (card == MAP_FAILED) {
+        perror(fn);
+        card = NULL;
+        return 0;
+    }
+
+    cached = (offset_t)-1;
+    memset(&card_stats, 0, sizeof(card_stats));
+    return 1;
+}
+
+void card_close(void)
+{
+    if (!card)
+        return;
+    msync(card, card_size, MS_SYNC);
+    munmap(card, card_size);
+    card = NULL;
+}
+
+// The block holding offset comes off the card unless it's the cached one
+static void fetch(offset_t offset)
+{
+    offset_t block = offset & ~(offset_t)(BLOCK_SIZE - 1);
+
+    if (block != cached) {
+        card_stats.blocks_read++;
+        shim_now_us += card_block_us;
+        cached = block;
+    }
+}
+
+uint8_t sd_raw_init_start()
+{
+    return card != NULL;
+}
+
+uint8_t sd_raw_init_poll()
+{
+    card_stats.init_polls++;
+    if (!card)
+        return SD_RAW_INIT_FAILED;
+    if (card_init_polls > 0) {
+        card_init_polls--;
+        return SD_RAW_INIT_BUSY;
+    }
+    return card_init_fails ? SD_RAW_INIT_FAILED : SD_RAW_INIT_DONE;
+}
+
+uint8_t sd_raw_init()
+{
+    uint8_t result;
+
+    if (!sd_raw_init_start())
+        return 0;
+    while ((result = sd_raw_init_poll()) == SD_RAW_INIT_BUSY);
+    return result == SD_RAW_INIT_DONE;
+}
+
+uint8_t sd_raw_available()
+{
+    return card != NULL;
+}
+
+uint8_t sd_raw_locked()
+{
+    return 0;
+}
+
+uint8_t sd_raw_ready()
+{
+    return 1;
+}
+
+uint8_t sd_raw_sync()
+{
+    return 1;
+}
+
+uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
+{
+    uintptr_t chunk;
+
+    if (!card || offset + length > card_size)
+        return 0;
+
+    memcpy(buffer, card + offset, length);
+    while (length > 0) {
+        fetch(offset);
+        chunk = BLOCK_SIZE - (offset & (BLOCK_SIZE - 1));
+        if (chunk > length)
+            chunk = length;
+        offset += chunk;
+        length -= chunk;
+    }
+
+    return 1;
+}
+
+uint8_t sd_raw_read_interval(offset_t offset, uint8_t* buffer, uintptr_t interval, uintptr_t length, sd_raw_read_interval_handler_t callback, void* p)
+{
+    if (!buffer || interval == 0 || length < interval || !callback)
+        return 0;
+
+    while (length >= interval) {
+        if (!sd_raw_read(offset, buffer, interval))
+            return 0;
+        if (!callback(buffer, offset, p))
+            break;
+        offset += interval;
+        length -= interval;
+    }
+
+    return 1;
+}
+
+uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
+{
+    uintptr_t chunk;
+
+    if (!card || offset + length > card_size || card_writes_left == 0)
+        return 0;
+    if (card_writes_left > 0)
+        card_writes_left--;
+
+    memcpy(card + offset, buffer, length);
+    while (length > 0) {
+        chunk = BLOCK_SIZE - (offset & (BLOCK_SIZE - 1));
+        if (chunk > length)
+            chunk = length;
+        // A partial block is read in first to be rewritten whole
+        if (chunk < BLOCK_SIZE)
+            fetch(offset);
+        else
+            cached = offset;
+        card_stats.blocks_written++;
+        shim_now_us += card_block_us;
+        offset += chunk;
+        length -= chunk;
+    }
+
+    return 1;
+}
+
+uint8_t sd_raw_write_interval(offset_t offset, uint8_t* buffer, uintptr_t length, sd_raw_write_interval_handler_t callback, void* p)
+{
+    uintptr_t count;
+    bool endless = length == 0;
+
+    if (!buffer || !callback)
+        return 0;
+
+    while (endless || length > 0) {
+        count = callback(buffer, offset, p);
+        if (!count)
+            break;
+        if (!endless && count > length)
+            return 0;
+        if (!sd_raw_write(offset, buffer, count))
+            return 0;
+        offset += count;
+        length -= count;
+    }
+
+    return 1;
+}
@@ -0,0 +1,248 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <vector>
+
+#include "mbed.h"
+
+thread_local uint32_t shim_now_us;
+thread_local uint32_t shim_waits;
+thread_local uint32_t shim_timer_read_us;
+thread_local uint8_t shim_pins[SHIM_PIN_COUNT];
+thread_local void (*shim_pin_changed)(PinName pin, int value);
+thread_local void (*shim_i2c_write)(int address, const char *data, int length);
+thread_local uint16_t shim_analog;
+thread_local uint32_t shim_analog_reads;
+thread_local Serial *Serial::rx_serial;
+thread_local Ticker *Ticker::attached;
+thread_local void (*shim_wake)(void);
+thread_local uint32_t shim_wake_at;
+thread_local uint64_t shim_slept_us;
+thread_local uint32_t shim_sleeps;
+thread_local uint32_t shim_awake_max_us;
+thread_local void (*shim_tx)(uint8_t c);
+thread_local FILE *shim_console;
+thread_local ADC_Type shim_adc;
+
+static thread_local uint32_t woke_at;
+
+static thread_local std::vector<Timeout *> timeouts;
+static thread_local std::vector<Ticker *> tickers;
+static thread_local std::vector<InterruptIn *> interrupts;
+static thread_local uintptr_t vectors[32];
+static thread_local uint32_t irqs_enabled;
+
+void shim_rx(uint8_t c)
+{
+    Serial *serial = Serial::rx_serial;
+
+    if (!serial || !serial->_rx)
+        return;
+
+    serial->_c = c;
+    serial->_rx();
+}
+
+InterruptIn::InterruptIn(PinName pin) :
+    _pin(pin)
+{
+    interrupts.push_back(this);
+}
+
+InterruptIn::~InterruptIn(void)
+{
+    for (size_t i = 0; i < interrupts.size(); i++) {
+        if (interrupts[i] == this) {
+            interrupts.erase(interrupts.begin() + i);
+            break;
+        }
+    }
+}
+
+void shim_pin_rose(PinName pin)
+{
+    for (size_t i = 0; i < interrupts.size(); i++) {
+        if (interrupts[i]->_pin == pin && interrupts[i]->_rise)
+            interrupts[i]->_rise();
+    }
+}
+
+// Each pin a channel of its own, none of them 31, disabled
+AnalogIn::AnalogIn(PinName pin) :
+    _channel((uint32_t)pin % ADC_SC1_ADCH_MASK)
+{
+
+}
+
+uint16_t AnalogIn::read_u16(void)
+{
+    ADC0->SC1[0] = ADC_SC1_ADCH(this->_channel);
+    ADC0->R[0] = shim_analog;
+    ADC0->SC1[0] |= ADC_SC1_COCO_MASK;
+    shim_analog_reads++;
+    return ADC0->R[0];
+}
+
+Ticker::Ticker(void) :
+    _us(0),
+    _next(0)
+{
+    tickers.push_back(this);
+}
+
+Ticker::~Ticker(void)
+{
+    for (size_t i = 0; i < tickers.size(); i++) {
+        if (tickers[i] == this) {
+            tickers.erase(tickers.begin() + i);
+            break;
+        }
+    }
+}
+
+void shim_tickers(void)
+{
+    for (size_t i = 0; i < tickers.size(); i++) {
+        Ticker *ticker = tickers[i];
+
+        while (ticker->_fn && ticker->_us && (int32_t)(shim_now_us - ticker->_next) >= 0) {
+            ticker->_next += ticker->_us;
+            ticker->fire();
+        }
+    }
+}
+
+bool shim_ticker_next(uint32_t *at)
+{
+    bool found = false;
+
+    for (size_t i = 0; i < tickers.size(); i++) {
+        if (!tickers[i]->_fn || !tickers[i]->_us)
+            continue;
+        if (!found || (int32_t)(tickers[i]->_next - *at) < 0)
+            *at = tickers[i]->_next;
+        found = true;
+    }
+    return found;
+}
+
+Timeout::Timeout(void) :
+    _at(0),
+    _armed(false)
+{
+    timeouts.push_back(this);
+}
+
+Timeout::~Timeout(void)
+{
+    for (size_t i = 0; i < timeouts.size(); i++) {
+        if (timeouts[i] == this) {
+            timeouts.erase(timeouts.begin() + i);
+            break;
+        }
+    }
+}
+
+void sleep(void)
+{
+    Timeout *next = nullptr;
+    uint32_t at;
+
+    if (shim_now_us - woke_at > shim_awake_max_us)
+        shim_awake_max_us = shim_now_us - woke_at;
+
+    // The earliest Timeout, in wrap-safe order
+    for (size_t i = 0; i < timeouts.size(); i++) {
+        if (timeouts[i]->_armed && (!next || (int32_t)(timeouts[i]->_at - next->_at) < 0))
+            next = timeouts[i];
+    }
+    if (shim_wake && (!next || (int32_t)(shim_wake_at - next->_at) < 0))
+        next = nullptr;
+    else if (!next)
+        return;
+
+    at = next ? next->_at : shim_wake_at;
+    if ((int32_t)(at - shim_now_us) > 0) {
+        shim_slept_us += at - shim_now_us;
+        shim_now_us = at;
+    }
+    shim_sleeps++;
+
+    if (next) {
+        next->_armed = false;
+        next->_fn();
+    } else {
+        shim_wake();
+    }
+    woke_at = shim_now_us;
+}
+
+void NVIC_SetVector(IRQn_Type irq, uintptr_t vector)
+{
+    vectors[irq] = vector;
+}
+
+void NVIC_EnableIRQ(IRQn_Type irq)
+{
+    irqs_enabled |= 1u << irq;
+}
+
+void NVIC_DisableIRQ(IRQn_Type irq)
+{
+    irqs_enabled &= ~(1u << irq);
+}
+
+void shim_adc_compare(void)
+{
+    bool greater = ADC0->SC2 & ADC_SC2_ACFGT_MASK;
+
+    if (!(ADC0->SC3 & ADC_SC3_ADCO_MASK) || !(ADC0->SC2 & ADC_SC2_ACFE_MASK))
+        return;
+    if ((ADC0->SC1[0] & ADC_SC1_ADCH_MASK) == ADC_SC1_ADCH_MASK)
+        return;
+    // Nothing is kept of a conversion the compare is false for
+    if (greater != (shim_analog >= ADC0->CV1))
+        return;
+
+    ADC0->R[0] = shim_analog;
+    ADC0->SC1[0] |= ADC_SC1_COCO_MASK;
+    if ((ADC0->SC1[0] & ADC_SC1_AIEN_MASK) && (irqs_enabled & (1u << ADC0_IRQn)) && vectors[ADC0_IRQn])
+        ((void (*)(void))vectors[ADC0_IRQn])();
+}
+
+// No-ops unless shim/spi.cpp is there to watch the bus
+__attribute__((weak)) void __disable_irq(void)
+{
+
+}
+
+__attribute__((weak)) void __enable_irq(void)
+{
+
+}
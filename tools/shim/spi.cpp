@@ -0,0 +1,373 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+
+#include "spi_sim.h"
+
+// A status poll or register access, a few cycles at 48MHz
+#define ACCESS_NS     60
+// Polls of a bus with nothing on it before a wait is taken as stuck
+#define STUCK_POLLS   10000
+// ACMD41s before the card leaves its idle state
+#define CARD_INIT_POLLS 3
+// Bytes the card stays busy programming a block
+#define CARD_BUSY_BYTES 20
+
+#define R1_IDLE     0x01
+#define R1_ILLEGAL  0x04
+#define R1_ADDRESS  0x20
+
+spi_sim_t spi_sim;
+
+static SPI_Type regs;
+static uint64_t now_ns;
+static uint32_t byte_ns = 8000;
+static unsigned rand_state;
+
+static bool masked;
+static bool pending;
+static uint64_t masked_at;
+
+// The module: a byte waiting in the transmit buffer, one shifting and
+// one received
+static bool tx_full;
+static uint8_t tx_byte;
+static bool shifting;
+static uint8_t shift_byte;
+static uint64_t shift_end;
+static bool rx_full;
+static uint8_t rx_byte;
+static uint32_t idle_polls;
+
+enum card_state_t {
+    CARD_COMMAND,
+    CARD_WRITE_TOKEN,
+    CARD_WRITE_DATA,
+};
+
+static struct {
+    card_state_t state;
+    uint8_t command[6];
+    int command_len;
+    std::deque<uint8_t> out;
+    bool idle;
+    bool app;
+    int init_polls;
+    uint32_t block;
+    uint8_t data[512 + 2];
+    int data_len;
+    uint8_t blocks[SPI_CARD_BLOCKS][512];
+} card;
+
+static uint32_t sim_rand(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 8) & 0xffffff;
+}
+
+static void card_command(void)
+{
+    uint8_t cmd = card.command[0] & 0x3f;
+    uint32_t arg = (uint32_t)card.command[1] << 24 | card.command[2] << 16 | card.command[3] << 8 | card.command[4];
+    uint8_t r1;
+
+    // Ncr: the answer comes a byte later
+    card.out.push_back(0xff);
+
+    if (card.app && cmd == 41) {
+        if (--card.init_polls <= 0)
+            card.idle = false;
+        card.app = false;
+        card.out.push_back(card.idle ? R1_IDLE : 0);
+        return;
+    }
+    card.app = false;
+
+    r1 = card.idle ? R1_IDLE : 0;
+    switch (cmd) {
+        case 0:
+            card.idle = true;
+            card.init_polls = CARD_INIT_POLLS;
+            card.out.push_back(R1_IDLE);
+            break;
+        case 8:
+            card.out.push_back(r1);
+            card.out.push_back(0x00);
+            card.out.push_back(0x00);
+            card.out.push_back((arg >> 8) & 0x0f);
+            card.out.push_back(arg & 0xff);
+            break;
+        case 55:
+            card.app = true;
+            card.out.push_back(r1);
+            break;
+        case 58:
+            // Powered up, SDHC
+            card.out.push_back(r1);
+            card.out.push_back(0xc0);
+            card.out.push_back(0xff);
+            card.out.push_back(0x80);
+            card.out.push_back(0x00);
+            break;
+        case 13:
+            card.out.push_back(r1);
+            card.out.push_back(0x00);
+            break;
+        case 16:
+            card.out.push_back(r1);
+            break;
+        case 17:
+            if (arg >= SPI_CARD_BLOCKS) {
+                card.out.push_back(r1 | R1_ADDRESS);
+                break;
+            }
+            card.out.push_back(r1);
+            card.out.push_back(0xff);
+            card.out.push_back(0xff);
+            card.out.push_back(0xfe);
+            card.out.insert(card.out.end(), card.blocks[arg], card.blocks[arg] + 512);
+            card.out.push_back(0x00);
+            card.out.push_back(0x00);
+            break;
+        case 24:
+            if (arg >= SPI_CARD_BLOCKS) {
+                card.out.push_back(r1 | R1_ADDRESS);
+                break;
+            }
+            card.out.push_back(r1);
+            card.block = arg;
+            card.state = CARD_WRITE_TOKEN;
+            break;
+        default:
+            card.out.push_back(r1 | R1_ILLEGAL);
+            break;
+    }
+}
+
+// One byte each way, as the card sees it
+static uint8_t card_exchange(uint8_t mosi)
+{
+    uint8_t miso = 0xff;
+
+    if (!card.out.empty()) {
+        miso = card.out.front();
+        card.out.pop_front();
+    }
+
+    switch (card.state) {
+        case CARD_COMMAND:
+            if (card.command_len == 0 && (mosi & 0xc0) != 0x40)
+                break;
+            card.command[card.command_len++] = mosi;
+            if (card.command_len == sizeof(card.command)) {
+                card.command_len = 0;
+                card_command();
+            }
+            break;
+        case CARD_WRITE_TOKEN:
+            if (mosi == 0xfe) {
+                card.data_len = 0;
+                card.state = CARD_WRITE_DATA;
+            }
+            break;
+        case CARD_WRITE_DATA:
+            card.data[card.data_len++] = mosi;
+            if (card.data_len < (int)sizeof(card.data))
+                break;
+            memcpy(card.blocks[card.block], card.data, 512);
+            card.out.push_back(0xe5); // Accepted
+            card.out.insert(card.out.end(), CARD_BUSY_BYTES, 0x00);
+            card.state = CARD_COMMAND;
+            break;
+    }
+
+    return miso;
+}
+
+// Runs the module up to now
+static void advance(void)
+{
+    uint8_t miso;
+
+    while (shifting && shift_end <= now_ns) {
+        miso = card_exchange(shift_byte);
+        spi_sim.bytes++;
+        if (rx_full) {
+            spi_sim.overruns++;
+        } else {
+            rx_byte = miso;
+            rx_full = true;
+        }
+
+        shifting = tx_full;
+        if (shifting) {
+            shift_byte = tx_byte;
+            shift_end += byte_ns;
+            tx_full = false;
+        }
+    }
+}
+
+// Each access takes its time, after any interrupt that gets in first
+static void access(void)
+{
+    if (spi_sim.irq_permille && (int)(sim_rand() % 1000) < spi_sim.irq_permille) {
+        if (masked) {
+            pending = true;
+        } else {
+            now_ns += sim_rand() % spi_sim.irq_max_ns;
+            spi_sim.irqs++;
+        }
+    }
+
+    now_ns += ACCESS_NS;
+    advance();
+}
+
+spi_status_reg::operator uint8_t(void) const
+{
+    access();
+
+    // Nothing shifting or received: a wait for SPRF would spin forever,
+    // so count it and let it see a byte
+    if (!shifting && !tx_full && !rx_full && ++idle_polls > STUCK_POLLS) {
+        spi_sim.stuck++;
+        idle_polls = 0;
+        rx_byte = 0xff;
+        rx_full = true;
+    }
+
+    return (rx_full ? SPI_S_SPRF_MASK : 0) | (tx_full ? 0 : SPI_S_SPTEF_MASK);
+}
+
+spi_data_reg::operator uint8_t(void) const
+{
+    access();
+    idle_polls = 0;
+    rx_full = false;
+    return rx_byte;
+}
+
+void spi_data_reg::operator=(uint8_t d)
+{
+    access();
+    idle_polls = 0;
+    if (tx_full) {
+        spi_sim.ignored++;
+        return;
+    }
+
+    if (shifting) {
+        tx_byte = d;
+        tx_full = true;
+    } else {
+        shift_byte = d;
+        shift_end = now_ns + byte_ns;
+        shifting = true;
+    }
+}
+
+void __disable_irq(void)
+{
+    if (masked)
+        return;
+    masked = true;
+    masked_at = now_ns;
+}
+
+void __enable_irq(void)
+{
+    if (!masked)
+        return;
+    masked = false;
+    if (now_ns - masked_at > spi_sim.masked_max_ns)
+        spi_sim.masked_max_ns = now_ns - masked_at;
+
+    // Held off until now
+    if (pending) {
+        pending = false;
+        now_ns += sim_rand() % spi_sim.irq_max_ns;
+        spi_sim.irqs++;
+    }
+}
+
+SPI::SPI(PinName mosi, PinName miso, PinName sclk)
+{
+    this->_spi.spi = &regs;
+}
+
+void SPI::frequency(int hz)
+{
+    byte_ns = 8 * 1000000000ull / hz;
+}
+
+int SPI::write(int value)
+{
+    while (!(regs.S & SPI_S_SPTEF_MASK));
+    regs.D = value;
+    while (!(regs.S & SPI_S_SPRF_MASK));
+    return regs.D;
+}
+
+void spi_sim_reset(int irq_permille, uint32_t irq_max_ns, unsigned seed)
+{
+    memset(&spi_sim, 0, sizeof(spi_sim));
+    spi_sim.irq_permille = irq_permille;
+    spi_sim.irq_max_ns = irq_max_ns;
+    rand_state = seed;
+
+    tx_full = shifting = rx_full = false;
+    masked = pending = false;
+    idle_polls = 0;
+
+    card.state = CARD_COMMAND;
+    card.command_len = 0;
+    card.out.clear();
+    card.idle = true;
+    card.app = false;
+    card.init_polls = CARD_INIT_POLLS;
+}
+
+uint32_t spi_sim_byte_ns(void)
+{
+    return byte_ns;
+}
+
+uint8_t *spi_sim_block(uint32_t block)
+{
+    return card.blocks[block % SPI_CARD_BLOCKS];
+}
+
+SPI_Type *spi_sim_regs(void)
+{
+    return &regs;
+}
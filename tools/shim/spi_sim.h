@@ -0,0 +1,71 @@
+#pragma once
+
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * The SPI bus for host builds of spi_io.cpp: the KL25Z's SPI module,
+ * one byte buffered and one shifting with no receive FIFO, and an SD
+ * card answering in SPI mode. Time moves by a bus access at a time;
+ * interrupts, if asked for, steal the CPU at random for a while unless
+ * masked, when they wait until __enable_irq().
+ */
+
+#include <stdint.h>
+
+#include "mbed.h"
+
+#define SPI_CARD_BLOCKS 64
+
+struct spi_sim_t {
+    // Chance, per thousand register accesses, that an interrupt runs
+    // first, and the longest one runs for
+    int irq_permille;
+    uint32_t irq_max_ns;
+
+    uint64_t bytes;          // bytes shifted
+    uint32_t irqs;
+    uint32_t overruns;       // bytes lost to SPRF still being set
+    uint32_t ignored;        // writes to D with SPTEF clear
+    uint32_t stuck;          // waits for a byte that will never arrive
+    uint64_t masked_max_ns;  // longest stretch with interrupts masked
+};
+
+extern spi_sim_t spi_sim;
+
+// Clears the counts and the card, which then needs initialising again
+void spi_sim_reset(int irq_permille, uint32_t irq_max_ns, unsigned seed);
+
+// The bus time one byte takes at the current clock
+uint32_t spi_sim_byte_ns(void);
+
+// The card's contents, block by block
+uint8_t *spi_sim_block(uint32_t block);
+
+SPI_Type *spi_sim_regs(void);
@@ -0,0 +1,211 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * How much TrackFilter drops, and what it costs
+ *
+ * Reads full rate track.bin logs, runs their fixes through TrackFilter
+ * and reports how many were kept, the bytes they'd take as blocks, and
+ * the largest distance from any fix to the line drawn through the kept
+ * ones around it.
+ *
+ *   simplify [-t metres] [-s knots] [-g seconds] [-o out.bin] track.bin...
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "track.h"
+
+#define M_PER_UDEG 0.111195 // As track.cpp, in double here
+
+static int load(const char *fn, std::vector<track_fix_t> *fixes)
+{
+    uint8_t block[TRACK_BLOCK_SIZE];
+    track_fix_t decoded[TRACK_BLOCK_SIZE];
+    int count;
+    FILE *f;
+
+    f = fopen(fn, "rb");
+    if (!f)
+        return 0;
+
+    while (fread(block, sizeof(block), 1, f) == 1) {
+        count = TrackBlock::decode(block, decoded, TRACK_BLOCK_SIZE);
+        if (count > 0)
+            fixes->insert(fixes->end(), decoded, decoded + count);
+    }
+    fclose(f);
+
+    return 1;
+}
+
+// Distance from p to the segment a-b, flat around a
+static double deviation(const track_fix_t &a, const track_fix_t &b, const track_fix_t &p)
+{
+    double m_per_ulon = M_PER_UDEG * cos(a.lat * M_PI / 180e6);
+    double bx = (b.lon - a.lon) * m_per_ulon, by = (b.lat - a.lat) * M_PER_UDEG;
+    double px = (p.lon - a.lon) * m_per_ulon, py = (p.lat - a.lat) * M_PER_UDEG;
+    double len2 = bx * bx + by * by;
+    double t = len2 > 0 ? (px * bx + py * by) / len2 : 0;
+
+    if (t < 0)
+        t = 0;
+    else if (t > 1)
+        t = 1;
+    return hypot(px - t * bx, py - t * by);
+}
+
+// Blocks the fixes would fill
+static size_t blocks(const std::vector<track_fix_t> &fixes, FILE *out)
+{
+    TrackBlock block;
+    size_t count = 0;
+
+    for (size_t i = 0; i < fixes.size(); i++) {
+        if (block.add(fixes[i]))
+            continue;
+        if (out)
+            fwrite(block.seal(), TRACK_BLOCK_SIZE, 1, out);
+        count++;
+        block.reset();
+        block.add(fixes[i]);
+    }
+    if (!block.empty()) {
+        if (out)
+            fwrite(block.seal(), TRACK_BLOCK_SIZE, 1, out);
+        count++;
+    }
+
+    return count;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<track_fix_t> fixes, kept;
+    std::vector<size_t> kept_at;
+    track_fix_t out[2];
+    float tolerance = TRACK_TOLERANCE_M;
+    int speed_step = TRACK_SPEED_STEP;
+    int max_gap = TRACK_MAX_GAP_S;
+    const char *out_fn = NULL;
+    double dev, max_dev = 0, sum_dev = 0;
+    size_t i, j, k, full_blocks, kept_blocks;
+    FILE *f = NULL;
+    int opt, count;
+
+    while ((opt = getopt(argc, argv, "t:s:g:o:")) != -1) {
+        switch (opt) {
+            case 't':
+                tolerance = atof(optarg);
+                break;
+            case 's':
+                speed_step = atof(optarg) * 100;
+                break;
+            case 'g':
+                max_gap = atoi(optarg);
+                break;
+            case 'o':
+                out_fn = optarg;
+                break;
+            default:
+                goto usage;
+        }
+    }
+    if (optind == argc)
+        goto usage;
+
+    for (; optind < argc; optind++) {
+        if (!load(argv[optind], &fixes)) {
+            perror(argv[optind]);
+            return 1;
+        }
+    }
+    if (fixes.empty()) {
+        fprintf(stderr, "no fixes\n");
+        return 1;
+    }
+
+    {
+        TrackFilter filter(tolerance, speed_step, max_gap);
+
+        // Where each kept fix came from, to measure against
+        for (i = 0; i < fixes.size(); i++) {
+            count = filter.add(fixes[i], out);
+            for (j = 0; j < (size_t)count; j++) {
+                kept.push_back(out[j]);
+                // The fix just fed, or the one held back before it
+                if (out[j].utc == fixes[i].utc && out[j].cs == fixes[i].cs)
+                    kept_at.push_back(i);
+                else
+                    kept_at.push_back(i - 1);
+            }
+        }
+        if (filter.flush(&out[0])) {
+            kept.push_back(out[0]);
+            kept_at.push_back(fixes.size() - 1);
+        }
+    }
+
+    for (k = 0; k + 1 < kept.size(); k++) {
+        for (i = kept_at[k] + 1; i < kept_at[k + 1]; i++) {
+            dev = deviation(kept[k], kept[k + 1], fixes[i]);
+            sum_dev += dev;
+            if (dev > max_dev)
+                max_dev = dev;
+        }
+    }
+
+    if (out_fn && !(f = fopen(out_fn, "wb"))) {
+        perror(out_fn);
+        return 1;
+    }
+    full_blocks = blocks(fixes, NULL);
+    kept_blocks = blocks(kept, f);
+    if (f)
+        fclose(f);
+
+    printf("%.1f m, %.1f kn, %d s: kept %lu of %lu fixes (%.1f%%), %lu of %lu blocks\n",
+        tolerance, speed_step / 100.0, max_gap,
+        (unsigned long)kept.size(), (unsigned long)fixes.size(),
+        100.0 * kept.size() / fixes.size(),
+        (unsigned long)kept_blocks, (unsigned long)full_blocks);
+    printf("deviation: max %.2f m, mean %.2f m over dropped fixes\n",
+        max_dev, fixes.size() > kept.size() ? sum_dev / (fixes.size() - kept.size()) : 0.0);
+
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-t metres] [-s knots] [-g seconds] [-o out.bin] track.bin...\n", argv[0]);
+    return 2;
+}
@@ -0,0 +1,164 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Assistance data through a sleep and a power cut, on the firmware
+ * itself (test/firmware.h):
+ *
+ *   - the first boot is cold; once fixed, a long RIGHT puts it to sleep
+ *     and aid.bin gets every AID record the receiver gave, without the
+ *     main loop held up for the whole save
+ *   - the next boot, receiver power lost, streams aid.bin back: every
+ *     record must come through as it was given, and the first fix is
+ *     the aided one, not cold
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mkfs.h"
+#include "test/check.h"
+#include "test/firmware.h"
+
+#define IMAGE_MB        64
+#define RUN_MAX_US      (120 * 1000000ull)
+#define FIXED_US        (2 * 1000000ull) // tracking after the fix, before sleeping
+#define SAVE_STALL_US   30000            // longest the save may hold the loop
+#define AID_RECORDS     21               // AID-INI, 8 EPH and 12 ALM
+#define AID_BLOCK       512
+
+static char image[] = "/tmp/aid-XXXXXX";
+
+static uint64_t fixed_us;
+static bool pressed;
+static uint32_t save_stall_us;
+
+// Cold start, fix, then asleep with aid.bin written
+static bool save_step(void)
+{
+    // Nothing wakes it once asleep, so this may come late
+    if (pressed && sleeping && !entering_sleep)
+        return false;
+    if (firmware_us() > RUN_MAX_US) {
+        CHECK(!"asleep in time");
+        return false;
+    }
+    if (waiting_for_gps_ready)
+        return true;
+
+    if (!fixed_us)
+        fixed_us = firmware_us();
+    if (!pressed && firmware_us() - fixed_us >= FIXED_US) {
+        firmware_key(ADC_RIGHT, KEY_LONG_MS);
+        pressed = true;
+        return true;
+    }
+
+    // Once the polls start, the save is all that runs
+    if (!entering_sleep || !gps_sim.aid_polls)
+        shim_awake_max_us = 0;
+    else if (shim_awake_max_us > save_stall_us)
+        save_stall_us = shim_awake_max_us;
+
+    return true;
+}
+
+static int save_finish(void)
+{
+    uint8_t block[AID_BLOCK];
+    uint32_t offset = 0;
+    int records = 0;
+
+    printf("first fix %llu ms cold, %u AID polls, %u answered, save held the loop %u us at most\n",
+        (unsigned long long)gps_sim.first_fix_us / 1000, gps_sim.aid_polls, gps_sim.aid_given, save_stall_us);
+
+    CHECK(gps_sim.cold_starts == 1);
+    CHECK(gps_sim.first_fix_us >= GPS_SIM_COLD_US);
+    CHECK(gps_sim.aid_polls == 1 + 2 * 32);
+    CHECK(gps_sim.aid_given == AID_RECORDS);
+    CHECK(gps_sim.backups == 1);
+    CHECK(save_stall_us < SAVE_STALL_US);
+
+    // Whole blocks, records packed from the start of each
+    while (fs.read_file("aid.bin", block, sizeof(block), offset)) {
+        for (size_t i = 0; i + 4 <= sizeof(block) && block[i] == 0x0B; ) {
+            i += 4 + (block[i + 2] | block[i + 3] << 8);
+            CHECK(i <= sizeof(block));
+            records++;
+        }
+        offset += sizeof(block);
+    }
+    CHECK(offset > 0);
+    CHECK(records == AID_RECORDS);
+
+    return check_failures;
+}
+
+// Power lost since, so the receiver is cold but for what's loaded
+static bool load_step(void)
+{
+    if (firmware_us() > RUN_MAX_US) {
+        CHECK(!"fixed in time");
+        return false;
+    }
+    return waiting_for_gps_ready;
+}
+
+static int load_finish(void)
+{
+    printf("first fix %llu ms with %u AID records loaded\n",
+        (unsigned long long)gps_sim.first_fix_us / 1000, gps_sim.aid_loaded);
+
+    CHECK(gps_sim.aid_loaded == AID_RECORDS);
+    CHECK(gps_sim.aid_bad == 0);
+    CHECK(gps_sim.aided_starts == 1);
+    CHECK(gps_sim.first_fix_us < GPS_SIM_COLD_US / 2);
+
+    return check_failures;
+}
+
+int main(int argc, char **argv)
+{
+    int fd;
+
+    fd = mkstemp(image);
+    if (fd < 0) {
+        perror(image);
+        return 1;
+    }
+    close(fd);
+
+    CHECK(mkfs(image, IMAGE_MB, 512));
+    CHECK(firmware_run(image, save_step, save_finish) == 0);
+    CHECK(firmware_run(image, load_step, load_finish) == 0);
+
+    unlink(image);
+    return check_status("aid");
+}
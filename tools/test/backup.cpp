@@ -0,0 +1,254 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Sleep with the receiver in backup rather than unpowered, on the
+ * firmware itself against the simulated receiver (test/firmware.h):
+ * a cold fix, a long RIGHT to sleep, half an hour asleep, a RIGHT to
+ * wake. The UBX it's sent is checked in order:
+ *
+ *   - going to sleep, the config is saved to BBR and then RXM-PMREQ asks
+ *     for backup; GPS_EN stays on
+ *   - nothing more is sent while asleep, and waking costs one lost byte
+ *   - with the receiver in backup and the keypad left to the ADC's
+ *     compare, nothing wakes the firmware for the half hour asleep
+ *   - on wake, a hot CFG-RST and an AID-INI time hint, none of the full
+ *     config init_gps gives a cold receiver, which still has it
+ *
+ * Wake to fix is timed from the key press. Sleep current is taken from
+ * the time the receiver spends in each state, at the currents below.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mkfs.h"
+#include "test/check.h"
+#include "test/firmware.h"
+
+#define IMAGE_MB        64
+#define S               1000000ull
+#define BEFORE_SLEEP_US (5 * S)
+#define ASLEEP_US       (1800 * S)
+#define AFTER_FIX_US    (10 * S)
+#define RUN_MAX_US      (2400 * S)
+#define WAKE_FIX_MAX_US (GPS_SIM_HOT_US + 2 * S)
+#define FRAMES_MAX      256
+#define ASLEEP_WAKES    2 // the harness's: 2^30 us idle, and the RIGHT press
+#define POLL_US         (S / 10)
+
+// Assumed receiver supply currents
+#define TRACKING_MA     20.0
+#define BACKUP_MA       0.015
+
+static char image[] = "/tmp/backup-XXXXXX";
+
+struct frame_t {
+    uint8_t cls;
+    uint8_t id;
+    uint16_t len;
+    uint8_t payload[16];  // enough for CFG-CFG, CFG-RST and PMREQ
+    uint32_t wakes;       // by the time it came
+};
+
+static frame_t frames[FRAMES_MAX];
+static int frame_count;
+
+enum {
+    STEP_FIX,
+    STEP_AWAKE,
+    STEP_ASLEEP,
+    STEP_WAKE,
+    STEP_REFIX,
+} state;
+
+static uint64_t at_us, pressed_us, wake_fix_us;
+static uint64_t off_us;
+static uint32_t asleep_sleeps, asleep_wakes;
+
+static void on_frame(uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len)
+{
+    frame_t *f;
+
+    if (frame_count >= FRAMES_MAX) {
+        frame_count++;
+        return;
+    }
+    f = &frames[frame_count++];
+    f->cls = cls;
+    f->id = id;
+    f->len = len;
+    memcpy(f->payload, payload, len < sizeof(f->payload) ? len : sizeof(f->payload));
+    f->wakes = gps_sim.wakes;
+}
+
+static bool step(void)
+{
+    uint64_t now = firmware_us();
+
+    if (now > RUN_MAX_US) {
+        CHECK(!"done in time");
+        return false;
+    }
+
+    switch (state) {
+        case STEP_FIX:
+            gps_sim_frame = on_frame;
+            if (waiting_for_gps_ready)
+                break;
+            off_us = gps_sim.off_us;
+            at_us = now;
+            state = STEP_AWAKE;
+            break;
+        case STEP_AWAKE:
+            if (now - at_us < BEFORE_SLEEP_US)
+                break;
+            if (!pressed_us) {
+                firmware_key(ADC_RIGHT, KEY_LONG_MS);
+                pressed_us = now;
+            }
+            if (sleeping && !entering_sleep) {
+                at_us = now;
+                asleep_sleeps = shim_sleeps;
+                firmware_step_at(at_us + ASLEEP_US);
+                state = STEP_ASLEEP;
+                break;
+            }
+            // Nothing else may wake it once it's asleep
+            firmware_step_at(now + POLL_US);
+            break;
+        case STEP_ASLEEP:
+            asleep_wakes = shim_sleeps - asleep_sleeps;
+            if (now - at_us < ASLEEP_US)
+                break;
+            firmware_key(ADC_RIGHT, KEY_PRESS_MS);
+            pressed_us = now;
+            state = STEP_WAKE;
+            break;
+        case STEP_WAKE:
+            if (sleeping || waiting_for_gps_ready)
+                break;
+            wake_fix_us = now - pressed_us;
+            at_us = now;
+            state = STEP_REFIX;
+            break;
+        case STEP_REFIX:
+            return now - at_us < AFTER_FIX_US;
+    }
+
+    return true;
+}
+
+static int find(uint8_t cls, uint8_t id, int from)
+{
+    for (int i = from; i < frame_count && i < FRAMES_MAX; i++) {
+        if (frames[i].cls == cls && frames[i].id == id)
+            return i;
+    }
+    return -1;
+}
+
+static int finish(void)
+{
+    double backup_mah, cold_mah;
+    int pmreq, rst;
+
+    CHECK(state == STEP_REFIX);
+    CHECK(frame_count <= FRAMES_MAX);
+
+    // Saved to BBR, then into backup, once
+    pmreq = find(0x02, 0x41, 0);
+    CHECK(pmreq > 0);
+    CHECK(find(0x02, 0x41, pmreq + 1) < 0);
+    if (pmreq > 0) {
+        CHECK(frames[pmreq - 1].cls == 0x06 && frames[pmreq - 1].id == 0x09);
+        CHECK(frames[pmreq - 1].payload[4] != 0);      // save mask
+        CHECK(frames[pmreq - 1].payload[12] & 0x01);   // to BBR
+        CHECK(frames[pmreq].payload[4] & 0x02);        // backup
+    }
+
+    // Woken by a byte, then straight into a hot restart and a time hint
+    CHECK(gps_sim.wakes == 1);
+    CHECK(gps_sim.lost_bytes == 1);
+    rst = pmreq + 1;
+    CHECK(rst > 0 && rst < frame_count);
+    if (rst > 0 && rst < frame_count) {
+        CHECK(frames[rst].wakes == 1);
+        CHECK(frames[rst].cls == 0x06 && frames[rst].id == 0x04);
+        CHECK(frames[rst].payload[0] == 0x00 && frames[rst].payload[1] == 0x00); // hot
+        CHECK(frames[rst].payload[2] == 0x02);                                   // GNSS only
+        CHECK(rst + 1 < frame_count && frames[rst + 1].cls == 0x0B && frames[rst + 1].id == 0x01);
+        CHECK(rst + 1 < frame_count && frames[rst + 1].len == 48);
+        CHECK(find(0x06, 0x00, rst) < 0);  // no CFG-PRT
+        CHECK(find(0x06, 0x24, rst) < 0);  // no CFG-NAV5
+    }
+    CHECK(gps_sim.ini_time >= 1);
+
+    // What was saved came back, and the power never went
+    CHECK(gps_sim.config.baud == 115200);
+    CHECK(gps_sim.config.div[GPS_SIM_VTG] == 0);
+    CHECK(gps_sim.config.div[GPS_SIM_GLL] == 0);
+    CHECK(gps_sim.off_us == off_us);
+    CHECK(gps_sim.cold_starts == 1);
+    CHECK(gps_sim.hot_starts == 2);    // the wake, then the CFG-RST
+    CHECK(gps_sim.first_fix_us == GPS_SIM_HOT_US);
+    CHECK(wake_fix_us <= WAKE_FIX_MAX_US);
+    CHECK(gps_sim.backup_us >= ASLEEP_US);
+    CHECK(asleep_wakes <= ASLEEP_WAKES);
+
+    // Against cutting GPS_EN: nothing while off, a cold start after
+    backup_mah = (BACKUP_MA * gps_sim.backup_us + TRACKING_MA * gps_sim.first_fix_us) / 3600e6;
+    cold_mah = TRACKING_MA * GPS_SIM_COLD_US / 3600e6;
+    printf("wake to fix %llu ms (receiver %llu ms), %llu s in backup\n",
+        (unsigned long long)wake_fix_us / 1000, (unsigned long long)gps_sim.first_fix_us / 1000,
+        (unsigned long long)gps_sim.backup_us / S);
+    printf("woken %u times in %llu s asleep\n", asleep_wakes, (unsigned long long)ASLEEP_US / S);
+    printf("sleep and fix %.4f mAh in backup, %.4f mAh powered off and cold\n", backup_mah, cold_mah);
+
+    return check_failures;
+}
+
+int main(int argc, char **argv)
+{
+    int fd;
+
+    fd = mkstemp(image);
+    if (fd < 0) {
+        perror(image);
+        return 1;
+    }
+    close(fd);
+
+    CHECK(mkfs(image, IMAGE_MB));
+    CHECK(firmware_run(image, step, finish) == 0);
+
+    unlink(image);
+    return check_status("backup");
+}
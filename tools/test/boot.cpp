@@ -0,0 +1,267 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * The boot timeline, main()'s boot order on the host clock with the
+ * peripherals mocked by how long they take: the display self-test by
+ * its steps, the receiver by its boot time, config messages and time
+ * to first fix, and the card through Storage and the firmware's FS on
+ * a card image that takes a while to get ready, or never does.
+ *
+ * Against the old sequential boot (self-test, blocking mount, then
+ * powering the receiver and waiting for it), the receiver has to be
+ * configured sooner and its first fix must not wait on the card.
+ *
+ * Each run is forked off, sd-reader only has room for one filesystem.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "boot.h"
+#include "storage.h"
+#include "mkfs.h"
+#include "shim/card.h"
+#include "test/check.h"
+
+#define IMAGE_MB        64
+#define COLUMNS         4
+#define LOOP_US         500     // a wait loop pass, about one card poll at 300kHz
+#define GPS_BOOT_US     1000000 // GPS_BOOT_TIME_S
+#define GPS_CFG_US      20000   // GPS_CFG_SPACING_US
+#define GPS_CFG_COUNT   5       // baud, three sentences off, dynamic model
+#define GPS_TTFF_US     2000000 // first fix after power, a warm start
+
+static char image[] = "/tmp/boot-XXXXXX";
+
+extern "C" void get_datetime(uint16_t *year, uint8_t *month, uint8_t *day, uint8_t *hour, uint8_t *min, uint8_t *sec)
+{
+    *year = 2024;
+    *month = 5;
+    *day = 17;
+    *hour = 8;
+    *min = 0;
+    *sec = 0;
+}
+
+// fn's exit status, run in a child of its own
+static int run(int (*fn)(long), long arg)
+{
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        check_failures = 0;
+        status = fn(arg);
+        fflush(stdout);
+        _exit(status);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
+}
+
+// How long the step of main.cpp's display_test() leaves lit, -1 once done
+static float display_test(int step)
+{
+    if (step == 0)
+        return 0.0;
+    step -= 1;
+    if (step < COLUMNS)
+        return 0.1;
+    step -= COLUMNS;
+    if (step <= 8)
+        return step == 8 ? 0.15 : 0.05;
+    step -= 9;
+    if (step <= 8)
+        return 0.05;
+    step -= 9;
+    if (step == 0)
+        return 0.0;
+    step -= 1;
+    if (step < COLUMNS)
+        return 0.1;
+    return -1.0;
+}
+
+static FS fs;
+static Storage storage(fs);
+static BootTimeline boot;
+static Stream pc;
+
+static uint32_t gps_power_us;
+static uint32_t display_us;
+static uint32_t gps_config_us;
+static uint32_t mounted_us;
+static int mount_result = -1;
+
+static void odom_mounted(int result)
+{
+    uint32_t odom[3];
+
+    mount_result = result;
+    mounted_us = shim_now_us;
+    boot.mark(result ? "mounted" : "no disk");
+    if (!result)
+        return;
+    fs.read_file("odom.bin", odom, sizeof(odom));
+    boot.mark("odom");
+}
+
+// One pass of a wait loop
+static void pass(void)
+{
+    storage.poll();
+    shim_now_us += LOOP_US;
+}
+
+static void wait_until(uint32_t us)
+{
+    while (shim_now_us < us)
+        pass();
+}
+
+// How long the self-test takes, give or take a loop pass per step
+static uint32_t display_test_us(int *steps)
+{
+    float delay;
+    float total = 0.0;
+
+    for (*steps = 0; (delay = display_test(*steps)) >= 0.0; (*steps)++)
+        total += delay;
+    return total * 1000000;
+}
+
+// A card ready after ready_ms, or failing then if negative
+static int boot_run(long ready_ms)
+{
+    uint32_t fix_us;
+    uint32_t test_us;
+    int steps;
+
+    if (ready_ms != 0 && !card_open(image))
+        return 1;
+    card_init_fails = ready_ms < 0;
+    card_init_polls = labs(ready_ms) * 1000 / LOOP_US;
+
+    shim_now_us = 0;
+    boot.start();
+
+    gps_power_us = shim_now_us;
+    boot.mark("gps power");
+
+    storage.mount(odom_mounted);
+    {
+        Timer test_timer;
+        float delay = 0.0;
+        int step = 0;
+
+        test_timer.start();
+        while (delay >= 0.0) {
+            if (test_timer.read() >= delay) {
+                test_timer.reset();
+                delay = display_test(step++);
+            }
+            pass();
+        }
+    }
+    display_us = shim_now_us;
+    boot.mark("display");
+
+    wait_until(gps_power_us + GPS_BOOT_US);
+    boot.mark("gps boot");
+    for (int i = 0; i < GPS_CFG_COUNT; i++)
+        wait_until(shim_now_us + GPS_CFG_US);
+    gps_config_us = shim_now_us;
+    boot.mark("gps config");
+
+    // The scheduler's storage task keeps the mount going
+    fix_us = gps_power_us + GPS_TTFF_US;
+    wait_until(fix_us);
+    boot.mark("fix");
+    while (mount_result < 0)
+        pass();
+
+    if (ready_ms)
+        printf("card %s after %ld ms:\n", ready_ms > 0 ? "ready" : "failing", labs(ready_ms));
+    else
+        printf("no card:\n");
+    boot.print(pc);
+
+    // Neither the receiver's boot nor the card hold anything up
+    test_us = display_test_us(&steps);
+    CHECK(gps_power_us == 0);
+    CHECK(display_us <= test_us + (steps + 1) * LOOP_US);
+    CHECK(gps_config_us == display_us + GPS_CFG_COUNT * GPS_CFG_US);
+    CHECK(mount_result == (ready_ms > 0));
+    // A card ready in time is mounted while the self-test runs
+    if (ready_ms > 0 && ready_ms * 1000 < (long)test_us)
+        CHECK(mounted_us <= display_us);
+
+    card_close();
+    return check_failures;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t test_us;
+    int steps;
+    int fd;
+
+    fd = mkstemp(image);
+    if (fd < 0) {
+        perror(image);
+        return 1;
+    }
+    close(fd);
+
+    CHECK(mkfs(image, IMAGE_MB, 512));
+    CHECK(run(boot_run, 250) == 0);
+    CHECK(run(boot_run, 3000) == 0);
+    CHECK(run(boot_run, -1000) == 0);
+    CHECK(run(boot_run, 0) == 0);
+
+    // The old boot: self-test, a blocking mount, then the receiver
+    test_us = display_test_us(&steps);
+    printf("%-30s %10s %10s\n", "first fix, card ready after", "old ms", "new ms");
+    for (uint32_t ready_ms = 250; ready_ms <= 1000; ready_ms *= 2) {
+        uint32_t old_us = test_us + ready_ms * 1000 + GPS_TTFF_US;
+
+        printf("%-30u %10u %10u\n", ready_ms, old_us / 1000, GPS_TTFF_US / 1000);
+        CHECK(GPS_TTFF_US < old_us);
+    }
+
+    unlink(image);
+    return check_status("boot");
+}
@@ -0,0 +1,183 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * raw.bin round trip: the firmware itself (test/firmware.h), built with
+ * RAW_CAPTURE, captures the receiver's stream on a drive, and Drive
+ * replays it off the card as tools/replay does.
+ *
+ *   - a cold fix, a few minutes at 30mph with a stop in the middle, then
+ *     a long RIGHT to sleep, which flushes the part filled chunk
+ *   - every chunk checks out and nothing was dropped
+ *   - the replay sees the receiver's bytes up to that flush (not the
+ *     AID polled on the way to sleep), and the same fixes: its odometer
+ *     matches the firmware's
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "drive.h"
+#include "mkfs.h"
+#include "test/check.h"
+#include "test/firmware.h"
+
+#define IMAGE_MB        64
+#define S               1000000ull
+#define RUN_MAX_US      (600 * S)
+#define ODOM_MAX_MI     0.001
+
+static char image[] = "/tmp/capture-XXXXXX";
+static char raw[] = "/tmp/capture-raw-XXXXXX";
+
+// What's done, and when from the first fix
+struct action_t {
+    uint64_t at_us;
+    double mph;
+    uint16_t key;
+};
+
+static const action_t actions[] = {
+    {0,        30.0, 0},
+    {120 * S,  0.0,  0},         // a stop, and the save it makes
+    {150 * S,  30.0, 0},
+    {270 * S,  0.0,  0},
+    {280 * S,  0.0,  ADC_RIGHT}, // to sleep
+};
+
+#define ACTION_COUNT    (sizeof(actions) / sizeof(actions[0]))
+
+static uint64_t fixed_us;
+static size_t next_action;
+static bool pressed;
+
+static bool step(void)
+{
+    const action_t *action;
+
+    if (firmware_us() > RUN_MAX_US) {
+        CHECK(!"asleep in time");
+        return false;
+    }
+    if (pressed && sleeping && !entering_sleep)
+        return false;
+    if (booting || waiting_for_gps_ready)
+        return true;
+
+    if (!fixed_us)
+        fixed_us = firmware_us();
+    if (next_action < ACTION_COUNT && firmware_us() - fixed_us >= actions[next_action].at_us) {
+        action = &actions[next_action++];
+        gps_sim.mph = action->mph;
+        if (action->key) {
+            firmware_key(action->key, KEY_LONG_MS);
+            pressed = true;
+        }
+    }
+    // Asleep, nothing else wakes it to look
+    if (pressed)
+        firmware_step_at(firmware_us() + S / 10);
+    return true;
+}
+
+// Copies raw.bin off the card for Drive, a chunk at a time
+static int copy_raw(void)
+{
+    uint8_t chunk[CAPTURE_CHUNK_SIZE];
+    uint32_t offset = 0;
+    FILE *f;
+
+    f = fopen(raw, "wb");
+    if (!f)
+        return 0;
+    while (fs.read_file("raw.bin", chunk, sizeof(chunk), offset)) {
+        fwrite(chunk, sizeof(chunk), 1, f);
+        offset += sizeof(chunk);
+    }
+    fclose(f);
+    return offset > 0;
+}
+
+static int finish(void)
+{
+    double firmware_mi = odom.get_odom(ODOM_ENGINE);
+    uint64_t sent = gps_sim.bytes_out;
+
+    CHECK(next_action == ACTION_COUNT);
+    CHECK(storage.idle());
+    CHECK(copy_raw());
+
+    Drive drive;
+    const drive_stats_t &stats = drive.stats();
+
+    CHECK(drive.replay(raw));
+    printf("%lu chunks (%lu bad), %lu bytes of %llu sent, %lu dropped\n",
+        stats.chunks, stats.bad, stats.bytes, (unsigned long long)sent, stats.dropped);
+    printf("%lu fixes, odom %.4f mi replayed, %.4f mi on the firmware\n",
+        stats.fixes, drive.odom_mi(), firmware_mi);
+
+    CHECK(stats.chunks > 0);
+    CHECK(stats.bad == 0);
+    CHECK(stats.dropped == 0);
+    CHECK(stats.bytes > 0 && stats.bytes <= sent);
+    CHECK(stats.fixes > 0);
+    CHECK(firmware_mi > 1.0);
+    CHECK(fabs(drive.odom_mi() - firmware_mi) < ODOM_MAX_MI);
+
+    unlink(raw);
+    return check_failures;
+}
+
+int main(int argc, char **argv)
+{
+    int fd;
+
+    fd = mkstemp(image);
+    if (fd < 0) {
+        perror(image);
+        return 1;
+    }
+    close(fd);
+    fd = mkstemp(raw);
+    if (fd < 0) {
+        perror(raw);
+        return 1;
+    }
+    close(fd);
+
+    CHECK(mkfs(image, IMAGE_MB, 512));
+    CHECK(firmware_run(image, step, finish) == 0);
+
+    unlink(image);
+    unlink(raw);
+    return check_status("capture");
+}
@@ -0,0 +1,315 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * cardfsck on damage of known shape. Two files are put on a blank image
+ * with fatimg, then its FAT is edited by hand:
+ *
+ *   - b.dat's first cluster is pointed into a.dat's chain, a cross-link
+ *     that leaves the rest of b.dat's own chain lost
+ *   - three free clusters are chained together, lost with no file
+ *
+ * The check must report both and fail; -r must cut b.dat back to its
+ * first cluster, leave a.dat whole and free the six lost clusters; a
+ * check after that must find the image clean, with a.dat and what's
+ * left of b.dat still reading back as they were put.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "test/check.h"
+
+#define IMAGE_MB    64
+#define A_CLUSTERS  8
+#define B_CLUSTERS  4
+#define LOST_CHAIN  3
+
+static char image[] = "/tmp/cardfsck-XXXXXX";
+static char dir[] = "/tmp/cardfsck-XXXXXX";
+
+// The image's FAT32 layout, from its boot sector
+static uint32_t cluster_size;
+static long fat_offset;
+static long data_offset;
+static uint32_t root_cluster;
+
+static std::string path(const char *fn)
+{
+    return std::string(dir) + "/" + fn;
+}
+
+static uint32_t get_le(const uint8_t *p, int len)
+{
+    uint32_t value = 0;
+
+    while (len--)
+        value = value << 8 | p[len];
+    return value;
+}
+
+static bool image_rw(long offset, void *data, size_t size, bool write)
+{
+    FILE *f = fopen(image, "r+b");
+    bool ok;
+
+    if (!f)
+        return false;
+    ok = fseek(f, offset, SEEK_SET) == 0 &&
+        (write ? fwrite(data, 1, size, f) : fread(data, 1, size, f)) == size;
+    return fclose(f) == 0 && ok;
+}
+
+static uint32_t fat_get(uint32_t cluster)
+{
+    uint8_t p[4];
+
+    if (!image_rw(fat_offset + cluster * 4, p, sizeof(p), false))
+        return 0;
+    return get_le(p, 4) & 0x0fffffff;
+}
+
+static bool fat_set(uint32_t cluster, uint32_t value)
+{
+    uint8_t p[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+
+    return image_rw(fat_offset + cluster * 4, p, sizeof(p), true);
+}
+
+static bool read_layout(void)
+{
+    uint8_t boot[512];
+    uint32_t sector, reserved, fats, fat_sectors;
+
+    if (!image_rw(0, boot, sizeof(boot), false))
+        return false;
+    sector = get_le(&boot[11], 2);
+    cluster_size = sector * boot[13];
+    reserved = get_le(&boot[14], 2);
+    fats = boot[16];
+    fat_sectors = get_le(&boot[36], 4);
+    root_cluster = get_le(&boot[44], 4);
+
+    fat_offset = (long)reserved * sector;
+    data_offset = fat_offset + (long)fats * fat_sectors * sector;
+    return cluster_size && root_cluster >= 2;
+}
+
+// A file's first cluster, by its short name in the root directory; sd-reader
+// writes them in lower case
+static uint32_t first_cluster(const char *name83)
+{
+    std::vector<uint8_t> root(cluster_size);
+    const uint8_t *entry;
+
+    if (!image_rw(data_offset + (long)(root_cluster - 2) * cluster_size, &root[0], cluster_size, false))
+        return 0;
+    for (uint32_t i = 0; i < cluster_size; i += 32) {
+        entry = &root[i];
+        if (entry[0] == 0)
+            break;
+        if (entry[0] == 0xe5 || entry[11] == 0x0f || strncasecmp((const char *)entry, name83, 11) != 0)
+            continue;
+        return get_le(&entry[20], 2) << 16 | get_le(&entry[26], 2);
+    }
+    return 0;
+}
+
+static bool write_host(const char *fn, const std::vector<uint8_t> &data)
+{
+    FILE *f = fopen(path(fn).c_str(), "wb");
+    bool ok;
+
+    if (!f)
+        return false;
+    ok = fwrite(&data[0], 1, data.size(), f) == data.size();
+    return fclose(f) == 0 && ok;
+}
+
+static std::vector<uint8_t> read_host(const char *fn)
+{
+    std::vector<uint8_t> data;
+    uint8_t buf[4096];
+    size_t len;
+    FILE *f = fopen(path(fn).c_str(), "rb");
+
+    if (!f)
+        return data;
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+        data.insert(data.end(), buf, buf + len);
+    fclose(f);
+    return data;
+}
+
+// The command's exit status and what it printed
+static int run(const char *cmd, std::string *out)
+{
+    char buf[4096];
+    size_t len;
+    FILE *f;
+    int status;
+
+    f = popen(cmd, "r");
+    if (!f)
+        return -1;
+    if (out)
+        out->clear();
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+        if (out)
+            out->append(buf, len);
+    }
+    status = pclose(f);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static int fatimg(const char *args)
+{
+    char cmd[1024];
+
+    snprintf(cmd, sizeof(cmd), "./fatimg %s %s 2>/dev/null", image, args);
+    return run(cmd, nullptr);
+}
+
+static int cardfsck(const char *args, std::string *out)
+{
+    char cmd[1024];
+
+    snprintf(cmd, sizeof(cmd), "./cardfsck -j 2 %s %s 2>/dev/null", args, image);
+    return run(cmd, out);
+}
+
+static bool said(const std::string &out, const char *line)
+{
+    if (out.find(line) != std::string::npos)
+        return true;
+    fprintf(stderr, "\"%s\" not in:\n%s", line, out.c_str());
+    return false;
+}
+
+static std::vector<uint8_t> pattern(size_t size, uint8_t seed)
+{
+    std::vector<uint8_t> data(size);
+
+    for (size_t i = 0; i < size; i++)
+        data[i] = (uint8_t)(i * 7 + seed + i / cluster_size);
+    return data;
+}
+
+int main(void)
+{
+    std::vector<uint8_t> a, b, back;
+    uint32_t a0, b0, end = 0;
+    int lost = 0;
+    int fd = mkstemp(image);
+    std::string out;
+    char cmd[1024];
+
+    if (fd < 0 || !mkdtemp(dir))
+        return 1;
+    close(fd);
+
+    snprintf(cmd, sizeof(cmd), "mkfs %d", IMAGE_MB);
+    CHECK(fatimg(cmd) == 0);
+    CHECK(read_layout());
+
+    a = pattern(A_CLUSTERS * cluster_size, 1);
+    b = pattern(B_CLUSTERS * cluster_size, 2);
+    CHECK(write_host("a.dat", a));
+    CHECK(write_host("b.dat", b));
+    snprintf(cmd, sizeof(cmd), "put /a.dat %s", path("a.dat").c_str());
+    CHECK(fatimg(cmd) == 0);
+    snprintf(cmd, sizeof(cmd), "put /b.dat %s", path("b.dat").c_str());
+    CHECK(fatimg(cmd) == 0);
+
+    CHECK(cardfsck("", &out) == 0);
+    CHECK(said(out, "2 files, 0 directories, "));
+    CHECK(said(out, ", 0 lost, 0 cross-linked, 0 bad\n"));
+
+    // The damage
+    a0 = first_cluster("A       DAT");
+    b0 = first_cluster("B       DAT");
+    CHECK(a0 && b0);
+    CHECK(fat_set(b0, fat_get(a0)));
+    for (uint32_t cluster = 2; lost < LOST_CHAIN; cluster++) {
+        if (fat_get(cluster))
+            continue;
+        if (end)
+            CHECK(fat_set(end, cluster));
+        CHECK(fat_set(cluster, 0x0fffffff));
+        end = cluster;
+        lost++;
+    }
+
+    CHECK(cardfsck("", &out) == 1);
+    CHECK(said(out, "/a.dat: cross-linked from cluster 1 of its chain\n"));
+    CHECK(said(out, "/b.dat: cross-linked from cluster 1 of its chain\n"));
+    snprintf(cmd, sizeof(cmd), "/b.dat: %d clusters past its size\n", A_CLUSTERS - B_CLUSTERS);
+    CHECK(said(out, cmd));
+    snprintf(cmd, sizeof(cmd), "%d lost clusters in 2 chains\n", B_CLUSTERS - 1 + LOST_CHAIN);
+    CHECK(said(out, cmd));
+    snprintf(cmd, sizeof(cmd), ", %d lost, %d cross-linked, 0 bad\n", B_CLUSTERS - 1 + LOST_CHAIN, A_CLUSTERS - 1);
+    CHECK(said(out, cmd));
+    printf("%-8s %s", "damaged", out.substr(out.rfind('\n', out.size() - 2) + 1).c_str());
+
+    CHECK(cardfsck("-r", &out) == 0);
+    CHECK(said(out, "/b.dat: chain cut\n"));
+    CHECK(out.find("/a.dat: chain cut") == std::string::npos);
+    snprintf(cmd, sizeof(cmd), "1 files repaired, %d lost clusters freed\n", B_CLUSTERS - 1 + LOST_CHAIN);
+    CHECK(said(out, cmd));
+    snprintf(cmd, sizeof(cmd), ", %d of ", 1 + A_CLUSTERS + 1);
+    CHECK(said(out, cmd));
+    CHECK(said(out, ", 0 lost, 0 cross-linked, 0 bad\n"));
+    CHECK(fat_get(b0) >= 0x0ffffff8);
+
+    CHECK(cardfsck("", &out) == 0);
+    CHECK(said(out, "2 files, 0 directories, "));
+    CHECK(said(out, ", 0 lost, 0 cross-linked, 0 bad\n"));
+    printf("%-8s %s", "repaired", out.c_str());
+
+    // a.dat keeps its chain, b.dat just the cluster that was its own
+    snprintf(cmd, sizeof(cmd), "get /a.dat %s", path("a.back").c_str());
+    CHECK(fatimg(cmd) == 0);
+    CHECK(read_host("a.back") == a);
+    snprintf(cmd, sizeof(cmd), "get /b.dat %s", path("b.back").c_str());
+    CHECK(fatimg(cmd) == 0);
+    back = read_host("b.back");
+    CHECK(back.size() == cluster_size);
+    CHECK(back == std::vector<uint8_t>(b.begin(), b.begin() + cluster_size));
+
+    unlink(image);
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    CHECK(system(cmd) == 0);
+    return check_status("cardfsck");
+}
@@ -0,0 +1,202 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * The GPS disciplined RTC against a crystal that's off, shim/rtc.cpp
+ * counting as the KL25Z's would, compensation registers and all. For
+ * each drift, fed a fix a second:
+ *
+ *   - until GPSCLOCK_SPAN_S the offset builds up unstepped
+ *   - then the drift is estimated and trimmed out, and an hour without
+ *     fixes, as asleep, stays within the accuracy it claims and well
+ *     inside what the crystal alone would have drifted
+ *   - the drift comes back from the registers through a reset
+ *   - a fix more than GPSCLOCK_STEP_MS off before the span steps it,
+ *     and an RTC set by something else is stepped without a drift
+ *     estimate being made of it
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "gpsclock.h"
+#include "rtc_api.h"
+#include "test/check.h"
+
+#define UTC_START   1715932800 // 2024-05-17 08:00
+#define TRACK_S     (3 * 3600)
+#define SLEEP_S     3600
+#define EST_PPM     1.0        // estimate to within
+#define SLEPT_MS    10         // off after SLEEP_S, compensated
+
+static uint64_t true_us; // Since UTC_START
+
+// One second on, a minute at a time when asleep so the RTC's 32-bit
+// view of the host clock never wraps between reads
+static void pass(uint32_t s)
+{
+    uint32_t utc;
+    uint16_t ms;
+
+    while (s--) {
+        shim_now_us += 1000000;
+        true_us += 1000000;
+        if (s % 60 == 0)
+            GpsClock::now(&utc, &ms);
+    }
+}
+
+static void fix(GpsClock &clock, int32_t off_ms = 0)
+{
+    int64_t t_ms = true_us / 1000 + off_ms;
+
+    clock.discipline(UTC_START + t_ms / 1000, t_ms % 1000);
+}
+
+// RTC less true time
+static int32_t error_ms(void)
+{
+    uint32_t utc;
+    uint16_t ms;
+
+    GpsClock::now(&utc, &ms);
+    return (int64_t)(utc - UTC_START) * 1000 + ms - (int64_t)(true_us / 1000);
+}
+
+static void drift(double ppm)
+{
+    int32_t err, before;
+    uint32_t s;
+    unsigned interval;
+
+    rtc_init();
+    shim_rtc_ppm = ppm;
+    true_us = 0;
+
+    GpsClock clock;
+    CHECK(!clock.valid());
+    CHECK(clock.accuracy_ms() == UINT32_MAX);
+
+    fix(clock);
+    CHECK(clock.valid());
+    CHECK(abs(error_ms()) <= 1);
+
+    // Left to build up, not stepped, for as long as it stays within
+    // GPSCLOCK_STEP_MS
+    for (s = 1; s < GPSCLOCK_SPAN_S; s++) {
+        pass(1);
+        fix(clock);
+    }
+    err = error_ms();
+    if (fabs(ppm) * GPSCLOCK_SPAN_S / 1000 < GPSCLOCK_STEP_MS) {
+        CHECK(abs(err - (int32_t)(ppm * GPSCLOCK_SPAN_S / 1000)) <= 2);
+        CHECK(clock.drift_ppm() == 0.0f);
+    } else {
+        // Stepped on the way, and estimated from that
+        CHECK(abs(err) <= GPSCLOCK_STEP_MS);
+        CHECK(fabs(clock.drift_ppm() - ppm) < EST_PPM * 2);
+    }
+
+    for (s = 0; s < TRACK_S; s++) {
+        pass(1);
+        fix(clock);
+    }
+    CHECK(fabs(clock.drift_ppm() - ppm) < EST_PPM);
+
+    // Asleep, no fixes
+    before = error_ms();
+    pass(SLEEP_S);
+    err = error_ms();
+    CHECK(abs(err - before) <= SLEPT_MS);
+    CHECK((uint32_t)abs(err) <= clock.accuracy_ms());
+    CHECK(clock.age() - SLEEP_S + 1 <= 2);
+
+    printf("%+7.1f ppm: estimated %+7.2f, TCR 0x%04x, %+d ms after %ds asleep (uncompensated %+d), claims %u\n",
+        ppm, clock.drift_ppm(), (unsigned)shim_rtc.TCR, err - before, SLEEP_S,
+        (int)(ppm * SLEEP_S / 1000), (unsigned)clock.accuracy_ms());
+
+    // Through a reset, the RTC and its compensation carry on, to within
+    // a cycle an interval
+    interval = ((shim_rtc.TCR & RTC_TCR_CIR_MASK) >> RTC_TCR_CIR_SHIFT) + 1;
+    GpsClock again;
+    CHECK(fabs(again.drift_ppm() - clock.drift_ppm()) <= 1e6 / (32768.0 * interval));
+    CHECK(again.valid());
+}
+
+static void steps(void)
+{
+    float ppm;
+
+    rtc_init();
+    shim_rtc_ppm = 0;
+    true_us = 0;
+
+    GpsClock clock;
+    fix(clock);
+
+    // Off by more than a step, inside the span: set right away
+    pass(10);
+    fix(clock, GPSCLOCK_STEP_MS + 50);
+    CHECK(abs(error_ms() - (GPSCLOCK_STEP_MS + 50)) <= 1);
+    pass(1);
+    fix(clock);
+    CHECK(abs(error_ms()) <= 1);
+
+    // Within it, left alone
+    pass(1);
+    fix(clock, GPSCLOCK_STEP_MS - 50);
+    CHECK(abs(error_ms()) <= 1);
+
+    // Set an hour out by something else, once the span is up: stepped,
+    // and no drift made of it
+    pass(GPSCLOCK_SPAN_S);
+    ppm = clock.drift_ppm();
+    fix(clock, 3600 * 1000);
+    CHECK(abs(error_ms() - 3600 * 1000) <= 1);
+    fix(clock);
+    CHECK(abs(error_ms()) <= 1);
+    CHECK(clock.drift_ppm() == ppm);
+
+    // Nothing before the epoch is a time
+    pass(10);
+    clock.discipline(GPSCLOCK_EPOCH - 1, 0);
+    CHECK(abs(error_ms()) <= 1);
+    CHECK(clock.age() == 10);
+}
+
+int main(void)
+{
+    drift(40.0);
+    drift(-20.0);
+    drift(-150.0);
+    drift(300.0);
+    steps();
+
+    return check_status("clock");
+}
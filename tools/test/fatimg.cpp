@@ -0,0 +1,250 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * fatimg on a card image of its own making, through the command line:
+ *
+ *   - mkfs, then put a file bigger than its copy buffer and put onto it
+ *     again, which appends; get gives back every byte, and ls its size
+ *   - a track log encoded here, put on the card, comes back out of
+ *     decode as the same fixes, and odom.bin as its three distances
+ *   - verify reads it all and finds nothing wrong; get of a file that
+ *     isn't there fails
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "track.h"
+#include "test/check.h"
+
+#define IMAGE_MB     64
+#define DATA_SIZE    200000 // over COPY_CHUNK, and many clusters
+#define APPEND_SIZE  1000
+#define FIXES        300    // a few blocks' worth
+
+static char image[] = "/tmp/fatimg-XXXXXX";
+static char dir[] = "/tmp/fatimg-XXXXXX";
+
+static std::string path(const char *fn)
+{
+    return std::string(dir) + "/" + fn;
+}
+
+static bool write_host(const char *fn, const void *data, size_t size)
+{
+    FILE *f = fopen(path(fn).c_str(), "wb");
+    bool ok;
+
+    if (!f)
+        return false;
+    ok = fwrite(data, 1, size, f) == size;
+    return fclose(f) == 0 && ok;
+}
+
+static std::vector<uint8_t> read_host(const char *fn)
+{
+    std::vector<uint8_t> data;
+    uint8_t buf[4096];
+    size_t len;
+    FILE *f = fopen(path(fn).c_str(), "rb");
+
+    if (!f)
+        return data;
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+        data.insert(data.end(), buf, buf + len);
+    fclose(f);
+    return data;
+}
+
+// ./fatimg image args, its exit status; what it printed in out, and
+// what went to stderr in err
+static int fatimg(const char *args, std::string *out = nullptr, std::string *err = nullptr)
+{
+    std::vector<uint8_t> said;
+    char cmd[1024], buf[4096];
+    size_t len;
+    FILE *f;
+    int status;
+
+    snprintf(cmd, sizeof(cmd), "./fatimg %s %s 2>%s", image, args, path("err").c_str());
+    f = popen(cmd, "r");
+    if (!f)
+        return -1;
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+        if (out)
+            out->append(buf, len);
+    }
+    status = pclose(f);
+    said = read_host("err");
+    if (err)
+        err->assign(said.begin(), said.end());
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// A fix a second going north east, with some of everything changing
+static track_fix_t fix_at(int i)
+{
+    track_fix_t fix;
+
+    fix.utc = 1715932800 + i;
+    fix.cs = i % 100;
+    fix.lat = 45523064 + i * 37;
+    fix.lon = -122676483 + i * 53 - (i % 7) * 11;
+    fix.speed = 1000 + (i * 13) % 2000;
+    fix.course = (i * 120) % 36000;
+    fix.hdop = 90 + i % 40;
+    return fix;
+}
+
+static void check_files(void)
+{
+    std::vector<uint8_t> data(DATA_SIZE), got;
+    std::string out;
+    char args[512];
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (i * 2654435761u) >> 13;
+    CHECK(write_host("data.in", data.data(), data.size()));
+    CHECK(write_host("more.in", data.data(), APPEND_SIZE));
+
+    snprintf(args, sizeof(args), "put /data.bin %s", path("data.in").c_str());
+    CHECK(fatimg(args) == 0);
+    snprintf(args, sizeof(args), "put /data.bin %s", path("more.in").c_str());
+    CHECK(fatimg(args) == 0);
+    data.insert(data.end(), data.begin(), data.begin() + APPEND_SIZE);
+
+    snprintf(args, sizeof(args), "get /data.bin %s", path("data.out").c_str());
+    CHECK(fatimg(args) == 0);
+    got = read_host("data.out");
+    CHECK(got == data);
+
+    CHECK(fatimg("ls /", &out) == 0);
+    snprintf(args, sizeof(args), " %10lu data.bin\n", (unsigned long)data.size());
+    CHECK(out.find(args) != std::string::npos);
+
+    printf("%-8s %lu bytes put, appended to and got back\n", "files", (unsigned long)data.size());
+}
+
+static void check_decode(void)
+{
+    std::vector<uint8_t> trk;
+    double odom[ODOM_COUNT] = {1234.5, 20.25, 0.5};
+    TrackBlock block;
+    track_fix_t fix;
+    std::string out, err;
+    char args[512], line[128], expected[128];
+    size_t at, end;
+    int lines = 0;
+
+    for (int i = 0; i < FIXES; i++) {
+        if (!block.add(fix_at(i))) {
+            const uint8_t *sealed = block.seal();
+            trk.insert(trk.end(), sealed, sealed + TRACK_BLOCK_SIZE);
+            block.reset();
+            CHECK(block.add(fix_at(i)));
+        }
+    }
+    const uint8_t *sealed = block.seal();
+    trk.insert(trk.end(), sealed, sealed + TRACK_BLOCK_SIZE);
+    CHECK(write_host("track.in", trk.data(), trk.size()));
+    CHECK(write_host("odom.in", odom, sizeof(odom)));
+
+    snprintf(args, sizeof(args), "put /17-00.trk %s", path("track.in").c_str());
+    CHECK(fatimg(args) == 0);
+    snprintf(args, sizeof(args), "put /odom.bin %s", path("odom.in").c_str());
+    CHECK(fatimg(args) == 0);
+
+    // CSV as decode prints it, a line a fix in order
+    CHECK(fatimg("decode /17-00.trk", &out, &err) == 0);
+    snprintf(expected, sizeof(expected), "%lu blocks (0 bad), %d fixes",
+        (unsigned long)(trk.size() / TRACK_BLOCK_SIZE), FIXES);
+    CHECK(err.find(expected) != std::string::npos);
+    at = out.find("utc,cs,lat,lon,speed_kn,course,hdop\n");
+    CHECK(at != std::string::npos);
+    for (at = out.find('\n', at) + 1; at < out.size(); at = end + 1) {
+        end = out.find('\n', at);
+        if (end == std::string::npos)
+            break;
+        snprintf(line, sizeof(line), "%.*s", (int)(end - at), &out[at]);
+        fix = fix_at(lines++);
+        snprintf(expected, sizeof(expected), "%lu,%02u,%.6f,%.6f,%.2f,%.2f,%.2f",
+            (unsigned long)fix.utc, fix.cs, fix.lat / 1e6, fix.lon / 1e6,
+            fix.speed / 100.0, fix.course / 100.0, fix.hdop / 100.0);
+        if (strcmp(line, expected)) {
+            fprintf(stderr, "fix %d: %s, not %s\n", lines - 1, line, expected);
+            check_failures++;
+            break;
+        }
+    }
+    CHECK(lines == FIXES);
+
+    out.clear();
+    CHECK(fatimg("decode /odom.bin", &out) == 0);
+    CHECK(out == "odom 1234.500000, trip A 20.250000, trip B 0.500000\n");
+
+    printf("%-8s %d fixes in %lu blocks decoded as encoded\n", "decode", lines,
+        (unsigned long)(trk.size() / TRACK_BLOCK_SIZE));
+}
+
+int main(void)
+{
+    int fd = mkstemp(image);
+    std::string out;
+    char cmd[1024];
+
+    if (fd < 0 || !mkdtemp(dir))
+        return 1;
+    close(fd);
+
+    snprintf(cmd, sizeof(cmd), "mkfs %d", IMAGE_MB);
+    CHECK(fatimg(cmd) == 0);
+
+    check_files();
+    check_decode();
+
+    CHECK(fatimg("verify", &out) == 0);
+    CHECK(out.find("3 files, ") != std::string::npos);
+    CHECK(out.find(", 0 errors\n") != std::string::npos);
+    printf("%-8s %s", "verify", out.c_str());
+
+    CHECK(fatimg("get /missing.bin", nullptr, &out) != 0);
+    CHECK(out == "/missing.bin: no such file\n");
+
+    unlink(image);
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    CHECK(system(cmd) == 0);
+    return check_status("fatimg");
+}
@@ -0,0 +1,135 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "pins.h"
+#include "shim/card.h"
+#include "test/firmware.h"
+
+static bool (*step_fn)(void);
+static int (*finish_fn)(void);
+static uint16_t key_level = ADC_NONE;
+static uint32_t key_until;
+static bool key_down;
+static uint32_t step_at;
+static bool step_due;
+
+static void pin_changed(PinName pin, int value)
+{
+    if (pin == GPS_EN)
+        gps_sim_power(value);
+}
+
+// Stands in for every interrupt the firmware sleeps through
+static void wake(void)
+{
+    uint32_t next, at;
+    int status;
+
+    if (key_down && (int32_t)(shim_now_us - key_until) >= 0)
+        key_down = false;
+    shim_analog = key_down ? key_level : ADC_NONE;
+    shim_adc_compare();
+
+    gps_sim_poll();
+    shim_tickers();
+
+    if (!step_fn()) {
+        status = finish_fn();
+        fflush(stdout);
+        _exit(status);
+    }
+
+    next = gps_sim_next_us();
+    if (shim_ticker_next(&at) && (int32_t)(at - next) < 0)
+        next = at;
+    if (key_down && (int32_t)(key_until - next) < 0)
+        next = key_until;
+    if (step_due && (int32_t)(shim_now_us - step_at) >= 0)
+        step_due = false;
+    if (step_due && (int32_t)(step_at - next) < 0)
+        next = step_at;
+    shim_wake_at = next;
+}
+
+int firmware_run(const char *image, bool (*step)(void), int (*finish)(void))
+{
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        if (!getenv("FIRMWARE_LOG"))
+            shim_console = fopen("/dev/null", "w");
+        if (!card_open(image))
+            _exit(1);
+        card_block_us = FIRMWARE_BLOCK_US;
+        shim_timer_read_us = FIRMWARE_TIMER_US;
+        step_fn = step;
+        finish_fn = finish;
+        gps_sim_reset();
+        gps_sim.pps_pin = GPS_PPS;
+        shim_pin_changed = pin_changed;
+        shim_wake = wake;
+        shim_wake_at = shim_now_us;
+        firmware_main();
+        _exit(1);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
+}
+
+void firmware_key(uint16_t level, uint32_t ms)
+{
+    key_level = level;
+    key_until = shim_now_us + ms * 1000;
+    key_down = true;
+    // The keypad may be idle, waiting on the ADC's compare
+    shim_analog = level;
+    shim_adc_compare();
+}
+
+void firmware_step_at(uint64_t us)
+{
+    uint64_t now = firmware_us();
+
+    step_at = shim_now_us + (uint32_t)(us > now ? us - now : 0);
+    step_due = true;
+}
+
+uint64_t firmware_us(void)
+{
+    return gps_sim_clock_us();
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * The firmware's own main() on the host, against the simulated receiver
+ * (shim/gps.cpp), the keypad by its ADC levels and FS on a card image,
+ * each on the shim's clock. main.cpp is built with main renamed, and
+ * its globals are there to look at.
+ *
+ * Every time the firmware sleeps it wakes for the next of: a Ticker,
+ * the receiver having something to send, the end of a key press, or a
+ * time the test asked for with firmware_step_at(). That's where the
+ * test gets to look and act, through step(). A key press is seen at
+ * once, through the keypad's ADC compare.
+ */
+
+#include <stdint.h>
+
+#include "mbed.h"
+#include "fs.h"
+#include "gpsclock.h"
+#include "odom.h"
+#include "scheduler.h"
+#include "storage.h"
+#include "ublox.h"
+#include "shim/gps_sim.h"
+
+// Resistor ladder readings for each key, and none
+#define ADC_NONE    0xffff
+#define ADC_DOWN    0x1000
+#define ADC_LEFT    0x4000
+#define ADC_UP      0x8ccc
+#define ADC_RIGHT   0xd000
+
+#define KEY_PRESS_MS    100
+#define KEY_LONG_MS     1100 // past the long press, not by much
+
+// A 512 byte block at the card's 1MHz SPI clock, with the command
+#define FIRMWARE_BLOCK_US   4200
+// A Timer read through the HAL
+#define FIRMWARE_TIMER_US   2
+
+extern Ublox gps;
+extern Scheduler sched;
+extern Storage storage;
+extern FS fs;
+extern Odom odom;
+extern int display_mode;
+extern bool booting;
+extern bool sleeping;
+extern bool entering_sleep;
+extern bool waiting_for_gps_ready;
+extern bool overlay_visible;
+extern GpsClock gpsclock;
+
+int firmware_main(void);
+
+// Boots the firmware on image in a child of its own. step() is called
+// at every wake until it returns false, then finish() gives the exit
+// status. Firmware console output is dropped unless FIRMWARE_LOG is set.
+int firmware_run(const char *image, bool (*step)(void), int (*finish)(void));
+
+// Holds a key down for ms from now
+void firmware_key(uint16_t level, uint32_t ms);
+
+// Wakes it for step() by firmware_us() == us, for whatever is due then
+// while nothing else would wake it (asleep, the keypad idle)
+void firmware_step_at(uint64_t us);
+
+// Microseconds since boot, on a clock that doesn't wrap
+uint64_t firmware_us(void);
@@ -0,0 +1,309 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * fleet over drives recorded here: the simulated receiver (shim/gps.cpp)
+ * from power on, a cold fix, then a stretch at a steady speed, its
+ * stream teed through the firmware's Capture into raw.bin as the speedo
+ * does, next to an odom.log that logged a known drift.
+ *
+ *   - one row a drive in the order given, each ok, with the distance the
+ *     drive covered and the drift that was logged against it
+ *   - a corrupted chunk is counted, and the rest of that drive still read
+ *   - a drive that's only a raw.bin or only an odom.log
+ *   - the same report on one thread or several, and from a list on stdin
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "capture.h"
+#include "pins.h"
+#include "shim/gps_sim.h"
+#include "test/check.h"
+
+#define BAUD        9600   // the receiver's default, nothing configures it
+#define STOP_S      5
+#define DISTANCE    0.02   // of what was driven
+#define DRIFT_MI    0.0005
+
+static char dir[] = "/tmp/fleet-XXXXXX";
+
+struct drive_t {
+    const char *name;
+    double mph;
+    int drive_s;
+    double drift_pct;  // the log's distance off from the drive's
+    bool raw;
+    bool log;
+    bool corrupt;      // a chunk in the middle overwritten
+};
+
+static const drive_t drives[] = {
+    {"commute",   30.0, 240,  0.0, true,  true,  false},
+    {"highway",   65.0, 300,  2.0, true,  true,  false},
+    {"town",      15.0, 120, -1.5, true,  true,  false},
+    {"torn",      40.0, 180,  0.0, true,  true,  true},
+    {"raw.bin",   25.0, 60,   0.0, true,  false, false},
+    {"odom.log",  0.0,  0,    0.0, false, true,  false},
+};
+
+#define DRIVES  (int)(sizeof(drives) / sizeof(drives[0]))
+
+// The UART, into the capture as the RX interrupt tees it
+class Recorder
+{
+public:
+    Recorder(void) : _serial(NC, NC) { this->_serial.attach(this, &Recorder::_rx); }
+
+    Capture capture;
+
+private:
+    void _rx(void) { this->capture.put(this->_serial.getc()); }
+
+    Serial _serial;
+};
+
+static std::string path(const drive_t &drive, const char *fn = nullptr)
+{
+    std::string p = std::string(dir) + "/" + drive.name;
+
+    return fn ? p + "/" + fn : p;
+}
+
+static int chunks_out(Capture &capture, FILE *f, bool flush)
+{
+    const uint8_t *chunk;
+    int chunks = 0;
+
+    while ((chunk = capture.poll(flush))) {
+        fwrite(chunk, CAPTURE_CHUNK_SIZE, 1, f);
+        capture.written(true);
+        chunks++;
+    }
+    return chunks;
+}
+
+// Runs the receiver from power on through the drive, into raw.bin
+static bool record(const drive_t &drive, const char *fn)
+{
+    Recorder recorder;
+    uint64_t moving_at = 0;
+    int chunks = 0;
+    FILE *f;
+
+    f = fopen(fn, "wb");
+    if (!f)
+        return false;
+
+    shim_now_us = 0;
+    gps_sim_reset();
+    gps_sim_power(true);
+    for (;;) {
+        shim_now_us = gps_sim_next_us();
+        gps_sim_poll();
+        chunks += chunks_out(recorder.capture, f, false);
+
+        if (!moving_at && gps_sim.fixed) {
+            moving_at = gps_sim_clock_us();
+            gps_sim.mph = drive.mph;
+        }
+        if (moving_at && gps_sim_clock_us() - moving_at >= drive.drive_s * 1000000ull)
+            gps_sim.mph = 0.0;
+        if (moving_at && gps_sim_clock_us() - moving_at >= (drive.drive_s + STOP_S) * 1000000ull)
+            break;
+    }
+    chunks_out(recorder.capture, f, true);
+    fclose(f);
+
+    // Half a chunk of zeroes, as a write the power went during
+    if (drive.corrupt && (f = fopen(fn, "r+b"))) {
+        uint8_t zeroes[CAPTURE_CHUNK_SIZE / 2] = {0};
+
+        fseek(f, (chunks / 2) * CAPTURE_CHUNK_SIZE, SEEK_SET);
+        fwrite(zeroes, sizeof(zeroes), 1, f);
+        fclose(f);
+    }
+    return true;
+}
+
+static double driven_mi(const drive_t &drive)
+{
+    return drive.mph * drive.drive_s / 3600.0;
+}
+
+// A line at the start and one at the end, the distance between them off
+// by drift_pct; with an unsynced line between
+static bool write_log(const drive_t &drive, const char *fn)
+{
+    double first = 1000.0, last = first + driven_mi(drive) * (1 + drive.drift_pct / 100);
+    FILE *f = fopen(fn, "w");
+
+    if (!f)
+        return false;
+    fprintf(f, "2024-05-17 08:00:00.000+000, %.6f, 1.000000, 2.000000\n", first);
+    fprintf(f, "unsynced, %.6f, 1.000000, 2.000000\n", (first + last) / 2);
+    fprintf(f, "2024-05-17 08:10:00.000+001, %.6f, 1.000000, 2.000000\n", last);
+    return fclose(f) == 0;
+}
+
+// ./fleet args; its exit status and what it printed
+static int fleet(const char *args, std::string *out, const char *in = nullptr)
+{
+    char cmd[4096], buf[4096];
+    size_t len;
+    FILE *f;
+    int status;
+
+    snprintf(cmd, sizeof(cmd), "%s%s./fleet -b %d %s 2>/dev/null",
+        in ? in : "", in ? " | " : "", BAUD, args);
+    f = popen(cmd, "r");
+    if (!f)
+        return -1;
+    out->clear();
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+        out->append(buf, len);
+    status = pclose(f);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static std::vector<std::string> fields(const std::string &line)
+{
+    std::vector<std::string> f;
+    size_t at = 0, comma;
+
+    while ((comma = line.find(',', at)) != std::string::npos) {
+        f.push_back(line.substr(at, comma - at));
+        at = comma + 1;
+    }
+    f.push_back(line.substr(at));
+    return f;
+}
+
+enum {
+    COL_DRIVE, COL_OK, COL_BYTES, COL_BAD, COL_DROPPED, COL_SENTENCES, COL_FIXES,
+    COL_CAPTURE_S, COL_MOVING_S, COL_DISTANCE, COL_MAX_MPH, COL_MEAN_MPH,
+    COL_LOG_LINES, COL_LOG_BACKSTEPS, COL_LOG_MI, COL_DRIFT_MI, COL_DRIFT_PCT,
+    COL_COUNT,
+};
+
+static void check_row(const drive_t &drive, const std::string &line)
+{
+    std::vector<std::string> f = fields(line);
+    double distance = 0, log_mi = 0;
+
+    CHECK(f.size() == COL_COUNT);
+    if (f.size() != COL_COUNT)
+        return;
+    CHECK(f[COL_DRIVE] == path(drive));
+    CHECK(f[COL_OK] == "1");
+
+    if (drive.raw) {
+        distance = atof(f[COL_DISTANCE].c_str());
+        printf("%-9s %6.2f mph %4d s: %8.4f mi of %8.4f, max %5s mph, %s bad chunks\n",
+            drive.name, drive.mph, drive.drive_s, distance, driven_mi(drive),
+            f[COL_MAX_MPH].c_str(), f[COL_BAD].c_str());
+        CHECK(f[COL_BAD] == (drive.corrupt ? "1" : "0"));
+        CHECK(f[COL_DROPPED] == "0");
+        CHECK(fabs(distance - driven_mi(drive)) <= DISTANCE * driven_mi(drive));
+        CHECK(fabs(atof(f[COL_MAX_MPH].c_str()) - drive.mph) < 1.0);
+    } else {
+        CHECK(f[COL_BYTES].empty() && f[COL_DISTANCE].empty());
+    }
+
+    if (drive.log) {
+        log_mi = atof(f[COL_LOG_MI].c_str());
+        CHECK(f[COL_LOG_LINES] == "3");
+        CHECK(f[COL_LOG_BACKSTEPS] == "0");
+        CHECK(fabs(log_mi - driven_mi(drive) * (1 + drive.drift_pct / 100)) < DRIFT_MI);
+    } else {
+        CHECK(f[COL_LOG_LINES].empty());
+    }
+
+    // The replay against the log, as far as the drive got both right
+    if (drive.raw && drive.log) {
+        CHECK(fabs(atof(f[COL_DRIFT_MI].c_str()) - (distance - log_mi)) < DRIFT_MI);
+        CHECK(fabs(atof(f[COL_DRIFT_PCT].c_str()) - 100 * (distance - log_mi) / log_mi) < 0.01);
+    } else {
+        CHECK(f[COL_DRIFT_MI].empty());
+    }
+}
+
+int main(void)
+{
+    std::string args, list, out, again;
+    char cmd[1024];
+    size_t at, end;
+    int rows = 0;
+
+    if (!mkdtemp(dir))
+        return 1;
+
+    for (int i = 0; i < DRIVES; i++) {
+        const drive_t &d = drives[i];
+
+        // A drive on its own is just the file
+        if (d.raw && d.log)
+            CHECK(mkdir(path(d).c_str(), 0700) == 0);
+        if (d.raw)
+            CHECK(record(d, (d.log ? path(d, "raw.bin") : path(d)).c_str()));
+        if (d.log)
+            CHECK(write_log(d, (d.raw ? path(d, "odom.log") : path(d)).c_str()));
+        args += " " + path(d);
+        list += path(d) + "\\n";
+    }
+
+    CHECK(fleet(("-j 1" + args).c_str(), &out) == 0);
+    at = out.find('\n');
+    CHECK(at != std::string::npos);
+    for (at++; at < out.size() && rows < DRIVES; at = end + 1, rows++) {
+        end = out.find('\n', at);
+        if (end == std::string::npos)
+            break;
+        check_row(drives[rows], out.substr(at, end - at));
+    }
+    CHECK(rows == DRIVES);
+
+    CHECK(fleet(("-j 4" + args).c_str(), &again) == 0);
+    CHECK(again == out);
+    snprintf(cmd, sizeof(cmd), "printf '%s'", list.c_str());
+    CHECK(fleet("-j 3 -", &again, cmd) == 0);
+    CHECK(again == out);
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    CHECK(system(cmd) == 0);
+    return check_status("fleet");
+}
@@ -0,0 +1,233 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * The keypad, sampled from the TM1650 driver's Ticker, with ADC
+ * waveforms replayed into it a millisecond at a time through the ADC's
+ * compare and the Ticker:
+ *
+ *   - a clean press and release, a long press, contact bounce, a glitch
+ *     too short to count and two presses close together, each with the
+ *     events it must give and when, to within a sample
+ *   - with no key down the Ticker is stopped, the compare armed, and a
+ *     minute of nothing takes no samples at all
+ *   - events pile up in the queue while nothing reads it, and once full
+ *     the newest are dropped, not the ones waiting
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pins.h"
+#include "tm1650.h"
+#include "test/check.h"
+
+// Resistor ladder readings for each key, and none
+#define ADC_NONE    0xffff
+#define ADC_DOWN    0x1000
+#define ADC_LEFT    0x4000
+#define ADC_UP      0x8ccc
+#define ADC_RIGHT   0xd000
+
+#define DEBOUNCE_MS 10
+#define LONG_MS     1000
+
+#define EVENTS_MAX  32
+
+// A stretch of the waveform, bouncing between level and ADC_NONE every
+// bounce_ms if that isn't 0
+struct segment_t {
+    uint16_t level;
+    uint32_t ms;
+    uint32_t bounce_ms;
+};
+
+// An event and when it's due, from the start of the waveform
+struct expect_t {
+    key_code_t key;
+    key_action_t action;
+    uint32_t ms;
+};
+
+static TM1650 tm1650(TM1650_DIO, TM1650_CLK, TM1650_AIN);
+
+static uint32_t replay_us;
+static uint32_t pushed_at[EVENTS_MAX];
+static int pushed;
+
+static void on_event(void)
+{
+    if (pushed < EVENTS_MAX)
+        pushed_at[pushed] = shim_now_us - replay_us;
+    pushed++;
+}
+
+// Nothing sampling, only the compare watching
+static bool idle(void)
+{
+    uint32_t at;
+
+    return !shim_ticker_next(&at) && (ADC0->SC3 & ADC_SC3_ADCO_MASK) && (ADC0->SC2 & ADC_SC2_ACFE_MASK);
+}
+
+// Plays the waveform through the sampler, times from its start
+static void replay(const segment_t *segments, int count)
+{
+    uint32_t start_us, end_us;
+
+    replay_us = shim_now_us;
+    pushed = 0;
+    shim_analog_reads = 0;
+    for (int i = 0; i < count; i++) {
+        start_us = shim_now_us;
+        end_us = start_us + segments[i].ms * 1000;
+        while ((int32_t)(shim_now_us - end_us) < 0) {
+            shim_analog = segments[i].level;
+            if (segments[i].bounce_ms && (shim_now_us - start_us) / (segments[i].bounce_ms * 1000) % 2)
+                shim_analog = ADC_NONE;
+            shim_adc_compare();
+            shim_tickers();
+            shim_now_us += 1000;
+        }
+    }
+}
+
+static void check(const char *name, const segment_t *segments, int segment_count, const expect_t *expect, int expect_count)
+{
+    uint32_t period_us = TM1650_SAMPLE_MS * 1000;
+    key_event_t event;
+    int got = 0;
+    int late_us = 0;
+
+    replay(segments, segment_count);
+
+    while ((event = tm1650.getEvent()) != NO_EVENT) {
+        if (got < expect_count) {
+            CHECK(event.key == expect[got].key);
+            CHECK(event.action == expect[got].action);
+            // Due on the sample that completes it, at most one late
+            int due_us = expect[got].ms * 1000;
+            int at_us = pushed_at[got];
+            CHECK(at_us >= due_us && at_us <= due_us + (int)period_us);
+            if (at_us - due_us > late_us)
+                late_us = at_us - due_us;
+        }
+        got++;
+    }
+
+    printf("%-14s %6d %6d %10.1f %8u\n", name, got, expect_count, late_us / 1000.0, shim_analog_reads);
+    CHECK(got == expect_count);
+    CHECK(pushed == got);
+    // Every waveform ends long enough after the last key to settle
+    CHECK(idle());
+}
+
+int main(int argc, char **argv)
+{
+    tm1650.init();
+    tm1650.attach(on_event);
+    CHECK(Ticker::attached != nullptr);
+    CHECK(Ticker::attached->period_us() == TM1650_SAMPLE_MS * 1000);
+
+    printf("%-14s %6s %6s %10s %8s\n", "waveform", "events", "due", "latest ms", "samples");
+    {
+        // The first sample finds nothing down, and stops the Ticker
+        const segment_t wave[] = {{ADC_NONE, 60000, 0}};
+        check("idle", wave, 1, nullptr, 0);
+        CHECK(shim_analog_reads == 1);
+    }
+    {
+        const segment_t wave[] = {{ADC_NONE, 50, 0}, {ADC_UP, 200, 0}, {ADC_NONE, 100, 0}};
+        const expect_t expect[] = {
+            {KEY_UP, ACTION_PRESS, 50 + DEBOUNCE_MS},
+            {KEY_UP, ACTION_RELEASE, 250},
+        };
+        check("press", wave, 3, expect, 2);
+    }
+    {
+        const segment_t wave[] = {{ADC_NONE, 50, 0}, {ADC_DOWN, 1500, 0}, {ADC_NONE, 100, 0}};
+        const expect_t expect[] = {
+            {KEY_DOWN, ACTION_PRESS, 50 + DEBOUNCE_MS},
+            {KEY_DOWN, ACTION_LONG_PRESS, 50 + LONG_MS},
+            {KEY_DOWN, ACTION_RELEASE, 1550},
+        };
+        check("long press", wave, 3, expect, 3);
+    }
+    {
+        // Contacts chattering for 30ms either side of a press
+        const segment_t wave[] = {
+            {ADC_NONE, 50, 0}, {ADC_LEFT, 30, 5}, {ADC_LEFT, 300, 0},
+            {ADC_LEFT, 30, 5}, {ADC_NONE, 100, 0},
+        };
+        const expect_t expect[] = {
+            {KEY_LEFT, ACTION_PRESS, 80 + DEBOUNCE_MS},
+            {KEY_LEFT, ACTION_RELEASE, 385},
+        };
+        check("bounce", wave, 5, expect, 2);
+    }
+    {
+        const segment_t wave[] = {{ADC_NONE, 50, 0}, {ADC_RIGHT, 5, 0}, {ADC_NONE, 100, 0}};
+        check("glitch", wave, 3, nullptr, 0);
+    }
+    {
+        // The second press comes before the inter-key gap is up
+        const segment_t wave[] = {
+            {ADC_NONE, 50, 0}, {ADC_UP, 100, 0}, {ADC_NONE, 15, 0},
+            {ADC_DOWN, 100, 0}, {ADC_NONE, 100, 0},
+        };
+        const expect_t expect[] = {
+            {KEY_UP, ACTION_PRESS, 50 + DEBOUNCE_MS},
+            {KEY_UP, ACTION_RELEASE, 150},
+            {KEY_DOWN, ACTION_PRESS, 175 + DEBOUNCE_MS},
+            {KEY_DOWN, ACTION_RELEASE, 265},
+        };
+        check("close presses", wave, 5, expect, 4);
+    }
+
+    // Nobody reading: the queue keeps the oldest it has room for
+    {
+        segment_t wave[2 * TM1650_EVENT_QUEUE];
+        key_event_t event;
+        int got = 0;
+
+        for (int i = 0; i < TM1650_EVENT_QUEUE; i++) {
+            wave[2 * i] = {ADC_UP, 100, 0};
+            wave[2 * i + 1] = {ADC_NONE, 100, 0};
+        }
+        replay(wave, 2 * TM1650_EVENT_QUEUE);
+        while ((event = tm1650.getEvent()) != NO_EVENT) {
+            CHECK(event.action == (got % 2 ? ACTION_RELEASE : ACTION_PRESS));
+            got++;
+        }
+        printf("%-14s %6d %6d %10s %8u\n", "queue full", got, TM1650_EVENT_QUEUE - 1, "-", shim_analog_reads);
+        CHECK(got == TM1650_EVENT_QUEUE - 1);
+    }
+
+    return check_status("keypad");
+}
@@ -0,0 +1,390 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Log appends on card images, through the firmware's own FS and
+ * sd-reader:
+ *
+ *   - odom.log style lines through the preallocated log against plain
+ *     append_file(), in card blocks per line
+ *   - a log reopened without its last checkpoint gets its lines back
+ *   - power lost after each card write in turn while a file and a log
+ *     grow: no FAT entry may point at a free cluster, even in a chain
+ *     not yet linked to a file, every file's chain must end properly,
+ *     and the log must come back as whole lines
+ *
+ * Each run is forked off, sd-reader only has room for one filesystem.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include <sd-reader/fat.h>
+#include <sd-reader/partition.h>
+#include <sd-reader/sd_raw.h>
+
+#include "fs.h"
+#include "mkfs.h"
+#include "shim/card.h"
+#include "test/check.h"
+
+#define BENCH_MB    512  // Big enough for 4k clusters
+#define BENCH_LINES 2000
+#define CUT_MB      64   // 512 byte clusters, so appends allocate often
+#define CUT_BLOCKS  16
+#define CUT_LINES   24
+
+#define FAT32_FREE  0x00000000
+#define FAT32_BAD   0x0ffffff7
+#define FAT32_LAST  0x0ffffff8
+#define FAT32_MASK  0x0fffffff
+
+static char image[] = "/tmp/log_append-XXXXXX";
+
+extern "C" void get_datetime(uint16_t *year, uint8_t *month, uint8_t *day, uint8_t *hour, uint8_t *min, uint8_t *sec)
+{
+    *year = 2024;
+    *month = 5;
+    *day = 17;
+    *hour = 8;
+    *min = 0;
+    *sec = 0;
+}
+
+// About what save_odom() logs
+static std::string log_lines(int count)
+{
+    std::string text;
+    char line[96];
+
+    for (int i = 0; i < count; i++) {
+        snprintf(line, sizeof(line), "2024-05-17 %02d:%02d:%02d,%.2f,%.2f,%.2f\n",
+            8 + i / 3600, i / 60 % 60, i % 60, 12345.67 + i * 0.01, i * 0.01, i * 0.02);
+        text += line;
+    }
+    return text;
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// fn's exit status, run in a child of its own
+static int run(int (*fn)(long), long arg)
+{
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        check_failures = 0;
+        status = fn(arg);
+        fflush(stdout);
+        _exit(status);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
+}
+
+// The file holds exactly text
+static bool holds(FS &fs, const char *fn, const std::string &text)
+{
+    std::string buf(text.size(), '\0');
+    uint8_t extra;
+
+    if (!buf.empty() && !fs.read_file(fn, &buf[0], buf.size()))
+        return false;
+    return buf == text && !fs.read_file(fn, &extra, 1, text.size());
+}
+
+static int bench(long)
+{
+    std::string text = log_lines(BENCH_LINES);
+    card_stats_t before, append, log;
+    double t, append_us, log_us;
+    size_t pos, len;
+    FS fs;
+
+    if (!card_open(image) || !fs.init())
+        return 1;
+
+    before = card_stats;
+    t = now_us();
+    for (pos = 0; pos < text.size(); pos += len) {
+        len = text.find('\n', pos) + 1 - pos;
+        if (!fs.append_file("append.log", &text[pos], len))
+            break;
+    }
+    append_us = now_us() - t;
+    append.blocks_read = card_stats.blocks_read - before.blocks_read;
+    append.blocks_written = card_stats.blocks_written - before.blocks_written;
+    CHECK(pos == text.size());
+
+    // Zeroing ahead is what Storage does between jobs, so it's counted
+    before = card_stats;
+    t = now_us();
+    CHECK(fs.open_log("odom.log"));
+    for (pos = 0; pos < text.size(); pos += len) {
+        len = text.find('\n', pos) + 1 - pos;
+        if (!fs.log_append(&text[pos], len))
+            break;
+        while (fs.log_idle());
+    }
+    CHECK(fs.log_checkpoint());
+    log_us = now_us() - t;
+    log.blocks_read = card_stats.blocks_read - before.blocks_read;
+    log.blocks_written = card_stats.blocks_written - before.blocks_written;
+    CHECK(pos == text.size());
+
+    printf("%d lines, %zu bytes\n", BENCH_LINES, text.size());
+    printf("path           blocks read/line  written/line  us/line\n");
+    printf("append_file()  %16.2f  %12.2f  %7.2f\n",
+        (double)append.blocks_read / BENCH_LINES, (double)append.blocks_written / BENCH_LINES, append_us / BENCH_LINES);
+    printf("log_append()   %16.2f  %12.2f  %7.2f\n",
+        (double)log.blocks_read / BENCH_LINES, (double)log.blocks_written / BENCH_LINES, log_us / BENCH_LINES);
+
+    CHECK(log.blocks_written < append.blocks_written);
+    CHECK(log.blocks_read < append.blocks_read);
+    CHECK(holds(fs, "append.log", text));
+    CHECK(holds(fs, "odom.log", text));
+
+    card_close();
+    return check_failures;
+}
+
+// Lines past the last checkpoint, then the power goes
+static int unsynced_write(long lines)
+{
+    std::string text = log_lines(lines);
+    FS fs;
+
+    if (!card_open(image) || !fs.init() || !fs.open_log("odom.log"))
+        return 1;
+    CHECK(fs.log_append(text.data(), text.size()));
+    card_close();
+    return check_failures;
+}
+
+static int unsynced_read(long lines)
+{
+    std::string text = log_lines(lines), more;
+    FS fs;
+
+    if (!card_open(image) || !fs.init())
+        return 1;
+    CHECK(fs.open_log("odom.log"));
+    CHECK(holds(fs, "odom.log", text));
+
+    more = log_lines(lines + 1).substr(text.size());
+    CHECK(fs.log_append(more.data(), more.size()));
+    CHECK(fs.log_checkpoint());
+    CHECK(holds(fs, "odom.log", text + more));
+    card_close();
+    return check_failures;
+}
+
+// A log and a file growing side by side until the card's write budget
+// runs out. 0 if it did, 2 if everything fit.
+static int cut_write(long writes)
+{
+    std::string text = log_lines(CUT_LINES);
+    uint8_t block[512];
+    size_t pos = 0, len;
+    FS fs;
+
+    if (!card_open(image) || !fs.init())
+        return 1;
+    card_writes_left = writes;
+
+    if (!fs.open_log("odom.log"))
+        goto out;
+    for (int i = 0; i < CUT_BLOCKS || pos < text.size(); i++) {
+        if (i < CUT_BLOCKS) {
+            memset(block, 'a' + i, sizeof(block));
+            if (!fs.append_file("track.bin", block, sizeof(block)))
+                goto out;
+        }
+        if (pos < text.size()) {
+            len = text.find('\n', pos) + 1 - pos;
+            if (!fs.log_append(&text[pos], len))
+                goto out;
+            pos += len;
+        }
+    }
+    if (!fs.log_checkpoint())
+        goto out;
+
+out:
+    card_close();
+    return card_writes_left == 0 ? 0 : 2;
+}
+
+// The chain a directory entry points to ends in an end of chain marker,
+// through clusters that are neither free nor bad, and holds the size
+static bool chain_ends(const struct fat_fs_layout_struct *layout, const struct fat_dir_entry_struct *entry)
+{
+    uint32_t clusters = layout->fat_size / 4;
+    uint32_t cluster = entry->cluster;
+    uint32_t count = 0, next;
+
+    if (!cluster)
+        return entry->file_size == 0;
+
+    for (;;) {
+        if (cluster < 2 || cluster >= clusters || ++count > clusters)
+            return false;
+        if (!sd_raw_read(layout->fat_offset + (offset_t)cluster * 4, (uint8_t *)&next, sizeof(next)))
+            return false;
+        next &= FAT32_MASK;
+        if (next >= FAT32_LAST)
+            break;
+        if (next == FAT32_FREE || next == FAT32_BAD)
+            return false;
+        cluster = next;
+    }
+
+    return (uint64_t)count * layout->cluster_size >= entry->file_size;
+}
+
+// Nothing in use points at a free cluster, linked to a file or not
+static bool fat_sound(const struct fat_fs_layout_struct *layout)
+{
+    std::vector<uint32_t> fat(layout->fat_size / 4);
+    uint32_t next;
+
+    if (!sd_raw_read(layout->fat_offset, (uint8_t *)&fat[0], fat.size() * 4))
+        return false;
+
+    for (size_t i = 2; i < fat.size(); i++) {
+        next = fat[i] & FAT32_MASK;
+        if (next == FAT32_FREE || next >= FAT32_BAD)
+            continue;
+        if (next < 2 || next >= fat.size() || (fat[next] & FAT32_MASK) == FAT32_FREE)
+            return false;
+    }
+
+    return true;
+}
+
+static int cut_check(long)
+{
+    static const char *names[] = { "/track.bin", "/odom.log" };
+    struct fat_fs_layout_struct layout;
+    struct fat_dir_entry_struct entry;
+    struct partition_struct *partition;
+    struct fat_fs_struct *fat;
+    std::string text = log_lines(CUT_LINES);
+    size_t end;
+    FS fs;
+
+    if (!card_open(image))
+        return 1;
+
+    partition = partition_open(sd_raw_read, sd_raw_read_interval, sd_raw_write, sd_raw_write_interval, -1);
+    fat = partition ? fat_open(partition) : NULL;
+    if (!fat || !fat_get_fs_layout(fat, &layout))
+        return 1;
+    if (!fat_sound(&layout)) {
+        fprintf(stderr, "FAT points at a free cluster\n");
+        check_failures++;
+    }
+    for (const char *name : names) {
+        if (fat_get_dir_entry_of_path(fat, name, &entry) && !chain_ends(&layout, &entry)) {
+            fprintf(stderr, "%s: broken chain\n", name);
+            check_failures++;
+        }
+    }
+    fat_close(fat);
+    partition_close(partition);
+
+    // Whatever the log recovers is whole lines, in order
+    CHECK(fs.init());
+    if (fs.open_log("odom.log")) {
+        for (end = text.size(); !holds(fs, "odom.log", text.substr(0, end)); end = text.rfind('\n', end - 2) + 1) {
+            if (end == 0) {
+                fprintf(stderr, "odom.log: not whole lines\n");
+                check_failures++;
+                break;
+            }
+        }
+    }
+
+    card_close();
+    return check_failures;
+}
+
+int main(int argc, char **argv)
+{
+    int fd, result, trials;
+
+    fd = mkstemp(image);
+    if (fd < 0) {
+        perror(image);
+        return 1;
+    }
+    close(fd);
+
+    CHECK(mkfs(image, BENCH_MB));
+    CHECK(run(bench, 0) == 0);
+
+    CHECK(mkfs(image, CUT_MB, 512));
+    CHECK(run(unsynced_write, 80) == 0);
+    CHECK(run(unsynced_read, 80) == 0);
+
+    for (trials = 0; ; trials++) {
+        if (!mkfs(image, CUT_MB, 512)) {
+            check_failures++;
+            break;
+        }
+        result = run(cut_write, trials);
+        if (result == 2)
+            break;
+        CHECK(result == 0);
+        if (run(cut_check, 0) != 0) {
+            fprintf(stderr, "power lost after %d writes\n", trials);
+            check_failures++;
+        }
+    }
+    printf("power lost after each of %d card writes\n", trials);
+
+    unlink(image);
+    return check_status("log_append");
+}
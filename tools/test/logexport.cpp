@@ -0,0 +1,255 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+ * logexport against known output. A card image is written the way the
+ * firmware writes it, through FS: a day's track log of two trips, over
+ * three blocks with a torn one between them, and an odom.log. Both are read
+ * back off the card, exported, and what comes out must match
+ * test/data/ byte for byte:
+ *
+ *   track.gpx   the track log as GPX, trips split by the gap
+ *   track.csv   the same as CSV
+ *   range.csv   limited with -s and -e, ending inside the first trip
+ *   odom.csv    odom.log as CSV, less a line saved before GPS time
+ *
+ * After a change to the output that's meant, write them again with
+ * LOGEXPORT_UPDATE=1 and look over the diff.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+
+#include "fs.h"
+#include "mkfs.h"
+#include "track.h"
+#include "shim/card.h"
+#include "test/check.h"
+
+#define IMAGE_MB     64
+#define BLOCK_FIXES  6    // a block sealed early, so the trip spans two
+#define TRACK_FN     "2024/05/17-00.trk"
+#define ODOM_FN      "odom.log"
+#define DATA         "test/data/"
+
+static char image[] = "/tmp/logexport-XXXXXX";
+static char dir[] = "/tmp/logexport-XXXXXX";
+
+// Two trips an hour apart; northern hemisphere, western longitudes
+static const track_fix_t fixes[] = {
+    {1715932800,  0, 45523064, -122676483,    0,     0, 120},
+    {1715932801, 50, 45523100, -122676400, 1250,  4500, 110},
+    {1715932803,  0, 45523200, -122676100, 2410,  4510, 110},
+    {1715932805, 20, 45523350, -122675700, 3107,  9000,  95},
+    {1715932807,  0, 45523350, -122675200, 3350,  8950,  95},
+    {1715932810,  5, 45523340, -122674500, 3360, 17990,   0}, // no HDOP yet
+    {1715932812,  0, 45522900, -122674480, 2005, 18000,  99},
+    {1715932815, 99, 45522400, -122674470,  512, 35999, 101},
+    {1715936400,  0, 45522400, -122674470,    0,     0, 250}, // next trip
+    {1715936401, 10,  5000000,   -1000000,    7,   100, 100}, // small numbers
+    {1715936402, 20,   -10000,       -999,    5,     1, 100},
+};
+#define FIXES  (int)(sizeof(fixes) / sizeof(fixes[0]))
+#define TRIP_2 8
+
+// As save_odom() writes it with PRETTY_LOG
+static const char odom_log[] =
+    "2024-05-17 08:00:00.000+000, 12345.678901, 12.000000, 0.500000\n"
+    "2024-05-17 08:00:10.250+001, 12345.700000, 12.021099, 0.521099\n"
+    "garbled line\n"
+    "unsynced, 12345.690000, 12.011099, 0.511099\n"
+    "2024-05-17 08:05:00.990+030, 12346.000000, 12.321099, 0.821099\n"
+    "2024-05-17 09:00:00.000+3300, 12346.000000, 12.321099, 0.821099\n"
+    "2024-05-17 09:00:01.500+000, 12346.010000, 12.331099, 0.831099\n";
+
+extern "C" void get_datetime(uint16_t *year, uint8_t *month, uint8_t *day, uint8_t *hour, uint8_t *min, uint8_t *sec)
+{
+    *year = 2024;
+    *month = 5;
+    *day = 17;
+    *hour = 8;
+    *min = 0;
+    *sec = 0;
+}
+
+// fn's exit status, run in a child of its own
+static int run(int (*fn)(void))
+{
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        check_failures = 0;
+        status = fn();
+        fflush(stdout);
+        _exit(status);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
+}
+
+static bool append_block(FS &fs, TrackBlock &block)
+{
+    bool ok = fs.append_file(TRACK_FN, block.seal(), TRACK_BLOCK_SIZE, TRACK_BLOCK_SIZE);
+
+    block.reset();
+    return ok;
+}
+
+static int write_card(void)
+{
+    TrackBlock block;
+    uint8_t torn[TRACK_BLOCK_SIZE];
+    FS fs;
+
+    if (!card_open(image) || !fs.init())
+        return 1;
+
+    for (int i = 0; i < FIXES; i++) {
+        // Between the trips, a copy of the last block the power went
+        // halfway through writing
+        if (i == TRIP_2) {
+            memcpy(torn, block.seal(), sizeof(torn));
+            memset(&torn[TRACK_BLOCK_SIZE / 2], 0, TRACK_BLOCK_SIZE / 2);
+            CHECK(append_block(fs, block));
+            CHECK(fs.append_file(TRACK_FN, torn, sizeof(torn), TRACK_BLOCK_SIZE));
+        }
+        if (block.count() == BLOCK_FIXES)
+            CHECK(append_block(fs, block));
+        CHECK(block.add(fixes[i]));
+    }
+    CHECK(append_block(fs, block));
+
+    CHECK(fs.write_file(ODOM_FN, odom_log, strlen(odom_log)));
+
+    card_close();
+    return check_failures;
+}
+
+// Off the card into dir, as a card reader would
+static bool copy_off(FS &fs, const char *fn, const char *to)
+{
+    uint8_t buf[TRACK_BLOCK_SIZE];
+    std::string path = std::string(dir) + "/" + to;
+    uint32_t offset = 0;
+    size_t len;
+    FILE *f;
+
+    f = fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    // read_file() only reads whole, so the tail goes a byte at a time
+    for (;;) {
+        if (fs.read_file(fn, buf, sizeof(buf), offset))
+            len = sizeof(buf);
+        else if (fs.read_file(fn, buf, 1, offset))
+            len = 1;
+        else
+            break;
+        fwrite(buf, 1, len, f);
+        offset += len;
+    }
+    fclose(f);
+    return offset > 0;
+}
+
+static int read_card(void)
+{
+    FS fs;
+
+    if (!card_open(image) || !fs.init())
+        return 1;
+    CHECK(copy_off(fs, TRACK_FN, "17-00.trk"));
+    CHECK(copy_off(fs, ODOM_FN, "odom.log"));
+    card_close();
+    return check_failures;
+}
+
+// Exports in and compares with test/data/expected, or writes it; what
+// logexport said on stderr must have said in it
+static void export_check(const char *args, const char *in, const char *expected, const char *said)
+{
+    char cmd[1024], err[256] = "";
+    std::string out = std::string(dir) + "/" + expected;
+    FILE *f;
+
+    snprintf(cmd, sizeof(cmd), "./logexport %s -o %s %s/%s 2>%s.err", args, out.c_str(), dir, in, out.c_str());
+    CHECK(system(cmd) == 0);
+
+    f = fopen((out + ".err").c_str(), "r");
+    if (f) {
+        err[fread(err, 1, sizeof(err) - 1, f)] = '\0';
+        fclose(f);
+    }
+    if (!strstr(err, said)) {
+        fprintf(stderr, "%s: \"%s\" not in: %s\n", expected, said, err);
+        check_failures++;
+    }
+
+    if (getenv("LOGEXPORT_UPDATE"))
+        snprintf(cmd, sizeof(cmd), "cp %s " DATA "%s", out.c_str(), expected);
+    else
+        snprintf(cmd, sizeof(cmd), "diff -u " DATA "%s %s", expected, out.c_str());
+    if (system(cmd) != 0) {
+        fprintf(stderr, "%s differs\n", expected);
+        check_failures++;
+    }
+}
+
+int main(void)
+{
+    int fd = mkstemp(image);
+    char cmd[1024];
+
+    if (fd < 0 || !mkdtemp(dir) || !mkfs(image, IMAGE_MB))
+        return 1;
+    close(fd);
+
+    CHECK(run(write_card) == 0);
+    CHECK(run(read_card) == 0);
+
+    export_check("-f gpx", "17-00.trk", "track.gpx", "1 bad blocks skipped");
+    export_check("-f csv", "17-00.trk", "track.csv", "11 records in 2 trips");
+    export_check("-f csv -s 2024-05-17T08:00:03 -e 1715932810", "17-00.trk", "range.csv", "4 records in 1 trips");
+    export_check("-f csv", "odom.log", "odom.csv", "5 records in 2 trips");
+    export_check("-f csv", "odom.log", "odom.csv", "1 unsynced lines skipped");
+
+    unlink(image);
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    CHECK(system(cmd) == 0);
+    return check_status("logexport");
+}
@@ -0,0 +1,189 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * NmeaGPS::feed() against TinyGPS::encode() a byte at a time, on the
+ * receiver's output in test/data/nmea.txt. That has the damage a real
+ * line has in it too: sentences torn off by another '$' or a line end,
+ * bad and non-hex checksums, a lower case one, junk between lines, a
+ * missing line end, an over-long term and a sentence left unfinished
+ * at the end.
+ *
+ * Every field must be the same wherever encode() would
+ * have accepted a sentence and at the end, for each framing kernel this
+ * CPU has and with the stream fed in pieces of every awkward size.
+ */
+
+#include <mbed.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "nmea.h"
+#include "test/check.h"
+
+#define FIXTURE         "test/data/nmea.txt"
+#define FIXTURE_GOOD    207 // sentences encode() accepts
+
+struct fields_t {
+    long lat, lon;
+    unsigned long date, time;
+    unsigned long speed, course, hdop;
+    long altitude;
+    unsigned short pdop;
+    unsigned char satsinview, satsused, fixtype;
+    bool good;
+};
+
+struct check_t {
+    const std::vector<fields_t> *ref;
+    size_t next;
+    unsigned long mismatched;
+};
+
+static const size_t pieces[] = { 1, 2, 3, 7, 16, 33, 64, 997, 0 };
+
+static void snapshot(TinyGPS *gps, fields_t *f)
+{
+    unsigned long age;
+
+    memset(f, 0, sizeof(*f));
+    gps->get_position(&f->lat, &f->lon, &age);
+    gps->get_datetime(&f->date, &f->time, &age);
+    f->speed = gps->speed();
+    f->course = gps->course();
+    f->hdop = gps->hdop();
+    f->altitude = gps->altitude();
+    f->pdop = gps->pdop();
+    f->satsinview = gps->satsinview();
+    f->satsused = gps->satsused();
+    f->fixtype = gps->fixtype();
+    f->good = gps->gps_good_data();
+}
+
+static void print(const char *what, const fields_t *f)
+{
+    fprintf(stderr, "  %-4s %ld %ld %lu %lu %lu %lu %lu %ld %u %u %u %u %d\n",
+        what, f->lat, f->lon, f->date, f->time, f->speed, f->course, f->hdop, f->altitude,
+        f->pdop, f->satsinview, f->satsused, f->fixtype, f->good);
+}
+
+static void check(NmeaGPS *gps, void *p)
+{
+    check_t *c = (check_t *)p;
+    fields_t f;
+
+    snapshot(gps, &f);
+    if (c->next >= c->ref->size() || memcmp(&f, &(*c->ref)[c->next], sizeof(f))) {
+        if (!c->mismatched++) {
+            fprintf(stderr, "sentence %zu:\n", c->next);
+            if (c->next < c->ref->size())
+                print("want", &(*c->ref)[c->next]);
+            print("got", &f);
+        }
+    }
+    c->next++;
+}
+
+static bool load(std::vector<uint8_t> *data)
+{
+    uint8_t buf[4096];
+    size_t len;
+    FILE *f;
+
+    f = fopen(FIXTURE, "rb");
+    if (!f) {
+        perror(FIXTURE);
+        return false;
+    }
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+        data->insert(data->end(), buf, buf + len);
+    fclose(f);
+
+    return true;
+}
+
+int main(void)
+{
+    std::vector<uint8_t> data;
+    std::vector<fields_t> ref;
+    fields_t end, f;
+
+    if (!load(&data))
+        return 1;
+
+    // What a byte at a time makes of it
+    {
+        TinyGPS gps;
+
+        for (size_t i = 0; i < data.size(); i++) {
+            if (gps.encode(data[i])) {
+                snapshot(&gps, &f);
+                ref.push_back(f);
+            }
+        }
+        snapshot(&gps, &end);
+    }
+    CHECK(ref.size() == FIXTURE_GOOD);
+
+    for (int k = 0; k < NMEA_KERNEL_COUNT; k++) {
+        nmea_kernel_t kernel = (nmea_kernel_t)k;
+
+        if (!nmea_kernel_supported(kernel)) {
+            printf("%-8s not on this CPU\n", nmea_kernel_name(kernel));
+            continue;
+        }
+
+        for (size_t n = 0; n < sizeof(pieces) / sizeof(pieces[0]); n++) {
+            size_t piece = pieces[n] ? pieces[n] : data.size();
+            check_t c = { &ref, 0, 0 };
+            unsigned long valid = 0;
+            NmeaGPS gps(kernel);
+
+            for (size_t i = 0; i < data.size(); i += piece)
+                valid += gps.feed(&data[i], std::min(piece, data.size() - i), check, &c);
+            snapshot(&gps, &f);
+
+            if (c.mismatched || c.next != ref.size() || memcmp(&f, &end, sizeof(f))) {
+                fprintf(stderr, "%s, %zu byte pieces: %lu of %zu differ, %zu sentences\n",
+                    nmea_kernel_name(kernel), piece, c.mismatched, ref.size(), c.next);
+                print("want", &end);
+                print("got", &f);
+            }
+            CHECK(c.mismatched == 0);
+            CHECK(c.next == ref.size());
+            CHECK(valid == ref.size());
+            CHECK(memcmp(&f, &end, sizeof(f)) == 0);
+        }
+        printf("%-8s %zu sentences, %zu piece sizes\n", nmea_kernel_name(kernel),
+            ref.size(), sizeof(pieces) / sizeof(pieces[0]));
+    }
+
+    return check_status("nmea");
+}
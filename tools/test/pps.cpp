@@ -0,0 +1,201 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * 1PPS capture and epoch alignment in Ublox, against the simulated
+ * receiver's edges and NMEA timing. Every epoch Ublox places on the
+ * local clock must be exactly where the receiver had it, whatever its
+ * sentence took to arrive:
+ *
+ *   - at 1Hz, with the first sentence of each epoch anywhere from 20 to
+ *     120ms behind it
+ *   - at 10Hz with each epoch's sentences only in after the next one,
+ *     so the .9 epoch lands after the following second's edge
+ *   - with the PPS wire cut for a few seconds, no epoch may be placed
+ *     on a stale edge; lock comes back with the first edge after
+ *
+ * and prints how far timestamping from the sentence would have been off.
+ */
+
+#include <stdio.h>
+
+#include "pins.h"
+#include "ublox.h"
+#include "shim/gps_sim.h"
+#include "test/check.h"
+
+#define FIX_WAIT_US   (GPS_SIM_COLD_US + 2000000ull)
+#define RUN_S         60
+#define CUT_S         3
+#define FAST_BAUD     115200
+#define FAST_RATE_MS  100
+#define FAST_LATENCY  150000 // past the next 10Hz epoch
+
+static Ublox gps(GPS_TX, GPS_RX, GPS_EN, GPS_PPS);
+
+struct result_t {
+    uint32_t epochs;
+    uint32_t locked;
+    uint32_t misplaced;   // locked, but not where the receiver had it
+    uint32_t bad_dt;
+    uint32_t latency_min;
+    uint32_t latency_max;
+};
+
+static uint32_t offset;   // local us less the receiver's
+static unsigned long last_time;
+static uint32_t rand_state = 1;
+
+static void pin_changed(PinName pin, int value)
+{
+    if (pin == GPS_EN)
+        gps_sim_power(value);
+}
+
+// The receiver's time of the epoch Ublox last saw, on the local clock
+static uint32_t expected_us(unsigned long time)
+{
+    uint64_t tod = time / 1000000 * 3600 + time / 10000 % 100 * 60 + time / 100 % 100;
+    uint64_t sim_us = (tod - GPS_SIM_UTC_START % 86400) * 1000000 + time % 100 * 10000;
+
+    return (uint32_t)sim_us + offset;
+}
+
+static void run(uint64_t until_us, result_t *r, bool jitter)
+{
+    unsigned long date, time, age;
+    uint32_t expected;
+
+    while (gps_sim_clock_us() < until_us) {
+        shim_now_us = gps_sim_next_us();
+        gps_sim_poll();
+
+        gps.get_datetime(&date, &time, &age);
+        if (time == TinyGPS::GPS_INVALID_TIME || time == last_time)
+            continue;
+        last_time = time;
+        if (!r)
+            continue;
+
+        r->epochs++;
+        if (!gps.pps_locked())
+            goto next;
+
+        expected = expected_us(time);
+        r->locked++;
+        if (gps.epoch_us() != expected) {
+            fprintf(stderr, "epoch %08lu placed %+d us off\n", time, (int)(gps.epoch_us() - expected));
+            r->misplaced++;
+        }
+        if (r->locked > 1 && gps.epoch_dt_us() != gps_sim.config.rate_ms * 1000u)
+            r->bad_dt++;
+        if (!r->latency_min || gps.latency_us() < r->latency_min)
+            r->latency_min = gps.latency_us();
+        if (gps.latency_us() > r->latency_max)
+            r->latency_max = gps.latency_us();
+
+next:
+        if (jitter) {
+            rand_state = rand_state * 1103515245 + 12345;
+            gps_sim.latency_us = 20000 + (rand_state >> 8) % 100000;
+        }
+    }
+}
+
+static void report(const char *name, const result_t &r)
+{
+    printf("%-12s %4u epochs, %4u locked, %u misplaced; from the sentence %u to %u us late\n",
+        name, r.epochs, r.locked, r.misplaced, r.latency_min, r.latency_max);
+}
+
+int main(void)
+{
+    result_t slow = {}, fast = {}, cut = {}, back = {};
+    uint64_t t;
+
+    gps_sim_reset();
+    gps_sim.pps_pin = GPS_PPS;
+    shim_pin_changed = pin_changed;
+    offset = shim_now_us - (uint32_t)gps_sim_clock_us();
+
+    // No fix, no edges
+    gps.set_enabled(true);
+    run(GPS_SIM_COLD_US / 2, nullptr, false);
+    CHECK(!gps_sim.pps_edges);
+    CHECK(!gps.pps_locked());
+    run(FIX_WAIT_US, nullptr, false);
+    CHECK(gps_sim.pps_edges);
+    CHECK(gps.pps_locked());
+
+    t = gps_sim_clock_us();
+    run(t + RUN_S * 1000000ull, &slow, true);
+    CHECK(slow.epochs >= RUN_S - 1);
+    CHECK(slow.locked == slow.epochs);
+    CHECK(!slow.misplaced);
+    CHECK(!slow.bad_dt);
+    CHECK(slow.latency_max - slow.latency_min > 50000);
+    report("1Hz", slow);
+
+    // Ublox left to think it's still 1Hz: only the timing matters here
+    gps_sim.latency_us = FAST_LATENCY;
+    gps_sim.config.baud = FAST_BAUD;
+    gps_sim.config.rate_ms = FAST_RATE_MS;
+    for (int i = 0; i < GPS_SIM_NMEA_COUNT; i++)
+        gps_sim.config.div[i] = i == GPS_SIM_RMC || i == GPS_SIM_GGA;
+    t = gps_sim_clock_us();
+    run(t + 2000000, nullptr, false);
+    t = gps_sim_clock_us();
+    run(t + RUN_S * 1000000ull, &fast, false);
+    CHECK(fast.epochs >= RUN_S * 10 - 1);
+    CHECK(fast.locked == fast.epochs);
+    CHECK(!fast.misplaced);
+    CHECK(!fast.bad_dt);
+    CHECK(fast.latency_min > FAST_RATE_MS * 1000);
+    report("10Hz", fast);
+
+    // Edges missed: nothing placed on the last one
+    gps_sim.pps_cut = true;
+    t = gps_sim_clock_us();
+    run(t + CUT_S * 1000000ull, &cut, false);
+    CHECK(!cut.misplaced);
+    CHECK(!gps.pps_locked());
+    report("cut", cut);
+
+    gps_sim.pps_cut = false;
+    t = gps_sim_clock_us();
+    run(t + 1100000, nullptr, false);
+    CHECK(gps.pps_locked());
+    t = gps_sim_clock_us();
+    run(t + 10 * 1000000ull, &back, false);
+    CHECK(back.locked == back.epochs);
+    CHECK(!back.misplaced);
+    report("reconnected", back);
+
+    return check_status("pps");
+}
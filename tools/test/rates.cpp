@@ -0,0 +1,225 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * What the rate governor saves: bytes an hour from the receiver, and
+ * the UART ISR load they cost, by what the firmware is doing. The
+ * firmware itself runs against the simulated receiver (test/firmware.h)
+ * through a still and a moving stretch on the speed screen, moving on
+ * the SATS and HDOP screens, and still on the odometer. Each is timed
+ * once the governor has settled.
+ *
+ * The old fixed setup, 10Hz with GGA/5, GSA/10 and GSV/20, is run on
+ * the receiver alone for the same time to compare.
+ *
+ * ISR load is by the byte: UART_ISR_US for the interrupt and TinyGPS's
+ * encode(), an estimate for the KL25Z at 48MHz rather than a measure.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mkfs.h"
+#include "test/check.h"
+#include "test/firmware.h"
+
+#define IMAGE_MB        64
+#define S               1000000ull
+#define SETTLE_US       (20 * S)
+#define WINDOW_US       (120 * S) // still, the firmware sleeps after 5 minutes
+#define RUN_MAX_US      (3600 * S)
+#define UART_ISR_US     5.0
+#define HOUR_US         3600e6
+
+static char image[] = "/tmp/rates-XXXXXX";
+
+struct stretch_t {
+    const char *name;
+    double mph;
+    int mode;
+    uint64_t bytes;
+    uint32_t sentences[GPS_SIM_NMEA_COUNT];
+    uint16_t rate_ms;
+};
+
+static stretch_t stretches[] = {
+    {"still, speed",   0.0,  MODE_SHOW_SPEED},
+    {"moving, speed",  30.0, MODE_SHOW_SPEED},
+    {"moving, sats",   30.0, MODE_SHOW_SATS},
+    {"moving, hdop",   30.0, MODE_SHOW_HDOP},
+    {"still, odom",    0.0,  MODE_SHOW_ODOM_LO},
+};
+
+#define STRETCH_COUNT   (sizeof(stretches) / sizeof(stretches[0]))
+
+static stretch_t old_setup = {"old, any", 0.0, 0};
+
+static size_t current;
+static uint64_t started_us, key_us;
+static bool measuring;
+static uint64_t bytes_at;
+static uint32_t sentences_at[GPS_SIM_NMEA_COUNT];
+
+static void mark(void)
+{
+    bytes_at = gps_sim.bytes_out;
+    memcpy(sentences_at, gps_sim.sentences, sizeof(sentences_at));
+}
+
+static void take(stretch_t *stretch)
+{
+    stretch->bytes = gps_sim.bytes_out - bytes_at;
+    for (int i = 0; i < GPS_SIM_NMEA_COUNT; i++)
+        stretch->sentences[i] = gps_sim.sentences[i] - sentences_at[i];
+    stretch->rate_ms = gps_sim.config.rate_ms;
+}
+
+static bool step(void)
+{
+    stretch_t *stretch = &stretches[current];
+    uint64_t now = firmware_us();
+
+    if (now > RUN_MAX_US) {
+        CHECK(!"done in time");
+        return false;
+    }
+    if (waiting_for_gps_ready)
+        return true;
+
+    if (!started_us) {
+        started_us = now;
+        gps_sim.mph = stretch->mph;
+    }
+
+    // A key at a time to the stretch's screen, past the overlay
+    if (display_mode != stretch->mode && now - key_us > 1500000) {
+        firmware_key(display_mode < stretch->mode ? ADC_DOWN : ADC_UP, KEY_PRESS_MS);
+        key_us = now;
+        return true;
+    }
+
+    if (!measuring && now - started_us >= SETTLE_US) {
+        mark();
+        measuring = true;
+    }
+    if (measuring && now - started_us >= SETTLE_US + WINDOW_US) {
+        take(stretch);
+        measuring = false;
+        if (++current == STRETCH_COUNT)
+            return false;
+        started_us = now;
+        gps_sim.mph = stretches[current].mph;
+    }
+
+    return true;
+}
+
+static void report(const stretch_t *stretch)
+{
+    double bytes_h = stretch->bytes * HOUR_US / WINDOW_US;
+
+    printf("%-15s %6u %10.0f %7.2f%%  %4u %4u %4u %4u\n", stretch->name, stretch->rate_ms, bytes_h,
+        100.0 * stretch->bytes * UART_ISR_US / WINDOW_US,
+        stretch->sentences[GPS_SIM_RMC], stretch->sentences[GPS_SIM_GGA],
+        stretch->sentences[GPS_SIM_GSA], stretch->sentences[GPS_SIM_GSV]);
+}
+
+static int finish(void)
+{
+    const stretch_t *still = &stretches[0], *moving = &stretches[1];
+    const stretch_t *sats = &stretches[2], *hdop = &stretches[3];
+    const stretch_t *stopped = &stretches[4];
+    uint64_t end_us;
+
+    CHECK(current == STRETCH_COUNT);
+
+    // The old setup on the receiver alone, fixed and at 115200
+    gps_sim_power(false);
+    gps_sim_power(true);
+    gps_sim.config.baud = 115200;
+    gps_sim.config.rate_ms = 100;
+    memset(gps_sim.config.div, 0, sizeof(gps_sim.config.div));
+    gps_sim.config.div[GPS_SIM_RMC] = 1;
+    gps_sim.config.div[GPS_SIM_GGA] = 5;
+    gps_sim.config.div[GPS_SIM_GSA] = 10;
+    gps_sim.config.div[GPS_SIM_GSV] = 20;
+    gps_sim.mph = 30.0;
+    end_us = firmware_us() + GPS_SIM_COLD_US + S;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass)
+            mark();
+        while (firmware_us() < end_us) {
+            shim_now_us += 1000;
+            gps_sim_poll();
+        }
+        end_us += WINDOW_US;
+    }
+    take(&old_setup);
+
+    printf("%-15s %6s %10s %8s  %4s %4s %4s %4s\n", "", "ms", "bytes/h", "ISR", "RMC", "GGA", "GSA", "GSV");
+    for (size_t i = 0; i < STRETCH_COUNT; i++)
+        report(&stretches[i]);
+    report(&old_setup);
+
+    // 1Hz still, 10Hz moving, and back to 1Hz once stopped
+    CHECK(still->rate_ms == 1000);
+    CHECK(moving->rate_ms == 100);
+    CHECK(stopped->rate_ms == 1000);
+    CHECK(still->bytes * 5 < old_setup.bytes);
+    CHECK(moving->bytes < old_setup.bytes);
+
+    // GSV for the SATS screen and GSA for DOP, nothing else
+    for (size_t i = 0; i < STRETCH_COUNT; i++) {
+        CHECK((stretches[i].sentences[GPS_SIM_GSV] > 0) == (&stretches[i] == sats));
+        CHECK((stretches[i].sentences[GPS_SIM_GSA] > 0) == (&stretches[i] == hdop));
+        CHECK(stretches[i].sentences[GPS_SIM_VTG] == 0);
+        CHECK(stretches[i].sentences[GPS_SIM_GLL] == 0);
+    }
+
+    return check_failures;
+}
+
+int main(int argc, char **argv)
+{
+    int fd;
+
+    fd = mkstemp(image);
+    if (fd < 0) {
+        perror(image);
+        return 1;
+    }
+    close(fd);
+
+    CHECK(mkfs(image, IMAGE_MB));
+    CHECK(firmware_run(image, step, finish) == 0);
+
+    unlink(image);
+    return check_status("rates");
+}
@@ -0,0 +1,216 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+ * Retention on a card image with more under /YYYY/MM/ than the firmware
+ * put there. With room wanted for the whole card, everything of its own
+ * goes, oldest first, but the newest month, and nothing put there by
+ * hand is deleted along with a directory it was in:
+ *
+ *   - a month or year emptied of its files goes with them
+ *   - one still holding a subdirectory, or a file of someone else's in
+ *     a year, stays, and retention goes on past it
+ *
+ * Each run is forked off, sd-reader only has room for one filesystem.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <sd-reader/fat.h>
+#include <sd-reader/partition.h>
+#include <sd-reader/sd_raw.h>
+
+#include "fs.h"
+#include "mkfs.h"
+#include "shim/card.h"
+#include "test/check.h"
+
+#define IMAGE_MB    64
+#define PRUNE_STEPS 1000000 // counting the FAT takes most of them
+
+static char image[] = "/tmp/retain-XXXXXX";
+
+// Written first, then whether each should be there after
+static const struct {
+    const char *fn;
+    bool kept;
+} files[] = {
+    {"2020/README.TXT", true},            // a year that's someone else's
+    {"2021/01/0101-00.TRK", false},
+    {"2021/02/0201-00.TRK", false},
+    {"2022/11/1101-00.TRK", false},
+    {"2022/11/PHOTOS/P1.JPG", true},      // keeps the month
+    {"2022/12/KEEP/NOTE.TXT", true},      // only a directory in it
+    {"2023/NOTES.TXT", true},             // keeps the year, not its months
+    {"2023/01/0101-00.TRK", false},
+    {"2024/01/0101-00.TRK", false},
+    {"2024/05/0516-00.TRK", true},        // the newest month
+    {"2024/05/0517-00.TRK", true},
+};
+
+// And the directories
+static const struct {
+    const char *path;
+    bool kept;
+} dirs[] = {
+    {"/2020", true},
+    {"/2021", false},
+    {"/2022", true},
+    {"/2022/11", true},
+    {"/2022/11/PHOTOS", true},
+    {"/2022/12", true},
+    {"/2023", true},
+    {"/2023/01", false},
+    {"/2024", true},
+    {"/2024/01", false},
+    {"/2024/05", true},
+};
+
+extern "C" void get_datetime(uint16_t *year, uint8_t *month, uint8_t *day, uint8_t *hour, uint8_t *min, uint8_t *sec)
+{
+    *year = 2024;
+    *month = 5;
+    *day = 17;
+    *hour = 8;
+    *min = 0;
+    *sec = 0;
+}
+
+// fn's exit status, run in a child of its own
+static int run(int (*fn)(void))
+{
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        check_failures = 0;
+        status = fn();
+        fflush(stdout);
+        _exit(status);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
+}
+
+static int fill(void)
+{
+    FS fs;
+
+    if (!card_open(image) || !fs.init())
+        return 1;
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+        CHECK(fs.write_file(files[i].fn, files[i].fn, strlen(files[i].fn)));
+    card_close();
+    return check_failures;
+}
+
+static int prune(void)
+{
+    int steps = 0;
+    FS fs;
+
+    if (!card_open(image) || !fs.init())
+        return 1;
+
+    // More than the card holds: all it may delete, it does
+    fs.retain_free((offset_t)IMAGE_MB * 2 * 1024 * 1024);
+    while (fs.retain_idle() && steps < PRUNE_STEPS)
+        steps++;
+    CHECK(steps < PRUNE_STEPS);
+    CHECK(!fs.retaining());
+
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        char buf[64] = "";
+        size_t len = strlen(files[i].fn);
+        bool there = fs.read_file(files[i].fn, buf, len) && memcmp(buf, files[i].fn, len) == 0;
+
+        if (there != files[i].kept)
+            fprintf(stderr, "%s %s\n", files[i].fn, there ? "left behind" : "deleted");
+        CHECK(there == files[i].kept);
+    }
+
+    card_close();
+    return check_failures;
+}
+
+// Straight through sd-reader, FS would make what it looks for
+static int check_dirs(void)
+{
+    struct partition_struct *partition;
+    struct fat_fs_struct *fat;
+    struct fat_dir_entry_struct entry;
+    bool there;
+
+    if (!card_open(image))
+        return 1;
+    // As FS::open_volume(), whole disk if there's no MBR
+    partition = partition_open(sd_raw_read, sd_raw_read_interval, sd_raw_write, sd_raw_write_interval, 0);
+    if (!partition)
+        partition = partition_open(sd_raw_read, sd_raw_read_interval, sd_raw_write, sd_raw_write_interval, -1);
+    if (!partition)
+        return 1;
+    fat = fat_open(partition);
+    if (!fat)
+        return 1;
+
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        there = fat_get_dir_entry_of_path(fat, dirs[i].path, &entry) && (entry.attributes & FAT_ATTRIB_DIR);
+        if (there != dirs[i].kept)
+            fprintf(stderr, "%s %s\n", dirs[i].path, there ? "left behind" : "deleted");
+        CHECK(there == dirs[i].kept);
+    }
+
+    fat_close(fat);
+    partition_close(partition);
+    card_close();
+    return check_failures;
+}
+
+int main(void)
+{
+    int fd = mkstemp(image);
+
+    if (fd < 0 || !mkfs(image, IMAGE_MB))
+        return 1;
+    close(fd);
+
+    CHECK(run(fill) == 0);
+    CHECK(run(prune) == 0);
+    CHECK(run(check_dirs) == 0);
+
+    unlink(image);
+    return check_status("retain");
+}
@@ -0,0 +1,195 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * The scheduler on a virtual clock: time only moves while a task runs,
+ * by what it says it costs, or while sleep() waits for the Timeout the
+ * scheduler armed or for an interrupt the test stands in for.
+ *
+ *   - timed tasks run exactly at their deadlines, and the core sleeps
+ *     in between, waking only when something is due
+ *   - a task signalled from an interrupt runs on that wake-up
+ *   - deadlines across the 32-bit clock wrapping keep their order
+ *   - overdue, cancelled and one task too many
+ *
+ * and prints the run-time accounting, which should come to what the
+ * tasks cost.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "scheduler.h"
+#include "test/check.h"
+
+#define DISPLAY_US      100000  // DISPLAY_MAX_TIME_MS
+#define DISPLAY_COST_US 300
+#define SAVE_US         1000000
+#define SAVE_COST_US    5000
+#define KEY_EVERY_US    737000  // keypad events, from the Ticker
+#define RUN_US          10000000
+
+static Scheduler sched;
+static int task_display, task_save, task_key;
+
+static uint32_t display_runs, display_late_us, display_due;
+static uint32_t save_runs;
+static uint32_t key_runs, key_late_us, key_at;
+
+static void run_display(void)
+{
+    if (shim_now_us - display_due > display_late_us)
+        display_late_us = shim_now_us - display_due;
+    display_runs++;
+    shim_now_us += DISPLAY_COST_US;
+    display_due += DISPLAY_US;
+    sched.run_at(task_display, display_due);
+}
+
+static void run_save(void)
+{
+    save_runs++;
+    shim_now_us += SAVE_COST_US;
+    sched.run_in(task_save, SAVE_US);
+}
+
+static void run_key(void)
+{
+    if (shim_now_us - key_at > key_late_us)
+        key_late_us = shim_now_us - key_at;
+    key_runs++;
+}
+
+// The keypad Ticker pushing an event
+static void key_irq(void)
+{
+    key_at = shim_now_us;
+    sched.signal(task_key);
+    shim_wake_at += KEY_EVERY_US;
+}
+
+// The main loop, as main() runs it
+static void main_loop(uint32_t us)
+{
+    uint32_t start = shim_now_us;
+
+    while (shim_now_us - start < us) {
+        sched.run();
+        sched.sleep();
+    }
+}
+
+static void reset(uint32_t now)
+{
+    shim_now_us = now;
+    shim_slept_us = 0;
+    shim_sleeps = 0;
+    shim_wake = key_irq;
+    shim_wake_at = now + KEY_EVERY_US;
+    display_runs = display_late_us = 0;
+    save_runs = 0;
+    key_runs = key_late_us = 0;
+
+    display_due = now + DISPLAY_US;
+    sched.run_at(task_display, display_due);
+    sched.run_in(task_save, SAVE_US);
+}
+
+static void periodic(const char *name, uint32_t start)
+{
+    uint32_t displays = RUN_US / DISPLAY_US;
+    uint32_t saves = RUN_US / SAVE_US;
+    uint32_t keys = RUN_US / KEY_EVERY_US;
+    uint64_t busy_us = (uint64_t)displays * DISPLAY_COST_US + (uint64_t)saves * SAVE_COST_US;
+
+    reset(start);
+    main_loop(RUN_US);
+
+    printf("%-10s %8u %8u %8u %8u %10.2f %8u\n", name, display_runs, save_runs, key_runs,
+        shim_sleeps, 100.0 * shim_slept_us / RUN_US, display_late_us);
+
+    // A save and a display refresh falling due together make the later
+    // one late by the other's cost, nothing else may
+    CHECK(display_runs >= displays - 1 && display_runs <= displays);
+    CHECK(display_late_us <= SAVE_COST_US);
+    CHECK(save_runs >= saves - 1 && save_runs <= saves);
+    CHECK(key_runs == keys);
+    CHECK(key_late_us == 0);
+    // Woken for each deadline and key, never for nothing
+    CHECK(shim_sleeps <= displays + saves + keys + 1);
+    CHECK(shim_slept_us + busy_us >= RUN_US - SAVE_COST_US);
+}
+
+int main(int argc, char **argv)
+{
+    Stream out;
+    int spare;
+
+    task_display = sched.add(run_display, "display");
+    task_save = sched.add(run_save, "save");
+    task_key = sched.add(run_key, "key");
+
+    printf("%-10s %8s %8s %8s %8s %10s %8s\n", "clock", "display", "save", "keys", "wakes", "asleep %", "late us");
+    periodic("from 0", 0);
+    // The clock wraps 70 minutes in, a few seconds into this one
+    periodic("wrapping", 0u - 4000000);
+
+    // Both runs: display 300us and save 5000us each time, keys nothing
+    sched.print(out);
+
+    // Due in the past: run on the next pass without sleeping
+    sched.cancel(task_display);
+    sched.cancel(task_save);
+    shim_wake = nullptr;
+    key_runs = 0;
+    sched.run_at(task_key, shim_now_us - 1000);
+    shim_sleeps = 0;
+    sched.sleep();
+    CHECK(shim_sleeps == 0);
+    sched.run();
+    CHECK(key_runs == 1);
+
+    // Nothing due, nothing armed: sleep has nothing to wake for
+    sched.sleep();
+    CHECK(shim_sleeps == 0);
+
+    // Cancelled before it's due
+    sched.run_in(task_key, 1000);
+    sched.cancel(task_key);
+    shim_now_us += 2000;
+    sched.run();
+    CHECK(key_runs == 1);
+
+    spare = SCHED_TASKS_MAX - 3;
+    for (int i = 0; i < spare; i++)
+        CHECK(sched.add(run_key, "spare") >= 0);
+    CHECK(sched.add(run_key, "too many") == -1);
+
+    return check_status("sched");
+}
@@ -0,0 +1,137 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * spi_io and sd_raw against a simulated KL25Z SPI module and SD card,
+ * see shim/spi.cpp:
+ *
+ *   - blocks read and written through sd_raw must match the card, with
+ *     no bytes lost to an overrun, on a quiet bus and with interrupts
+ *     taking the CPU away at random, longer than a byte at a time
+ *   - interrupts stay masked for about a byte at most
+ *   - the simulator does catch two bytes in flight with interrupts on,
+ *     as SPI_Transfer() used to keep them
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sd-reader/sd_raw.h>
+
+#include "shim/spi_sim.h"
+#include "test/check.h"
+
+#define SEED       1
+#define BLOCKS     SPI_CARD_BLOCKS
+#define IRQ_RATE   50     // per thousand register accesses
+#define IRQ_MAX_NS 40000  // the longest handler, five bytes at 1MHz
+
+static void fill(uint8_t *data, size_t len, unsigned seed)
+{
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = seed >> 16;
+    }
+}
+
+static void round_trip(const char *name, int irq_permille)
+{
+    uint8_t data[512];
+    int bad_reads = 0;
+    int bad_writes = 0;
+
+    spi_sim_reset(irq_permille, IRQ_MAX_NS, SEED);
+    for (int i = 0; i < BLOCKS; i++)
+        fill(spi_sim_block(i), 512, i);
+
+    CHECK(sd_raw_init());
+    // Only the data phases at full speed, not the slow clock of init
+    spi_sim.masked_max_ns = 0;
+
+    // sd_raw caches a block, each one read in turn goes to the card
+    for (int i = 1; i < BLOCKS; i++) {
+        if (!sd_raw_read((offset_t)i * 512, data, sizeof(data)) || memcmp(data, spi_sim_block(i), 512))
+            bad_reads++;
+    }
+
+    for (int i = 0; i < BLOCKS; i++) {
+        fill(data, sizeof(data), i + BLOCKS);
+        if (!sd_raw_write((offset_t)i * 512, data, sizeof(data)) || memcmp(data, spi_sim_block(i), 512))
+            bad_writes++;
+    }
+
+    printf("%-12s %10llu %8u %10u %12.1f\n", name, (unsigned long long)spi_sim.bytes,
+        spi_sim.irqs, spi_sim.overruns, spi_sim.masked_max_ns / 1000.0);
+
+    CHECK(bad_reads == 0);
+    CHECK(bad_writes == 0);
+    CHECK(spi_sim.overruns == 0);
+    CHECK(spi_sim.ignored == 0);
+    CHECK(spi_sim.stuck == 0);
+    // Queueing a byte and reading the one before, plus a few accesses
+    CHECK(spi_sim.masked_max_ns < spi_sim_byte_ns() * 3 / 2);
+}
+
+// The old SPI_Transfer(): the next byte queued with interrupts on
+static void two_in_flight(void)
+{
+    SPI_Type *regs = spi_sim_regs();
+    unsigned len = 512;
+
+    spi_sim_reset(IRQ_RATE, IRQ_MAX_NS, SEED);
+
+    while (!(regs->S & SPI_S_SPTEF_MASK));
+    regs->D = 0xff;
+    while (--len) {
+        while (!(regs->S & SPI_S_SPTEF_MASK));
+        regs->D = 0xff;
+        while (!(regs->S & SPI_S_SPRF_MASK));
+        (void)(uint8_t)regs->D;
+    }
+    while (!(regs->S & SPI_S_SPRF_MASK));
+    (void)(uint8_t)regs->D;
+
+    printf("%-12s %10llu %8u %10u %12s\n", "unmasked", (unsigned long long)spi_sim.bytes,
+        spi_sim.irqs, spi_sim.overruns, "-");
+
+    CHECK(spi_sim.overruns > 0);
+    CHECK(spi_sim.stuck == spi_sim.overruns);
+}
+
+int main(int argc, char **argv)
+{
+    printf("%d blocks each way, interrupts up to %dus\n", BLOCKS, IRQ_MAX_NS / 1000);
+    printf("%-12s %10s %8s %10s %12s\n", "", "bytes", "irqs", "overruns", "masked us");
+    round_trip("quiet", 0);
+    round_trip("interrupted", IRQ_RATE);
+    two_in_flight();
+
+    return check_status("sd_spi");
+}
@@ -0,0 +1,227 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * segfmt() against a printf-based reference, for every width, point
+ * position and flag, over edge values and a few thousand random ones.
+ * Guard bytes either side of the buffer catch any write outside
+ * glyphs[0..width-1].
+ *
+ * Then times it against what show_odom() used to do (modf, pow and
+ * snprintf) for the same readings. That's host time, not the M0+'s,
+ * so only the ratio means much.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "segfmt.h"
+#include "test/check.h"
+
+#define GUARD   4
+#define CANARY  0xa5
+
+static const int32_t edges[] = {
+    0, 1, -1, 5, -5, 9, -9, 10, -10, 99, -99, 100, -100, 12345, -12345,
+    999999999, -999999999, 1000000000, -1000000000, INT32_MAX, INT32_MIN,
+};
+
+/* What segfmt() should show, worked out the slow way */
+static void reference(uint8_t *glyphs, int width, int32_t value, int decimals, unsigned flags)
+{
+    bool negative = value < 0;
+    uint32_t v = negative ? -(uint32_t)value : (uint32_t)value;
+    uint8_t pad = (flags & SEGFMT_ZERO_PAD) ? SEG_DIGITS[0] : SEG_BLANK;
+    char text[16];
+    int digits, start, first;
+
+    if (width > SEGFMT_MAX_WIDTH)
+        width = SEGFMT_MAX_WIDTH;
+    if (decimals < 0)
+        decimals = 0;
+
+    digits = negative ? width - 1 : width;
+    if (digits < 1) {
+        glyphs[0] = SEG_MINUS;
+        return;
+    }
+    if (v >= SEG_POW10[digits])
+        v = (flags & SEGFMT_WRAP) ? v % SEG_POW10[digits] : SEG_POW10[digits] - 1;
+
+    // All the digits, then blank the leading zeros that aren't needed
+    snprintf(text, sizeof(text), "%0*u", digits, (unsigned)v);
+    start = width - digits;
+    first = width - 1;
+    for (int i = 0; i < digits; i++) {
+        int k = digits - 1 - i;
+        if (text[i] != '0' || k <= decimals) {
+            first = start + i;
+            break;
+        }
+    }
+
+    for (int i = 0; i < width; i++)
+        glyphs[i] = i < first ? pad : SEG_DIGITS[text[i - start] - '0'];
+    if (negative)
+        glyphs[(flags & SEGFMT_ZERO_PAD) ? 0 : first - 1] = SEG_MINUS;
+    if (decimals > 0 && decimals < width)
+        glyphs[width - 1 - decimals] |= SEG_DOT;
+}
+
+static int compares;
+
+static void compare(int width, int32_t value, int decimals, unsigned flags)
+{
+    uint8_t got[GUARD + SEGFMT_MAX_WIDTH + GUARD];
+    uint8_t want[SEGFMT_MAX_WIDTH];
+    bool ok = true;
+
+    memset(got, CANARY, sizeof(got));
+    memset(want, CANARY, sizeof(want));
+    segfmt(&got[GUARD], width, value, decimals, flags);
+    reference(want, width, value, decimals, flags);
+    compares++;
+
+    for (int i = 0; i < GUARD; i++)
+        ok = ok && got[i] == CANARY;
+    for (int i = GUARD + width; i < (int)sizeof(got); i++)
+        ok = ok && got[i] == CANARY;
+    ok = ok && memcmp(&got[GUARD], want, width) == 0;
+    if (!ok) {
+        fprintf(stderr, "segfmt(%d, %ld, %d, %u):", width, (long)value, decimals, flags);
+        for (int i = 0; i < (int)sizeof(got); i++)
+            fprintf(stderr, " %02x", got[i]);
+        fprintf(stderr, "\n");
+    }
+    CHECK(ok);
+}
+
+static void test_reference(void)
+{
+    for (int width = 1; width <= SEGFMT_MAX_WIDTH; width++)
+        for (int decimals = -1; decimals <= width + 1; decimals++)
+            for (unsigned flags = 0; flags < 4; flags++) {
+                for (size_t e = 0; e < sizeof(edges) / sizeof(edges[0]); e++)
+                    compare(width, edges[e], decimals, flags);
+                for (int r = 0; r < 200; r++)
+                    compare(width, (int32_t)(rand() - RAND_MAX / 2) >> (rand() % 31), decimals, flags);
+            }
+}
+
+/* The cases that used to write in front of the buffer */
+static void test_sign_column(void)
+{
+    uint8_t g[GUARD + 2 + GUARD];
+
+    memset(g, CANARY, sizeof(g));
+    segfmt(&g[GUARD], 2, -5, 1);
+    CHECK(g[GUARD - 1] == CANARY);
+    CHECK(g[GUARD] == (SEG_MINUS | SEG_DOT));
+    CHECK(g[GUARD + 1] == SEG_DIGITS[5]);
+
+    memset(g, CANARY, sizeof(g));
+    segfmt(&g[GUARD], 2, -9, 5);
+    CHECK(g[GUARD - 1] == CANARY);
+    CHECK(g[GUARD] == SEG_MINUS);
+    CHECK(g[GUARD + 1] == SEG_DIGITS[9]);
+
+    memset(g, CANARY, sizeof(g));
+    segfmt(&g[GUARD], 1, -3);
+    CHECK(g[GUARD - 1] == CANARY);
+    CHECK(g[GUARD] == SEG_MINUS);
+    CHECK(g[GUARD + 1] == CANARY);
+}
+
+/* show_odom() before segfmt(), minus the display */
+static char old_buf[16];
+
+static void old_odom(double dist, int whole_w, int fract_w)
+{
+    double whole, fract;
+    int whole_mod, fract_mod;
+
+    fract = modf(dist, &whole);
+    whole_mod = (int)pow(10, whole_w);
+    fract_mod = (int)pow(10, fract_w);
+
+    if (whole_w > 0 && fract_w > 0)
+        snprintf(old_buf, sizeof(old_buf), "%*d.%*d", whole_w, (int)(whole) % whole_mod, fract_w, (int)(fract * fract_mod) % fract_mod);
+    else
+        snprintf(old_buf, sizeof(old_buf), "%*d", whole_w, (int)(whole) % whole_mod);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench(void)
+{
+    const int n = 1000000;
+    volatile double dist;
+    volatile uint8_t sink = 0;
+    uint8_t g[4];
+    double t0, t_old, t_new;
+
+    t0 = now_ns();
+    for (int i = 0; i < n; i++) {
+        dist = i * 0.37;
+        old_odom(dist, 3, 1);
+        sink += old_buf[0];
+    }
+    t_old = (now_ns() - t0) / n;
+
+    t0 = now_ns();
+    for (int i = 0; i < n; i++) {
+        dist = i * 0.37;
+        segfmt(g, 4, (int32_t)(dist * 10), 1, SEGFMT_WRAP);
+        sink += g[0];
+    }
+    t_new = (now_ns() - t0) / n;
+
+    printf("trip reading: snprintf %.1f ns, segfmt %.1f ns (%.1fx)\n",
+            t_old, t_new, t_old / t_new);
+    (void)sink;
+}
+
+int main(void)
+{
+    srand(1);
+    test_sign_column();
+    test_reference();
+    printf("%d comparisons\n", compares);
+    bench();
+    return check_status("segfmt");
+}
@@ -0,0 +1,247 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * shardsim on card images of its own, through the command line, and
+ * then what it left on the card read back through FS:
+ *
+ *   - sharded, every day's track log is there under /YYYY/MM/ with its
+ *     blocks and one index entry, each year's row is in the table and
+ *     lookups stay steady
+ *   - flat, the same days are there as YYMMDD00.TRK in the root, and the
+ *     run fails as lookups grow with the root directory
+ *   - with -r asking for more than the card holds, days are gone from the
+ *     lookups and only the newest month, being written, is left
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+
+#include "fs.h"
+#include "mkfs.h"
+#include "track.h"
+#include "shim/card.h"
+#include "test/check.h"
+
+#define IMAGE_MB   64
+#define YEARS      2
+#define BLOCKS     2
+#define DAYS       (YEARS * 365)
+#define SIM_START  1577836800 // as shardsim, 2020-01-01
+#define SIM_DRIVE  (8 * 3600) // and each day's first fix
+
+#define STR_(x) #x
+#define STR(x)  STR_(x)
+
+static char image[] = "/tmp/shardsim-XXXXXX";
+static bool flat;
+static bool retained;
+
+extern "C" void get_datetime(uint16_t *year, uint8_t *month, uint8_t *day, uint8_t *hour, uint8_t *min, uint8_t *sec)
+{
+    *year = 2024;
+    *month = 5;
+    *day = 17;
+    *hour = 8;
+    *min = 0;
+    *sec = 0;
+}
+
+// fn's exit status, run in a child of its own
+static int run(int (*fn)(void))
+{
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        check_failures = 0;
+        status = fn();
+        fflush(stdout);
+        _exit(status);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
+}
+
+// ./shardsim args on a blank image; its exit status and what it printed
+static int shardsim(const char *args, std::string *out)
+{
+    char cmd[1024], buf[4096];
+    size_t len;
+    FILE *f;
+    int status;
+
+    if (!mkfs(image, IMAGE_MB))
+        return -1;
+    snprintf(cmd, sizeof(cmd), "./shardsim -y %d -b %d %s %s 2>&1", YEARS, BLOCKS, args, image);
+    f = popen(cmd, "r");
+    if (!f)
+        return -1;
+    out->clear();
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+        out->append(buf, len);
+    status = pclose(f);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// The year table's rows in order, and their gone column summed
+static int year_rows(const std::string &out, int *gone)
+{
+    int rows = 0, year, days, lost;
+    double create, lookup, us;
+    size_t at = 0, end;
+
+    *gone = 0;
+    for (; (end = out.find('\n', at)) != std::string::npos; at = end + 1) {
+        if (sscanf(out.c_str() + at, "%d %d %lf %lf %lf %d", &year, &days, &create, &lookup, &us, &lost) != 6)
+            continue;
+        CHECK(year == rows + 1);
+        CHECK(days == 365);
+        *gone += lost;
+        rows++;
+    }
+    return rows;
+}
+
+static void day_tm(int day, struct tm *tm)
+{
+    time_t t = SIM_START + (time_t)day * 86400;
+
+    gmtime_r(&t, tm);
+}
+
+// As shardsim names them
+static void day_name(int day, const char *ext, char *fn, size_t size)
+{
+    struct tm tm;
+
+    day_tm(day, &tm);
+    if (flat)
+        snprintf(fn, size, "%02d%02d%02d00.%s", tm.tm_year % 100, tm.tm_mon + 1, tm.tm_mday, ext);
+    else
+        snprintf(fn, size, "%04d/%02d/%02d-00.%s", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, ext);
+}
+
+static void check_day(FS &fs, int day, bool kept)
+{
+    uint8_t buf[TRACK_BLOCK_SIZE], packed[TRACK_INDEX_LEN];
+    track_index_t entry;
+    uint32_t utc, last = 0;
+    char fn[32], idx_fn[32];
+
+    day_name(day, "trk", fn, sizeof(fn));
+    day_name(day, "idx", idx_fn, sizeof(idx_fn));
+
+    if (!kept) {
+        CHECK(!fs.read_file(fn, buf, 1));
+        CHECK(!fs.read_file(idx_fn, packed, 1));
+        return;
+    }
+
+    for (int b = 0; b < BLOCKS; b++) {
+        CHECK(fs.read_file(fn, buf, sizeof(buf), b * TRACK_BLOCK_SIZE));
+        CHECK(TrackBlock::first_utc(buf, &utc));
+        if (b == 0)
+            CHECK(utc == SIM_START + (uint32_t)day * 86400 + SIM_DRIVE);
+        else
+            CHECK(utc > last);
+        last = utc;
+    }
+    CHECK(!fs.read_file(fn, buf, 1, BLOCKS * TRACK_BLOCK_SIZE));
+
+    // BLOCKS is under TRACK_INDEX_EVERY, so just the first block's
+    CHECK(fs.read_file(idx_fn, packed, sizeof(packed)));
+    track_index_unpack(packed, &entry);
+    CHECK(entry.utc == SIM_START + (uint32_t)day * 86400 + SIM_DRIVE);
+    CHECK(entry.block == 0);
+    CHECK(!fs.read_file(idx_fn, packed, 1, sizeof(packed)));
+}
+
+static int read_card(void)
+{
+    struct tm tm, newest;
+    FS fs;
+
+    if (!card_open(image) || !fs.init())
+        return 1;
+
+    day_tm(DAYS - 1, &newest);
+    for (int day = 0; day < DAYS; day++) {
+        day_tm(day, &tm);
+        check_day(fs, day, !retained || (tm.tm_year == newest.tm_year && tm.tm_mon == newest.tm_mon));
+    }
+
+    card_close();
+    return check_failures;
+}
+
+int main(void)
+{
+    std::string out;
+    int fd = mkstemp(image);
+    int gone;
+
+    if (fd < 0)
+        return 1;
+    close(fd);
+
+    CHECK(shardsim("", &out) == 0);
+    CHECK(out.find("sharded, 2 blocks a day") != std::string::npos);
+    CHECK(year_rows(out, &gone) == YEARS);
+    CHECK(gone == 0);
+    CHECK(out.find("lookups steady") != std::string::npos);
+    CHECK(run(read_card) == 0);
+
+    flat = true;
+    CHECK(shardsim("-f", &out) == 1);
+    CHECK(out.find("flat, 2 blocks a day") != std::string::npos);
+    CHECK(year_rows(out, &gone) == YEARS);
+    CHECK(gone == 0);
+    CHECK(out.find("lookups grew") != std::string::npos);
+    CHECK(run(read_card) == 0);
+
+    flat = false;
+    retained = true;
+    CHECK(shardsim("-r " STR(IMAGE_MB), &out) == 0);
+    CHECK(year_rows(out, &gone) == YEARS);
+    CHECK(gone > 0);
+    CHECK(out.find("lookups steady") != std::string::npos);
+    CHECK(run(read_card) == 0);
+
+    unlink(image);
+    return check_status("shardsim");
+}
@@ -0,0 +1,339 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * TrackFilter, and ./simplify around it, on a drive with a bit of
+ * everything in it: straights, junctions, a roundabout, stops at
+ * lights, a U-turn and the signal lost for a while, at 10Hz with the
+ * wander a real fix has.
+ *
+ * At each tolerance every fix dropped lies within it of the line
+ * through the kept fixes either side, and within the speed step of the
+ * one before, and less than the gap after it; the first and last are
+ * kept, and far fewer than all of them, fewer still as it loosens.
+ * ./simplify reports the same and writes the same fixes out as blocks.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "track.h"
+#include "test/check.h"
+
+#define UTC_START      1715932800 // 2024-05-17 08:00
+#define START_LAT      45523064   // millionths of a degree
+#define START_LON      -122676483
+#define M_PER_UDEG     0.111195
+#define KNOTS_PER_MPS  1.943844
+#define DRIVE_S        900
+#define LOST_AT_S      600        // no fix for LOST_S from here
+#define LOST_S         45
+#define SLACK_M        0.01       // float against double
+#define KEPT_MAX       0.25       // of the fixes, at the default tolerance
+
+typedef std::vector<track_fix_t> drive_t;
+
+static const float tolerances[] = { 1.0f, TRACK_TOLERANCE_M, 20.0f };
+
+static char dir[] = "/tmp/simplify-XXXXXX";
+
+static uint32_t rand_state = 1;
+
+// -1 to 1
+static double noise(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return ((rand_state >> 8) & 0xFFFF) / 32767.5 - 1.0;
+}
+
+/*
+ * Town, every 100 s: lights at 30, a junction at 50, round a roundabout
+ * (a quarter turn over 8 s) at 70 and back the way it came at 90.
+ */
+static void drive(drive_t *fixes)
+{
+    double lat = START_LAT, lon = START_LON;
+    double heading = 90.0, mps = 0.0, target = 13.0, turn = 0.0;
+    double wander_n = 0.0, wander_e = 0.0, dt = 0.1;
+    uint32_t hdop = 95;
+    uint64_t cs;
+    track_fix_t fix;
+
+    for (cs = 0; cs < DRIVE_S * 100ull; cs += 10) {
+        uint32_t s = cs / 100, t = s % 100;
+        bool tick = cs % 100 == 0;
+
+        if (t == 30)
+            target = 0.0;
+        else if (t == 40)
+            target = 13.0;
+        if (tick && t == 50)
+            heading += noise() > 0 ? 90 : -90;
+        turn = t >= 70 && t < 78 ? 90.0 / 8 : 0.0;
+        if (t >= 90 && t < 96) {
+            target = 2.0;
+            turn = 180.0 / 6;
+        }
+        heading += turn * dt;
+
+        if (mps < target)
+            mps = fmin(mps + 2.0 * dt, target);
+        else
+            mps = fmax(mps - 3.0 * dt, target);
+
+        wander_n = 0.9 * wander_n + 0.05 * noise();
+        wander_e = 0.9 * wander_e + 0.05 * noise();
+        lat += (mps * dt * cos(heading * M_PI / 180) + wander_n * dt) / M_PER_UDEG;
+        lon += (mps * dt * sin(heading * M_PI / 180) + wander_e * dt) / (M_PER_UDEG * cos(lat / 1e6 * M_PI / 180));
+        heading = fmod(heading + 360.0, 360.0);
+
+        if (noise() > 0.98)
+            hdop += noise() > 0 ? 5 : -5;
+
+        if (s >= LOST_AT_S && s < LOST_AT_S + LOST_S)
+            continue;
+        fix.utc = UTC_START + s;
+        fix.cs = cs % 100;
+        fix.lat = lround(lat);
+        fix.lon = lround(lon);
+        fix.speed = mps > 0.1 ? lround((mps + 0.05 * noise()) * KNOTS_PER_MPS * 100) : 0;
+        fix.course = (uint16_t)lround(fmod(heading + 0.3 * noise() + 360.0, 360.0) * 100) % 36000;
+        fix.hdop = hdop;
+        fixes->push_back(fix);
+    }
+}
+
+static bool same(const track_fix_t &a, const track_fix_t &b)
+{
+    return a.utc == b.utc && a.cs == b.cs && a.lat == b.lat && a.lon == b.lon &&
+        a.speed == b.speed && a.course == b.course && a.hdop == b.hdop;
+}
+
+// Distance from p to the segment a-b, flat around a, as simplify.cpp
+static double deviation(const track_fix_t &a, const track_fix_t &b, const track_fix_t &p)
+{
+    double m_per_ulon = M_PER_UDEG * cos(a.lat * M_PI / 180e6);
+    double bx = (b.lon - a.lon) * m_per_ulon, by = (b.lat - a.lat) * M_PER_UDEG;
+    double px = (p.lon - a.lon) * m_per_ulon, py = (p.lat - a.lat) * M_PER_UDEG;
+    double len2 = bx * bx + by * by;
+    double t = len2 > 0 ? (px * bx + py * by) / len2 : 0;
+
+    if (t < 0)
+        t = 0;
+    else if (t > 1)
+        t = 1;
+    return hypot(px - t * bx, py - t * by);
+}
+
+// Which of fixes TrackFilter keeps, by index
+static std::vector<size_t> filter(const drive_t &fixes, float tolerance)
+{
+    TrackFilter f(tolerance);
+    std::vector<size_t> kept;
+    track_fix_t out[2];
+    size_t i, from = 0;
+    int count, j;
+
+    for (i = 0; i < fixes.size(); i++) {
+        count = f.add(fixes[i], out);
+        for (j = 0; j < count; j++) {
+            while (from <= i && !same(fixes[from], out[j]))
+                from++;
+            CHECK(from <= i);
+            kept.push_back(from++);
+        }
+    }
+    if (f.flush(&out[0])) {
+        CHECK(same(out[0], fixes.back()));
+        kept.push_back(fixes.size() - 1);
+    }
+
+    return kept;
+}
+
+// Returns the largest deviation of any fix dropped
+static double check_kept(const drive_t &fixes, const std::vector<size_t> &kept, float tolerance)
+{
+    double dev, max_dev = 0;
+    int speed_change;
+    size_t k, i;
+
+    CHECK(!kept.empty() && kept.front() == 0);
+    CHECK(!kept.empty() && kept.back() == fixes.size() - 1);
+
+    for (k = 0; k + 1 < kept.size(); k++) {
+        const track_fix_t &a = fixes[kept[k]], &b = fixes[kept[k + 1]];
+
+        CHECK(kept[k] < kept[k + 1]);
+        for (i = kept[k] + 1; i < kept[k + 1]; i++) {
+            dev = deviation(a, b, fixes[i]);
+            if (dev > max_dev)
+                max_dev = dev;
+            speed_change = fixes[i].speed - a.speed;
+            CHECK(abs(speed_change) <= TRACK_SPEED_STEP);
+            CHECK(fixes[i].utc - a.utc < TRACK_MAX_GAP_S);
+        }
+    }
+    if (max_dev > tolerance + SLACK_M)
+        fprintf(stderr, "%.1f m: a dropped fix is %.3f m off\n", tolerance, max_dev);
+    CHECK(max_dev <= tolerance + SLACK_M);
+
+    return max_dev;
+}
+
+static void check_filter(const drive_t &fixes)
+{
+    std::vector<size_t> kept;
+    size_t last = fixes.size();
+    double max_dev;
+
+    for (size_t t = 0; t < sizeof(tolerances) / sizeof(tolerances[0]); t++) {
+        kept = filter(fixes, tolerances[t]);
+        max_dev = check_kept(fixes, kept, tolerances[t]);
+
+        // Fewer still as it loosens
+        CHECK(kept.size() < last);
+        if (tolerances[t] == TRACK_TOLERANCE_M)
+            CHECK(kept.size() <= fixes.size() * KEPT_MAX);
+        last = kept.size();
+
+        printf("%5.1f m  kept %5lu of %lu fixes (%4.1f%%), max %.2f m off\n", tolerances[t],
+            (unsigned long)kept.size(), (unsigned long)fixes.size(),
+            100.0 * kept.size() / fixes.size(), max_dev);
+    }
+}
+
+static std::string path(const char *fn)
+{
+    return std::string(dir) + "/" + fn;
+}
+
+// Blocks as the firmware fills them
+static bool write_track(const char *fn, const drive_t &fixes)
+{
+    FILE *f = fopen(path(fn).c_str(), "wb");
+    TrackBlock block;
+    bool ok = f != NULL;
+
+    for (size_t i = 0; ok && i < fixes.size(); i++) {
+        if (block.add(fixes[i]))
+            continue;
+        ok = fwrite(block.seal(), TRACK_BLOCK_SIZE, 1, f) == 1;
+        block.reset();
+        block.add(fixes[i]);
+    }
+    if (ok && !block.empty())
+        ok = fwrite(block.seal(), TRACK_BLOCK_SIZE, 1, f) == 1;
+    if (f && fclose(f))
+        ok = false;
+    return ok;
+}
+
+static drive_t read_track(const char *fn)
+{
+    uint8_t block[TRACK_BLOCK_SIZE];
+    track_fix_t decoded[TRACK_BLOCK_SIZE];
+    drive_t fixes;
+    FILE *f = fopen(path(fn).c_str(), "rb");
+    int count;
+
+    if (!f)
+        return fixes;
+    while (fread(block, sizeof(block), 1, f) == 1) {
+        count = TrackBlock::decode(block, decoded, TRACK_BLOCK_SIZE);
+        CHECK(count > 0);
+        if (count > 0)
+            fixes.insert(fixes.end(), decoded, decoded + count);
+    }
+    fclose(f);
+    return fixes;
+}
+
+// ./simplify at the defaults, against TrackFilter run here
+static void check_tool(const drive_t &fixes)
+{
+    std::vector<size_t> kept = filter(fixes, TRACK_TOLERANCE_M);
+    unsigned long kept_n = 0, total = 0;
+    double max_dev = -1, mean_dev = -1;
+    char cmd[1024], line[256];
+    drive_t out;
+    FILE *f;
+    int lines = 0;
+
+    CHECK(write_track("track.bin", fixes));
+    snprintf(cmd, sizeof(cmd), "./simplify -o %s %s", path("out.bin").c_str(), path("track.bin").c_str());
+    f = popen(cmd, "r");
+    CHECK(f != NULL);
+    if (!f)
+        return;
+    while (fgets(line, sizeof(line), f)) {
+        const char *p = strstr(line, "kept ");
+
+        if (p && sscanf(p, "kept %lu of %lu", &kept_n, &total) == 2)
+            lines++;
+        if (sscanf(line, "deviation: max %lf m, mean %lf m", &max_dev, &mean_dev) == 2)
+            lines++;
+        printf("simplify %s", line);
+    }
+    CHECK(pclose(f) == 0);
+    CHECK(lines == 2);
+
+    CHECK(total == fixes.size());
+    CHECK(kept_n == kept.size());
+    CHECK(max_dev >= 0 && max_dev <= TRACK_TOLERANCE_M + SLACK_M);
+    CHECK(mean_dev >= 0 && mean_dev <= max_dev);
+
+    out = read_track("out.bin");
+    CHECK(out.size() == kept.size());
+    for (size_t k = 0; k < out.size() && k < kept.size(); k++)
+        CHECK(same(out[k], fixes[kept[k]]));
+}
+
+int main(void)
+{
+    drive_t fixes;
+    char cmd[1024];
+
+    if (!mkdtemp(dir))
+        return 1;
+
+    drive(&fixes);
+    check_filter(fixes);
+    check_tool(fixes);
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    CHECK(system(cmd) == 0);
+    return check_status("simplify");
+}
@@ -0,0 +1,308 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Mounting in the background, through Storage and the firmware's own FS
+ * on a card image whose card takes its time getting ready:
+ *
+ *   - each poll() asks the card once and returns, no block moves until
+ *     it is ready
+ *   - odom.bin can be loaded from the mount callback before a write
+ *     queued meanwhile replaces it, as odom_mounted() does
+ *   - a card that never gets ready completes the mount and every job
+ *     queued meanwhile as failed, and Storage carries on RAM only
+ *   - on the firmware itself (test/firmware.h), a trip reset with a long
+ *     LEFT while the card is still getting ready: odom.bin keeps the
+ *     odometer it had and the trip stays reset. Reset again once mounted,
+ *     before any GPS time, the odom.log line is marked unsynced.
+ *
+ * Each run is forked off, sd-reader only has room for one filesystem.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "storage.h"
+#include "mkfs.h"
+#include "shim/card.h"
+#include "test/check.h"
+#include "test/firmware.h"
+
+#define IMAGE_MB        64
+#define SLOW_POLLS      1000   // a second at the busy poll rate
+#define RESET_POLLS     15000  // long enough for a save to be due first
+#define RESET_AT_US     (11 * 1000000ull) // past MIN_TIME_BETWEEN_SAVE_S
+#define RUN_MAX_US      (60 * 1000000ull)
+#define SETTLE_MS       1000
+
+static char image[] = "/tmp/slow_card-XXXXXX";
+
+// fn's exit status, run in a child of its own
+static int run(int (*fn)(long), long arg)
+{
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        check_failures = 0;
+        status = fn(arg);
+        fflush(stdout);
+        _exit(status);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
+}
+
+static const uint32_t odom_old[3] = {1000, 20, 30};
+static uint32_t odom_new[3] = {1005, 25, 35};
+static uint32_t odom_loaded[3];
+static int mounts, mount_result = -1;
+static int jobs_done, jobs_failed;
+
+static void on_mount(int result)
+{
+    mounts++;
+    mount_result = result;
+    if (result && !fs.read_file("odom.bin", odom_loaded, sizeof(odom_loaded)))
+        CHECK(!"odom.bin read");
+}
+
+static void on_job(int result)
+{
+    if (result)
+        jobs_done++;
+    else
+        jobs_failed++;
+}
+
+// A card as left by the last drive
+static int last_drive(long)
+{
+    if (!card_open(image) || !fs.init())
+        return 1;
+    CHECK(fs.write_file("odom.bin", odom_old, sizeof(odom_old)));
+    card_close();
+    return check_failures;
+}
+
+static int slow(long)
+{
+    int polls = 0;
+
+    if (!card_open(image))
+        return 1;
+    card_init_polls = SLOW_POLLS;
+
+    // Jobs queued before the card is up
+    storage.mount(on_mount);
+    CHECK(storage.write_file("odom.bin", odom_new, sizeof(odom_new), on_job));
+    CHECK(storage.append_file("boot.txt", "boot\n", 5, on_job));
+
+    while (mount_result < 0) {
+        storage.poll();
+        polls++;
+        // The first resets the card, each one after asks it once
+        CHECK(card_stats.init_polls == (uint64_t)polls - 1);
+        if (mount_result < 0)
+            CHECK(card_stats.blocks_read + card_stats.blocks_written == 0);
+    }
+    printf("%-10s %6d polls to mount, %llu blocks read to open the volume\n", "slow", polls,
+        (unsigned long long)card_stats.blocks_read);
+
+    CHECK(mounts == 1 && mount_result == 1);
+    CHECK(polls == SLOW_POLLS + 2);
+    CHECK(memcmp(odom_loaded, odom_old, sizeof(odom_old)) == 0);
+    CHECK(storage.room() == STORAGE_QUEUE_LEN - 2);
+
+    storage.flush();
+    CHECK(jobs_done == 2 && jobs_failed == 0);
+    CHECK(fs.read_file("odom.bin", odom_loaded, sizeof(odom_loaded)));
+    CHECK(memcmp(odom_loaded, odom_new, sizeof(odom_new)) == 0);
+    CHECK(!storage.ram_only());
+
+    card_close();
+    return check_failures;
+}
+
+static int never_ready(long)
+{
+    int polls = 0;
+
+    if (!card_open(image))
+        return 1;
+    card_init_polls = SLOW_POLLS;
+    card_init_fails = true;
+
+    storage.mount(on_mount);
+    CHECK(storage.write_file("odom.bin", odom_new, sizeof(odom_new), on_job));
+    CHECK(storage.append_file("boot.txt", "boot\n", 5, on_job));
+
+    while (mount_result < 0) {
+        storage.poll();
+        polls++;
+    }
+    printf("%-10s %6d polls to give up\n", "never", polls);
+
+    CHECK(mounts == 1 && mount_result == 0);
+    CHECK(jobs_done == 0 && jobs_failed == 2);
+    CHECK(storage.idle());
+    CHECK(storage.ram_only());
+    CHECK(!storage.write_file("odom.bin", odom_new, sizeof(odom_new), on_job));
+    CHECK(card_stats.blocks_written == 0);
+
+    // Polls from the main loop carry on harmlessly
+    for (int i = 0; i < 10; i++)
+        storage.poll();
+    CHECK(mounts == 1);
+
+    card_close();
+    return check_failures;
+}
+
+// odom.bin as the firmware left it, engine and the two trips
+static const double odom_card[ODOM_COUNT] = {1234.5, 20.25, 30.5};
+static int reset_state;
+static bool reset_early;
+static bool reset_unsynced;
+static uint64_t unsynced_at_us;
+
+static int odom_drive(long)
+{
+    if (!card_open(image) || !fs.init())
+        return 1;
+    CHECK(fs.write_file("odom.bin", odom_card, sizeof(odom_card)));
+    card_close();
+    return check_failures;
+}
+
+// Trip B up on the screen, then reset with a save due, before the mount,
+// and again after it
+static bool reset_step(void)
+{
+    if (firmware_us() > RUN_MAX_US) {
+        CHECK(!"mounted in time");
+        return false;
+    }
+    if (booting)
+        return true;
+
+    switch (reset_state) {
+        case 0:
+            firmware_key(ADC_UP, KEY_PRESS_MS);
+            reset_state++;
+            break;
+        case 1:
+            if (display_mode == MODE_SHOW_TRIP_B && firmware_us() >= RESET_AT_US) {
+                firmware_key(ADC_LEFT, KEY_LONG_MS);
+                reset_state++;
+            }
+            break;
+        case 2:
+            if (odom.get_odom(ODOM_TRIP_B) == 0.0) {
+                reset_early = !storage.mounted();
+                reset_state++;
+            }
+            break;
+        case 3:
+            // Again once mounted, still without a fix: odom.log too
+            if (storage.mounted() && storage.idle()) {
+                firmware_key(ADC_LEFT, KEY_LONG_MS);
+                unsynced_at_us = firmware_us() + (KEY_LONG_MS + SETTLE_MS) * 1000;
+                reset_state++;
+            }
+            break;
+        default:
+            if (firmware_us() < unsynced_at_us || !storage.idle())
+                return true;
+            reset_unsynced = !gpsclock.valid() && waiting_for_gps_ready;
+            return false;
+    }
+    return true;
+}
+
+static int reset_finish(void)
+{
+    double saved[ODOM_COUNT];
+    char line[32] = "";
+
+    CHECK(reset_early);
+    // Through meters and back, by float constants
+    CHECK(fabs(odom.get_odom(ODOM_ENGINE) - odom_card[ODOM_ENGINE]) < 0.01);
+    CHECK(fabs(odom.get_odom(ODOM_TRIP_A) - odom_card[ODOM_TRIP_A]) < 0.01);
+    CHECK(odom.get_odom(ODOM_TRIP_B) == 0.0);
+
+    CHECK(fs.read_file("odom.bin", saved, sizeof(saved)));
+    printf("%-10s %6.2f %6.2f %6.2f in odom.bin after a trip reset before the mount\n", "reset",
+        saved[ODOM_ENGINE], saved[ODOM_TRIP_A], saved[ODOM_TRIP_B]);
+    // Saved again by the second reset, through meters too
+    CHECK(fabs(saved[ODOM_ENGINE] - odom_card[ODOM_ENGINE]) < 0.01);
+    CHECK(fabs(saved[ODOM_TRIP_A] - odom_card[ODOM_TRIP_A]) < 0.01);
+    CHECK(saved[ODOM_TRIP_B] == 0.0);
+
+    // No GPS time yet, so no stamp. The log's size is only in its
+    // directory entry after a checkpoint.
+    CHECK(reset_unsynced);
+    CHECK(fs.log_checkpoint());
+    CHECK(fs.read_file("odom.log", line, sizeof(line) - 1));
+    printf("%-10s %.*s in odom.log, saved before GPS time\n", "unsynced", (int)strcspn(line, "\n"), line);
+    CHECK(!strncmp(line, "unsynced, 1234.", 15));
+
+    return check_failures;
+}
+
+int main(int argc, char **argv)
+{
+    int fd;
+
+    fd = mkstemp(image);
+    if (fd < 0) {
+        perror(image);
+        return 1;
+    }
+    close(fd);
+
+    CHECK(mkfs(image, IMAGE_MB, 512));
+    CHECK(run(last_drive, 0) == 0);
+    CHECK(run(slow, 0) == 0);
+    CHECK(run(never_ready, 0) == 0);
+
+    CHECK(run(odom_drive, 0) == 0);
+    card_init_polls = RESET_POLLS;
+    CHECK(firmware_run(image, reset_step, reset_finish) == 0);
+
+    unlink(image);
+    return check_status("slow_card");
+}
@@ -0,0 +1,185 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * How long the firmware's main loop goes without getting back to sleep,
+ * which is as long as a key or a sentence can wait on it. A drive on
+ * the firmware itself (test/firmware.h): boot and a cold fix, 30mph with
+ * the screens paged through, a trip reset, a stop and an odom save, a
+ * long RIGHT to sleep, asleep for a while, woken and fixed again.
+ *
+ * No pass may take longer than STALL_MAX_US, booting or running: the
+ * self-test, the receiver's boot time and its config are scheduler
+ * steps like everything else.
+ *
+ * The longest pass is a Storage step: the first track of a month makes
+ * its directories, each one step of about ten card blocks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mkfs.h"
+#include "test/check.h"
+#include "test/firmware.h"
+
+#define IMAGE_MB        64
+#define STALL_MAX_US    50000
+#define S               1000000ull
+
+static char image[] = "/tmp/stall-XXXXXX";
+
+enum phase_t {
+    PHASE_BOOT,
+    PHASE_RUN,
+    PHASE_SLEEP,
+    PHASE_WAKE,
+    PHASE_COUNT,
+};
+
+static const char *phase_names[PHASE_COUNT] = {"boot", "running", "asleep", "wake"};
+
+// What's done, and when from the first fix
+struct action_t {
+    uint64_t at_us;
+    uint16_t key;
+    uint32_t key_ms;
+    double mph;
+};
+
+static const action_t actions[] = {
+    {1 * S,   0,         0,            30.0},
+    {10 * S,  ADC_DOWN,  KEY_PRESS_MS, 30.0},
+    {12 * S,  ADC_DOWN,  KEY_PRESS_MS, 30.0},
+    {14 * S,  ADC_DOWN,  KEY_PRESS_MS, 30.0},
+    {16 * S,  ADC_DOWN,  KEY_PRESS_MS, 30.0},
+    {16200000, ADC_DOWN, KEY_PRESS_MS, 30.0}, // overlays back to back
+    {20 * S,  ADC_UP,    KEY_PRESS_MS, 30.0},
+    {22 * S,  ADC_LEFT,  KEY_LONG_MS,  30.0}, // trip reset and save
+    {60 * S,  0,         0,            0.0},
+    {80 * S,  ADC_UP,    KEY_PRESS_MS, 0.0},
+    {82 * S,  ADC_UP,    KEY_PRESS_MS, 0.0},
+    {84 * S,  ADC_UP,    KEY_PRESS_MS, 0.0},
+    {90 * S,  ADC_RIGHT, KEY_LONG_MS,  0.0},
+    {150 * S, ADC_RIGHT, KEY_PRESS_MS, 0.0},
+};
+
+#define ACTION_COUNT    (sizeof(actions) / sizeof(actions[0]))
+#define AFTER_WAKE_US   (20 * S)
+#define RUN_MAX_US      (400 * S)
+
+static uint32_t stall_us[PHASE_COUNT];
+static phase_t phase = PHASE_BOOT;
+static uint64_t fixed_us, woke_us;
+static size_t next_action;
+
+static bool step(void)
+{
+    const action_t *action;
+
+    if (firmware_us() > RUN_MAX_US) {
+        CHECK(!"done in time");
+        return false;
+    }
+
+    // Where the pass that just ended left it
+    switch (phase) {
+        case PHASE_BOOT:
+            if (!waiting_for_gps_ready) {
+                fixed_us = firmware_us();
+                phase = PHASE_RUN;
+            }
+            break;
+        case PHASE_RUN:
+            if (sleeping && !entering_sleep)
+                phase = PHASE_SLEEP;
+            break;
+        case PHASE_SLEEP:
+            // Woken by a key, and through init_gps already
+            if (!sleeping)
+                phase = PHASE_WAKE;
+            break;
+        case PHASE_WAKE:
+            woke_us = firmware_us();
+            phase = PHASE_RUN;
+            break;
+        default:
+            break;
+    }
+
+    if (shim_awake_max_us > stall_us[phase])
+        stall_us[phase] = shim_awake_max_us;
+    shim_awake_max_us = 0;
+
+    if (woke_us && firmware_us() - woke_us > AFTER_WAKE_US)
+        return false;
+
+    if (phase != PHASE_BOOT && next_action < ACTION_COUNT && firmware_us() - fixed_us >= actions[next_action].at_us) {
+        action = &actions[next_action++];
+        gps_sim.mph = action->mph;
+        if (action->key)
+            firmware_key(action->key, action->key_ms);
+    }
+    if (phase != PHASE_BOOT && next_action < ACTION_COUNT)
+        firmware_step_at(fixed_us + actions[next_action].at_us);
+
+    return true;
+}
+
+static int finish(void)
+{
+    for (int i = 0; i < PHASE_COUNT; i++)
+        printf("%-8s longest pass %6u us\n", phase_names[i], stall_us[i]);
+
+    CHECK(next_action == ACTION_COUNT);
+    CHECK(woke_us != 0);
+    for (int i = 0; i < PHASE_COUNT; i++)
+        CHECK(stall_us[i] <= STALL_MAX_US);
+
+    return check_failures;
+}
+
+int main(int argc, char **argv)
+{
+    int fd;
+
+    fd = mkstemp(image);
+    if (fd < 0) {
+        perror(image);
+        return 1;
+    }
+    close(fd);
+
+    CHECK(mkfs(image, IMAGE_MB));
+    CHECK(firmware_run(image, step, finish) == 0);
+
+    unlink(image);
+    return check_status("stall");
+}
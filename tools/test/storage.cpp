@@ -0,0 +1,346 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Storage on a card image, through the firmware's own FS and sd-reader:
+ *
+ *   - the main loop's producers at once, track blocks with their index,
+ *     capture chunks, odom.log and odom.bin, with the card blocks each
+ *     poll() moves against running each job whole; everything must then
+ *     read back as written
+ *   - jobs queued for a card that won't mount are completed as failed
+ *   - a full queue refuses more without taking the card for failed
+ *
+ * Each run is forked off, sd-reader only has room for one filesystem.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+
+#include "storage.h"
+#include "mkfs.h"
+#include "shim/card.h"
+#include "test/check.h"
+
+#define IMAGE_MB    64   // 512 byte clusters, so appends allocate often
+#define TICKS       3000 // simulated seconds
+#define DAY_TICKS   1000 // a new day, directory and track file this often
+#define POLLS       16   // storage polls per tick
+#define ODOM_TICKS  10
+#define CAP_TICKS   7
+
+// A step that adds a cluster moves up to this many blocks, only making
+// a directory, which clears a whole cluster, may take more
+#define STALL_BLOCKS 5
+#define DIRS_MADE    2   // 2024/ and 2024/05/
+
+static char image[] = "/tmp/storage-XXXXXX";
+
+extern "C" void get_datetime(uint16_t *year, uint8_t *month, uint8_t *day, uint8_t *hour, uint8_t *min, uint8_t *sec)
+{
+    *year = 2024;
+    *month = 5;
+    *day = 17;
+    *hour = 8;
+    *min = 0;
+    *sec = 0;
+}
+
+// fn's exit status, run in a child of its own
+static int run(int (*fn)(long), long arg)
+{
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        check_failures = 0;
+        status = fn(arg);
+        fflush(stdout);
+        _exit(status);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
+}
+
+static uint64_t card_blocks(void)
+{
+    return card_stats.blocks_read + card_stats.blocks_written;
+}
+
+static FS fs;
+static Storage storage(fs);
+
+static uint8_t track_block[STORAGE_BLOCK_SIZE];
+static uint8_t cap_block[STORAGE_BLOCK_SIZE];
+static char track_fn[32];
+static char idx_fn[32];
+static bool track_busy, cap_busy;
+static int failures;
+
+static void fill(uint8_t *block, uint32_t seq)
+{
+    for (size_t i = 0; i < STORAGE_BLOCK_SIZE; i += 4)
+        memcpy(&block[i], &seq, 4);
+    block[4] = (uint8_t)(seq >> 24 ^ 0xa5);
+}
+
+static void track_written(int result)
+{
+    uint32_t entry[2] = {storage.appended_at(), 0};
+
+    track_busy = false;
+    if (!result)
+        failures++;
+    memcpy(&entry[1], track_block, 4);
+    if (!storage.append_file(idx_fn, entry, sizeof(entry)))
+        failures++;
+}
+
+static void cap_written(int result)
+{
+    cap_busy = false;
+    if (!result)
+        failures++;
+}
+
+static void saved(int result)
+{
+    if (!result)
+        failures++;
+}
+
+static std::string log_line(int tick)
+{
+    char line[80];
+
+    snprintf(line, sizeof(line), "2024-05-17 %02d:%02d:%02d, %d.%06d, 0.000000, 0.000000\n",
+        8 + tick / 3600, tick / 60 % 60, tick % 60, 1000 + tick, tick * 37 % 1000000);
+    return line;
+}
+
+/*
+ * The producers run for TICKS, polling storage between them. With whole,
+ * each poll runs its job to the end as it used to.
+ */
+static int producers(long whole)
+{
+    uint64_t before, blocks, most = 0, stalls = 0, polls = 0;
+    uint32_t track_seq = 0, cap_seq = 0, odom[6] = {0};
+    std::string log, line;
+    int tick, i, day = 0;
+    uint8_t buf[STORAGE_BLOCK_SIZE];
+    uint32_t entry[2], at;
+
+    if (!card_open(image))
+        return 1;
+    storage.mount();
+    while (!storage.mounted() && !storage.ram_only())
+        storage.poll();
+    CHECK(storage.mounted());
+    CHECK(fs.open_log("odom.log"));
+
+    for (tick = 0; tick < TICKS; tick++) {
+        if (tick % DAY_TICKS == 0) {
+            // Names are kept until their jobs are done, as in track_flush()
+            while (!storage.idle())
+                storage.poll();
+            snprintf(track_fn, sizeof(track_fn), "2024/05/%02d-00.trk", 17 + tick / DAY_TICKS);
+            snprintf(idx_fn, sizeof(idx_fn), "2024/05/%02d-00.idx", 17 + tick / DAY_TICKS);
+            day = tick / DAY_TICKS;
+        }
+        if (!track_busy) {
+            fill(track_block, track_seq++);
+            track_busy = storage.append_block(track_fn, track_block, track_written);
+            CHECK(track_busy);
+        }
+        if (tick % CAP_TICKS == 0 && !cap_busy) {
+            fill(cap_block, cap_seq++ | 0x80000000);
+            cap_busy = storage.append_block("capture.bin", cap_block, cap_written);
+            CHECK(cap_busy);
+        }
+        if (tick % ODOM_TICKS == 0) {
+            // As save_odom(): both or neither
+            if (storage.room() >= 2) {
+                line = log_line(tick);
+                log += line;
+                odom[0] = tick;
+                CHECK(storage.append_log(line.data(), line.size(), saved));
+                CHECK(storage.write_file("odom.bin", odom, sizeof(odom), saved));
+            }
+        }
+
+        for (i = 0; i < POLLS; i++) {
+            before = card_blocks();
+            if (whole) {
+                do
+                    storage.poll();
+                while (fs.stepping());
+            } else {
+                storage.poll();
+            }
+            blocks = card_blocks() - before;
+            polls++;
+            if (blocks > most)
+                most = blocks;
+            if (blocks > STALL_BLOCKS)
+                stalls++;
+        }
+    }
+    CHECK(storage.checkpoint(saved));
+    storage.flush();
+    CHECK(failures == 0);
+    CHECK(whole || stalls <= DIRS_MADE);
+
+    printf("%-22s %10llu %10llu %14llu\n", whole ? "whole job per poll" : "one step per poll",
+        (unsigned long long)polls, (unsigned long long)most, (unsigned long long)stalls);
+
+    // Everything reads back: the last odom.bin, the whole log, and each
+    // day's blocks where their index says
+    CHECK(fs.read_file("odom.bin", buf, sizeof(odom)) && memcmp(buf, odom, sizeof(odom)) == 0);
+    {
+        std::string got(log.size(), '\0');
+        CHECK(fs.read_file("odom.log", &got[0], got.size()) && got == log);
+        CHECK(!fs.read_file("odom.log", buf, 1, log.size()));
+    }
+    track_seq = 0;
+    for (i = 0; i <= day; i++) {
+        snprintf(track_fn, sizeof(track_fn), "2024/05/%02d-00.trk", 17 + i);
+        snprintf(idx_fn, sizeof(idx_fn), "2024/05/%02d-00.idx", 17 + i);
+        for (at = 0; fs.read_file(idx_fn, entry, sizeof(entry), at); at += sizeof(entry)) {
+            CHECK(entry[0] % STORAGE_BLOCK_SIZE == 0);
+            CHECK(entry[1] == track_seq);
+            fill(track_block, track_seq++);
+            CHECK(fs.read_file(track_fn, buf, sizeof(buf), entry[0]) && memcmp(buf, track_block, sizeof(buf)) == 0);
+        }
+    }
+    CHECK(track_seq > TICKS / 2);
+    for (i = 0; i < (int)cap_seq; i++) {
+        fill(cap_block, i | 0x80000000);
+        CHECK(fs.read_file("capture.bin", buf, sizeof(buf), i * STORAGE_BLOCK_SIZE) && memcmp(buf, cap_block, sizeof(buf)) == 0);
+    }
+
+    card_close();
+    return check_failures;
+}
+
+static int mount_done = -1;
+static int jobs_failed;
+
+static void on_mount(int result)
+{
+    mount_done = result;
+}
+
+static void on_job(int result)
+{
+    if (!result)
+        jobs_failed++;
+}
+
+// No card: what was queued before the mount fails is let go as failed
+static int no_card(long)
+{
+    uint32_t odom[6] = {0};
+
+    storage.mount(on_mount);
+    CHECK(storage.write_file("odom.bin", odom, sizeof(odom), on_job));
+    CHECK(storage.append_log("line\n", 5, on_job));
+    CHECK(storage.checkpoint(on_job));
+    while (mount_done < 0)
+        storage.poll();
+
+    CHECK(mount_done == 0);
+    CHECK(jobs_failed == 3);
+    CHECK(storage.idle());
+    CHECK(storage.ram_only());
+    CHECK(!storage.append_log("line\n", 5, on_job));
+    return check_failures;
+}
+
+// A queue filled before the card is up is busy, not failed
+static int full(long)
+{
+    uint32_t odom[6] = {0};
+    int queued = 0;
+
+    if (!card_open(image))
+        return 1;
+    storage.mount();
+    CHECK(storage.room() == STORAGE_QUEUE_LEN);
+    while (storage.append_log("line\n", 5, on_job))
+        queued++;
+    CHECK(queued == STORAGE_QUEUE_LEN);
+    CHECK(storage.room() == 0);
+    CHECK(!storage.write_file("odom.bin", odom, sizeof(odom)));
+    CHECK(!storage.ram_only());
+
+    // Nothing was lost: once mounted, all of it goes down
+    while (!storage.mounted())
+        storage.poll();
+    CHECK(fs.open_log("odom.log"));
+    storage.flush();
+    CHECK(jobs_failed == 0);
+    CHECK(storage.room() == STORAGE_QUEUE_LEN);
+
+    card_close();
+    return check_failures;
+}
+
+int main(int argc, char **argv)
+{
+    int fd;
+
+    fd = mkstemp(image);
+    if (fd < 0) {
+        perror(image);
+        return 1;
+    }
+    close(fd);
+
+    printf("%d ticks, %d blocks per poll or more is a stall\n", TICKS, STALL_BLOCKS + 1);
+    printf("%-22s %10s %10s %14s\n", "", "polls", "max blocks", "stalls");
+    CHECK(mkfs(image, IMAGE_MB, 512));
+    CHECK(run(producers, 1) == 0);
+    CHECK(mkfs(image, IMAGE_MB, 512));
+    CHECK(run(producers, 0) == 0);
+
+    CHECK(run(no_card, 0) == 0);
+    CHECK(mkfs(image, IMAGE_MB, 512));
+    CHECK(run(full, 0) == 0);
+
+    unlink(image);
+    return check_status("storage");
+}
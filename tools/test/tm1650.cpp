@@ -0,0 +1,250 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * The TM1650 driver on each bus back-end, with the chip played by a
+ * mock on the other end: the bit-banged pins are decoded edge by edge,
+ * I2C writes taken as they come. For a minute of driving in each
+ * display mode, refreshed every 100ms as run_display() does:
+ *
+ *   - what the chip shows must always match what was put
+ *   - transactions and edge waits per second, against sending all four
+ *     columns on every refresh as the driver used to
+ *
+ * and a repeated put or brightness costs nothing, while init() sends
+ * everything again.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pins.h"
+#include "segfmt.h"
+#include "tm1650.h"
+#include "test/check.h"
+
+#define REFRESH_MS  100   // DISPLAY_MAX_TIME_MS
+#define DRIVE_S     60
+
+// The chip, as written to
+static struct {
+    uint8_t mem[TM1650_COLUMNS];
+    uint8_t ctrl;
+    uint32_t transactions;
+    uint32_t errors;
+} chip;
+
+static void chip_write(uint8_t cmd, uint8_t data)
+{
+    chip.transactions++;
+    if (cmd == 0x48)
+        chip.ctrl = data;
+    else if ((cmd & ~0x06) == 0x68)
+        chip.mem[(cmd >> 1) & 0x03] = data;
+    else
+        chip.errors++;
+}
+
+// Start and stop are DIO edges with CLK high, bits are taken on the
+// rising edge of CLK, the ninth one of a byte is the ack
+static struct {
+    bool active;
+    int bits;
+    int count;
+    uint8_t byte;
+    uint8_t bytes[2];
+} wire;
+
+static void on_pin(PinName pin, int value)
+{
+    if (pin == TM1650_DIO && shim_pins[TM1650_CLK]) {
+        if (!value) {
+            wire.active = true;
+            wire.bits = 0;
+            wire.count = 0;
+        } else if (wire.active) {
+            wire.active = false;
+            if (wire.count == 2)
+                chip_write(wire.bytes[0], wire.bytes[1]);
+            else
+                chip.errors++;
+        }
+        return;
+    }
+
+    if (pin != TM1650_CLK || !value || !wire.active)
+        return;
+    if (wire.bits < 8) {
+        wire.byte = wire.byte << 1 | shim_pins[TM1650_DIO];
+        wire.bits++;
+        return;
+    }
+    if (wire.count < 2)
+        wire.bytes[wire.count] = wire.byte;
+    wire.count++;
+    wire.bits = 0;
+}
+
+static void on_i2c(int address, const char *data, int length)
+{
+    if (length != 1) {
+        chip.errors++;
+        return;
+    }
+    chip_write(address, data[0]);
+}
+
+// A minute of driving, sampled at time t
+struct drive_t {
+    double speed;
+    double odom;
+    double trip;
+    int sats_used;
+    int sats_inview;
+    int hdop;
+};
+
+static drive_t drive_at(double t)
+{
+    drive_t d;
+
+    d.speed = 30 + 30 * sin(t / 10);
+    // The integral of the speed, in miles
+    d.odom = 12345.6 + (30 * t - 300 * cos(t / 10) + 300) / 3600;
+    d.trip = d.odom - 12000.0;
+    // Satellites come and go every few seconds, DOP with every GSA
+    d.sats_used = 7 + (int)(t / 5) % 3;
+    d.sats_inview = 12 + (int)(t / 7) % 2;
+    d.hdop = 90 + (int)t % 13;
+    return d;
+}
+
+enum show_t {
+    SHOW_SPEED,
+    SHOW_ODOM,
+    SHOW_TRIP,
+    SHOW_SATS,
+    SHOW_HDOP,
+    SHOW_COUNT,
+};
+
+static const char *show_names[SHOW_COUNT] = {"speed", "odom", "trip", "sats", "hdop"};
+
+// As main.cpp's show_*() render them
+static void render(show_t mode, const drive_t &d, uint8_t *glyphs)
+{
+    switch (mode) {
+        case SHOW_SPEED:
+            segfmt(glyphs, TM1650_COLUMNS, (int32_t)d.speed);
+            break;
+        case SHOW_ODOM:
+            segfmt(glyphs, TM1650_COLUMNS, (int32_t)d.odom, 0, SEGFMT_WRAP);
+            break;
+        case SHOW_TRIP:
+            segfmt(glyphs, TM1650_COLUMNS, (int32_t)(d.trip * 10), 1, SEGFMT_WRAP);
+            break;
+        case SHOW_SATS:
+            segfmt(&glyphs[0], 2, d.sats_used, 0, SEGFMT_ZERO_PAD);
+            glyphs[1] |= SEG_DOT;
+            segfmt(&glyphs[2], 2, d.sats_inview, 0, SEGFMT_ZERO_PAD);
+            break;
+        case SHOW_HDOP:
+            glyphs[0] = TM1650::glyph('H');
+            segfmt(&glyphs[1], 3, d.hdop, 0, SEGFMT_ZERO_PAD);
+            break;
+        default:
+            break;
+    }
+}
+
+template <class Bus>
+static void bus_run(const char *name)
+{
+    TM1650T<Bus> tm1650(TM1650_DIO, TM1650_CLK, TM1650_AIN);
+    uint8_t glyphs[TM1650_COLUMNS];
+    uint32_t refreshes = DRIVE_S * 1000 / REFRESH_MS;
+    uint32_t transactions, waits;
+    double per_transaction;
+
+    memset(&chip, 0, sizeof(chip));
+    memset(&wire, 0, sizeof(wire));
+    shim_waits = 0;
+
+    tm1650.init();
+    CHECK(chip.transactions == 1 + TM1650_COLUMNS);
+    per_transaction = (double)shim_waits / chip.transactions;
+
+    // Nothing changed, nothing sent
+    tm1650.setDisplay(true);
+    tm1650.setBrightness(1);
+    tm1650.puts("SPD ");
+    transactions = chip.transactions;
+    tm1650.puts("SPD ");
+    tm1650.setBrightness(1);
+    CHECK(chip.transactions == transactions);
+    CHECK(chip.ctrl == (1 << 4 | 1));
+
+    for (int mode = 0; mode < SHOW_COUNT; mode++) {
+        transactions = chip.transactions;
+        waits = shim_waits;
+
+        for (uint32_t i = 0; i < refreshes; i++) {
+            render((show_t)mode, drive_at(i * REFRESH_MS / 1000.0), glyphs);
+            tm1650.putGlyphs(glyphs, TM1650_COLUMNS);
+            CHECK(memcmp(chip.mem, glyphs, sizeof(glyphs)) == 0);
+        }
+
+        printf("%-9s %-6s %12.1f %12.1f %12.1f %12.1f\n", name, show_names[mode],
+            (double)(chip.transactions - transactions) / DRIVE_S,
+            (double)(shim_waits - waits) / DRIVE_S,
+            (double)TM1650_COLUMNS * 1000 / REFRESH_MS,
+            per_transaction * TM1650_COLUMNS * 1000 / REFRESH_MS);
+        CHECK(chip.transactions - transactions < refreshes * TM1650_COLUMNS / 2);
+    }
+
+    // The chip may have been reset, init() trusts none of the shadow
+    transactions = chip.transactions;
+    tm1650.init();
+    CHECK(chip.transactions == transactions + 1 + TM1650_COLUMNS);
+    CHECK(chip.errors == 0);
+}
+
+int main(int argc, char **argv)
+{
+    shim_pin_changed = on_pin;
+    shim_i2c_write = on_i2c;
+
+    printf("%d refreshes a second, per second:\n", 1000 / REFRESH_MS);
+    printf("%-9s %-6s %12s %12s %12s %12s\n", "bus", "mode", "writes", "waits", "writes was", "waits was");
+    bus_run<TM1650BitBang>("bit-bang");
+    bus_run<TM1650I2C>("i2c");
+
+    return check_status("tm1650");
+}
@@ -0,0 +1,288 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * The track log's block encoding, on drives as the receiver would have
+ * reported them: every fix through TrackBlock and back must come out as
+ * it went in, and the bytes each one took are reported per drive.
+ *
+ *   - highway and town at 10Hz, to the 6-8 bytes a fix track.h gives
+ *   - the same highway at 1Hz
+ *   - a drive with everything awkward in it: fix gaps, a day lost,
+ *     course through north, the antimeridian, a jump across the map,
+ *     a course TinyGPS hadn't set yet and fields at their limits
+ *
+ * and a block with a flipped bit, or cut short, decodes to nothing.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "track.h"
+#include "test/check.h"
+
+#define UTC_START      1715932800 // 2024-05-17 08:00
+#define START_LAT      45523064   // millionths of a degree
+#define START_LON      -122676483
+#define M_PER_UDEG     0.111195
+#define KNOTS_PER_MPS  1.943844
+#define DRIVE_S        1800
+#define STEADY_MAX     8.0        // bytes a fix, 10Hz, track.h
+#define EMPTY_COURSE   (uint16_t)999999999 // TinyGPS::GPS_INVALID_ANGLE, as it's stored
+
+typedef std::vector<track_fix_t> drive_t;
+
+static uint32_t rand_state = 1;
+
+// -1 to 1
+static double noise(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return ((rand_state >> 8) & 0xFFFF) / 32767.5 - 1.0;
+}
+
+/*
+ * A vehicle on the road, reported every period_cs: position and course
+ * to the receiver's resolution, with a little of the wander a real fix
+ * has, speed from it in hundredths of a knot, and HDOP that now and
+ * then moves. town stops and starts, and turns at each junction.
+ */
+static void drive(drive_t *fixes, uint32_t period_cs, uint32_t seconds, bool town)
+{
+    double lat = START_LAT, lon = START_LON;
+    double heading = 90.0, mps = 0.0, target = town ? 13.0 : 29.0;
+    double wander_n = 0.0, wander_e = 0.0, dt = period_cs / 100.0;
+    uint32_t hdop = 95;
+    uint64_t cs;
+    track_fix_t fix;
+
+    for (cs = 0; cs < seconds * 100ull; cs += period_cs) {
+        uint32_t s = cs / 100;
+
+        if (town && s % 90 == 60)
+            target = 0.0;                  // lights
+        else if (town && s % 90 == 75)
+            target = 13.0;
+        if (town && s % 90 == 45 && cs % 100 == 0)
+            heading += noise() > 0 ? 90 : -90; // junction
+        if (!town)
+            heading += 0.02 * dt * sin(s / 120.0); // sweeping curves
+
+        if (mps < target)
+            mps = fmin(mps + 2.0 * dt, target);
+        else
+            mps = fmax(mps - 3.0 * dt, target);
+
+        wander_n += 0.05 * noise() * dt;
+        wander_e += 0.05 * noise() * dt;
+        lat += (mps * dt * cos(heading * M_PI / 180) + wander_n * dt) / M_PER_UDEG;
+        lon += (mps * dt * sin(heading * M_PI / 180) + wander_e * dt) / (M_PER_UDEG * cos(lat / 1e6 * M_PI / 180));
+        heading = fmod(heading + 360.0, 360.0);
+
+        if (noise() > 0.98)
+            hdop += noise() > 0 ? 5 : -5;
+
+        fix.utc = UTC_START + s;
+        fix.cs = cs % 100;
+        fix.lat = lround(lat);
+        fix.lon = lround(lon);
+        // At a standstill, static hold keeps the position and zeroes speed
+        fix.speed = mps > 0.1 ? lround((mps + 0.05 * noise()) * KNOTS_PER_MPS * 100) : 0;
+        fix.course = (uint16_t)lround(fmod(heading + 0.3 * noise() + 360.0, 360.0) * 100) % 36000;
+        fix.hdop = hdop;
+        fixes->push_back(fix);
+    }
+}
+
+static void awkward(drive_t *fixes)
+{
+    track_fix_t fix = {UTC_START, 0, START_LAT, START_LON, 2500, 35990, 120};
+    int i;
+
+    // Keyframed before RMC gave a course
+    fix.course = EMPTY_COURSE;
+    fixes->push_back(fix);
+    fix.course = 35990;
+
+    // Through north and back
+    for (i = 0; i < 40; i++) {
+        fix.cs += 10;
+        if (fix.cs == 100) {
+            fix.cs = 0;
+            fix.utc++;
+        }
+        fix.course = (fix.course + (i < 20 ? 7 : 35993)) % 36000;
+        fix.lat += 20;
+        fixes->push_back(fix);
+    }
+
+    // Gaps, a whole day lost, time going back
+    fix.utc += 7;
+    fix.cs = 30;
+    fixes->push_back(fix);
+    fix.utc += 86400;
+    fixes->push_back(fix);
+    fix.utc -= 1;
+    fix.cs = 99;
+    fixes->push_back(fix);
+    fix.cs = 0;
+    fix.utc += 1;
+    fixes->push_back(fix);
+
+    // Across the map and the antimeridian
+    fix.lat = -89999999;
+    fix.lon = 179999990;
+    fixes->push_back(fix);
+    for (i = 0; i < 10; i++) {
+        fix.lon += 3;
+        if (fix.lon > 180000000)
+            fix.lon -= 360000000;
+        fixes->push_back(fix);
+    }
+    fix.lat = 89999999;
+    fix.lon = -180000000;
+    fixes->push_back(fix);
+
+    // Limits
+    fix.speed = 65535;
+    fix.hdop = 9999;
+    fixes->push_back(fix);
+    fix.speed = 0;
+    fix.hdop = 0;
+    fix.course = 0;
+    fixes->push_back(fix);
+    fix.course = 35999;
+    fixes->push_back(fix);
+}
+
+static bool same(const track_fix_t &a, const track_fix_t &b)
+{
+    return a.utc == b.utc && a.cs == b.cs && a.lat == b.lat && a.lon == b.lon &&
+        a.speed == b.speed && a.course == b.course && a.hdop == b.hdop;
+}
+
+// Blocks for the whole drive, as the firmware fills them
+static void encode(const drive_t &fixes, std::vector<std::vector<uint8_t> > *blocks)
+{
+    TrackBlock block;
+    const uint8_t *sealed;
+
+    for (size_t i = 0; i < fixes.size(); i++) {
+        if (block.add(fixes[i]))
+            continue;
+        sealed = block.seal();
+        blocks->push_back(std::vector<uint8_t>(sealed, sealed + TRACK_BLOCK_SIZE));
+        block.reset();
+        CHECK(block.add(fixes[i]));
+    }
+    if (!block.empty()) {
+        sealed = block.seal();
+        blocks->push_back(std::vector<uint8_t>(sealed, sealed + TRACK_BLOCK_SIZE));
+    }
+}
+
+// Bytes a fix, or 0 if it didn't come back as it went in
+static double round_trip(const char *name, const drive_t &fixes)
+{
+    std::vector<std::vector<uint8_t> > blocks;
+    track_fix_t decoded[TRACK_BLOCK_SIZE];
+    size_t n = 0, bad = 0;
+    uint32_t utc;
+    double per_fix;
+    int count;
+
+    encode(fixes, &blocks);
+
+    for (size_t b = 0; b < blocks.size(); b++) {
+        count = TrackBlock::decode(&blocks[b][0], decoded, TRACK_BLOCK_SIZE);
+        CHECK(count > 0);
+        CHECK(TrackBlock::first_utc(&blocks[b][0], &utc) && utc == decoded[0].utc);
+        for (int i = 0; i < count && n < fixes.size(); i++, n++) {
+            if (!same(decoded[i], fixes[n]) && !bad++)
+                fprintf(stderr, "%s: fix %zu doesn't come back\n", name, n);
+        }
+    }
+    CHECK(n == fixes.size());
+    CHECK(!bad);
+
+    per_fix = (double)blocks.size() * TRACK_BLOCK_SIZE / fixes.size();
+    printf("%-10s %6zu fixes, %4zu blocks, %5.2f bytes a fix\n", name, fixes.size(), blocks.size(), per_fix);
+
+    return bad || n != fixes.size() ? 0 : per_fix;
+}
+
+static void damaged(const drive_t &fixes)
+{
+    std::vector<std::vector<uint8_t> > blocks;
+    track_fix_t decoded[TRACK_BLOCK_SIZE];
+    uint8_t block[TRACK_BLOCK_SIZE];
+    uint32_t utc;
+
+    encode(fixes, &blocks);
+
+    for (int bit = 0; bit < TRACK_BLOCK_SIZE * 8; bit += 37) {
+        memcpy(block, &blocks[0][0], sizeof(block));
+        block[bit / 8] ^= 1 << bit % 8;
+        CHECK(TrackBlock::decode(block, decoded, TRACK_BLOCK_SIZE) == -1);
+        CHECK(!TrackBlock::first_utc(block, &utc));
+    }
+
+    // Torn write: the tail never made it
+    memcpy(block, &blocks[0][0], sizeof(block));
+    memset(&block[TRACK_BLOCK_SIZE / 2], 0xFF, TRACK_BLOCK_SIZE / 2);
+    CHECK(TrackBlock::decode(block, decoded, TRACK_BLOCK_SIZE) == -1);
+
+    // A short buffer gets as many as fit
+    CHECK(TrackBlock::decode(&blocks[0][0], decoded, 3) == 3);
+    CHECK(same(decoded[2], fixes[2]));
+}
+
+int main(void)
+{
+    drive_t highway, town, slow, odd;
+    double per_fix;
+
+    drive(&highway, 10, DRIVE_S, false);
+    drive(&town, 10, DRIVE_S, true);
+    drive(&slow, 100, DRIVE_S, false);
+    awkward(&odd);
+
+    per_fix = round_trip("highway", highway);
+    CHECK(per_fix > 0 && per_fix <= STEADY_MAX);
+    per_fix = round_trip("town", town);
+    CHECK(per_fix > 0 && per_fix <= STEADY_MAX);
+    CHECK(round_trip("1Hz", slow) > 0);
+    CHECK(round_trip("awkward", odd) > 0);
+
+    damaged(highway);
+
+    return check_status("track");
+}
@@ -0,0 +1,203 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Which part of the day's track the firmware (test/firmware.h) starts
+ * in after a restart, from the sizes of the parts already on the card:
+ *
+ *   - a blank card: the drive goes to DD-00.trk
+ *   - 00 full, 01 past full (as a restart used to leave one) and 02
+ *     part way: the drive carries on at the end of 02, leaving 00 and
+ *     01 as they were and starting no 03
+ *
+ * Each drive is a cold fix, a minute at 30mph and a long RIGHT to
+ * sleep, which flushes the part filled block. Finding a part full
+ * takes no more than the directory lookup its append makes anyway, so
+ * none of it stalls the main loop (test/stall).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mkfs.h"
+#include "track.h"
+#include "shim/card.h"
+#include "test/check.h"
+#include "test/firmware.h"
+
+#define IMAGE_MB        64
+#define S               1000000ull
+#define RUN_MAX_US      (300 * S)
+#define DRIVE_US        (60 * S)
+#define TRACK_FILE_MAX  (4 * 1024 * 1024) // as main.cpp
+#define PART_BLOCKS     3                 // in 02 before the drive
+#define DAY             "2024/05/17"      // GPS_SIM_UTC_START's
+
+extern int track_part;
+
+static char image[] = "/tmp/track_part-XXXXXX";
+
+// fn's exit status, run in a child of its own
+static int run(int (*fn)(void))
+{
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        check_failures = 0;
+        status = fn();
+        fflush(stdout);
+        _exit(status);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
+}
+
+// Whether fn is size bytes long, 0 for one that isn't there
+static bool has_size(const char *fn, uint32_t size)
+{
+    uint8_t c;
+
+    return (!size || fs.read_file(fn, &c, 1, size - 1)) && !fs.read_file(fn, &c, 1, size);
+}
+
+static bool fill(const char *fn, uint32_t size)
+{
+    uint8_t block[TRACK_BLOCK_SIZE];
+
+    memset(block, 0, sizeof(block));
+    for (uint32_t at = 0; at < size; at += sizeof(block)) {
+        if (!fs.append_file(fn, block, sizeof(block)))
+            return false;
+    }
+    return true;
+}
+
+// The day so far, as a run before the restart left it
+static int earlier_parts(void)
+{
+    if (!card_open(image) || !fs.init())
+        return 1;
+    CHECK(fill(DAY "-00.trk", TRACK_FILE_MAX));
+    CHECK(fill(DAY "-01.trk", TRACK_FILE_MAX + TRACK_BLOCK_SIZE));
+    CHECK(fill(DAY "-02.trk", PART_BLOCKS * TRACK_BLOCK_SIZE));
+    card_close();
+    return check_failures;
+}
+
+static uint64_t fixed_us;
+static bool pressed;
+
+static bool step(void)
+{
+    if (firmware_us() > RUN_MAX_US) {
+        CHECK(!"asleep in time");
+        return false;
+    }
+    if (pressed && sleeping && !entering_sleep)
+        return false;
+    if (booting || waiting_for_gps_ready)
+        return true;
+
+    if (!fixed_us) {
+        fixed_us = firmware_us();
+        gps_sim.mph = 30.0;
+    }
+    if (!pressed && firmware_us() - fixed_us >= DRIVE_US) {
+        firmware_key(ADC_RIGHT, KEY_LONG_MS);
+        pressed = true;
+    }
+    // Asleep, nothing else wakes it to look
+    if (pressed)
+        firmware_step_at(firmware_us() + S / 10);
+    return true;
+}
+
+// A good block of the drive's at offset in fn
+static bool drive_block(const char *fn, uint32_t offset)
+{
+    uint8_t block[TRACK_BLOCK_SIZE];
+    uint32_t utc;
+
+    return fs.read_file(fn, block, sizeof(block), offset) && TrackBlock::first_utc(block, &utc)
+        && utc >= GPS_SIM_UTC_START && utc < GPS_SIM_UTC_START + RUN_MAX_US / S;
+}
+
+static int finish_blank(void)
+{
+    CHECK(storage.idle());
+    CHECK(track_part == 0);
+    CHECK(has_size(DAY "-00.trk", TRACK_BLOCK_SIZE));
+    CHECK(drive_block(DAY "-00.trk", 0));
+    CHECK(has_size(DAY "-01.trk", 0));
+    printf("%-8s drive in %s-%02d.trk\n", "blank", DAY, track_part);
+    return check_failures;
+}
+
+static int finish_restart(void)
+{
+    CHECK(storage.idle());
+    CHECK(track_part == 2);
+    CHECK(has_size(DAY "-00.trk", TRACK_FILE_MAX));
+    CHECK(has_size(DAY "-01.trk", TRACK_FILE_MAX + TRACK_BLOCK_SIZE));
+    CHECK(has_size(DAY "-02.trk", (PART_BLOCKS + 1) * TRACK_BLOCK_SIZE));
+    CHECK(drive_block(DAY "-02.trk", PART_BLOCKS * TRACK_BLOCK_SIZE));
+    CHECK(has_size(DAY "-03.trk", 0));
+    printf("%-8s drive in %s-%02d.trk after %u bytes\n", "restart", DAY, track_part,
+        PART_BLOCKS * TRACK_BLOCK_SIZE);
+    return check_failures;
+}
+
+int main(void)
+{
+    int fd;
+
+    fd = mkstemp(image);
+    if (fd < 0) {
+        perror(image);
+        return 1;
+    }
+    close(fd);
+
+    CHECK(mkfs(image, IMAGE_MB, 512));
+    CHECK(firmware_run(image, step, finish_blank) == 0);
+
+    CHECK(mkfs(image, IMAGE_MB, 512));
+    CHECK(run(earlier_parts) == 0);
+    CHECK(firmware_run(image, step, finish_restart) == 0);
+
+    unlink(image);
+    return check_status("track_part");
+}
@@ -0,0 +1,314 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * ./trackseek on a log of its own, some blocks torn, against a linear
+ * scan for every block's first time, either side of it and past both
+ * ends of the log:
+ *
+ *   - with no index, bisecting the whole log
+ *   - -r builds the index, an entry for the first good block of each
+ *     stride; seeks through it find the same blocks in fewer reads, and
+ *     a rebuild after the index is lost gives back the same file
+ *   - an index with an entry gone, one gone stale, one naming a block
+ *     past the end and one cut short by the log growing since, all
+ *     still find the right block
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "track.h"
+#include "test/check.h"
+
+#define UTC_START   1715932800 // 2024-05-17 08:00
+#define BLOCKS      1000       // strides of TRACK_INDEX_EVERY, and a part one
+#define GAP_EVERY   37         // blocks between fix gaps
+#define GAP_S       600
+
+// Torn by a power cut or a bad card; 128 is the first of its stride
+static const uint32_t torn[] = { 5, 6, 128, 200, BLOCKS - 1 };
+
+static char dir[] = "/tmp/trackseek-XXXXXX";
+
+struct result_t {
+    int32_t block;
+    unsigned long reads;
+};
+
+static std::string path(const char *fn)
+{
+    return std::string(dir) + "/" + fn;
+}
+
+static bool is_torn(uint32_t b)
+{
+    for (size_t i = 0; i < sizeof(torn) / sizeof(torn[0]); i++)
+        if (torn[i] == b)
+            return true;
+    return false;
+}
+
+static bool write_file(const char *fn, const void *data, size_t size)
+{
+    FILE *f = fopen(path(fn).c_str(), "wb");
+    bool ok;
+
+    if (!f)
+        return false;
+    ok = fwrite(data, 1, size, f) == size;
+    return fclose(f) == 0 && ok;
+}
+
+static std::vector<uint8_t> read_file(const char *fn)
+{
+    std::vector<uint8_t> data;
+    uint8_t buf[4096];
+    size_t len;
+    FILE *f = fopen(path(fn).c_str(), "rb");
+
+    if (!f)
+        return data;
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+        data.insert(data.end(), buf, buf + len);
+    fclose(f);
+    return data;
+}
+
+/*
+ * Full blocks of a fix a second, a gap every so often; firsts gets
+ * each block's first utc, 0 where it's torn.
+ */
+static std::vector<uint8_t> make_log(std::vector<uint32_t> *firsts)
+{
+    std::vector<uint8_t> log;
+    TrackBlock block;
+    track_fix_t fix;
+    const uint8_t *sealed;
+    uint8_t bad[TRACK_BLOCK_SIZE];
+
+    memset(&fix, 0, sizeof(fix));
+    memset(bad, 0xA5, sizeof(bad));
+    fix.utc = UTC_START;
+    fix.lat = 45523064;
+    fix.lon = -122676483;
+    while (firsts->size() < BLOCKS) {
+        if (block.add(fix)) {
+            fix.utc++;
+            fix.lat += 10;
+            continue;
+        }
+        sealed = block.seal();
+        if (is_torn(firsts->size())) {
+            log.insert(log.end(), bad, bad + sizeof(bad));
+            firsts->push_back(0);
+        } else {
+            log.insert(log.end(), sealed, sealed + TRACK_BLOCK_SIZE);
+            firsts->push_back(block.first_utc());
+        }
+        block.reset();
+        if (firsts->size() % GAP_EVERY == 0)
+            fix.utc += GAP_S;
+    }
+
+    return log;
+}
+
+// The last good block starting no later than utc, the slow way
+static int32_t linear(const std::vector<uint32_t> &firsts, uint32_t utc)
+{
+    int32_t found = -1;
+
+    for (uint32_t b = 0; b < firsts.size(); b++) {
+        if (!firsts[b])
+            continue;
+        if (firsts[b] > utc)
+            break;
+        found = b;
+    }
+    return found;
+}
+
+// ./trackseek args... log.trk each of utcs, what it found for each
+static std::vector<result_t> seek(const char *args, const std::vector<uint32_t> &utcs)
+{
+    std::vector<result_t> results;
+    std::string cmd = std::string("./trackseek ") + args + " " + path("log.trk");
+    char line[256];
+    unsigned long utc;
+    result_t r;
+    size_t n = 0;
+    FILE *f;
+
+    for (size_t i = 0; i < utcs.size(); i++)
+        cmd += " " + std::to_string(utcs[i]);
+
+    f = popen(cmd.c_str(), "r");
+    if (!f)
+        return results;
+    while (fgets(line, sizeof(line), f)) {
+        long block;
+
+        if (sscanf(line, "%lu: block %ld, %lu reads", &utc, &block, &r.reads) != 3
+            || n >= utcs.size() || utc != utcs[n]) {
+            fprintf(stderr, "trackseek %s: %s", args, line);
+            break;
+        }
+        r.block = block;
+        results.push_back(r);
+        n++;
+    }
+    CHECK(pclose(f) == 0);
+
+    return results;
+}
+
+// Seeks through idx agree with the scan; returns the reads they took
+static unsigned long check_seeks(const char *what, const char *args,
+    const std::vector<uint32_t> &firsts, const std::vector<uint32_t> &utcs)
+{
+    std::vector<result_t> results = seek(args, utcs);
+    unsigned long reads = 0;
+    int wrong = 0;
+
+    CHECK(results.size() == utcs.size());
+    for (size_t i = 0; i < results.size() && i < utcs.size(); i++) {
+        if (results[i].block != linear(firsts, utcs[i])) {
+            if (!wrong++)
+                fprintf(stderr, "%s: %lu found block %ld, not %ld\n", what, (unsigned long)utcs[i],
+                    (long)results[i].block, (long)linear(firsts, utcs[i]));
+        }
+        reads += results[i].reads;
+    }
+    CHECK(wrong == 0);
+
+    printf("%-10s %4lu seeks, %5.1f reads each\n", what, (unsigned long)results.size(),
+        results.empty() ? 0.0 : (double)reads / results.size());
+    return reads;
+}
+
+static void put_index(const char *fn, const std::vector<track_index_t> &index)
+{
+    std::vector<uint8_t> data(index.size() * TRACK_INDEX_LEN);
+
+    for (size_t i = 0; i < index.size(); i++)
+        track_index_pack(index[i], &data[i * TRACK_INDEX_LEN]);
+    CHECK(write_file(fn, data.empty() ? NULL : &data[0], data.size()));
+}
+
+int main(void)
+{
+    std::vector<uint32_t> firsts, utcs;
+    std::vector<track_index_t> index, lost;
+    std::vector<uint8_t> log, idx, rebuilt;
+    unsigned long bisect_reads, index_reads;
+    track_index_t entry;
+    char cmd[1024];
+    uint32_t b, e;
+    int status;
+
+    if (!mkdtemp(dir))
+        return 1;
+
+    log = make_log(&firsts);
+    CHECK(write_file("log.trk", &log[0], log.size()));
+
+    // Every block's first time, a second either side, and past both ends
+    utcs.push_back(UTC_START - 1);
+    for (b = 0; b < firsts.size(); b++) {
+        if (!firsts[b])
+            continue;
+        utcs.push_back(firsts[b] - 1);
+        utcs.push_back(firsts[b]);
+        utcs.push_back(firsts[b] + 1);
+    }
+    utcs.push_back(utcs.back() + 10 * GAP_S);
+
+    bisect_reads = check_seeks("no index", "", firsts, utcs);
+
+    // Beside log.trk as log.idx, where trackseek looks by default
+    snprintf(cmd, sizeof(cmd), "./trackseek -r %s >/dev/null", path("log.trk").c_str());
+    status = system(cmd);
+    CHECK(status == 0);
+    idx = read_file("log.idx");
+    CHECK(idx.size() == (BLOCKS + TRACK_INDEX_EVERY - 1) / TRACK_INDEX_EVERY * TRACK_INDEX_LEN);
+    for (e = 0; e * TRACK_INDEX_LEN < idx.size(); e++) {
+        track_index_unpack(&idx[e * TRACK_INDEX_LEN], &entry);
+        index.push_back(entry);
+
+        // The first good block of its stride
+        for (b = e * TRACK_INDEX_EVERY; b < firsts.size() && !firsts[b]; b++)
+            ;
+        CHECK(entry.block == b);
+        CHECK(b < firsts.size() && entry.utc == firsts[b]);
+    }
+
+    index_reads = check_seeks("index", "", firsts, utcs);
+    CHECK(index_reads < bisect_reads);
+
+    // Lost, and built again from the log
+    unlink(path("log.idx").c_str());
+    check_seeks("idx lost", "", firsts, utcs);
+    status = system(cmd);
+    CHECK(status == 0);
+    rebuilt = read_file("log.idx");
+    CHECK(rebuilt == idx);
+
+    // Entries gone wrong, each on its own
+    snprintf(cmd, sizeof(cmd), "-i %s", path("lost.idx").c_str());
+
+    lost = index;
+    lost.erase(lost.begin() + 2);
+    put_index("lost.idx", lost);
+    check_seeks("entry gone", cmd, firsts, utcs);
+
+    lost = index;
+    lost[2].utc += 1;
+    lost[3].block += 1;
+    put_index("lost.idx", lost);
+    check_seeks("stale", cmd, firsts, utcs);
+
+    lost = index;
+    lost[1].block = BLOCKS + 10;
+    put_index("lost.idx", lost);
+    check_seeks("past end", cmd, firsts, utcs);
+
+    lost = index;
+    lost.resize(2);
+    put_index("lost.idx", lost);
+    check_seeks("cut short", cmd, firsts, utcs);
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    CHECK(system(cmd) == 0);
+    return check_status("trackseek");
+}
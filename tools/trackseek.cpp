@@ -0,0 +1,336 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Seeking in track logs by time
+ *
+ *   trackseek [-i IDX] LOG TIME...  block each TIME falls in
+ *   trackseek -r [-i IDX] LOG       rebuild the index from the log
+ *   trackseek -B MB FILE            time seeks on a made up log
+ *
+ * TIME is seconds since 1970 or YYYY-MM-DDTHH:MM:SS, UTC. IDX defaults
+ * to the log's name with .idx in place of .trk, or for an old track.bin,
+ * track.idx beside it. The benchmark writes an MB sized log to
+ * FILE and its index to FILE.idx, then seeks to random times by linear
+ * scan, by bisection and through the index, counting block reads: on
+ * the card those are what cost.
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "track.h"
+
+#define BENCH_SEEKS  1000
+#define BENCH_SCANS  5
+#define BENCH_STEP_S 30   // Between blocks' first fixes
+#define BENCH_BAD    1000 // One block in so many torn
+
+struct log_t {
+    int fd;
+    uint32_t blocks;
+    unsigned long reads;
+};
+
+static bool read_block(uint32_t block, uint8_t *buf, void *p)
+{
+    log_t *log = (log_t *)p;
+
+    log->reads++;
+    return pread(log->fd, buf, TRACK_BLOCK_SIZE, (off_t)block * TRACK_BLOCK_SIZE) == TRACK_BLOCK_SIZE;
+}
+
+static int open_log(const char *fn, log_t *log, int flags = O_RDONLY)
+{
+    struct stat st;
+
+    log->fd = open(fn, flags, 0644);
+    if (log->fd < 0 || fstat(log->fd, &st) < 0) {
+        perror(fn);
+        return 0;
+    }
+    log->blocks = st.st_size / TRACK_BLOCK_SIZE;
+    log->reads = 0;
+    return 1;
+}
+
+static void load_index(const std::string &fn, std::vector<track_index_t> *index)
+{
+    uint8_t packed[TRACK_INDEX_LEN];
+    track_index_t entry;
+    FILE *f;
+
+    f = fopen(fn.c_str(), "rb");
+    if (!f)
+        return;
+    while (fread(packed, sizeof(packed), 1, f) == 1) {
+        track_index_unpack(packed, &entry);
+        index->push_back(entry);
+    }
+    fclose(f);
+}
+
+// First good block of each stride, as the device would have noted it
+static int build_index(log_t *log, const std::string &fn)
+{
+    uint8_t block[TRACK_BLOCK_SIZE], packed[TRACK_INDEX_LEN];
+    track_index_t entry;
+    unsigned long entries = 0;
+    uint32_t b, end;
+    FILE *f;
+
+    f = fopen(fn.c_str(), "wb");
+    if (!f) {
+        perror(fn.c_str());
+        return 0;
+    }
+
+    for (b = 0; b < log->blocks; b += TRACK_INDEX_EVERY) {
+        end = b + TRACK_INDEX_EVERY < log->blocks ? b + TRACK_INDEX_EVERY : log->blocks;
+        for (entry.block = b; entry.block < end; entry.block++) {
+            if (read_block(entry.block, block, log) && TrackBlock::first_utc(block, &entry.utc))
+                break;
+        }
+        if (entry.block == end)
+            continue;
+        track_index_pack(entry, packed);
+        fwrite(packed, sizeof(packed), 1, f);
+        entries++;
+    }
+    fclose(f);
+
+    printf("%lu entries for %lu blocks\n", entries, (unsigned long)log->blocks);
+    return 1;
+}
+
+static int parse_time(const char *s, uint32_t *utc)
+{
+    struct tm tm;
+    char *end;
+
+    *utc = strtoul(s, &end, 10);
+    if (!*end)
+        return 1;
+
+    memset(&tm, 0, sizeof(tm));
+    end = strptime(s, "%Y-%m-%dT%H:%M:%S", &tm);
+    if (!end || *end)
+        return 0;
+    *utc = timegm(&tm);
+    return 1;
+}
+
+// What the index saves a reader from
+static int32_t linear_seek(log_t *log, uint32_t utc)
+{
+    uint8_t block[TRACK_BLOCK_SIZE];
+    uint32_t b, first;
+    int32_t found = -1;
+
+    for (b = 0; b < log->blocks; b++) {
+        if (!read_block(b, block, log) || !TrackBlock::first_utc(block, &first))
+            continue;
+        if (first > utc)
+            break;
+        found = b;
+    }
+    return found;
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int bench(const char *fn, unsigned long mb)
+{
+    std::vector<track_index_t> index;
+    std::string idx = std::string(fn) + ".idx";
+    std::vector<uint32_t> targets;
+    const uint32_t start = 1577836800; // 2020-01-01
+    uint8_t torn[TRACK_BLOCK_SIZE];
+    uint32_t blocks = mb * 1000000 / TRACK_BLOCK_SIZE, b;
+    unsigned long reads[3] = {0, 0, 0};
+    double us[3] = {0, 0, 0}, t;
+    int32_t found[3];
+    int i, runs[3] = {0, 0, 0}, wrong = 0;
+    track_fix_t fix;
+    log_t log;
+    FILE *f;
+
+    // A fix per block is enough to seek on
+    f = fopen(fn, "wb");
+    if (!f) {
+        perror(fn);
+        return 1;
+    }
+    srand(1);
+    memset(&fix, 0, sizeof(fix));
+    memset(torn, 0xA5, sizeof(torn));
+    for (b = 0; b < blocks; b++) {
+        TrackBlock block;
+
+        fix.utc = start + b * BENCH_STEP_S;
+        block.add(fix);
+        if (rand() % BENCH_BAD == 0)
+            fwrite(torn, sizeof(torn), 1, f);
+        else
+            fwrite(block.seal(), TRACK_BLOCK_SIZE, 1, f);
+    }
+    fclose(f);
+
+    if (!open_log(fn, &log) || !build_index(&log, idx))
+        return 1;
+    load_index(idx, &index);
+    printf("%.1f MB, %lu blocks\n", (double)blocks * TRACK_BLOCK_SIZE / 1e6, (unsigned long)blocks);
+
+    for (i = 0; i < BENCH_SEEKS; i++)
+        targets.push_back(start + (uint32_t)((double)rand() / RAND_MAX * blocks * BENCH_STEP_S));
+
+    for (i = 0; i < BENCH_SEEKS; i++) {
+        log.reads = 0;
+        t = now_us();
+        found[1] = track_seek(read_block, &log, log.blocks, NULL, 0, targets[i]);
+        us[1] += now_us() - t;
+        reads[1] += log.reads;
+        runs[1]++;
+
+        log.reads = 0;
+        t = now_us();
+        found[2] = track_seek(read_block, &log, log.blocks, &index[0], index.size(), targets[i]);
+        us[2] += now_us() - t;
+        reads[2] += log.reads;
+        runs[2]++;
+
+        if (i < BENCH_SCANS) {
+            log.reads = 0;
+            t = now_us();
+            found[0] = linear_seek(&log, targets[i]);
+            us[0] += now_us() - t;
+            reads[0] += log.reads;
+            runs[0]++;
+            if (found[0] != found[1])
+                wrong++;
+        }
+        if (found[1] != found[2])
+            wrong++;
+    }
+    close(log.fd);
+
+    const char *names[] = {"linear", "bisect", "index"};
+    for (i = 0; i < 3; i++)
+        printf("%-8s %8.0f reads %10.1f us per seek\n", names[i],
+            (double)reads[i] / runs[i], us[i] / runs[i]);
+    if (wrong)
+        printf("%d seeks disagree\n", wrong);
+
+    return wrong ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<track_index_t> index;
+    std::string idx;
+    bool rebuild = false;
+    unsigned long mb = 0;
+    uint32_t utc;
+    int32_t found;
+    int opt;
+    log_t log;
+
+    while ((opt = getopt(argc, argv, "i:rB:")) != -1) {
+        switch (opt) {
+            case 'i':
+                idx = optarg;
+                break;
+            case 'r':
+                rebuild = true;
+                break;
+            case 'B':
+                mb = atol(optarg);
+                break;
+            default:
+                goto usage;
+        }
+    }
+    if (optind == argc)
+        goto usage;
+
+    if (mb)
+        return bench(argv[optind], mb);
+
+    if (idx.empty()) {
+        const char *slash = strrchr(argv[optind], '/');
+        const char *dot = strrchr(argv[optind], '.');
+        if (dot && !strcmp(dot, ".trk"))
+            idx = std::string(argv[optind], dot - argv[optind]) + ".idx";
+        else
+            idx = std::string(argv[optind], slash ? slash + 1 - argv[optind] : 0) + "track.idx";
+    }
+    if (!open_log(argv[optind], &log))
+        return 1;
+
+    if (rebuild)
+        return build_index(&log, idx) ? 0 : 1;
+    if (optind + 1 == argc)
+        goto usage;
+
+    load_index(idx, &index);
+    for (int i = optind + 1; i < argc; i++) {
+        if (!parse_time(argv[i], &utc)) {
+            fprintf(stderr, "%s: not a time\n", argv[i]);
+            return 2;
+        }
+        log.reads = 0;
+        found = track_seek(read_block, &log, log.blocks,
+            index.empty() ? NULL : &index[0], index.size(), utc);
+        printf("%s: block %ld, %lu reads\n", argv[i], (long)found, log.reads);
+    }
+
+    return 0;
+
+usage:
+    fprintf(stderr,
+        "usage: %s [-i IDX] LOG TIME...\n"
+        "       %s -r [-i IDX] LOG\n"
+        "       %s -B MB FILE\n",
+        argv[0], argv[0], argv[0]);
+    return 2;
+}
@@ -0,0 +1,464 @@
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <math.h>
+#include <string.h>
+
+#include "track.h"
+
+#define HEADER_LEN 23
+#define CRC_OFFSET (TRACK_BLOCK_SIZE - 2)
+#define DELTA_MAX  (1 + 6 * 5) // Mask and six worst case varints
+
+// Delta mask, also the order the varints follow in
+#define F_DT     (1u<<0)
+#define F_LAT    (1u<<1)
+#define F_LON    (1u<<2)
+#define F_SPEED  (1u<<3)
+#define F_COURSE (1u<<4)
+#define F_HDOP   (1u<<5)
+
+#define COURSE_FULL 36000
+
+#define M_PER_UDEG 0.111195f // Metres per microdegree of latitude
+#define PI_F       3.14159265f
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Zig-zag folds the sign into bit 0 so small negatives stay short
+static size_t put_varint(uint8_t *p, int32_t v)
+{
+    uint32_t z = ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+    size_t len = 0;
+
+    while (z >= 0x80) {
+        p[len++] = z | 0x80;
+        z >>= 7;
+    }
+    p[len++] = z;
+
+    return len;
+}
+
+static size_t get_varint(const uint8_t *p, const uint8_t *end, int32_t *v)
+{
+    uint32_t z = 0;
+    size_t len = 0;
+
+    do {
+        if (p + len >= end || len >= 5)
+            return 0;
+        z |= (uint32_t)(p[len] & 0x7F) << (7 * len);
+    } while (p[len++] & 0x80);
+
+    *v = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+    return len;
+}
+
+static uint16_t crc16(const uint8_t *p, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (len--) {
+        crc ^= (uint16_t)*p++ << 8;
+        for (int i = 0; i < 8; i++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+
+    return crc;
+}
+
+TrackBlock::TrackBlock(void)
+{
+    this->reset();
+}
+
+void TrackBlock::reset(void)
+{
+    memset(this->_block, 0, sizeof(this->_block));
+    this->_len = HEADER_LEN;
+    this->_count = 0;
+    this->_dt = 0;
+}
+
+bool TrackBlock::add(const track_fix_t &fix)
+{
+    uint8_t delta[DELTA_MAX];
+    size_t len = 1;
+    int32_t dt, course;
+    uint8_t mask = 0;
+
+    if (this->_count == 0) {
+        put32(&this->_block[4], fix.utc);
+        this->_block[8] = fix.cs;
+        put32(&this->_block[9], fix.lat);
+        put32(&this->_block[13], fix.lon);
+        put16(&this->_block[17], fix.speed);
+        put16(&this->_block[19], fix.course);
+        put16(&this->_block[21], fix.hdop);
+        goto added;
+    }
+
+    dt = (int32_t)(fix.utc - this->_prev.utc) * 100 + fix.cs - this->_prev.cs;
+    if (dt != this->_dt) {
+        mask |= F_DT;
+        len += put_varint(&delta[len], dt);
+    }
+    if (fix.lat != this->_prev.lat) {
+        mask |= F_LAT;
+        len += put_varint(&delta[len], fix.lat - this->_prev.lat);
+    }
+    if (fix.lon != this->_prev.lon) {
+        mask |= F_LON;
+        len += put_varint(&delta[len], fix.lon - this->_prev.lon);
+    }
+    if (fix.speed != this->_prev.speed) {
+        mask |= F_SPEED;
+        len += put_varint(&delta[len], fix.speed - this->_prev.speed);
+    }
+    if (fix.course != this->_prev.course) {
+        // The short way round
+        course = fix.course - this->_prev.course;
+        if (course > COURSE_FULL / 2)
+            course -= COURSE_FULL;
+        else if (course <= -COURSE_FULL / 2)
+            course += COURSE_FULL;
+        mask |= F_COURSE;
+        len += put_varint(&delta[len], course);
+    }
+    if (fix.hdop != this->_prev.hdop) {
+        mask |= F_HDOP;
+        len += put_varint(&delta[len], fix.hdop - this->_prev.hdop);
+    }
+    delta[0] = mask;
+
+    if (this->_len + len > CRC_OFFSET)
+        return false;
+
+    memcpy(&this->_block[this->_len], delta, len);
+    this->_len += len;
+    this->_dt = dt;
+
+added:
+    this->_prev = fix;
+    this->_count++;
+    return true;
+}
+
+const uint8_t *TrackBlock::seal(void)
+{
+    this->_block[0] = TRACK_MAGIC;
+    this->_block[1] = TRACK_VERSION;
+    put16(&this->_block[2], this->_count);
+    put16(&this->_block[CRC_OFFSET], crc16(this->_block, CRC_OFFSET));
+
+    return this->_block;
+}
+
+uint32_t TrackBlock::first_utc(void) const
+{
+    return get32(&this->_block[4]);
+}
+
+bool TrackBlock::first_utc(const uint8_t *block, uint32_t *utc)
+{
+    if (block[0] != TRACK_MAGIC || block[1] != TRACK_VERSION)
+        return false;
+    if (get16(&block[2]) == 0 || get16(&block[CRC_OFFSET]) != crc16(block, CRC_OFFSET))
+        return false;
+
+    *utc = get32(&block[4]);
+    return true;
+}
+
+int TrackBlock::decode(const uint8_t *block, track_fix_t *fixes, int max)
+{
+    const uint8_t *p = &block[HEADER_LEN];
+    const uint8_t *end = &block[CRC_OFFSET];
+    track_fix_t fix;
+    int32_t v, dt = 0, cs;
+    uint8_t mask;
+    size_t len;
+    int count, i;
+
+    if (block[0] != TRACK_MAGIC || block[1] != TRACK_VERSION)
+        return -1;
+    if (get16(&block[CRC_OFFSET]) != crc16(block, CRC_OFFSET))
+        return -1;
+
+    count = get16(&block[2]);
+    if (count == 0)
+        return 0;
+
+    fix.utc = get32(&block[4]);
+    fix.cs = block[8];
+    fix.lat = get32(&block[9]);
+    fix.lon = get32(&block[13]);
+    fix.speed = get16(&block[17]);
+    fix.course = get16(&block[19]);
+    fix.hdop = get16(&block[21]);
+
+    for (i = 0; i < count && i < max; i++) {
+        if (i > 0) {
+            if (p >= end)
+                return -1;
+            mask = *p++;
+
+#define FIELD(flag, dst) \
+            if (mask & (flag)) { \
+                len = get_varint(p, end, &v); \
+                if (!len) \
+                    return -1; \
+                p += len; \
+                dst; \
+            }
+
+            FIELD(F_DT, dt = v)
+            FIELD(F_LAT, fix.lat += v)
+            FIELD(F_LON, fix.lon += v)
+            FIELD(F_SPEED, fix.speed += v)
+            FIELD(F_COURSE, fix.course = (fix.course + v + COURSE_FULL) % COURSE_FULL)
+            FIELD(F_HDOP, fix.hdop += v)
+#undef FIELD
+
+            // Carry whole seconds out of the hundredths, either way
+            cs = fix.cs + dt;
+            fix.utc += cs / 100 - (cs % 100 < 0);
+            fix.cs = (cs % 100 + 100) % 100;
+        }
+
+        fixes[i] = fix;
+    }
+
+    return i;
+}
+
+void track_index_pack(const track_index_t &entry, uint8_t *p)
+{
+    put32(&p[0], entry.utc);
+    put32(&p[4], entry.block);
+}
+
+void track_index_unpack(const uint8_t *p, track_index_t *entry)
+{
+    entry->utc = get32(&p[0]);
+    entry->block = get32(&p[4]);
+}
+
+// First good block in [lo, hi) and its utc, hi if there's none
+static uint32_t good_block(track_read_t read, void *p, uint32_t lo, uint32_t hi, uint32_t *utc)
+{
+    uint8_t block[TRACK_BLOCK_SIZE];
+
+    for (; lo < hi; lo++) {
+        if (read(lo, block, p) && TrackBlock::first_utc(block, utc))
+            break;
+    }
+    return lo;
+}
+
+// Whether an index entry still says what's in the log
+static bool entry_ok(track_read_t read, void *p, uint32_t blocks, const track_index_t &entry)
+{
+    uint8_t block[TRACK_BLOCK_SIZE];
+    uint32_t utc;
+
+    return entry.block < blocks && read(entry.block, block, p)
+        && TrackBlock::first_utc(block, &utc) && utc == entry.utc;
+}
+
+int32_t track_seek(track_read_t read, void *p, uint32_t blocks,
+    const track_index_t *index, uint32_t entries, uint32_t utc)
+{
+    uint32_t lo = 0, hi = blocks, mid, at, at_utc, e_lo, e_hi, e;
+    int32_t found = -1;
+
+    // Between the entries either side of utc, as far as they hold up
+    if (index && entries) {
+        e_lo = 0;
+        e_hi = entries;
+        while (e_lo < e_hi) {
+            e = e_lo + (e_hi - e_lo) / 2;
+            if (index[e].utc <= utc)
+                e_lo = e + 1;
+            else
+                e_hi = e;
+        }
+
+        if (e_lo > 0 && entry_ok(read, p, blocks, index[e_lo - 1]))
+            lo = index[e_lo - 1].block;
+        if (e_lo < entries && index[e_lo].block > lo && entry_ok(read, p, blocks, index[e_lo]))
+            hi = index[e_lo].block;
+    }
+
+    // Blocks that don't check out are passed over for the next good one
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        at = good_block(read, p, mid, hi, &at_utc);
+        if (at == hi) {
+            hi = mid;
+        } else if (at_utc <= utc) {
+            found = at;
+            lo = at + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return found;
+}
+
+TrackFilter::TrackFilter(float tolerance_m, uint16_t speed_step, uint32_t max_gap_s) :
+    _tolerance(tolerance_m),
+    _speed_step(speed_step),
+    _max_gap(max_gap_s)
+{
+    this->reset();
+}
+
+void TrackFilter::reset(void)
+{
+    this->_have_anchor = false;
+    this->_have_pending = false;
+    this->_have_cone = false;
+}
+
+// Flat earth around the anchor, fine over one line's length
+void TrackFilter::_offset(const track_fix_t &fix, float *dx, float *dy)
+{
+    *dx = (fix.lon - this->_anchor_fix.lon) * this->_m_per_ulon;
+    *dy = (fix.lat - this->_anchor_fix.lat) * M_PER_UDEG;
+}
+
+void TrackFilter::_anchor(const track_fix_t &fix)
+{
+    this->_anchor_fix = fix;
+    this->_m_per_ulon = M_PER_UDEG * cosf(fix.lat * (PI_F / 180e6f));
+    this->_have_anchor = true;
+    this->_have_pending = false;
+    this->_have_cone = false;
+    this->_reach = 0;
+}
+
+int TrackFilter::add(const track_fix_t &fix, track_fix_t kept[2])
+{
+    float dx, dy, d, a, half;
+    int speed_change;
+    int count = 0;
+
+    if (!this->_have_anchor) {
+        this->_anchor(fix);
+        kept[count++] = fix;
+        return count;
+    }
+
+    this->_offset(fix, &dx, &dy);
+    d = sqrtf(dx * dx + dy * dy);
+    a = 0;
+    if (this->_have_cone && d > this->_tolerance) {
+        a = atan2f(dy, dx) - this->_dir;
+        if (a > PI_F)
+            a -= 2 * PI_F;
+        else if (a < -PI_F)
+            a += 2 * PI_F;
+    }
+
+    // Off the line so far, or doubling back on it: the line ends before
+    if (this->_have_pending && this->_have_cone
+        && ((d > this->_tolerance && (a < this->_lo || a > this->_hi))
+            || d < this->_reach - this->_tolerance)) {
+        kept[count++] = this->_pending;
+        this->_anchor(this->_pending);
+        this->_offset(fix, &dx, &dy);
+        d = sqrtf(dx * dx + dy * dy);
+        a = 0;
+    }
+
+    speed_change = fix.speed - this->_anchor_fix.speed;
+    if (speed_change > this->_speed_step || -speed_change > this->_speed_step
+        || fix.utc - this->_anchor_fix.utc >= this->_max_gap) {
+        kept[count++] = fix;
+        this->_anchor(fix);
+        return count;
+    }
+
+    // Close to the anchor says nothing about the direction
+    if (d > this->_tolerance) {
+        half = asinf(this->_tolerance / d);
+        if (!this->_have_cone) {
+            this->_dir = atan2f(dy, dx);
+            this->_lo = -half;
+            this->_hi = half;
+            this->_have_cone = true;
+        } else {
+            if (a - half > this->_lo)
+                this->_lo = a - half;
+            if (a + half < this->_hi)
+                this->_hi = a + half;
+        }
+    }
+    if (d > this->_reach)
+        this->_reach = d;
+
+    this->_pending = fix;
+    this->_have_pending = true;
+    return count;
+}
+
+bool TrackFilter::flush(track_fix_t *kept)
+{
+    bool result = this->_have_pending;
+
+    if (result)
+        *kept = this->_pending;
+    this->reset();
+    return result;
+}
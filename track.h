@@ -0,0 +1,171 @@
+#pragma once
+
+/*
+SPDX-License-Identifier: BSD-2-Clause
+
+Copyright (c) 2020 Josh Watts. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Binary track log
+ *
+ * Fixes are packed into sector sized blocks which stand on their own:
+ * each opens with its first fix in full (the keyframe), followed by the
+ * rest as deltas from the fix before, and ends with a CRC. A lost or
+ * torn block takes only its own fixes with it.
+ *
+ * Block layout, little endian:
+ *   0   'T', version, fix count (2)
+ *   4   keyframe: utc (4), cs (1), lat (4), lon (4), speed (2),
+ *       course (2), hdop (2)
+ *   23  deltas, one per further fix: a mask byte saying which fields
+ *       changed, then a zig-zag varint for each of them in mask order
+ *   510 CRC-16/CCITT of bytes 0-509
+ *
+ * The time delta is only stored when it differs from the previous one,
+ * so a steady 10Hz fix costs about 6-8 bytes.
+ *
+ * TrackFilter sits in front and drops the fixes the path can do
+ * without: kept fixes joined by straight lines pass within the tolerance
+ * of every fix in between.
+ *
+ * Alongside goes a sparse index, one entry per TRACK_INDEX_EVERY blocks:
+ * the block's first utc (4) and its number (4). track_seek() uses it to
+ * narrow a binary search over the blocks; every entry is checked against
+ * the block it names, and without it the search covers the whole log, so
+ * a lost index can be rebuilt from the data at leisure.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TRACK_BLOCK_SIZE 512
+#define TRACK_MAGIC      'T'
+#define TRACK_VERSION    1
+
+#define TRACK_TOLERANCE_M  5.0f
+#define TRACK_SPEED_STEP   300 // Hundredths of a knot
+#define TRACK_MAX_GAP_S    30
+
+#define TRACK_INDEX_EVERY  64
+#define TRACK_INDEX_LEN    8
+
+struct track_fix_t {
+    uint32_t utc;    // s
+    uint8_t cs;      // hundredths of a second
+    int32_t lat;     // millionths of a degree
+    int32_t lon;     // millionths of a degree
+    uint16_t speed;  // hundredths of a knot
+    uint16_t course; // hundredths of a degree
+    uint16_t hdop;   // hundredths
+};
+
+class TrackBlock
+{
+public:
+    TrackBlock(void);
+
+    void reset(void);
+    bool empty(void) const { return this->_count == 0; }
+    int count(void) const { return this->_count; }
+
+    // False once full: seal(), write it out and reset()
+    bool add(const track_fix_t &fix);
+    const uint8_t *seal(void);
+
+    uint32_t first_utc(void) const;
+
+    // Fixes in a sealed block, -1 if it doesn't check out
+    static int decode(const uint8_t *block, track_fix_t *fixes, int max);
+    // A sealed block's first utc, false if it doesn't check out
+    static bool first_utc(const uint8_t *block, uint32_t *utc);
+
+private:
+    uint8_t _block[TRACK_BLOCK_SIZE];
+    size_t _len;
+    int _count;
+    track_fix_t _prev;
+    int32_t _dt;     // cs, last stored
+};
+
+struct track_index_t {
+    uint32_t utc;
+    uint32_t block;
+};
+
+void track_index_pack(const track_index_t &entry, uint8_t *p);
+void track_index_unpack(const uint8_t *p, track_index_t *entry);
+
+// Reads block n of the log, false if it can't
+typedef bool (*track_read_t)(uint32_t block, uint8_t *buf, void *p);
+
+/*
+ * The last block starting no later than utc, -1 if none does. Takes
+ * O(log n) reads, fewer with an index; index may be NULL.
+ */
+int32_t track_seek(track_read_t read, void *p, uint32_t blocks,
+    const track_index_t *index, uint32_t entries, uint32_t utc);
+
+/*
+ * Online line simplification, a sleeve (opening window) filter: the
+ * directions from the last kept fix that would still pass within the
+ * tolerance of every fix since form a cone, narrowed by each new one.
+ * A fix outside it ends the line at the one before. Speed changing by
+ * more than a step from the last kept fix, or time running past the
+ * gap, keep a fix regardless. Constant time per fix and no buffer.
+ */
+class TrackFilter
+{
+public:
+    TrackFilter(float tolerance_m = TRACK_TOLERANCE_M,
+        uint16_t speed_step = TRACK_SPEED_STEP,
+        uint32_t max_gap_s = TRACK_MAX_GAP_S);
+
+    void reset(void);
+
+    // Fixes to keep, oldest first, in kept: none, one or two
+    int add(const track_fix_t &fix, track_fix_t kept[2]);
+    // The last fix seen if it wasn't kept, to end a run with; resets
+    bool flush(track_fix_t *kept);
+
+private:
+    void _anchor(const track_fix_t &fix);
+    void _offset(const track_fix_t &fix, float *dx, float *dy);
+
+    float _tolerance;
+    uint16_t _speed_step;
+    uint32_t _max_gap;
+
+    bool _have_anchor;
+    bool _have_pending;
+    bool _have_cone;
+    track_fix_t _anchor_fix;
+    track_fix_t _pending;
+    float _m_per_ulon;   // Metres per microdegree of longitude at the anchor
+    float _dir;          // Cone, radians: centre and bounds either side
+    float _lo, _hi;
+    float _reach;        // Farthest from the anchor so far
+};
@@ -24,19 +24,88 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 // #define GPS_UART_PASSTHROUGH
 
+#define UBLOX_WAKE_MS 100 // Backup to accepting commands
+#define UBLOX_POLL_MS 250 // Poll to response
+#define UBLOX_SVS     32
+
+// AID message ids
+#define AID_INI       0x01
+#define AID_ALM       0x30
+#define AID_EPH       0x31
+#define AID_EMPTY     8    // Payload length of a SV without data
+
+// AID-INI
+#define INI_LEN       48
+#define INI_WN        18   // Payload offsets
+#define INI_TOW       20
+#define INI_TACC_MS   28
+#define INI_FLAGS     44
+#define INI_TIME_VALID (1u<<1)
+#define INI_TIME      ((1u<<1) | (1u<<2) | (1u<<3) | (1u<<4) | (1u<<7) | (1u<<10))
+
+#define GPS_EPOCH     315964800 // 1980-01-06 in UTC
+#define GPS_LEAP_S    18        // GPS - UTC, since 2017
+#define WEEK_S        604800
+
+// CFG-RST navBbrMask
+#define NAV_BBR_HOT   0x0000
+#define NAV_BBR_COLD  0xFFFF
+
+// CFG-RST resetMode
+#define RESET_HW      0x00 // Watchdog, immediately
+#define RESET_GNSS    0x02 // Controlled, GNSS only
+
+// CFG-CFG masks
+#define CFG_ALL       0x0000FFFF
+#define CFG_DEV_BBR   0x01
+#define CFG_DEV_FLASH 0x02
+
 Ublox::Ublox(PinName TX, PinName RX, PinName EN, PinName PPS) :
     _uart(TX, RX),
     _en(EN),
     _pps(PPS),
-    _changed(false)
+    _asleep(false),
+    _changed(false),
+    _changed_cb(nullptr),
+    _tee_cb(nullptr),
+    _time_cb(nullptr),
+    _hinted(false),
+    _pps_us(0),
+    _pps_edges(0),
+    _pps_locked(false),
+    _epoch_time(GPS_INVALID_TIME),
+    _epoch_us(0),
+    _epoch_dt_us(0),
+    _latency_us(0),
+    _aid_sink(nullptr),
+    _aid_next(0),
+    _aid_waiting(false),
+    _aid_sent_us(0),
+    _want_rate(RATE_1HZ),
+    _want_sentences(0),
+    _gov_rate(0)
 {
+    memset(this->_gov_div, 0xFF, sizeof(this->_gov_div));
     this->set_enabled(false);
     this->_uart.baud(9600);
     this->_uart.attach(this, &Ublox::_uart_rx);
+    if (PPS != NC)
+        this->_pps.rise(this, &Ublox::_pps_rise);
 }
 
 void Ublox::set_enabled(bool enabled)
 {
+    // Whatever the receiver had, it's gone after a power cycle
+    if (enabled && !this->_en) {
+        this->_gov_rate = 0;
+        memset(this->_gov_div, 0xFF, sizeof(this->_gov_div));
+    }
+
+    if (!enabled)
+        this->_asleep = false;
+    if (enabled && !this->_en)
+        this->_hinted = false;
+
     this->_en = enabled ? 1 : 0;
 }
 
@@ -49,7 +118,7 @@ bool Ublox::changed(void)
 
 //TODO: CFG-NAV5 -> Set to automotive? :-D
 
-void Ublox::set_feature_rate(const char *feature, int rate)
+void Ublox::set_feature_rate(const char *feature, int rate, bool wait)
 {
     uint8_t payload[3];
 
@@ -81,7 +150,7 @@ void Ublox::set_feature_rate(const char *feature, int rate)
             payload[0] = f->class_id[0];
             payload[1] = f->class_id[1];
             payload[2] = rate;
-            this->_write_command(0x06, 0x01, payload, 3);
+            this->_write_command(0x06, 0x01, payload, 3, wait);
             return;
         }
     }
@@ -132,7 +201,7 @@ void Ublox::set_baud(int baud)
     this->_uart.baud(baud);
 }
 
-bool Ublox::set_fix_rate(uint16_t rate)
+bool Ublox::set_fix_rate(uint16_t rate, bool wait)
 {
     uint8_t payload[6];
     
@@ -146,7 +215,7 @@ bool Ublox::set_fix_rate(uint16_t rate)
     payload[4] = timeRef;
     payload[5] = timeRef >> 8;
 
-    return this->_write_command(0x06, 0x08, payload, 6);
+    return this->_write_command(0x06, 0x08, payload, 6, wait);
 }
 
 bool Ublox::set_dyn_model(dyn_model_t dyn_model)
@@ -164,7 +233,316 @@ bool Ublox::set_dyn_model(dyn_model_t dyn_model)
     return this->_write_command(0x06, 0x24, payload, 36);
 }
 
-bool Ublox::_write_command(uint8_t msg_class, uint8_t msg_id, const uint8_t *payload, uint16_t msg_len)
+// Governed sentences, and how often each is wanted
+static const struct {
+    const char *mnemonic;
+    uint16_t interval_ms;  // 0: every fix
+    unsigned sentence;     // 0: always on
+} governed[] = {
+    {"RMC",    0, 0},
+    {"GGA",  500, 0},
+    {"GSA", 1000, Ublox::SENTENCE_GSA},
+    {"GSV", 2000, Ublox::SENTENCE_GSV},
+};
+
+void Ublox::set_moving(bool moving)
+{
+    this->_want_rate = moving ? RATE_10Hz : RATE_1HZ;
+}
+
+void Ublox::set_sentences(unsigned sentences)
+{
+    this->_want_sentences = sentences;
+}
+
+bool Ublox::govern(void)
+{
+    uint8_t div;
+
+    if (!this->_en)
+        return false;
+
+    if (this->_gov_rate != this->_want_rate) {
+        this->set_fix_rate(this->_want_rate, false);
+        this->_gov_rate = this->_want_rate;
+        return true;
+    }
+
+    for (unsigned int i = 0; i < sizeof(governed) / sizeof(*governed); i++) {
+        if (governed[i].sentence && !(this->_want_sentences & governed[i].sentence))
+            div = 0;
+        else if (governed[i].interval_ms > this->_gov_rate)
+            div = governed[i].interval_ms / this->_gov_rate;
+        else
+            div = 1;
+
+        if (div != this->_gov_div[i]) {
+            this->set_feature_rate(governed[i].mnemonic, div, false);
+            this->_gov_div[i] = div;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Ublox::reset(void)
+{
+    this->_restart(NAV_BBR_HOT, RESET_HW);
+}
+
+void Ublox::cold_start(void)
+{
+    this->_restart(NAV_BBR_COLD, RESET_GNSS);
+}
+
+void Ublox::hot_start(void)
+{
+    int ms = this->wake();
+
+    if (ms)
+        wait_ms(ms);
+
+    this->_restart(NAV_BBR_HOT, RESET_GNSS);
+}
+
+int Ublox::wake(void)
+{
+    if (!this->_asleep)
+        return 0;
+
+    // Any activity on RX wakes it from backup; that byte itself is lost
+    this->_uart.putc(0xFF);
+    this->_asleep = false;
+    return UBLOX_WAKE_MS;
+}
+
+void Ublox::mfr_reset(void)
+{
+    this->_config(CFG_ALL, 0, CFG_ALL, CFG_DEV_BBR | CFG_DEV_FLASH);
+    this->_restart(NAV_BBR_COLD, RESET_HW);
+
+    // Defaults are back, including the port
+    this->_uart.baud(9600);
+    this->_gov_rate = 0;
+    memset(this->_gov_div, 0xFF, sizeof(this->_gov_div));
+}
+
+void Ublox::sleep(void)
+{
+    uint8_t payload[8];
+
+    uint32_t duration = 0; // ms, 0 - until woken
+    uint32_t flags = 1u<<1; // backup
+
+    if (!this->_en || this->_asleep)
+        return;
+
+    // Backup comes back with what's in BBR, so put the current config there
+    this->save();
+
+    payload[0] = duration;
+    payload[1] = duration >> 8;
+    payload[2] = duration >> 16;
+    payload[3] = duration >> 24;
+    payload[4] = flags;
+    payload[5] = flags >> 8;
+    payload[6] = flags >> 16;
+    payload[7] = flags >> 24;
+
+    this->_write_command(0x02, 0x41, payload, 8, false);
+    this->_asleep = true;
+}
+
+void Ublox::save(void)
+{
+    // BBR only, flash would wear out from a save per sleep
+    this->_config(0, CFG_ALL, 0, CFG_DEV_BBR);
+}
+
+void Ublox::save_aid(aid_sink_t sink)
+{
+    this->_aid_sink = sink;
+    this->_aid_next = 0;
+    this->_aid_waiting = false;
+}
+
+bool Ublox::save_aid_step(void)
+{
+    uint8_t svid;
+
+    if (!this->_aid_sink)
+        return false;
+    if (!this->_en || this->_asleep)
+        goto done;
+
+    if (this->_aid_waiting) {
+        if (this->_aid_answer()) {
+            this->_aid_waiting = false;
+            this->_aid_next++;
+        } else if (us_ticker_read() - this->_aid_sent_us >= UBLOX_POLL_MS * 1000) {
+            // Not answering, no point asking for the rest
+            goto done;
+        }
+        return true;
+    }
+
+    if (this->_aid_next > 2 * UBLOX_SVS)
+        goto done;
+
+    // AID-INI first, then EPH and ALM for each SV
+    svid = (this->_aid_next + 1) / 2;
+    this->_ubx.got_response();
+    if (this->_aid_next == 0)
+        this->_write_command(0x0B, AID_INI, nullptr, 0, false);
+    else
+        this->_write_command(0x0B, this->_aid_next & 1 ? AID_EPH : AID_ALM, &svid, 1, false);
+    this->_aid_sent_us = us_ticker_read();
+    this->_aid_waiting = true;
+    return true;
+
+done:
+    this->_aid_sink = nullptr;
+    return false;
+}
+
+bool Ublox::load_aid(const uint8_t *record, uint16_t size)
+{
+    uint8_t payload[UBLOX_AID_MAX - 4];
+    uint16_t len;
+
+    if (size < 4 || record[0] != 0x0B)
+        return false;
+
+    len = record[2] | record[3] << 8;
+    if (len > sizeof(payload) || size != len + 4)
+        return false;
+
+    memcpy(payload, &record[4], len);
+
+    // Time in the saved AID-INI is long gone, only the position still holds
+    if (record[1] == AID_INI && len == INI_LEN) {
+        payload[INI_FLAGS] &= ~INI_TIME;
+        payload[INI_FLAGS + 1] &= ~(INI_TIME >> 8);
+        if (this->_fill_time(payload)) {
+            payload[INI_FLAGS] |= INI_TIME_VALID;
+            this->_hinted = true;
+        }
+    }
+
+    return this->_write_command(0x0B, record[1], payload, len, false);
+}
+
+bool Ublox::send_time_hint(void)
+{
+    uint8_t payload[INI_LEN];
+
+    if (this->_hinted || !this->_en || this->_asleep)
+        return false;
+
+    memset(payload, 0, sizeof(payload));
+    if (!this->_fill_time(payload))
+        return false;
+    payload[INI_FLAGS] = INI_TIME_VALID;
+
+    this->_hinted = true;
+    return this->_write_command(0x0B, AID_INI, payload, INI_LEN, false);
+}
+
+// GPS week and time of week from the time source, as late as possible
+bool Ublox::_fill_time(uint8_t *ini)
+{
+    uint32_t utc, gps, tow, acc_ms;
+    uint16_t ms, wn;
+
+    if (!this->_time_cb || !this->_time_cb(&utc, &ms, &acc_ms))
+        return false;
+    if (utc < GPS_EPOCH)
+        return false;
+
+    gps = utc - GPS_EPOCH + GPS_LEAP_S;
+    wn = gps / WEEK_S;
+    tow = (gps % WEEK_S) * 1000 + ms;
+
+    ini[INI_WN]          = wn;
+    ini[INI_WN + 1]      = wn >> 8;
+    ini[INI_TOW]         = tow;
+    ini[INI_TOW + 1]     = tow >> 8;
+    ini[INI_TOW + 2]     = tow >> 16;
+    ini[INI_TOW + 3]     = tow >> 24;
+    ini[INI_TACC_MS]     = acc_ms;
+    ini[INI_TACC_MS + 1] = acc_ms >> 8;
+    ini[INI_TACC_MS + 2] = acc_ms >> 16;
+    ini[INI_TACC_MS + 3] = acc_ms >> 24;
+
+    return true;
+}
+
+// Hands the answer to the last poll to the sink, unless there's nothing in it
+bool Ublox::_aid_answer(void)
+{
+    uint8_t record[UBLOX_AID_MAX];
+    uint8_t msg_id;
+    uint16_t len;
+
+    if (!this->_ubx.got_response() || this->_ubx.msg_class() != 0x0B)
+        return false;
+
+    msg_id = this->_ubx.msg_id();
+    if (msg_id != (this->_aid_next == 0 ? AID_INI : this->_aid_next & 1 ? AID_EPH : AID_ALM))
+        return false;
+
+    len = this->_ubx.msg_len();
+    if (len <= AID_EMPTY && msg_id != AID_INI)
+        return true;
+    if (len > sizeof(record) - 4)
+        return true;
+
+    record[0] = 0x0B;
+    record[1] = msg_id;
+    record[2] = len;
+    record[3] = len >> 8;
+    memcpy(&record[4], this->_ubx.msg_payload(), len);
+
+    this->_aid_sink(record, len + 4);
+    return true;
+}
+
+void Ublox::_restart(uint16_t nav_bbr_mask, uint8_t reset_mode)
+{
+    uint8_t payload[4];
+
+    payload[0] = nav_bbr_mask;
+    payload[1] = nav_bbr_mask >> 8;
+    payload[2] = reset_mode;
+    payload[3] = 0; // reserved
+
+    this->_hinted = false;
+    this->_write_command(0x06, 0x04, payload, 4, false);
+}
+
+bool Ublox::_config(uint32_t clear_mask, uint32_t save_mask, uint32_t load_mask, uint8_t device_mask)
+{
+    uint8_t payload[13];
+
+    payload[0]  = clear_mask;
+    payload[1]  = clear_mask >> 8;
+    payload[2]  = clear_mask >> 16;
+    payload[3]  = clear_mask >> 24;
+    payload[4]  = save_mask;
+    payload[5]  = save_mask >> 8;
+    payload[6]  = save_mask >> 16;
+    payload[7]  = save_mask >> 24;
+    payload[8]  = load_mask;
+    payload[9]  = load_mask >> 8;
+    payload[10] = load_mask >> 16;
+    payload[11] = load_mask >> 24;
+    payload[12] = device_mask;
+
+    return this->_write_command(0x06, 0x09, payload, 13);
+}
+
+bool Ublox::_write_command(uint8_t msg_class, uint8_t msg_id, const uint8_t *payload, uint16_t msg_len, bool wait)
 {
     uint8_t CK_A, CK_B;
     uint8_t header[4];
@@ -172,6 +550,9 @@ bool Ublox::_write_command(uint8_t msg_class, uint8_t msg_id, const uint8_t *pay
 
     CK_A = CK_B = 0;
 
+    // Don't mistake the ACK of an earlier unwaited command for ours
+    this->_ubx.got_response();
+
     this->_uart.putc(0xB5);
     this->_uart.putc(0x62);
 
@@ -195,7 +576,7 @@ bool Ublox::_write_command(uint8_t msg_class, uint8_t msg_id, const uint8_t *pay
     this->_uart.putc(CK_A);
     this->_uart.putc(CK_B);
 
-    if (msg_class == 0x06) {
+    if (msg_class == 0x06 && wait) {
         Timer msg_timeout;
         msg_timeout.start();
 
@@ -214,10 +595,62 @@ void Ublox::_uart_rx(void)
 #ifdef GPS_UART_PASSTHROUGH
     fputc(c, stdout);
 #endif
+    if (this->_tee_cb)
+        this->_tee_cb(c);
     if (this->_term_offset == 0 && this->_ubx.encode(c)) {
         return;
     } else {
-        if (this->encode(c))
+        if (this->encode(c)) {
+            this->_align(us_ticker_read());
             this->_changed = true;
+            if (this->_changed_cb)
+                this->_changed_cb();
+        }
+    }
+}
+
+void Ublox::_pps_rise(void)
+{
+    this->_pps_us = us_ticker_read();
+    this->_pps_edges++;
+}
+
+/*
+ * Called as each sentence completes. The first one of a new epoch puts
+ * it on the local clock: the last edge, plus the fraction of a second
+ * in its time. At 10Hz the .9 sentence can arrive after the next edge,
+ * in which case that epoch belongs a second before it. Placed a second
+ * or more before its sentence, the edge it needed was missed.
+ */
+void Ublox::_align(uint32_t now)
+{
+    unsigned long date, time, age;
+    uint32_t epoch, frac_us;
+
+    this->get_datetime(&date, &time, &age);
+    if (time == GPS_INVALID_TIME || time == this->_epoch_time)
+        return;
+
+    if (!this->_pps_edges || now - this->_pps_us > UBLOX_PPS_TIMEOUT_US) {
+        this->_pps_locked = false;
+        this->_epoch_time = time;
+        return;
     }
-}
\ No newline at end of file
+
+    frac_us = (time % 100) * 10000;
+    epoch = this->_pps_us + frac_us;
+    if ((int32_t)(now - epoch) < 0)
+        epoch -= 1000000;
+    if (now - epoch >= 1000000) {
+        this->_pps_locked = false;
+        this->_epoch_time = time;
+        return;
+    }
+
+    if (this->_pps_locked && this->_epoch_time != GPS_INVALID_TIME)
+        this->_epoch_dt_us = epoch - this->_epoch_us;
+    this->_epoch_us = epoch;
+    this->_epoch_time = time;
+    this->_latency_us = now - epoch;
+    this->_pps_locked = true;
+}
@@ -25,6 +25,15 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <TinyGPS.h>
 #include "UbxParser.h"
 
+#define UBLOX_GOVERNED 4 // RMC, GGA, GSA, GSV
+#define UBLOX_AID_MAX 108 // AID record: class, id, length, up to 104 payload
+#define UBLOX_PPS_TIMEOUT_US 1500000 // Lock is lost after a missed edge
+
+// Takes one AID record, see Ublox::save_aid()
+typedef bool (*aid_sink_t)(const uint8_t *record, uint16_t size);
+// UTC as of now and how far off it may be, false if there's none
+typedef bool (*time_source_t)(uint32_t *utc, uint16_t *ms, uint32_t *acc_ms);
+
 class Ublox : public TinyGPS
 {
 public:
@@ -49,36 +58,111 @@ public:
         DYN_AIRBORNE_4G = 8, // Airborne with <4g Acceleration
     };
 
+    // Optional sentences for set_sentences()
+    enum sentence_t {
+        SENTENCE_GSA = 1u<<0,
+        SENTENCE_GSV = 1u<<1,
+    };
+
     Ublox(PinName TX, PinName RX, PinName EN = NC, PinName PPS = NC);
 
     void set_enabled(bool enabled);
+    bool enabled(void) { return this->_en; }
+    bool asleep(void) { return this->_asleep; }
 
     bool changed(void);
+    void attach(void (*fn)(void)) { this->_changed_cb = fn; }
+    // Sees every received byte, from the RX interrupt
+    void attach_tee(void (*fn)(uint8_t c)) { this->_tee_cb = fn; }
 
-    void set_feature_rate(const char *feature, int rate);
+    void set_feature_rate(const char *feature, int rate, bool wait = true);
     void disable_feature(const char *feature);
 
     void set_baud(int baud);
     void detect_baud(void);
 
-    bool set_fix_rate(uint16_t rate);
+    bool set_fix_rate(uint16_t rate, bool wait = true);
     bool set_dyn_model(dyn_model_t dyn_model);
 
+    // Resets and restarts don't get an ACK, nothing is waited on
     void reset(void);
     void cold_start(void);
     void hot_start(void);
     void mfr_reset(void);
+
+    // Backup mode: RTC, ephemeris and the saved config survive, hot_start()
+    // wakes it again. Power stays on, see set_enabled(). wake() only
+    // starts waking it, returning the ms until it takes commands.
     void sleep(void);
+    int wake(void);
 
     void save(void);
 
+    // Assistance data for a fast start from a cold receiver. save_aid()
+    // starts polling AID-INI and the AID-EPH/ALM of every SV, and each
+    // save_aid_step() moves that on by a poll, handing any answer with
+    // data in it to sink as a record: class, id, length, payload. Call
+    // it until it returns false. load_aid() sends a record back.
+    void save_aid(aid_sink_t sink);
+    bool save_aid_step(void);
+    bool load_aid(const uint8_t *record, uint16_t size);
+
+    // Time hint for AID-INI: load_aid() puts it in the saved one,
+    // send_time_hint() sends it on its own if that hasn't happened
+    // since the last (re)start.
+    void attach_time(time_source_t fn) { this->_time_cb = fn; }
+    bool send_time_hint(void);
+
+    // 1PPS: each fix epoch is placed on the local us_ticker from the edge
+    // that started its UTC second, not from when its sentence came in.
+    // Only good while pps_locked().
+    bool pps_locked(void) { return this->_pps_locked; }
+    uint32_t epoch_us(void) { return this->_epoch_us; }
+    uint32_t epoch_dt_us(void) { return this->_epoch_dt_us; }
+    uint32_t latency_us(void) { return this->_latency_us; }
+
+    // Rate governor: say what's needed, govern() brings the receiver
+    // in line one unacknowledged CFG message at a time.
+    void set_moving(bool moving);
+    void set_sentences(unsigned sentences);
+    bool govern(void);
+
 protected:
-    bool _write_command(uint8_t msg_class, uint8_t msg_id, const uint8_t *payload, uint16_t msg_len);
+    bool _write_command(uint8_t msg_class, uint8_t msg_id, const uint8_t *payload, uint16_t msg_len, bool wait = true);
+    bool _aid_answer(void);
+    bool _fill_time(uint8_t *ini);
+    void _restart(uint16_t nav_bbr_mask, uint8_t reset_mode);
+    bool _config(uint32_t clear_mask, uint32_t save_mask, uint32_t load_mask, uint8_t device_mask);
     void _uart_rx(void);
+    void _pps_rise(void);
+    void _align(uint32_t now);
 
     Serial _uart;
     DigitalOut _en;
     InterruptIn _pps;
+    bool _asleep;
     volatile bool _changed;
+    void (*_changed_cb)(void);
+    void (*_tee_cb)(uint8_t c);
+    time_source_t _time_cb;
+    bool _hinted;
+
+    volatile uint32_t _pps_us;   // Last edge
+    volatile uint32_t _pps_edges;
+    bool _pps_locked;
+    unsigned long _epoch_time;   // hhmmsscc of the epoch below
+    uint32_t _epoch_us;
+    uint32_t _epoch_dt_us;
+    uint32_t _latency_us;        // Epoch to its first sentence
     UbxParser _ubx;
+
+    aid_sink_t _aid_sink;        // Until save_aid() is done
+    uint8_t _aid_next;           // 0: AID-INI, then EPH and ALM by SV
+    bool _aid_waiting;
+    uint32_t _aid_sent_us;
+
+    uint16_t _want_rate;
+    unsigned _want_sentences;
+    uint16_t _gov_rate;      // 0 until sent
+    uint8_t _gov_div[UBLOX_GOVERNED]; // 0xFF until sent
 };
\ No newline at end of file